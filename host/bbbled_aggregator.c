@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "bbbled_aggregator.h"
+
+LOG_MODULE_REGISTER(bbbled_aggregator, LOG_LEVEL_DBG);
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static int init(bbbled_aggregator_t agg, size_t count)
+{
+    if (count == 0 || count > BBBLED_AGGREGATOR_MAX_DONGLES)
+    {
+        return -EINVAL;
+    }
+
+    memset(agg, 0, sizeof(*agg));
+    agg->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (agg->epoll_fd < 0)
+    {
+        return -errno;
+    }
+
+    /*  A client is mostly buffers, far too big for the stack */
+    agg->clients = calloc(count, sizeof(agg->clients[0]));
+    if (!agg->clients)
+    {
+        close(agg->epoll_fd);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*  Nest a client's epoll fd in ours, tagged with its index */
+static int add_client(bbbled_aggregator_t agg, size_t dongle)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = dongle};
+
+    if (epoll_ctl(agg->epoll_fd, EPOLL_CTL_ADD, bbbled_client_fd(&agg->clients[dongle]), &ev) < 0)
+    {
+        return -errno;
+    }
+
+    agg->num_dongles++;
+    return 0;
+}
+
+int bbbled_aggregator_open(bbbled_aggregator_t agg, const char *const *paths, size_t count, const struct bbbled_client_config *config)
+{
+    int ret = init(agg, count);
+
+    if (ret)
+    {
+        return ret;
+    }
+
+    for (size_t index = 0; index < count; ++index)
+    {
+        ret = bbbled_client_open(&agg->clients[index], paths[index], config);
+        if (ret == 0)
+        {
+            ret = add_client(agg, index);
+        }
+        if (ret)
+        {
+            LOG_ERR("could not open %s [%d]", paths[index], ret);
+            bbbled_client_close(&agg->clients[index]);
+            bbbled_aggregator_close(agg);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int bbbled_aggregator_attach(bbbled_aggregator_t agg, const int *fds, size_t count, const struct bbbled_client_config *config)
+{
+    int ret = init(agg, count);
+
+    if (ret)
+    {
+        return ret;
+    }
+
+    for (size_t index = 0; index < count; ++index)
+    {
+        ret = bbbled_client_attach(&agg->clients[index], fds[index], config);
+        if (ret == 0)
+        {
+            ret = add_client(agg, index);
+        }
+        if (ret)
+        {
+            bbbled_client_close(&agg->clients[index]);
+            bbbled_aggregator_close(agg);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void bbbled_aggregator_close(bbbled_aggregator_t agg)
+{
+    for (size_t index = 0; index < agg->num_dongles; ++index)
+    {
+        bbbled_client_close(&agg->clients[index]);
+    }
+
+    if (agg->epoll_fd >= 0)
+    {
+        close(agg->epoll_fd);
+    }
+    free(agg->clients);
+
+    agg->clients = NULL;
+    agg->num_dongles = 0;
+    agg->epoll_fd = -1;
+}
+
+int bbbled_aggregator_route(bbbled_aggregator_t agg, uint16_t first, uint16_t last, size_t dongle)
+{
+    if (first > last || dongle >= agg->num_dongles)
+    {
+        return -EINVAL;
+    }
+    if (agg->num_routes == BBBLED_AGGREGATOR_MAX_ROUTES)
+    {
+        return -ENOSPC;
+    }
+
+    agg->routes[agg->num_routes++] = (struct bbbled_route) {
+        .first = first,
+        .last = last,
+        .dongle = dongle,
+    };
+    return 0;
+}
+
+static size_t least_loaded(bbbled_aggregator_t agg)
+{
+    size_t best = 0;
+
+    for (size_t index = 1; index < agg->num_dongles; ++index)
+    {
+        if (bbbled_client_in_flight(&agg->clients[index]) < bbbled_client_in_flight(&agg->clients[best]))
+        {
+            best = index;
+        }
+    }
+    return best;
+}
+
+static size_t owner(bbbled_aggregator_t agg, uint16_t target)
+{
+    for (size_t route = 0; route < agg->num_routes; ++route)
+    {
+        if (target >= agg->routes[route].first && target <= agg->routes[route].last)
+        {
+            return agg->routes[route].dongle;
+        }
+    }
+    return target % agg->num_dongles;
+}
+
+size_t bbbled_aggregator_pick(bbbled_aggregator_t agg, const struct key_val_pair *params, size_t num_params)
+{
+    for (size_t index = 0; index < num_params; ++index)
+    {
+        if (params[index].key == KEY_TARGET)
+        {
+            return owner(agg, params[index].value);
+        }
+    }
+
+    /*  Nobody owns it, so whoever is least busy */
+    return least_loaded(agg);
+}
+
+int bbbled_aggregator_submit(
+    bbbled_aggregator_t agg,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params,
+    bbbled_done_cb_t done,
+    void *user_data)
+{
+    size_t dongle = bbbled_aggregator_pick(agg, params, num_params);
+    int ret = bbbled_client_submit(&agg->clients[dongle], command, params, num_params, done, user_data);
+
+    if (ret >= 0)
+    {
+        agg->routed[dongle]++;
+    }
+    return ret;
+}
+
+int bbbled_aggregator_upload_palette(bbbled_aggregator_t agg, const struct rgb *colours, size_t count, int timeout_ms)
+{
+    uint64_t failed[BBBLED_AGGREGATOR_MAX_DONGLES];
+    int ret;
+
+    if (count > PALETTE_MAX_ENTRIES)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t dongle = 0; dongle < agg->num_dongles; ++dongle)
+    {
+        failed[dongle] = agg->clients[dongle].stats.failed;
+    }
+
+    /*  Entry by entry across the dongles, so they all load at once */
+    for (size_t index = 0; index < count; ++index)
+    {
+        struct key_val_pair params[] = {
+            {.key = KEY_INDEX, .value = (value_t) index},
+            {.key = KEY_RED, .value = colours[index].red},
+            {.key = KEY_GREEN, .value = colours[index].green},
+            {.key = KEY_BLUE, .value = colours[index].blue},
+        };
+
+        for (size_t dongle = 0; dongle < agg->num_dongles;)
+        {
+            ret = bbbled_client_submit(&agg->clients[dongle], COMMAND_PALETTE, params, ARRAY_SIZE(params), NULL, NULL);
+            if (ret == -EAGAIN)
+            {
+                ret = bbbled_aggregator_poll(agg, timeout_ms);
+                if (ret)
+                {
+                    return ret;
+                }
+                continue;
+            }
+            if (ret < 0)
+            {
+                return ret;
+            }
+            agg->routed[dongle]++;
+            dongle++;
+        }
+    }
+
+    ret = bbbled_aggregator_drain(agg, timeout_ms);
+    if (ret)
+    {
+        return ret;
+    }
+
+    for (size_t dongle = 0; dongle < agg->num_dongles; ++dongle)
+    {
+        if (agg->clients[dongle].stats.failed != failed[dongle])
+        {
+            LOG_WRN("dongle %zu is missing palette entries", dongle);
+            return -ETIMEDOUT;
+        }
+    }
+    return 0;
+}
+
+int bbbled_aggregator_set_indexed(
+    bbbled_aggregator_t agg,
+    uint16_t target,
+    const uint8_t *indices,
+    size_t count,
+    bbbled_done_cb_t done,
+    void *user_data)
+{
+    size_t pieces[BBBLED_AGGREGATOR_MAX_DONGLES] = {0};
+    size_t dongles[PALETTE_MAX_PER_FRAME];
+    int frames = 0;
+
+    if (count == 0 || count > PALETTE_MAX_PER_FRAME || target + count - 1 > UINT16_MAX)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t led = 0; led < count; ++led)
+    {
+        dongles[led] = owner(agg, (uint16_t) (target + led));
+        if (led == 0 || dongles[led] != dongles[led - 1])
+        {
+            pieces[dongles[led]]++;
+        }
+    }
+
+    /*  All of the run or none of it */
+    for (size_t dongle = 0; dongle < agg->num_dongles; ++dongle)
+    {
+        bbbled_client_t client = &agg->clients[dongle];
+
+        if (pieces[dongle] > client->config.window - bbbled_client_in_flight(client))
+        {
+            return -EAGAIN;
+        }
+    }
+
+    for (size_t first = 0; first < count;)
+    {
+        size_t last = first;
+        int ret;
+
+        while (last + 1 < count && dongles[last + 1] == dongles[first])
+        {
+            last++;
+        }
+
+        ret = bbbled_client_set_indexed(&agg->clients[dongles[first]], (uint16_t) (target + first),
+                                        indices + first, last - first + 1, done, user_data);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        agg->routed[dongles[first]]++;
+        frames++;
+        first = last + 1;
+    }
+
+    return frames;
+}
+
+int bbbled_aggregator_poll(bbbled_aggregator_t agg, int timeout_ms)
+{
+    struct epoll_event events[BBBLED_AGGREGATOR_MAX_DONGLES];
+    int num_events;
+    int ret;
+
+    /*  Get whatever was submitted since the last poll on the wire,
+        and pick up anything already waiting, before blocking */
+    for (size_t index = 0; index < agg->num_dongles; ++index)
+    {
+        ret = bbbled_client_poll(&agg->clients[index], 0);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    num_events = epoll_wait(agg->epoll_fd, events, BBBLED_AGGREGATOR_MAX_DONGLES, timeout_ms);
+    if (num_events < 0)
+    {
+        return (errno == EINTR) ? 0 : -errno;
+    }
+
+    for (int index = 0; index < num_events; ++index)
+    {
+        ret = bbbled_client_poll(&agg->clients[events[index].data.u64], 0);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int bbbled_aggregator_drain(bbbled_aggregator_t agg, int timeout_ms)
+{
+    uint64_t deadline = now_us() + (uint64_t)timeout_ms * 1000ULL;
+
+    while (bbbled_aggregator_in_flight(agg))
+    {
+        uint64_t now = now_us();
+        if (now >= deadline)
+        {
+            return -ETIMEDOUT;
+        }
+
+        int ret = bbbled_aggregator_poll(agg, (int)((deadline - now) / 1000ULL) + 1);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void bbbled_aggregator_stats(bbbled_aggregator_t agg, struct bbbled_aggregator_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (size_t index = 0; index < agg->num_dongles; ++index)
+    {
+        const struct bbbled_client_stats *client = &agg->clients[index].stats;
+
+        stats->total.submitted += client->submitted;
+        stats->total.completed += client->completed;
+        stats->total.failed += client->failed;
+        stats->total.retransmits += client->retransmits;
+        stats->total.nacks += client->nacks;
+        stats->total.invalid_params += client->invalid_params;
+        stats->total.pongs += client->pongs;
+        stats->total.frames_rx += client->frames_rx;
+        stats->total.bytes_tx += client->bytes_tx;
+        stats->total.bytes_rx += client->bytes_rx;
+        stats->routed[index] = agg->routed[index];
+    }
+}
@@ -0,0 +1,205 @@
+#ifndef _BBBLED_AGGREGATOR_H
+#define _BBBLED_AGGREGATOR_H
+
+#include "bbbled_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most dongles one aggregator drives
+#define BBBLED_AGGREGATOR_MAX_DONGLES 16
+// Most explicit target ranges
+#define BBBLED_AGGREGATOR_MAX_ROUTES 64
+
+/**
+ * @brief A range of targets owned by one dongle
+ * @param   first   :   first target in the range
+ * @param   last    :   last target in the range, inclusive
+ * @param   dongle  :   index of the dongle that owns it
+ */
+struct bbbled_route {
+    uint16_t first;
+    uint16_t last;
+    size_t dongle;
+};
+
+/**
+ * @brief Totals over every dongle, plus how the commands were spread
+ * @param   total   :   client statistics summed over the dongles
+ * @param   routed  :   commands submitted to each dongle
+ */
+struct bbbled_aggregator_stats {
+    struct bbbled_client_stats total;
+    uint64_t routed[BBBLED_AGGREGATOR_MAX_DONGLES];
+};
+
+/**
+ * @brief Drives several dongles as one. Each dongle has its own client
+ *        and window; their epoll fds are nested in the aggregator's, so
+ *        one thread serves them all.
+ * @param   clients     :   one client per dongle
+ * @param   num_dongles :   dongles in use
+ * @param   epoll_fd    :   readable when any client has work
+ * @param   routes      :   explicit target ranges, searched in order
+ * @param   num_routes  :   ranges in use
+ * @param   routed      :   commands submitted to each dongle
+ */
+struct bbbled_aggregator {
+    struct bbbled_client *clients;
+    size_t num_dongles;
+    int epoll_fd;
+    struct bbbled_route routes[BBBLED_AGGREGATOR_MAX_ROUTES];
+    size_t num_routes;
+    uint64_t routed[BBBLED_AGGREGATOR_MAX_DONGLES];
+};
+
+typedef struct bbbled_aggregator* bbbled_aggregator_t;
+
+/**
+ * @brief   Open every dongle's tty
+ *
+ * @param   agg     :   aggregator to initialise
+ * @param   paths   :   one tty per dongle
+ * @param   count   :   number of dongles
+ * @param   config  :   configuration for every client, NULL for defaults
+ *
+ * @retval  0 on success
+ * @retval  -EINVAL for no dongles or too many
+ * @retval  -errno if a tty failed to open, none are left open
+ */
+int bbbled_aggregator_open(bbbled_aggregator_t agg, const char *const *paths, size_t count, const struct bbbled_client_config *config);
+
+/**
+ * @brief   As bbbled_aggregator_open(), with file descriptors that are
+ *          already open (ptys to native_sim, ...). Takes ownership of them.
+ */
+int bbbled_aggregator_attach(bbbled_aggregator_t agg, const int *fds, size_t count, const struct bbbled_client_config *config);
+
+/**
+ * @brief   Close every dongle. Requests in flight are dropped.
+ */
+void bbbled_aggregator_close(bbbled_aggregator_t agg);
+
+/**
+ * @brief   Give a range of targets to a dongle. Targets not covered by
+ *          any range go to target % number of dongles.
+ *
+ * @param   agg     :   aggregator
+ * @param   first   :   first target
+ * @param   last    :   last target, inclusive
+ * @param   dongle  :   dongle index
+ *
+ * @retval  0 on success
+ * @retval  -EINVAL for a bad range or dongle
+ * @retval  -ENOSPC if every route is in use
+ */
+int bbbled_aggregator_route(bbbled_aggregator_t agg, uint16_t first, uint16_t last, size_t dongle);
+
+/**
+ * @brief   Which dongle a command goes to. One with a target param goes
+ *          to the dongle that owns the target. One without goes to the
+ *          dongle with the fewest requests in flight.
+ */
+size_t bbbled_aggregator_pick(bbbled_aggregator_t agg, const struct key_val_pair *params, size_t num_params);
+
+/**
+ * @brief   Queue a command on the dongle it belongs to, see
+ *          bbbled_aggregator_pick() and bbbled_client_submit(). The
+ *          callback gets that dongle's client.
+ *
+ * @retval  message number (>= 0) on that dongle's link
+ * @retval  -EAGAIN if that dongle's window is full, poll and try again
+ * @retval  -errno as bbbled_client_submit()
+ */
+int bbbled_aggregator_submit(
+    bbbled_aggregator_t agg,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params,
+    bbbled_done_cb_t done,
+    void *user_data);
+
+/**
+ * @brief   Upload a palette to every dongle, see
+ *          bbbled_client_upload_palette(). The dongles load it at the
+ *          same time.
+ *
+ * @retval  0 once every dongle has every entry
+ * @retval  -EINVAL for too many entries
+ * @retval  -ETIMEDOUT if the ACKs didn't all arrive in time, or any
+ *          dongle is missing an entry
+ * @retval  -errno if a tty failed
+ */
+int bbbled_aggregator_upload_palette(bbbled_aggregator_t agg, const struct rgb *colours, size_t count, int timeout_ms);
+
+/**
+ * @brief   Set a run of LEDs to palette colours. The run is split where
+ *          its owner changes and each piece is a set_idx to the dongle
+ *          that owns it, so a run inside one route is one frame, while
+ *          with target % dongles every LED is a frame of its own.
+ *
+ * @param   agg         :   aggregator
+ * @param   target      :   first LED
+ * @param   indices     :   palette index for each LED
+ * @param   count       :   number of LEDs, at most PALETTE_MAX_PER_FRAME
+ * @param   done        :   completion callback, called for each piece
+ * @param   user_data   :   passed through to done
+ *
+ * @retval  number of set_idx frames submitted (> 0)
+ * @retval  -EINVAL for no LEDs, too many, or a run past the last target
+ * @retval  -EAGAIN if a dongle hasn't the window for its pieces, nothing
+ *          was submitted. Poll and try again
+ * @retval  -errno as bbbled_client_submit()
+ */
+int bbbled_aggregator_set_indexed(
+    bbbled_aggregator_t agg,
+    uint16_t target,
+    const uint8_t *indices,
+    size_t count,
+    bbbled_done_cb_t done,
+    void *user_data);
+
+/**
+ * @brief   Wait for and handle I/O and timers on every dongle
+ *
+ * @retval  0 on success (including timeout)
+ * @retval  -errno if a tty failed
+ */
+int bbbled_aggregator_poll(bbbled_aggregator_t agg, int timeout_ms);
+
+/**
+ * @brief   Poll until nothing is in flight on any dongle
+ *
+ * @retval  0 once nothing is in flight
+ * @retval  -ETIMEDOUT if the time limit ran out first
+ * @retval  -errno if a tty failed
+ */
+int bbbled_aggregator_drain(bbbled_aggregator_t agg, int timeout_ms);
+
+/**
+ * @brief   Sum the statistics over every dongle
+ */
+void bbbled_aggregator_stats(bbbled_aggregator_t agg, struct bbbled_aggregator_stats *stats);
+
+static inline size_t bbbled_aggregator_in_flight(bbbled_aggregator_t agg)
+{
+    size_t in_flight = 0;
+
+    for (size_t index = 0; index < agg->num_dongles; ++index)
+    {
+        in_flight += bbbled_client_in_flight(&agg->clients[index]);
+    }
+    return in_flight;
+}
+
+static inline bbbled_client_t bbbled_aggregator_client(bbbled_aggregator_t agg, size_t dongle)
+{
+    return &agg->clients[dongle];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_AGGREGATOR_H */
@@ -0,0 +1,783 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "bbbled_client.h"
+
+LOG_MODULE_REGISTER(bbbled_client, LOG_LEVEL_DBG);
+
+// Max frames serialised for ACK/NACK replies
+#define REPLY_BUF_SIZE 64
+#define MAX_EVENTS 4
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static void update_write_interest(bbbled_client_t client, bool want_write)
+{
+    if (want_write == client->want_write)
+    {
+        return;
+    }
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+        .data.fd = client->fd,
+    };
+
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+    client->want_write = want_write;
+}
+
+static void send_unsent(bbbled_client_t client);
+
+static int flush_tx(bbbled_client_t client)
+{
+    while (client->tx_tail < client->tx_head)
+    {
+        ssize_t written = write(client->fd,
+                                client->tx_buf + client->tx_tail,
+                                client->tx_head - client->tx_tail);
+        if (written > 0)
+        {
+            client->tx_tail += written;
+            client->stats.bytes_tx += written;
+        }
+        else if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (written < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else
+        {
+            return -errno;
+        }
+    }
+
+    if (client->tx_tail == client->tx_head)
+    {
+        client->tx_tail = client->tx_head = 0;
+        send_unsent(client);
+    }
+
+    update_write_interest(client, client->tx_tail < client->tx_head);
+
+    return 0;
+}
+
+static int queue_tx(bbbled_client_t client, const uint8_t *data, size_t len)
+{
+    if (client->tx_head + len > BBBLED_CLIENT_TX_BUF_SIZE && client->tx_tail > 0)
+    {
+        /*  Slide what is left to the front to make room */
+        memmove(client->tx_buf, client->tx_buf + client->tx_tail, client->tx_head - client->tx_tail);
+        client->tx_head -= client->tx_tail;
+        client->tx_tail = 0;
+    }
+
+    if (client->tx_head + len > BBBLED_CLIENT_TX_BUF_SIZE)
+    {
+        return -ENOBUFS;
+    }
+
+    memcpy(client->tx_buf + client->tx_head, data, len);
+    client->tx_head += len;
+
+    /*  Let the event loop pick it up, so back to back submissions
+        go out in a single write */
+    update_write_interest(client, true);
+
+    return 0;
+}
+
+/**
+ * @brief   Serialise a packet into the bytes that go on the wire
+ *
+ * @returns Bytes written to dest, 0 if they didn't fit
+ */
+static size_t build_frame(bbbled_client_t client, struct protocol_pkt *pkt, uint8_t *dest, size_t dest_size)
+{
+    uint8_t frame[PROTOCOL_RECV_BUF_SIZE];
+    size_t len;
+
+    if (client->config.framing == FRAMER_MODE_TEXT)
+    {
+        return serialise_packet(pkt, dest, dest_size);
+    }
+
+    len = serialise_packet(pkt, frame, sizeof(frame));
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    return framer_encode(client->config.framing, frame, len, dest, dest_size);
+}
+
+static void queue_reply(bbbled_client_t client, command_t command, uint16_t msg_num)
+{
+    uint8_t frame[REPLY_BUF_SIZE];
+    struct protocol_pkt pkt = {
+        .command = command,
+        .msg_num = msg_num,
+    };
+
+    size_t len = build_frame(client, &pkt, frame, sizeof(frame));
+    queue_tx(client, frame, len);
+}
+
+static void arm_timer(bbbled_client_t client)
+{
+    uint64_t deadline = UINT64_MAX;
+    struct itimerspec spec = {0};
+
+    for (size_t index = 0; index < BBBLED_CLIENT_MAX_IN_FLIGHT; ++index)
+    {
+        struct bbbled_request *req = &client->requests[index];
+        if (req->in_use)
+        {
+            deadline = MIN(deadline, req->deadline_us);
+        }
+    }
+
+    if (deadline != UINT64_MAX)
+    {
+        spec.it_value.tv_sec = deadline / 1000000ULL;
+        spec.it_value.tv_nsec = (deadline % 1000000ULL) * 1000ULL;
+        /*  A zero it_value disarms the timer, nudge it if already due */
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(client->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static struct bbbled_request *find_request(bbbled_client_t client, uint16_t msg_num)
+{
+    for (size_t index = 0; index < BBBLED_CLIENT_MAX_IN_FLIGHT; ++index)
+    {
+        struct bbbled_request *req = &client->requests[index];
+        if (req->in_use && req->msg_num == msg_num)
+        {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static void complete_request(bbbled_client_t client, struct bbbled_request *req, int status)
+{
+    bbbled_done_cb_t done = req->done;
+    void *user_data = req->user_data;
+    uint16_t msg_num = req->msg_num;
+
+    /*  Free the slot first so the callback can submit straight away */
+    req->in_use = false;
+    client->in_flight--;
+
+    if (status == 0)
+    {
+        client->stats.completed++;
+    }
+    else
+    {
+        client->stats.failed++;
+    }
+
+    if (done)
+    {
+        done(client, msg_num, status, user_data);
+    }
+}
+
+/**
+ * @retval  0 if the frame is queued
+ * @retval  -ENOBUFS if the TX buffer is full. The request stays pending
+ *          and goes out as soon as the buffer drains, the deadline is
+ *          only a fallback.
+ */
+static int transmit_request(bbbled_client_t client, struct bbbled_request *req, uint64_t now)
+{
+    int ret = queue_tx(client, req->frame, req->len);
+
+    req->unsent = (ret != 0);
+    req->deadline_us = now + (uint64_t)client->config.timeout_ms * 1000ULL;
+    if (ret == 0)
+    {
+        req->sent_us = now;
+    }
+
+    return ret;
+}
+
+static void retransmit_request(bbbled_client_t client, struct bbbled_request *req, uint64_t now)
+{
+    /*  A try that found no room still counts towards giving up, so a
+        link that never drains times the request out */
+    req->retries++;
+    if (transmit_request(client, req, now) == 0)
+    {
+        client->stats.retransmits++;
+    }
+}
+
+/**
+ * @brief   The TX buffer has drained, send what it had no room for
+ */
+static void send_unsent(bbbled_client_t client)
+{
+    uint64_t now = now_us();
+
+    for (size_t index = 0; index < BBBLED_CLIENT_MAX_IN_FLIGHT; ++index)
+    {
+        struct bbbled_request *req = &client->requests[index];
+
+        if (req->in_use && req->unsent && transmit_request(client, req, now) == 0 && req->retries)
+        {
+            client->stats.retransmits++;
+        }
+    }
+}
+
+/**
+ * @brief   A NACK does not say which frame it is for. The dongle
+ *          handles frames in order, so blame the oldest one.
+ */
+static void retransmit_oldest(bbbled_client_t client)
+{
+    struct bbbled_request *oldest = NULL;
+
+    for (size_t index = 0; index < BBBLED_CLIENT_MAX_IN_FLIGHT; ++index)
+    {
+        struct bbbled_request *req = &client->requests[index];
+        if (req->in_use && (oldest == NULL || req->sent_us < oldest->sent_us))
+        {
+            oldest = req;
+        }
+    }
+
+    if (oldest)
+    {
+        retransmit_request(client, oldest, now_us());
+        arm_timer(client);
+    }
+}
+
+static void handle_pong(bbbled_client_t client, parsed_data_t data)
+{
+    struct ping_sample sample;
+
+    if (parsed_data_decode(data) != PARSER_OK
+        || ping_sample(data->params, data->num_params, (uint32_t) now_us(), &sample))
+    {
+        LOG_WRN("pong %u without its timestamps", data->msg_num);
+        client->stats.invalid_params++;
+        return;
+    }
+
+    client->pings[client->stats.pongs++ % BBBLED_CLIENT_PING_HISTORY] = sample;
+}
+
+static void handle_frame(const uint8_t *frame, size_t len, void *user_data)
+{
+    bbbled_client_t client = (bbbled_client_t) user_data;
+    struct parsed_data data = {0};
+    uint16_t msg_num = 0;
+    struct bbbled_request *req;
+
+    client->stats.frames_rx++;
+
+    /*  ACKs and NACKs are all header, and a data frame is acknowledged
+        before its params are decoded */
+    if (parse_header((char*) frame, len, &data))
+    {
+        LOG_WRN("dropping unparsable frame from dongle");
+        queue_reply(client, COMMAND_NACK, UINT16_MAX);
+        return;
+    }
+
+    msg_num = data.msg_num;
+
+    switch (data.command)
+    {
+        case COMMAND_ACK:
+            req = find_request(client, msg_num);
+            if (req)
+            {
+                complete_request(client, req, 0);
+                arm_timer(client);
+            }
+            break;
+        case COMMAND_NACK:
+            client->stats.nacks++;
+            retransmit_oldest(client);
+            break;
+        case COMMAND_PONG:
+            queue_reply(client, COMMAND_ACK, msg_num);
+            handle_pong(client, &data);
+            break;
+        default:
+            queue_reply(client, COMMAND_ACK, msg_num);
+            if (client->config.rx_cb == NULL)
+            {
+                break;
+            }
+            if (parsed_data_decode(&data) != PARSER_OK)
+            {
+                /*  Too late to NACK, the frame has been acknowledged */
+                LOG_WRN("invalid params in msg %u", msg_num);
+                client->stats.invalid_params++;
+                break;
+            }
+            client->config.rx_cb(client, &data, msg_num, client->config.rx_user_data);
+            break;
+    }
+}
+
+static int handle_readable(bbbled_client_t client)
+{
+    uint8_t buf[1024];
+
+    for (;;)
+    {
+        ssize_t len = read(client->fd, buf, sizeof(buf));
+
+        if (len > 0)
+        {
+            client->stats.bytes_rx += len;
+            framer_feed(&client->framer, buf, len);
+        }
+        else if (len < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (len < 0 && errno == EAGAIN)
+        {
+            return 0;
+        }
+        else
+        {
+            /*  EOF or a real error, the dongle went away */
+            return (len == 0) ? -EPIPE : -errno;
+        }
+    }
+}
+
+static void handle_timeouts(bbbled_client_t client)
+{
+    uint64_t expirations;
+    uint64_t now = now_us();
+
+    /*  Clear the timerfd, we work from the deadlines themselves */
+    if (read(client->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    {
+        LOG_WRN("timerfd read failed [%d]", errno);
+    }
+
+    for (size_t index = 0; index < BBBLED_CLIENT_MAX_IN_FLIGHT; ++index)
+    {
+        struct bbbled_request *req = &client->requests[index];
+
+        if (!req->in_use || req->deadline_us > now)
+        {
+            continue;
+        }
+
+        if (req->retries >= client->config.max_retries)
+        {
+            LOG_WRN("msg %d timed out", req->msg_num);
+            complete_request(client, req, -ETIMEDOUT);
+        }
+        else
+        {
+            retransmit_request(client, req, now);
+        }
+    }
+
+    arm_timer(client);
+}
+
+void bbbled_client_config_default(struct bbbled_client_config *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->window = BBBLED_CLIENT_DEFAULT_WINDOW;
+    config->timeout_ms = BBBLED_CLIENT_DEFAULT_TIMEOUT_MS;
+    config->max_retries = BBBLED_CLIENT_DEFAULT_RETRIES;
+}
+
+int bbbled_client_attach(bbbled_client_t client, int fd, const struct bbbled_client_config *config)
+{
+    memset(client, 0, sizeof(*client));
+    client->fd = fd;
+    client->epoll_fd = -1;
+    client->timer_fd = -1;
+
+    if (config)
+    {
+        client->config = *config;
+    }
+    else
+    {
+        bbbled_client_config_default(&client->config);
+    }
+
+    client->config.window = MIN(MAX(client->config.window, 1), BBBLED_CLIENT_MAX_IN_FLIGHT);
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        return -errno;
+    }
+
+    client->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    client->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (client->epoll_fd < 0 || client->timer_fd < 0)
+    {
+        int err = -errno;
+        bbbled_client_close(client);
+        return err;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+    ev.data.fd = client->timer_fd;
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, client->timer_fd, &ev);
+
+    framer_init(&client->framer, handle_frame, client);
+    framer_set_mode(&client->framer, client->config.framing);
+    client->next_msg_num = os_rand16();
+
+    return 0;
+}
+
+int bbbled_client_open(bbbled_client_t client, const char *path, const struct bbbled_client_config *config)
+{
+    /*  Safe to close even if the open fails */
+    client->fd = client->epoll_fd = client->timer_fd = -1;
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (isatty(fd))
+    {
+        struct termios tio;
+
+        /*  Raw bytes both ways. CDC-ACM ignores the baud rate */
+        if (tcgetattr(fd, &tio) == 0)
+        {
+            cfmakeraw(&tio);
+            tio.c_cc[VMIN] = 0;
+            tio.c_cc[VTIME] = 0;
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+        tcflush(fd, TCIOFLUSH);
+    }
+
+    return bbbled_client_attach(client, fd, config);
+}
+
+void bbbled_client_close(bbbled_client_t client)
+{
+    if (client->timer_fd >= 0) close(client->timer_fd);
+    if (client->epoll_fd >= 0) close(client->epoll_fd);
+    if (client->fd >= 0) close(client->fd);
+
+    client->timer_fd = client->epoll_fd = client->fd = -1;
+}
+
+static uint16_t next_msg_num(bbbled_client_t client)
+{
+    uint16_t msg_num;
+
+    /*  UINT16_MAX is what a NACK carries, never hand it out */
+    do
+    {
+        msg_num = client->next_msg_num++;
+    } while (msg_num == UINT16_MAX || find_request(client, msg_num));
+
+    return msg_num;
+}
+
+int bbbled_client_submit(
+    bbbled_client_t client,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params,
+    bbbled_done_cb_t done,
+    void *user_data)
+{
+    struct bbbled_request *req = NULL;
+
+    if (client->in_flight >= client->config.window)
+    {
+        return -EAGAIN;
+    }
+
+    if (command >= NUM_COMMANDS || num_params > PROTOCOL_MAX_PARAMS)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t index = 0; index < num_params; ++index)
+    {
+        if (validate_param_for_command(command, params[index].key, params[index].value))
+        {
+            return -EINVAL;
+        }
+    }
+
+    for (size_t index = 0; index < BBBLED_CLIENT_MAX_IN_FLIGHT; ++index)
+    {
+        if (!client->requests[index].in_use)
+        {
+            req = &client->requests[index];
+            break;
+        }
+    }
+
+    struct protocol_pkt pkt = {
+        .command = command,
+        .num_params = num_params,
+        .msg_num = next_msg_num(client),
+    };
+    memcpy(pkt.params, params, num_params * sizeof(*params));
+
+    req->len = build_frame(client, &pkt, req->frame, sizeof(req->frame));
+    if (req->len == 0)
+    {
+        return -EINVAL;
+    }
+    req->msg_num = pkt.msg_num;
+    req->retries = 0;
+    req->unsent = false;
+    req->done = done;
+    req->user_data = user_data;
+
+    if (queue_tx(client, req->frame, req->len))
+    {
+        return -ENOBUFS;
+    }
+
+    req->in_use = true;
+    client->in_flight++;
+    client->stats.submitted++;
+
+    req->sent_us = now_us();
+    req->deadline_us = req->sent_us + (uint64_t)client->config.timeout_ms * 1000ULL;
+    arm_timer(client);
+
+    return req->msg_num;
+}
+
+int bbbled_client_ping(bbbled_client_t client)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    size_t num_params = 0;
+
+    ping_stamp(params, &num_params, PING_SENT, (uint32_t) now_us());
+
+    return bbbled_client_submit(client, COMMAND_PING, params, num_params, NULL, NULL);
+}
+
+int bbbled_client_upload_palette(bbbled_client_t client, const struct rgb *colours, size_t count, int timeout_ms)
+{
+    uint64_t failed = client->stats.failed;
+    int ret;
+
+    if (count > PALETTE_MAX_ENTRIES)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t index = 0; index < count;)
+    {
+        struct key_val_pair params[] = {
+            {.key = KEY_INDEX, .value = (value_t) index},
+            {.key = KEY_RED, .value = colours[index].red},
+            {.key = KEY_GREEN, .value = colours[index].green},
+            {.key = KEY_BLUE, .value = colours[index].blue},
+        };
+
+        ret = bbbled_client_submit(client, COMMAND_PALETTE, params, ARRAY_SIZE(params), NULL, NULL);
+        if (ret == -EAGAIN)
+        {
+            ret = bbbled_client_poll(client, timeout_ms);
+            if (ret)
+            {
+                return ret;
+            }
+            continue;
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+        index++;
+    }
+
+    ret = bbbled_client_drain(client, timeout_ms);
+    if (ret)
+    {
+        return ret;
+    }
+
+    /*  An entry that ran out of retries is missing on the dongle */
+    return (client->stats.failed == failed) ? 0 : -ETIMEDOUT;
+}
+
+int bbbled_client_set_indexed(
+    bbbled_client_t client,
+    uint16_t target,
+    const uint8_t *indices,
+    size_t count,
+    bbbled_done_cb_t done,
+    void *user_data)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    size_t num_params = palette_pack(target, indices, count, params);
+
+    if (num_params == 0)
+    {
+        return -EINVAL;
+    }
+
+    return bbbled_client_submit(client, COMMAND_SET_IDX, params, num_params, done, user_data);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t lhs = *(const uint32_t *) a;
+    uint32_t rhs = *(const uint32_t *) b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/*  Sorts values in place */
+static void summarise(uint32_t *values, size_t count, struct bbbled_latency *latency)
+{
+    qsort(values, count, sizeof(values[0]), compare_u32);
+
+    latency->p50_us = values[(count - 1) * 50 / 100];
+    latency->p90_us = values[(count - 1) * 90 / 100];
+    latency->p99_us = values[(count - 1) * 99 / 100];
+    latency->max_us = values[count - 1];
+}
+
+void bbbled_client_ping_report(bbbled_client_t client, struct bbbled_ping_report *report)
+{
+    uint32_t rtt[BBBLED_CLIENT_PING_HISTORY];
+    uint32_t usb[BBBLED_CLIENT_PING_HISTORY];
+    uint32_t peer[BBBLED_CLIENT_PING_HISTORY];
+    uint32_t dongle[BBBLED_CLIENT_PING_HISTORY];
+    size_t count = MIN(client->stats.pongs, BBBLED_CLIENT_PING_HISTORY);
+
+    memset(report, 0, sizeof(*report));
+    report->samples = count;
+    if (count == 0)
+    {
+        return;
+    }
+
+    for (size_t index = 0; index < count; ++index)
+    {
+        const struct ping_sample *sample = &client->pings[index];
+
+        rtt[index] = sample->rtt_us;
+        usb[index] = sample->usb_rtt_us / 2;
+        peer[index] = sample->peer_rtt_us / 2;
+        dongle[index] = sample->dongle_us;
+    }
+
+    summarise(rtt, count, &report->rtt);
+    summarise(usb, count, &report->usb_one_way);
+    summarise(peer, count, &report->peer_one_way);
+    summarise(dongle, count, &report->dongle);
+}
+
+int bbbled_client_poll(bbbled_client_t client, int timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int ret;
+
+    /*  Get anything queued since the last poll on the wire first */
+    ret = flush_tx(client);
+    if (ret)
+    {
+        return ret;
+    }
+
+    int num_events = epoll_wait(client->epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (num_events < 0)
+    {
+        return (errno == EINTR) ? 0 : -errno;
+    }
+
+    for (int index = 0; index < num_events; ++index)
+    {
+        if (events[index].data.fd == client->timer_fd)
+        {
+            handle_timeouts(client);
+            continue;
+        }
+
+        if (events[index].events & EPOLLIN)
+        {
+            ret = handle_readable(client);
+            if (ret)
+            {
+                return ret;
+            }
+        }
+
+        if (events[index].events & (EPOLLERR | EPOLLHUP))
+        {
+            return -EPIPE;
+        }
+    }
+
+    return flush_tx(client);
+}
+
+int bbbled_client_drain(bbbled_client_t client, int timeout_ms)
+{
+    uint64_t deadline = now_us() + (uint64_t)timeout_ms * 1000ULL;
+
+    while (client->in_flight)
+    {
+        uint64_t now = now_us();
+        if (now >= deadline)
+        {
+            return -ETIMEDOUT;
+        }
+
+        int ret = bbbled_client_poll(client, (int)((deadline - now) / 1000ULL) + 1);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
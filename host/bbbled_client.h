@@ -0,0 +1,306 @@
+#ifndef _BBBLED_CLIENT_H
+#define _BBBLED_CLIENT_H
+
+#include "protocol.h"
+#include "framer.h"
+#include "ping.h"
+#include "palette.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Upper bound on the requests that can be waiting for an ACK
+#define BBBLED_CLIENT_MAX_IN_FLIGHT 64
+#define BBBLED_CLIENT_TX_BUF_SIZE 65536
+#define BBBLED_CLIENT_DEFAULT_WINDOW 32
+#define BBBLED_CLIENT_DEFAULT_TIMEOUT_MS 100
+#define BBBLED_CLIENT_DEFAULT_RETRIES PROTOCOL_MAX_MSG_RETRIES
+// Pongs kept for bbbled_client_ping_report()
+#define BBBLED_CLIENT_PING_HISTORY 256
+
+struct bbbled_client;
+
+/**
+ * @brief   Called once a request has been acknowledged, or has run
+ *          out of retries
+ *
+ * @param   client      :   client the request was submitted on
+ * @param   msg_num     :   message number assigned at submission
+ * @param   status      :   0 when acknowledged, -ETIMEDOUT when retries ran out
+ * @param   user_data   :   user data given at submission
+ */
+typedef void (*bbbled_done_cb_t)(struct bbbled_client *client, uint16_t msg_num, int status, void *user_data);
+
+/**
+ * @brief   Called for every data frame the dongle sends us. The client
+ *          has already queued the ACK for it. Frames with a param out of
+ *          range are counted in invalid_params instead.
+ */
+typedef void (*bbbled_rx_cb_t)(struct bbbled_client *client, const struct parsed_data *data, uint16_t msg_num, void *user_data);
+
+/**
+ * @brief Client configuration
+ * @param   window          :   max requests in flight (<= BBBLED_CLIENT_MAX_IN_FLIGHT)
+ * @param   timeout_ms      :   time to wait for an ACK before retransmitting
+ * @param   max_retries     :   retransmissions before a request fails
+ * @param   rx_cb           :   optional handler for data frames from the dongle
+ * @param   rx_user_data    :   passed through to rx_cb
+ * @param   framing         :   must match the dongle's CONFIG_BBBLED_FRAMING
+ */
+struct bbbled_client_config {
+    size_t window;
+    uint32_t timeout_ms;
+    uint8_t max_retries;
+    bbbled_rx_cb_t rx_cb;
+    void *rx_user_data;
+    framer_mode_t framing;
+};
+
+struct bbbled_client_stats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t retransmits;
+    uint64_t nacks;
+    // Data frames acknowledged, then dropped for a param out of range
+    uint64_t invalid_params;
+    // Pongs received, whether or not they are still in the history
+    uint64_t pongs;
+    uint64_t frames_rx;
+    uint64_t bytes_tx;
+    uint64_t bytes_rx;
+};
+
+/**
+ * @brief A request waiting for its ACK
+ * @param   in_use      :   slot holds a request
+ * @param   msg_num     :   message number of the request
+ * @param   frame       :   frame as sent on the wire, kept for retransmission
+ * @param   len         :   length of the frame
+ * @param   sent_us     :   when the frame was (last) written
+ * @param   deadline_us :   when to give up waiting for the ACK
+ * @param   retries     :   retransmissions so far
+ * @param   unsent      :   the TX buffer had no room for its last (re)transmission
+ * @param   done        :   completion callback
+ * @param   user_data   :   passed through to done
+ */
+struct bbbled_request {
+    bool in_use;
+    uint16_t msg_num;
+    uint8_t frame[FRAMER_COBS_BUF_SIZE + 1];
+    size_t len;
+    uint64_t sent_us;
+    uint64_t deadline_us;
+    uint8_t retries;
+    bool unsent;
+    bbbled_done_cb_t done;
+    void *user_data;
+};
+
+/**
+ * @brief One latency distribution, in microseconds
+ */
+struct bbbled_latency {
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+};
+
+/**
+ * @brief Latencies over the last BBBLED_CLIENT_PING_HISTORY pongs. See
+ *        ping.h for how each is measured, one way figures are half the
+ *        link's round trip.
+ * @param   samples         :   pongs the report covers
+ * @param   rtt             :   host to host round trip
+ * @param   usb_one_way     :   host to dongle
+ * @param   peer_one_way    :   dongle to peer (0 without a peer link)
+ * @param   dongle          :   time a ping waits in the dongle before forwarding
+ */
+struct bbbled_ping_report {
+    size_t samples;
+    struct bbbled_latency rtt;
+    struct bbbled_latency usb_one_way;
+    struct bbbled_latency peer_one_way;
+    struct bbbled_latency dongle;
+};
+
+struct bbbled_client {
+    int fd;
+    int epoll_fd;
+    int timer_fd;
+    bool want_write;
+    struct bbbled_client_config config;
+    struct bbbled_request requests[BBBLED_CLIENT_MAX_IN_FLIGHT];
+    size_t in_flight;
+    uint16_t next_msg_num;
+    uint8_t tx_buf[BBBLED_CLIENT_TX_BUF_SIZE];
+    size_t tx_head;
+    size_t tx_tail;
+    struct framer framer;
+    struct bbbled_client_stats stats;
+    struct ping_sample pings[BBBLED_CLIENT_PING_HISTORY];
+};
+
+typedef struct bbbled_client* bbbled_client_t;
+
+/**
+ * @brief   Fill a config with the defaults
+ */
+void bbbled_client_config_default(struct bbbled_client_config *config);
+
+/**
+ * @brief   Open the dongle's CDC-ACM tty (raw, non-blocking)
+ *
+ * @param   client  :   client to initialise
+ * @param   path    :   tty path, e.g. /dev/ttyACM0
+ * @param   config  :   configuration, NULL for defaults
+ *
+ * @retval  0 on success
+ * @retval  -errno on failure
+ */
+int bbbled_client_open(bbbled_client_t client, const char *path, const struct bbbled_client_config *config);
+
+/**
+ * @brief   Use an already open file descriptor (pty, socket, ...).
+ *          The client takes ownership of the fd.
+ *
+ * @retval  0 on success
+ * @retval  -errno on failure
+ */
+int bbbled_client_attach(bbbled_client_t client, int fd, const struct bbbled_client_config *config);
+
+/**
+ * @brief   Close the client. Requests still in flight are dropped
+ *          without their callbacks being called.
+ */
+void bbbled_client_close(bbbled_client_t client);
+
+/**
+ * @brief   Queue a command. Returns straight away, the callback fires
+ *          from bbbled_client_poll() once the request completes.
+ *
+ * @param   client      :   client
+ * @param   command     :   command to send
+ * @param   params      :   parameters for the command
+ * @param   num_params  :   number of parameters
+ * @param   done        :   completion callback, may be NULL
+ * @param   user_data   :   passed through to done
+ *
+ * @retval  message number (>= 0) on success
+ * @retval  -EAGAIN if the window is full, poll and try again
+ * @retval  -EINVAL if the command or its parameters are invalid
+ * @retval  -ENOBUFS if the tx buffer is full
+ */
+int bbbled_client_submit(
+    bbbled_client_t client,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params,
+    bbbled_done_cb_t done,
+    void *user_data);
+
+/**
+ * @brief   Upload a palette to the dongle (see palette.h), one entry per
+ *          frame, and wait until every entry has been acknowledged so
+ *          set_idx frames sent afterwards can't overtake it.
+ *
+ * @param   client      :   client
+ * @param   colours     :   entries 0 to count - 1
+ * @param   count       :   number of entries, at most PALETTE_MAX_ENTRIES
+ * @param   timeout_ms  :   longest to wait for the ACKs
+ *
+ * @retval  0 once the dongle has every entry
+ * @retval  -EINVAL for too many entries
+ * @retval  -ETIMEDOUT if the ACKs didn't all arrive in time, or any
+ *          request failed meanwhile
+ * @retval  -errno as bbbled_client_submit()
+ */
+int bbbled_client_upload_palette(bbbled_client_t client, const struct rgb *colours, size_t count, int timeout_ms);
+
+/**
+ * @brief   Set a run of LEDs to palette colours in one set_idx
+ *
+ * @param   client      :   client
+ * @param   target      :   first LED
+ * @param   indices     :   palette index for each LED
+ * @param   count       :   number of LEDs, at most PALETTE_MAX_PER_FRAME
+ * @param   done        :   completion callback, may be NULL
+ * @param   user_data   :   passed through to done
+ *
+ * @retval  message number (>= 0) on success
+ * @retval  -EINVAL for no LEDs or too many
+ * @retval  -errno as bbbled_client_submit()
+ */
+int bbbled_client_set_indexed(
+    bbbled_client_t client,
+    uint16_t target,
+    const uint8_t *indices,
+    size_t count,
+    bbbled_done_cb_t done,
+    void *user_data);
+
+/**
+ * @brief   Send a ping stamped with the host's clock. Its pong is picked
+ *          up by bbbled_client_poll() and added to the ping history,
+ *          it is not passed to rx_cb. Cheap enough to send every second
+ *          or so alongside normal traffic as a health probe.
+ *
+ * @param   client  :   client
+ *
+ * @retval  message number (>= 0) on success
+ * @retval  -errno as bbbled_client_submit()
+ */
+int bbbled_client_ping(bbbled_client_t client);
+
+/**
+ * @brief   Latency distributions over the pongs in the history
+ *
+ * @param   client  :   client
+ * @param   report  :   filled in, all zeros if no pong has come back
+ */
+void bbbled_client_ping_report(bbbled_client_t client, struct bbbled_ping_report *report);
+
+/**
+ * @brief   Wait for and handle I/O and retransmission timers
+ *
+ * @param   client      :   client
+ * @param   timeout_ms  :   how long to wait, -1 for forever
+ *
+ * @retval  0 on success (including timeout)
+ * @retval  -errno if the tty failed
+ */
+int bbbled_client_poll(bbbled_client_t client, int timeout_ms);
+
+/**
+ * @brief   Poll until every request in flight has completed
+ *
+ * @param   client      :   client
+ * @param   timeout_ms  :   overall time limit
+ *
+ * @retval  0 once nothing is in flight
+ * @retval  -ETIMEDOUT if the time limit ran out first
+ * @retval  -errno if the tty failed
+ */
+int bbbled_client_drain(bbbled_client_t client, int timeout_ms);
+
+/**
+ * @brief   The client's epoll fd. Readable whenever bbbled_client_poll()
+ *          has work to do, so clients can be nested in another event loop.
+ */
+static inline int bbbled_client_fd(bbbled_client_t client)
+{
+    return client->epoll_fd;
+}
+
+static inline size_t bbbled_client_in_flight(bbbled_client_t client)
+{
+    return client->in_flight;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_CLIENT_H */
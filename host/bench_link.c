@@ -0,0 +1,93 @@
+/*
+ * Sustained throughput against a real dongle. Keeps the client's window
+ * full of set_rgb requests for a fixed time and reports what got
+ * through. Run once per transport build (CONFIG_BBBLED_TRANSPORT_IRQ /
+ * _ASYNC) with CONFIG_BBBLED_TRANSPORT_STATS_INTERVAL_MS set, and read the
+ * dongle's log for the CPU time per KB:
+ *
+ *   ./bbbled_bench_link /dev/ttyACM0 [seconds] [window]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bbbled_client.h"
+
+#define DEFAULT_SECONDS 10
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static struct bbbled_client client;
+    struct bbbled_client_config config;
+    struct key_val_pair params[] = {
+        {.key = KEY_RED, .value = 255},
+        {.key = KEY_GREEN, .value = 128},
+        {.key = KEY_BLUE, .value = 0},
+    };
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <tty> [seconds] [window]\n", argv[0]);
+        return 1;
+    }
+
+    double seconds = (argc > 2) ? atof(argv[2]) : DEFAULT_SECONDS;
+
+    bbbled_client_config_default(&config);
+    if (argc > 3)
+    {
+        config.window = strtoul(argv[3], NULL, 10);
+    }
+
+    int ret = bbbled_client_open(&client, argv[1], &config);
+    if (ret)
+    {
+        fprintf(stderr, "failed to open %s [%d]\n", argv[1], ret);
+        return 1;
+    }
+
+    double start = now_s();
+    double end = start + seconds;
+
+    while (now_s() < end)
+    {
+        params[2].value = (params[2].value + 1) & 0xFF;
+
+        ret = bbbled_client_submit(&client, COMMAND_SET_RGB, params, ARRAY_SIZE(params), NULL, NULL);
+        if (ret == -EAGAIN || ret == -ENOBUFS)
+        {
+            ret = bbbled_client_poll(&client, 10);
+        }
+        if (ret < 0)
+        {
+            fprintf(stderr, "link failed [%d]\n", ret);
+            break;
+        }
+    }
+
+    bbbled_client_drain(&client, 1000);
+    double elapsed = now_s() - start;
+
+    printf("window %zu: %.0f req/s, tx %.1f KB/s, rx %.1f KB/s, %llu retransmits, %llu failed\n",
+           config.window,
+           client.stats.completed / elapsed,
+           client.stats.bytes_tx / 1024.0 / elapsed,
+           client.stats.bytes_rx / 1024.0 / elapsed,
+           (unsigned long long) client.stats.retransmits,
+           (unsigned long long) client.stats.failed);
+
+    bbbled_client_close(&client);
+    return 0;
+}
\ No newline at end of file
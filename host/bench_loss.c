@@ -0,0 +1,297 @@
+/*
+ * Delivery latency over a lossy link, ordered (stop-and-wait) against
+ * unordered delivery. Runs in simulated time, one step per millisecond,
+ * so the numbers are the protocol's and not the scheduler's:
+ *
+ *   ./bbbled_bench_loss [messages] [interval_ms] [one_way_ms]
+ *
+ * The sender is a protocol context driving its own timer wheel by hand,
+ * the far end applies each set_rgb as it arrives and ACKs it. Frames in
+ * either direction are lost at random. Latency is from protocol_submit()
+ * to the first copy arriving at the far end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+#define DEFAULT_MESSAGES 20000
+#define DEFAULT_INTERVAL_MS 20
+#define DEFAULT_ONE_WAY_MS 5
+#define LINK_DEPTH 1024
+#define LINK_FRAME_SIZE 128
+// Give up on a run that stops making progress
+#define MAX_IDLE_MS 60000
+
+struct link_frame {
+    uint32_t arrive_ms;
+    size_t len;
+    uint8_t data[LINK_FRAME_SIZE];
+};
+
+/*  Constant delay, so frames arrive in the order they were sent */
+struct link {
+    struct link_frame frames[LINK_DEPTH];
+    size_t head;
+    size_t tail;
+    uint32_t loss_ppm;
+};
+
+struct run {
+    struct protocol_ctx ctx;
+    os_timer_t resend_timer;
+    struct timer_wheel wheel;
+    struct link to_far;
+    struct link to_near;
+    uint32_t now_ms;
+    uint32_t one_way_ms;
+    bool timed_out;
+    uint32_t submit_ms[UINT16_MAX + 1];
+    bool waiting[UINT16_MAX + 1];
+    uint32_t *latencies;
+    size_t delivered;
+    size_t frames_sent;
+};
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void link_send(struct run *run, struct link *link, const uint8_t *data, size_t len)
+{
+    if ((rng() % 1000000) < link->loss_ppm)
+    {
+        return;
+    }
+    if (link->tail - link->head == LINK_DEPTH || len > LINK_FRAME_SIZE)
+    {
+        return;
+    }
+
+    struct link_frame *frame = &link->frames[link->tail++ % LINK_DEPTH];
+    frame->arrive_ms = run->now_ms + run->one_way_ms;
+    frame->len = len;
+    memcpy(frame->data, data, len);
+}
+
+static struct link_frame *link_recv(struct run *run, struct link *link)
+{
+    if (link->head == link->tail)
+    {
+        return NULL;
+    }
+
+    struct link_frame *frame = &link->frames[link->head % LINK_DEPTH];
+    if ((int32_t)(frame->arrive_ms - run->now_ms) > 0)
+    {
+        return NULL;
+    }
+    link->head++;
+    return frame;
+}
+
+static void sender_event(protocol_ctx_t ctx, protocol_event_t event, void *user_data)
+{
+    struct run *run = user_data;
+
+    if (event == PROTOCOL_EVENT_TIMEOUT)
+    {
+        run->timed_out = true;
+    }
+}
+
+/*  The far end: apply whatever arrives, ACK it */
+static void far_end_receive(struct run *run, struct link_frame *frame)
+{
+    char text[LINK_FRAME_SIZE + 1];
+    struct parsed_data parsed = {0};
+    uint16_t msg_num = 0;
+    uint8_t ack_buf[LINK_FRAME_SIZE];
+
+    memcpy(text, frame->data, frame->len);
+    text[frame->len] = '\0';
+    if (parse(text, frame->len, &parsed, &msg_num) != 0 || parsed.command != COMMAND_SET_RGB)
+    {
+        return;
+    }
+
+    uint16_t num = msg_num;
+    if (run->waiting[num])
+    {
+        run->waiting[num] = false;
+        run->latencies[run->delivered++] = run->now_ms - run->submit_ms[num];
+    }
+
+    struct protocol_pkt ack = {.command = COMMAND_ACK, .msg_num = num};
+    size_t len = serialise_packet(&ack, ack_buf, sizeof(ack_buf));
+    link_send(run, &run->to_near, ack_buf, len);
+}
+
+static void sender_receive(struct run *run, struct link_frame *frame)
+{
+    uint8_t text[LINK_FRAME_SIZE + 1];
+    struct parsed_data parsed = {0};
+
+    memcpy(text, frame->data, frame->len);
+    text[frame->len] = '\0';
+    run->ctx.rx_buf = text;
+    run->ctx.rx_len = frame->len;
+    handle_incoming(&run->ctx, &parsed);
+}
+
+static void sender_transmit(struct run *run)
+{
+    struct pbuf *frame;
+
+    while ((frame = protocol_tx_pbuf(&run->ctx)) != NULL)
+    {
+        link_send(run, &run->to_far, frame->data, frame->len);
+        run->frames_sent++;
+        pbuf_unref(frame);
+    }
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t count, double fraction)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    return sorted[(size_t)(fraction * (count - 1))];
+}
+
+static void run_once(struct run *run, command_delivery_t delivery, uint32_t loss_ppm,
+                     size_t messages, uint32_t interval_ms)
+{
+    size_t submitted = 0;
+    uint32_t next_submit_ms = 0;
+    uint32_t idle_ms = 0;
+    size_t last_delivered = 0;
+
+    memset(run->waiting, 0, sizeof(run->waiting));
+    run->to_far.head = run->to_far.tail = 0;
+    run->to_near.head = run->to_near.tail = 0;
+    run->to_far.loss_ppm = loss_ppm;
+    run->to_near.loss_ppm = loss_ppm;
+    run->now_ms = 0;
+    run->delivered = 0;
+    run->frames_sent = 0;
+    run->timed_out = false;
+
+    protocol_init(&run->ctx, NULL, 0, &run->resend_timer);
+    timer_wheel_init(&run->wheel, NULL, TIMER_MSEC(1));
+    protocol_set_delivery(&run->ctx, &run->wheel, delivery);
+    protocol_set_event_cb(&run->ctx, sender_event, run);
+
+    while (submitted < messages || run->wheel.num_active || run->to_far.head != run->to_far.tail
+           || run->to_near.head != run->to_near.tail)
+    {
+        struct link_frame *frame;
+
+        while ((frame = link_recv(run, &run->to_far)) != NULL)
+        {
+            far_end_receive(run, frame);
+        }
+        while ((frame = link_recv(run, &run->to_near)) != NULL)
+        {
+            sender_receive(run, frame);
+        }
+
+        /*  A submission the pool had no room for keeps its original
+            time, so waiting in the backlog counts against latency */
+        if (submitted < messages && (int32_t)(run->now_ms - next_submit_ms) >= 0)
+        {
+            struct key_val_pair params[] = {
+                {.key = KEY_RED, .value = submitted & 0xff},
+                {.key = KEY_GREEN, .value = 128},
+                {.key = KEY_BLUE, .value = 7},
+            };
+            int msg_num = protocol_submit(&run->ctx, COMMAND_SET_RGB, params, 3);
+
+            if (msg_num >= 0)
+            {
+                run->submit_ms[msg_num] = next_submit_ms;
+                run->waiting[msg_num] = true;
+                next_submit_ms += interval_ms;
+                submitted++;
+            }
+        }
+
+        timer_wheel_advance(&run->wheel, 1);
+        if (run->timed_out)
+        {
+            run->timed_out = false;
+            protocol_timeout(&run->ctx);
+        }
+        sender_transmit(run);
+
+        idle_ms = (run->delivered == last_delivered) ? idle_ms + 1 : 0;
+        last_delivered = run->delivered;
+        if (idle_ms > MAX_IDLE_MS)
+        {
+            fprintf(stderr, "no progress for %d ms, giving up\n", MAX_IDLE_MS);
+            break;
+        }
+        run->now_ms++;
+    }
+
+    qsort(run->latencies, run->delivered, sizeof(uint32_t), compare_u32);
+    printf("%5.1f%% %-10s %7u %7u %7u %7u %8.2f %6zu\n",
+           loss_ppm / 1e4,
+           (delivery == COMMAND_DELIVERY_ORDERED) ? "ordered" : "unordered",
+           percentile(run->latencies, run->delivered, 0.5),
+           percentile(run->latencies, run->delivered, 0.99),
+           percentile(run->latencies, run->delivered, 0.999),
+           percentile(run->latencies, run->delivered, 1.0),
+           (double) run->frames_sent / messages,
+           messages - run->delivered);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t loss_ppm[] = {0, 10000, 50000, 100000};
+    size_t messages = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES;
+    uint32_t interval_ms = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_INTERVAL_MS;
+    uint32_t one_way_ms = (argc > 3) ? strtoul(argv[3], NULL, 10) : DEFAULT_ONE_WAY_MS;
+    struct run *run = calloc(1, sizeof(*run));
+
+    if (run == NULL || messages == 0 || interval_ms == 0)
+    {
+        return 1;
+    }
+    run->latencies = calloc(messages, sizeof(uint32_t));
+    run->one_way_ms = one_way_ms;
+    if (run->latencies == NULL)
+    {
+        return 1;
+    }
+
+    printf("%zu set_rgb every %u ms, %u ms each way, latency in ms\n", messages, interval_ms, one_way_ms);
+    printf("%6s %-10s %7s %7s %7s %7s %8s %6s\n", "loss", "mode", "p50", "p99", "p99.9", "max", "tx/msg", "lost");
+
+    for (size_t index = 0; index < sizeof(loss_ppm) / sizeof(loss_ppm[0]); ++index)
+    {
+        run_once(run, COMMAND_DELIVERY_ORDERED, loss_ppm[index], messages, interval_ms);
+        run_once(run, COMMAND_DELIVERY_UNORDERED, loss_ppm[index], messages, interval_ms);
+    }
+
+    free(run->latencies);
+    free(run);
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Worst case parse cost. Feeds generated hostile frames of every length
+ * up to PROTOCOL_RECV_BUF_SIZE through the receive path. For each kind of
+ * input it reports the most os_cycles any one frame took, and the worst
+ * os_cycles per byte over frames of MIN_PER_BYTE_LEN bytes or more:
+ *
+ *   ./bbbled_bench_parse [seeds]
+ *
+ * Each input is timed several times and the fastest run kept, so the
+ * figure is the parser's and not the scheduler's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+#define DEFAULT_SEEDS 100
+#define REPEATS 16
+#define MIN_LEN 8
+#define LEN_STEP 7
+// Below this the fixed cost per frame swamps the per byte figure
+#define MIN_PER_BYTE_LEN 64
+
+typedef size_t (*generator_t)(char *frame, size_t len, uint32_t *rng);
+
+static uint32_t next_rand(uint32_t *rng)
+{
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    return *rng;
+}
+
+/*  Overwrite the last 5 bytes with '#' and a good CRC, so the input gets
+    past verify_crc() and into the rest of the parser */
+static size_t seal(char *frame, size_t len)
+{
+    char crc[5];
+
+    frame[len - 5] = '#';
+    snprintf(crc, sizeof(crc), "%04x", os_crc16_ccitt(PROTOCOL_CRC_POLY, (uint8_t *) frame, len - 4));
+    memcpy(&frame[len - 4], crc, 4);
+    return len;
+}
+
+static size_t gen_valid(char *frame, size_t len, uint32_t *rng)
+{
+    /*  A real set_rgb, padded out with repeats of a valid param */
+    size_t pos = (size_t) snprintf(frame, len, "!set_rgb,");
+
+    while (pos + 16 < len)
+    {
+        pos += (size_t) snprintf(frame + pos, len - pos, "red:%u,", next_rand(rng) & 0xff);
+    }
+    pos += (size_t) snprintf(frame + pos, len - pos, "msg:1");
+    while (pos < len - 5)
+    {
+        frame[pos++] = '0';
+    }
+    return seal(frame, len);
+}
+
+static size_t gen_random(char *frame, size_t len, uint32_t *rng)
+{
+    for (size_t index = 0; index < len; ++index)
+    {
+        frame[index] = (char) next_rand(rng);
+    }
+    frame[0] = '!';
+    return len;
+}
+
+static size_t gen_no_crc(char *frame, size_t len, uint32_t *rng)
+{
+    memset(frame, 'a', len);
+    frame[0] = '!';
+    return len;
+}
+
+static size_t gen_separators(char *frame, size_t len, uint32_t *rng)
+{
+    memset(frame, ',', len);
+    memcpy(frame, "!set_rgb", 8);
+    return seal(frame, len);
+}
+
+static size_t gen_colons(char *frame, size_t len, uint32_t *rng)
+{
+    memset(frame, ':', len);
+    memcpy(frame, "!set_rgb,", 9);
+    for (size_t index = 9; index < len; index += 3)
+    {
+        frame[index] = ',';
+    }
+    return seal(frame, len);
+}
+
+static size_t gen_long_tokens(char *frame, size_t len, uint32_t *rng)
+{
+    memset(frame, 'r', len);
+    memcpy(frame, "!set_rgb,", 9);
+    for (size_t index = 9 + PROTOCOL_MAX_TOKEN_LEN - 2; index < len; index += PROTOCOL_MAX_TOKEN_LEN - 1)
+    {
+        frame[index - 2] = ':';
+        frame[index] = ',';
+    }
+    return seal(frame, len);
+}
+
+static size_t gen_msg_first(char *frame, size_t len, uint32_t *rng)
+{
+    /*  msg where the header doesn't look first, so it walks the params */
+    memset(frame, 'x', len);
+    memcpy(frame, "!set_rgb,msg:1,", 15);
+    return seal(frame, len);
+}
+
+static size_t gen_hashes(char *frame, size_t len, uint32_t *rng)
+{
+    memset(frame, '#', len);
+    frame[0] = '!';
+    return len;
+}
+
+static const struct {
+    const char *name;
+    generator_t generate;
+} generators[] = {
+    {"valid", gen_valid},
+    {"random", gen_random},
+    {"no_crc", gen_no_crc},
+    {"commas", gen_separators},
+    {"colons", gen_colons},
+    {"long_tokens", gen_long_tokens},
+    {"msg_first", gen_msg_first},
+    {"hashes", gen_hashes},
+};
+
+/*  What the loop does with a frame: header, ACK, then the params */
+static void receive(char *frame, size_t len)
+{
+    struct parsed_data parsed = {0};
+
+    if (parse_header(frame, len, &parsed) == PARSER_OK)
+    {
+        parsed_data_decode(&parsed);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seeds = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_SEEDS;
+    static char frame[PROTOCOL_RECV_BUF_SIZE + 1];
+    double overall = 0;
+    uint32_t overall_cycles = 0;
+
+    printf("os_cycles at %u Hz, lengths %d..%d\n", os_cycles_per_sec(), MIN_LEN, PROTOCOL_RECV_BUF_SIZE);
+    printf("%-12s %12s %12s %12s\n", "input", "worst cyc", "worst cyc/B", "mean cyc/B");
+
+    for (size_t gen = 0; gen < sizeof(generators) / sizeof(generators[0]); ++gen)
+    {
+        uint32_t worst = 0;
+        double worst_per_byte = 0;
+        double total = 0;
+        size_t samples = 0;
+
+        for (uint32_t seed = 1; seed <= seeds; ++seed)
+        {
+            uint32_t rng = seed * 2654435761u;
+
+            for (size_t len = MIN_LEN; len <= PROTOCOL_RECV_BUF_SIZE; len += LEN_STEP)
+            {
+                uint32_t best = UINT32_MAX;
+
+                len = generators[gen].generate(frame, len, &rng);
+                frame[len] = '\0';
+
+                for (int repeat = 0; repeat < REPEATS; ++repeat)
+                {
+                    uint32_t start = os_cycles();
+
+                    receive(frame, len);
+                    best = MIN(best, os_cycles() - start);
+                }
+
+                worst = MAX(worst, best);
+                if (len >= MIN_PER_BYTE_LEN)
+                {
+                    double per_byte = (double) best / len;
+
+                    worst_per_byte = MAX(worst_per_byte, per_byte);
+                    total += per_byte;
+                    samples++;
+                }
+            }
+        }
+
+        printf("%-12s %12u %12.2f %12.2f\n", generators[gen].name, worst, worst_per_byte, total / samples);
+        overall = MAX(overall, worst_per_byte);
+        overall_cycles = MAX(overall_cycles, worst);
+    }
+
+    printf("%-12s %12u %12.2f\n", "worst", overall_cycles, overall);
+    return 0;
+}
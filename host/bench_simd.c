@@ -0,0 +1,162 @@
+/*
+ * The vector CRC and delimiter scan against the scalar code, across
+ * frame sizes, then the framer and parser on top of them over a stream
+ * of real frames. Every level this machine runs is measured:
+ *
+ *   ./bbbled_bench_simd [iterations]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "os_simd.h"
+#include "protocol.h"
+#include "framer.h"
+
+#define DEFAULT_ITERATIONS 200000
+#define STREAM_FRAMES 256
+
+static const size_t sizes[] = {16, 32, 64, 128, 256, 512, 1024, 4096};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double time_crc(const uint8_t *buffer, size_t len, size_t iterations)
+{
+    volatile uint16_t sink = 0;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        sink ^= os_crc16_ccitt(PROTOCOL_CRC_POLY, buffer, len);
+    }
+    return (double) (now_ns() - start) / iterations;
+}
+
+/*  The delimiter at the very end, so the whole frame is scanned */
+static double time_find(const uint8_t *buffer, size_t len, size_t iterations)
+{
+    volatile size_t sink = 0;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        sink += os_find_delim(buffer, len, ',', '#');
+    }
+    return (double) (now_ns() - start) / iterations;
+}
+
+static void on_frame(const uint8_t *frame, size_t len, void *user_data)
+{
+    struct parsed_data parsed = {0};
+    uint16_t msg_num = 0;
+
+    if (parse((char *) frame, len, &parsed, &msg_num) == 0)
+    {
+        ++*(unsigned long *) user_data;
+    }
+}
+
+static double time_stream(const uint8_t *stream, size_t len, size_t iterations)
+{
+    static struct framer framer;
+    unsigned long frames = 0;
+    uint64_t start;
+
+    framer_init(&framer, on_frame, &frames);
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        framer_feed(&framer, stream, len);
+    }
+    return (double) (now_ns() - start) / frames;
+}
+
+int main(int argc, char **argv)
+{
+    size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    static uint8_t buffer[4096];
+    static uint8_t stream[STREAM_FRAMES * PROTOCOL_RECV_BUF_SIZE];
+    double crc_ns[OS_SIMD_NUM_LEVELS][ARRAY_SIZE(sizes)];
+    double find_ns[OS_SIMD_NUM_LEVELS][ARRAY_SIZE(sizes)];
+    double stream_ns[OS_SIMD_NUM_LEVELS];
+    size_t stream_len = 0;
+
+    struct protocol_pkt pkt = {
+        .command = COMMAND_SET_RGB,
+        .params = {
+            {.key = KEY_RED, .value = 255},
+            {.key = KEY_GREEN, .value = 128},
+            {.key = KEY_BLUE, .value = 7},
+            {.key = KEY_TARGET, .value = 1234},
+        },
+        .num_params = 4,
+    };
+
+    for (size_t index = 0; index < sizeof(buffer); ++index)
+    {
+        buffer[index] = 'a' + index % 26;
+    }
+
+    for (size_t index = 0; index < STREAM_FRAMES; ++index)
+    {
+        pkt.msg_num = (uint16_t) (index * 251);
+        stream_len += serialise_packet(&pkt, stream + stream_len, sizeof(stream) - stream_len);
+    }
+
+    for (os_simd_t level = OS_SIMD_SCALAR; level < OS_SIMD_NUM_LEVELS; ++level)
+    {
+        if (os_simd_select(level))
+        {
+            continue;
+        }
+
+        for (size_t size = 0; size < ARRAY_SIZE(sizes); ++size)
+        {
+            size_t scaled = MAX(iterations * 64 / sizes[size], 1000);
+
+            buffer[sizes[size] - 1] = '#';
+            crc_ns[level][size] = time_crc(buffer, sizes[size], scaled);
+            find_ns[level][size] = time_find(buffer, sizes[size], scaled);
+            buffer[sizes[size] - 1] = 'a' + (sizes[size] - 1) % 26;
+        }
+
+        stream_ns[level] = time_stream(stream, stream_len, MAX(iterations / STREAM_FRAMES, 100));
+    }
+
+    for (os_simd_t level = OS_SIMD_SCALAR; level < OS_SIMD_NUM_LEVELS; ++level)
+    {
+        if (os_simd_select(level))
+        {
+            continue;
+        }
+
+        printf("%s%s\n", os_simd_name(level), os_simd_has_crc() ? "" : " (scalar crc)");
+        printf("  %6s %12s %10s %8s %12s %10s %8s\n", "bytes", "crc ns/op", "MB/s", "speedup",
+               "scan ns/op", "MB/s", "speedup");
+
+        for (size_t size = 0; size < ARRAY_SIZE(sizes); ++size)
+        {
+            printf("  %6zu %12.1f %10.1f %7.2fx %12.1f %10.1f %7.2fx\n", sizes[size],
+                   crc_ns[level][size], sizes[size] * 1e3 / crc_ns[level][size],
+                   crc_ns[OS_SIMD_SCALAR][size] / crc_ns[level][size],
+                   find_ns[level][size], sizes[size] * 1e3 / find_ns[level][size],
+                   find_ns[OS_SIMD_SCALAR][size] / find_ns[level][size]);
+        }
+
+        printf("  framer + parse %.1f ns/frame (%zu byte frames), %.2fx\n\n", stream_ns[level],
+               stream_len / STREAM_FRAMES, stream_ns[OS_SIMD_SCALAR] / stream_ns[level]);
+    }
+
+    return 0;
+}
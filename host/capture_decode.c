@@ -0,0 +1,149 @@
+/*
+ * Turns a "proto capture dump" from the dongle's shell into a timeline.
+ * Reads the shell output (a terminal log is fine, anything that isn't
+ * part of a dump is skipped) and prints one line per frame:
+ *
+ *   ./bbbled_capture_decode < shell.log
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+#define LINE_SIZE 1024
+// Larger than any capture ring the dongle can be built with
+#define MAX_DUMP_SIZE (1024 * 1024)
+
+static uint8_t dump[MAX_DUMP_SIZE];
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c = tolower((unsigned char) c);
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/*  Append a line of hex to the dump. Anything else isn't part of it */
+static size_t append_hex(const char *line, size_t len)
+{
+    size_t digits = strlen(line);
+    size_t count = 0;
+
+    while (digits && isspace((unsigned char) line[digits - 1]))
+    {
+        digits--;
+    }
+    if (digits == 0 || digits % 2)
+    {
+        return 0;
+    }
+
+    for (size_t index = 0; index < digits && len + count < MAX_DUMP_SIZE; index += 2)
+    {
+        int high = hex_value(line[index]);
+        int low = hex_value(line[index + 1]);
+
+        if (high < 0 || low < 0)
+        {
+            return 0;
+        }
+        dump[len + count++] = (uint8_t) ((high << 4) | low);
+    }
+
+    return count;
+}
+
+static void print_timeline(size_t len, unsigned long hz)
+{
+    struct capture_record record;
+    uint32_t last = 0;
+    double elapsed = 0;
+    size_t offset = 0;
+    size_t frames = 0;
+    int used;
+
+    printf("%12s  %-2s  %4s  frame\n", "ms", "", "len");
+
+    while ((used = capture_parse(&dump[offset], len - offset, &record)) > 0)
+    {
+        if (frames++ == 0)
+        {
+            last = record.timestamp;
+        }
+
+        /*  Differences are wrap safe, the absolute count isn't */
+        elapsed += (uint32_t) (record.timestamp - last);
+        last = record.timestamp;
+
+        printf("%12.3f  %s  %4u  ", elapsed * 1000.0 / hz, (record.dir == CAPTURE_TX) ? "TX" : "RX", record.len);
+        for (size_t index = 0; index < record.captured; ++index)
+        {
+            putchar(isprint(record.data[index]) ? record.data[index] : '.');
+        }
+        printf("%s\n", (record.captured < record.len) ? "..." : "");
+
+        offset += used;
+    }
+
+    if (offset != len)
+    {
+        fprintf(stderr, "%zu trailing bytes, dump cut short?\n", len - offset);
+    }
+}
+
+int main(void)
+{
+    char line[LINE_SIZE];
+    unsigned long hz = 0;
+    unsigned long records;
+    unsigned long overwritten;
+    bool in_dump = false;
+    size_t len = 0;
+
+    while (fgets(line, sizeof(line), stdin))
+    {
+        const char *start = strstr(line, "capture ");
+
+        if (start && sscanf(start, "capture %lu Hz, %lu records, %lu overwritten", &hz, &records, &overwritten) == 3)
+        {
+            printf("%lu records, %lu overwritten before this dump, %lu Hz clock\n", records, overwritten, hz);
+            in_dump = true;
+            len = 0;
+            continue;
+        }
+
+        if (!in_dump)
+        {
+            continue;
+        }
+
+        if (start && strncmp(start, "capture end", 11) == 0)
+        {
+            print_timeline(len, hz ? hz : 1);
+            in_dump = false;
+            continue;
+        }
+
+        len += append_hex(line, len);
+    }
+
+    if (in_dump)
+    {
+        fprintf(stderr, "no \"capture end\", decoding what there is\n");
+        print_timeline(len, hz ? hz : 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Latency probe. Pings the dongle at a low rate and prints the round
+ * trip, the per hop one way estimates and the time spent in the dongle
+ * every so often. Safe to run next to the real traffic on another
+ * client, it is one small frame per interval:
+ *
+ *   ./bbbled_ping /dev/ttyACM0 [interval_ms] [report_every]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bbbled_client.h"
+
+#define DEFAULT_INTERVAL_MS 1000
+#define DEFAULT_REPORT_EVERY 10
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_latency(const char *name, const struct bbbled_latency *latency)
+{
+    printf("  %-14s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", name,
+           latency->p50_us / 1e3, latency->p90_us / 1e3, latency->p99_us / 1e3, latency->max_us / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    static struct bbbled_client client;
+    struct bbbled_ping_report report;
+    unsigned interval_ms = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_INTERVAL_MS;
+    unsigned report_every = (argc > 3) ? strtoul(argv[3], NULL, 10) : DEFAULT_REPORT_EVERY;
+    unsigned long sent = 0;
+    int ret;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <tty> [interval_ms] [report_every]\n", argv[0]);
+        return 1;
+    }
+
+    ret = bbbled_client_open(&client, argv[1], NULL);
+    if (ret)
+    {
+        fprintf(stderr, "could not open %s [%d]\n", argv[1], ret);
+        return 1;
+    }
+
+    for (;;)
+    {
+        double next = now_s() + interval_ms / 1e3;
+
+        ret = bbbled_client_ping(&client);
+        if (ret < 0 && ret != -EAGAIN)
+        {
+            fprintf(stderr, "ping failed [%d]\n", ret);
+            break;
+        }
+        sent++;
+
+        while (now_s() < next)
+        {
+            ret = bbbled_client_poll(&client, (int) ((next - now_s()) * 1e3) + 1);
+            if (ret)
+            {
+                fprintf(stderr, "tty failed [%d]\n", ret);
+                goto out;
+            }
+        }
+
+        if (report_every && sent % report_every == 0)
+        {
+            bbbled_client_ping_report(&client, &report);
+            printf("%lu sent, %llu pongs, %llu lost, last %zu:\n", sent,
+                   (unsigned long long) client.stats.pongs,
+                   (unsigned long long) client.stats.failed, report.samples);
+            print_latency("round trip", &report.rtt);
+            print_latency("usb one way", &report.usb_one_way);
+            print_latency("peer one way", &report.peer_one_way);
+            print_latency("in dongle", &report.dongle);
+            fflush(stdout);
+        }
+    }
+
+out:
+    bbbled_client_close(&client);
+    return 1;
+}
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "standin.h"
+#include "ping.h"
+
+static void send_packet(struct standin *standin, struct protocol_pkt *pkt)
+{
+    uint8_t text[PROTOCOL_RECV_BUF_SIZE];
+    uint8_t frame[COBS_MAX_ENCODED_SIZE(sizeof(text)) + 1];
+
+    size_t len = serialise_packet(pkt, text, sizeof(text));
+    size_t written = 0;
+
+    len = framer_encode(standin->framing, text, len, frame, sizeof(frame));
+
+    while (written < len)
+    {
+        ssize_t ret = write(standin->slave_fd, frame + written, len - written);
+        if (ret < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            return;
+        }
+        written += ret;
+    }
+}
+
+static void reply(struct standin *standin, command_t command, uint16_t msg_num)
+{
+    struct protocol_pkt pkt = {
+        .command = command,
+        .msg_num = msg_num,
+    };
+
+    send_packet(standin, &pkt);
+}
+
+/*  Answer as a dongle with no peer link would, stamped with our clock */
+static void pong(struct standin *standin, const struct parsed_data *ping)
+{
+    struct protocol_pkt pkt = {
+        .command = COMMAND_PONG,
+        .num_params = ping->num_params,
+        .msg_num = standin->next_msg_num++,
+    };
+
+    memcpy(pkt.params, ping->params, ping->num_params * sizeof(ping->params[0]));
+    ping_stamp(pkt.params, &pkt.num_params, PING_RECEIVED, os_uptime_us());
+    ping_stamp(pkt.params, &pkt.num_params, PING_FORWARDED, os_uptime_us());
+    ping_stamp(pkt.params, &pkt.num_params, PING_ECHOED, os_uptime_us());
+    send_packet(standin, &pkt);
+}
+
+static void handle_frame(const uint8_t *frame, size_t len, void *user_data)
+{
+    struct standin *standin = (struct standin *) user_data;
+    struct parsed_data data = {0};
+    uint16_t msg_num = 0;
+
+    standin->frames++;
+
+    if (standin->silent)
+    {
+        return;
+    }
+
+    if (parse((char *) frame, len, &data, &msg_num))
+    {
+        reply(standin, COMMAND_NACK, UINT16_MAX);
+        return;
+    }
+
+    if (data.command == COMMAND_ACK || data.command == COMMAND_NACK)
+    {
+        return;
+    }
+
+    if (standin->drop_every && standin->frames % standin->drop_every == 0)
+    {
+        return;
+    }
+
+    if (standin->nack_every && standin->frames % standin->nack_every == 0)
+    {
+        reply(standin, COMMAND_NACK, UINT16_MAX);
+        return;
+    }
+
+    for (size_t index = 0; index < data.num_params; ++index)
+    {
+        if (data.params[index].key == KEY_TARGET)
+        {
+            standin->min_target = MIN(standin->min_target, data.params[index].value);
+            standin->max_target = MAX(standin->max_target, data.params[index].value);
+        }
+    }
+
+    if (standin->service_us)
+    {
+        usleep(standin->service_us);
+    }
+
+    reply(standin, COMMAND_ACK, msg_num);
+
+    if (data.command == COMMAND_PING)
+    {
+        pong(standin, &data);
+    }
+}
+
+static void *standin_thread(void *arg)
+{
+    struct standin *standin = (struct standin *) arg;
+    uint8_t buf[1024];
+    struct pollfd pfd = {.fd = standin->slave_fd, .events = POLLIN};
+
+    while (standin->running)
+    {
+        if (poll(&pfd, 1, 10) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t len = read(standin->slave_fd, buf, sizeof(buf));
+        if (len > 0)
+        {
+            framer_feed(&standin->framer, buf, len);
+        }
+    }
+
+    return NULL;
+}
+
+int standin_start(struct standin *standin, unsigned drop_every, unsigned nack_every, bool silent)
+{
+    return standin_start_framed(standin, drop_every, nack_every, silent, FRAMER_MODE_TEXT);
+}
+
+int standin_start_framed(struct standin *standin, unsigned drop_every, unsigned nack_every, bool silent, framer_mode_t framing)
+{
+    struct termios tio;
+
+    memset(standin, 0, sizeof(*standin));
+    standin->drop_every = drop_every;
+    standin->nack_every = nack_every;
+    standin->silent = silent;
+    standin->framing = framing;
+    standin->min_target = UINT16_MAX;
+
+    if (openpty(&standin->master_fd, &standin->slave_fd, NULL, NULL, NULL) < 0)
+    {
+        return -errno;
+    }
+
+    /*  No echo or line discipline, the dongle is a raw byte pipe */
+    tcgetattr(standin->slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(standin->slave_fd, TCSANOW, &tio);
+
+    framer_init(&standin->framer, handle_frame, standin);
+    framer_set_mode(&standin->framer, framing);
+
+    standin->running = true;
+    if (pthread_create(&standin->thread, NULL, standin_thread, standin))
+    {
+        close(standin->master_fd);
+        close(standin->slave_fd);
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+void standin_stop(struct standin *standin)
+{
+    standin->running = false;
+    pthread_join(standin->thread, NULL);
+    close(standin->slave_fd);
+}
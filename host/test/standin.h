@@ -0,0 +1,70 @@
+#ifndef _BBBLED_STANDIN_H
+#define _BBBLED_STANDIN_H
+
+#include <pthread.h>
+
+#include "protocol.h"
+#include "framer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A stand-in for the dongle on the other end of a pty. ACKs every
+ *        frame it can parse, optionally losing or NACKing some of them.
+ *        Answers pings as a dongle with no peer link would.
+ * @param   master_fd   :   pty master, hand this to the client
+ * @param   slave_fd    :   pty slave, served by the stand-in thread
+ * @param   drop_every  :   swallow every Nth frame without a reply (0 = never)
+ * @param   nack_every  :   NACK every Nth frame instead of ACKing it (0 = never)
+ * @param   silent      :   never reply at all
+ * @param   framing     :   how frames are delimited on the pty
+ * @param   service_us  :   time spent on each frame before replying, to
+ *                          stand in for a link with a fixed budget
+ * @param   frames      :   frames received
+ * @param   min_target  :   lowest target param seen (UINT16_MAX if none)
+ * @param   max_target  :   highest target param seen
+ * @param   next_msg_num:   msg number for the next pong
+ */
+struct standin {
+    int master_fd;
+    int slave_fd;
+    unsigned drop_every;
+    unsigned nack_every;
+    bool silent;
+    framer_mode_t framing;
+    unsigned service_us;
+    volatile bool running;
+    unsigned long frames;
+    uint16_t min_target;
+    uint16_t max_target;
+    uint16_t next_msg_num;
+    struct framer framer;
+    pthread_t thread;
+};
+
+/**
+ * @brief   Open a pty pair and start serving the slave side
+ *
+ * @retval  0 on success
+ * @retval  -errno on failure
+ */
+int standin_start(struct standin *standin, unsigned drop_every, unsigned nack_every, bool silent);
+
+/**
+ * @brief   As standin_start(), with the given framing
+ */
+int standin_start_framed(struct standin *standin, unsigned drop_every, unsigned nack_every, bool silent, framer_mode_t framing);
+
+/**
+ * @brief   Stop the thread and close the slave side. The master fd
+ *          belongs to whoever it was handed to.
+ */
+void standin_stop(struct standin *standin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_STANDIN_H */
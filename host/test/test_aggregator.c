@@ -0,0 +1,300 @@
+/*
+ * Tests for the multi-dongle aggregator, each dongle a stand-in on its
+ * own pty. The stand-ins take a fixed time per frame, like a link with a
+ * fixed budget, so throughput should grow with the number of dongles.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bbbled_aggregator.h"
+#include "standin.h"
+
+#define NUM_REQUESTS 2000
+#define SERVICE_US 200
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static void on_done(struct bbbled_client *client, uint16_t msg_num, int status, void *user_data)
+{
+    unsigned *ok = (unsigned *) user_data;
+
+    if (status == 0)
+    {
+        (*ok)++;
+    }
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void start(struct bbbled_aggregator *agg, struct standin *standins, size_t count, unsigned service_us)
+{
+    int fds[BBBLED_AGGREGATOR_MAX_DONGLES];
+
+    for (size_t index = 0; index < count; ++index)
+    {
+        CHECK(standin_start(&standins[index], 0, 0, false) == 0);
+        standins[index].service_us = service_us;
+        fds[index] = standins[index].master_fd;
+    }
+
+    CHECK(bbbled_aggregator_attach(agg, fds, count, NULL) == 0);
+}
+
+static void stop(struct bbbled_aggregator *agg, struct standin *standins, size_t count)
+{
+    bbbled_aggregator_close(agg);
+
+    for (size_t index = 0; index < count; ++index)
+    {
+        standin_stop(&standins[index]);
+    }
+}
+
+/*  Submit count commands, with targets 0..num_targets-1 in turn, or none
+    if num_targets is 0 */
+static unsigned pump(bbbled_aggregator_t agg, unsigned count, unsigned num_targets)
+{
+    struct key_val_pair params[] = {
+        {.key = KEY_RED, .value = 255},
+        {.key = KEY_GREEN, .value = 128},
+        {.key = KEY_BLUE, .value = 0},
+        {.key = KEY_TARGET, .value = 0},
+    };
+    size_t num_params = num_targets ? ARRAY_SIZE(params) : ARRAY_SIZE(params) - 1;
+    unsigned ok = 0;
+
+    for (unsigned sent = 0; sent < count;)
+    {
+        params[2].value = sent & 0xFF;
+        params[3].value = num_targets ? sent % num_targets : 0;
+
+        int ret = bbbled_aggregator_submit(agg, COMMAND_SET_RGB, params, num_params, on_done, &ok);
+        if (ret == -EAGAIN)
+        {
+            CHECK(bbbled_aggregator_poll(agg, 100) == 0);
+            continue;
+        }
+        CHECK(ret >= 0);
+        sent++;
+    }
+
+    CHECK(bbbled_aggregator_drain(agg, 10000) == 0);
+    return ok;
+}
+
+static void test_routing(void)
+{
+    struct bbbled_aggregator agg;
+    struct standin standins[3];
+    struct bbbled_aggregator_stats stats;
+
+    start(&agg, standins, 3, 0);
+
+    CHECK(bbbled_aggregator_route(&agg, 0, 9, 2) == 0);
+    CHECK(bbbled_aggregator_route(&agg, 10, 19, 0) == 0);
+    CHECK(bbbled_aggregator_route(&agg, 20, 29, 1) == 0);
+    CHECK(bbbled_aggregator_route(&agg, 5, 4, 1) == -EINVAL);
+    CHECK(bbbled_aggregator_route(&agg, 0, 1, 3) == -EINVAL);
+
+    CHECK(pump(&agg, 300, 30) == 300);
+
+    // Each stand-in only ever saw its own targets
+    CHECK(standins[2].min_target == 0 && standins[2].max_target == 9);
+    CHECK(standins[0].min_target == 10 && standins[0].max_target == 19);
+    CHECK(standins[1].min_target == 20 && standins[1].max_target == 29);
+
+    bbbled_aggregator_stats(&agg, &stats);
+    CHECK(stats.routed[0] == 100 && stats.routed[1] == 100 && stats.routed[2] == 100);
+    CHECK(stats.total.submitted == 300);
+    CHECK(stats.total.completed == 300);
+    CHECK(stats.total.completed == agg.clients[0].stats.completed
+          + agg.clients[1].stats.completed + agg.clients[2].stats.completed);
+    CHECK(stats.total.bytes_tx == agg.clients[0].stats.bytes_tx
+          + agg.clients[1].stats.bytes_tx + agg.clients[2].stats.bytes_tx);
+
+    stop(&agg, standins, 3);
+}
+
+static void test_unrouted_targets(void)
+{
+    struct bbbled_aggregator agg;
+    struct standin standins[4];
+
+    start(&agg, standins, 4, 0);
+
+    CHECK(pump(&agg, 400, 16) == 400);
+
+    // Without routes, target % dongles
+    for (size_t index = 0; index < 4; ++index)
+    {
+        CHECK(agg.routed[index] == 100);
+        CHECK(standins[index].min_target == index);
+        CHECK(standins[index].max_target == 12 + index);
+    }
+
+    stop(&agg, standins, 4);
+}
+
+static void test_balanced(void)
+{
+    struct bbbled_aggregator agg;
+    struct standin standins[4];
+
+    start(&agg, standins, 4, SERVICE_US);
+
+    CHECK(pump(&agg, NUM_REQUESTS, 0) == NUM_REQUESTS);
+
+    // Commands without a target go wherever is least busy, all equally quick
+    for (size_t index = 0; index < 4; ++index)
+    {
+        CHECK(agg.routed[index] > NUM_REQUESTS / 8);
+        CHECK(standins[index].min_target == UINT16_MAX);
+    }
+
+    stop(&agg, standins, 4);
+}
+
+static double throughput(size_t count)
+{
+    struct bbbled_aggregator agg;
+    struct standin standins[BBBLED_AGGREGATOR_MAX_DONGLES];
+
+    start(&agg, standins, count, SERVICE_US);
+
+    double begin = now_s();
+    CHECK(pump(&agg, NUM_REQUESTS, 64) == NUM_REQUESTS);
+    double rate = NUM_REQUESTS / (now_s() - begin);
+
+    printf("%zu dongle(s): %.0f req/s\n", count, rate);
+
+    stop(&agg, standins, count);
+    return rate;
+}
+
+static void test_scaling(void)
+{
+    double one = throughput(1);
+    double two = throughput(2);
+    double four = throughput(4);
+
+    // Roughly linear, with slack for a busy build machine
+    CHECK(two > 1.6 * one);
+    CHECK(four > 2.5 * one);
+}
+
+static void test_palette(void)
+{
+    struct bbbled_aggregator agg;
+    struct standin standins[3];
+    struct rgb colours[16];
+    uint8_t indices[PALETTE_MAX_PER_FRAME];
+    unsigned ok = 0;
+
+    for (size_t index = 0; index < ARRAY_SIZE(colours); ++index)
+    {
+        colours[index] = (struct rgb) {.red = index, .green = 0, .blue = 255 - index};
+    }
+    memset(indices, 3, sizeof(indices));
+
+    start(&agg, standins, 3, 0);
+    CHECK(bbbled_aggregator_route(&agg, 0, 99, 0) == 0);
+    CHECK(bbbled_aggregator_route(&agg, 100, 199, 1) == 0);
+    CHECK(bbbled_aggregator_route(&agg, 200, 299, 2) == 0);
+
+    // Every dongle gets every entry
+    CHECK(bbbled_aggregator_upload_palette(&agg, colours, ARRAY_SIZE(colours), 5000) == 0);
+    for (size_t index = 0; index < 3; ++index)
+    {
+        CHECK(standins[index].frames == ARRAY_SIZE(colours));
+    }
+    CHECK(bbbled_aggregator_upload_palette(&agg, colours, PALETTE_MAX_ENTRIES + 1, 5000) == -EINVAL);
+
+    // Inside one route, one frame
+    CHECK(bbbled_aggregator_set_indexed(&agg, 10, indices, PALETTE_MAX_PER_FRAME, on_done, &ok) == 1);
+    // Across a route boundary, a frame for each side
+    CHECK(bbbled_aggregator_set_indexed(&agg, 195, indices, PALETTE_MAX_PER_FRAME, on_done, &ok) == 2);
+    CHECK(bbbled_aggregator_drain(&agg, 5000) == 0);
+    CHECK(ok == 3);
+
+    CHECK(standins[0].frames == ARRAY_SIZE(colours) + 1);
+    CHECK(standins[1].frames == ARRAY_SIZE(colours) + 1);
+    CHECK(standins[2].frames == ARRAY_SIZE(colours) + 1);
+    CHECK(standins[1].min_target == 195 && standins[1].max_target == 195);
+    CHECK(standins[2].min_target == 200 && standins[2].max_target == 200);
+
+    CHECK(bbbled_aggregator_set_indexed(&agg, 0, indices, 0, NULL, NULL) == -EINVAL);
+    CHECK(bbbled_aggregator_set_indexed(&agg, 0, indices, PALETTE_MAX_PER_FRAME + 1, NULL, NULL) == -EINVAL);
+    CHECK(bbbled_aggregator_set_indexed(&agg, UINT16_MAX - 2, indices, 4, NULL, NULL) == -EINVAL);
+
+    stop(&agg, standins, 3);
+
+    // Unrouted, neighbours are on different dongles
+    start(&agg, standins, 2, 0);
+    CHECK(bbbled_aggregator_set_indexed(&agg, 0, indices, 4, NULL, NULL) == 4);
+    CHECK(bbbled_aggregator_drain(&agg, 5000) == 0);
+    CHECK(standins[0].frames == 2 && standins[1].frames == 2);
+    stop(&agg, standins, 2);
+}
+
+/*  A dongle that isn't there fails the open, and closes nothing it
+    doesn't own on the way out */
+static void test_missing_tty(void)
+{
+    const char *last_missing[] = {"/dev/null", "/nonexistent/tty"};
+    const char *first_missing[] = {"/nonexistent/tty", "/dev/null"};
+    struct bbbled_aggregator agg;
+
+    // Make sure there is an fd 0 to lose
+    if (fcntl(0, F_GETFD) < 0)
+    {
+        CHECK(open("/dev/null", O_RDONLY) == 0);
+    }
+
+    CHECK(bbbled_aggregator_open(&agg, last_missing, 2, NULL) == -ENOENT);
+    CHECK(agg.clients == NULL);
+    CHECK(fcntl(0, F_GETFD) >= 0);
+
+    CHECK(bbbled_aggregator_open(&agg, first_missing, 2, NULL) == -ENOENT);
+    CHECK(agg.clients == NULL);
+    CHECK(fcntl(0, F_GETFD) >= 0);
+}
+
+int main(void)
+{
+    test_routing();
+    test_unrouted_targets();
+    test_balanced();
+    test_scaling();
+    test_palette();
+    test_missing_tty();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("all aggregator tests passed\n");
+    return 0;
+}
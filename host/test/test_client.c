@@ -0,0 +1,450 @@
+/*
+ * End to end tests for the host client, run against a stand-in dongle on
+ * a pty. Set BBBLED_TTY to run the pipelined test against a real device
+ * (or the native_sim firmware's pty) instead.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bbbled_client.h"
+#include "standin.h"
+
+#define NUM_REQUESTS 2000
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+struct results {
+    unsigned ok;
+    unsigned timed_out;
+};
+
+static void on_done(struct bbbled_client *client, uint16_t msg_num, int status, void *user_data)
+{
+    struct results *results = (struct results *) user_data;
+
+    if (status == 0)
+    {
+        results->ok++;
+    }
+    else if (status == -ETIMEDOUT)
+    {
+        results->timed_out++;
+    }
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Keep the window full until every request has been submitted */
+static void pump(bbbled_client_t client, unsigned count, struct results *results)
+{
+    struct key_val_pair params[] = {
+        {.key = KEY_RED, .value = 255},
+        {.key = KEY_GREEN, .value = 128},
+        {.key = KEY_BLUE, .value = 0},
+    };
+
+    for (unsigned sent = 0; sent < count;)
+    {
+        params[2].value = sent & 0xFF;
+
+        int ret = bbbled_client_submit(client, COMMAND_SET_RGB, params, ARRAY_SIZE(params), on_done, results);
+        if (ret == -EAGAIN)
+        {
+            CHECK(bbbled_client_poll(client, 100) == 0);
+            continue;
+        }
+        CHECK(ret >= 0);
+        sent++;
+    }
+
+    CHECK(bbbled_client_drain(client, 10000) == 0);
+}
+
+static void test_pipelined(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct results results = {0};
+    const char *tty = getenv("BBBLED_TTY");
+
+    if (tty)
+    {
+        CHECK(bbbled_client_open(client, tty, NULL) == 0);
+    }
+    else
+    {
+        CHECK(standin_start(&standin, 0, 0, false) == 0);
+        CHECK(bbbled_client_attach(client, standin.master_fd, NULL) == 0);
+    }
+
+    double start = now_s();
+    pump(client, NUM_REQUESTS, &results);
+    double elapsed = now_s() - start;
+
+    CHECK(results.ok == NUM_REQUESTS);
+    CHECK(client->stats.completed == NUM_REQUESTS);
+    if (!tty)
+    {
+        CHECK(client->stats.retransmits == 0);
+    }
+
+    printf("pipelined: %u requests in %.3f s, %.0f req/s, %.1f KB/s tx\n",
+           NUM_REQUESTS, elapsed, NUM_REQUESTS / elapsed,
+           client->stats.bytes_tx / 1024.0 / elapsed);
+
+    bbbled_client_close(client);
+    if (!tty)
+    {
+        standin_stop(&standin);
+    }
+    free(client);
+}
+
+static void test_lossy(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct bbbled_client_config config;
+    struct results results = {0};
+
+    bbbled_client_config_default(&config);
+    config.timeout_ms = 20;
+
+    CHECK(standin_start(&standin, 7, 0, false) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, &config) == 0);
+
+    pump(client, 500, &results);
+
+    CHECK(results.ok == 500);
+    CHECK(results.timed_out == 0);
+    CHECK(client->stats.retransmits > 0);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+static void test_nack(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct bbbled_client_config config;
+    struct results results = {0};
+
+    bbbled_client_config_default(&config);
+    config.timeout_ms = 20;
+    config.window = 1;
+
+    CHECK(standin_start(&standin, 0, 5, false) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, &config) == 0);
+
+    pump(client, 100, &results);
+
+    CHECK(results.ok == 100);
+    CHECK(client->stats.nacks > 0);
+    /*  With one request in flight a NACK always names the right frame */
+    CHECK(client->stats.retransmits == client->stats.nacks);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+static void test_dead_peer(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct bbbled_client_config config;
+    struct results results = {0};
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 1}};
+
+    bbbled_client_config_default(&config);
+    config.timeout_ms = 10;
+    config.max_retries = 2;
+
+    CHECK(standin_start(&standin, 0, 0, true) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, &config) == 0);
+
+    CHECK(bbbled_client_submit(client, COMMAND_SET_RGB, params, 1, on_done, &results) >= 0);
+    CHECK(bbbled_client_drain(client, 1000) == 0);
+
+    CHECK(results.timed_out == 1);
+    CHECK(client->stats.retransmits == 2);
+    CHECK(client->stats.failed == 1);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+/* Send a frame straight down the peer's end of a socketpair */
+static void peer_send(int fd, command_t command, uint16_t msg_num)
+{
+    struct protocol_pkt pkt = {.command = command, .msg_num = msg_num};
+    uint8_t text[PROTOCOL_RECV_BUF_SIZE];
+    size_t len = serialise_packet(&pkt, text, sizeof(text));
+
+    CHECK(write(fd, text, len) == (ssize_t) len);
+}
+
+static void test_tx_full(void)
+{
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct bbbled_client_config config;
+    struct results results = {0};
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 1}};
+    uint8_t junk[4096];
+    int fds[2];
+    int msg_num;
+    double start;
+
+    bbbled_client_config_default(&config);
+    config.timeout_ms = 5000;
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CHECK(bbbled_client_attach(client, fds[0], &config) == 0);
+
+    msg_num = bbbled_client_submit(client, COMMAND_SET_RGB, params, 1, on_done, &results);
+    CHECK(msg_num >= 0);
+
+    /*  The peer isn't reading, fill the socket and then the client's own buffer */
+    memset(junk, 'x', sizeof(junk));
+    while (write(fds[0], junk, sizeof(junk)) > 0)
+    {
+    }
+    memset(client->tx_buf + client->tx_head, 'x', BBBLED_CLIENT_TX_BUF_SIZE - client->tx_head);
+    client->tx_head = BBBLED_CLIENT_TX_BUF_SIZE;
+
+    /*  No room for the retransmission, it waits rather than being lost */
+    start = now_s();
+    peer_send(fds[1], COMMAND_NACK, UINT16_MAX);
+    CHECK(bbbled_client_poll(client, 100) == 0);
+    CHECK(client->stats.nacks == 1);
+    CHECK(client->stats.retransmits == 0);
+    CHECK(results.ok == 0);
+
+    /*  The peer catches up, the frame goes out well before its deadline */
+    while (!client->stats.retransmits && now_s() - start < 1.0)
+    {
+        while (recv(fds[1], junk, sizeof(junk), MSG_DONTWAIT) > 0)
+        {
+        }
+        CHECK(bbbled_client_poll(client, 10) == 0);
+    }
+    CHECK(client->stats.retransmits == 1);
+
+    peer_send(fds[1], COMMAND_ACK, msg_num);
+    CHECK(bbbled_client_drain(client, 1000) == 0);
+    CHECK(results.ok == 1);
+    CHECK(results.timed_out == 0);
+    CHECK(now_s() - start < 1.0);
+
+    bbbled_client_close(client);
+    close(fds[1]);
+    free(client);
+}
+
+static void test_cobs(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct bbbled_client_config config;
+    struct results results = {0};
+
+    bbbled_client_config_default(&config);
+    config.framing = FRAMER_MODE_COBS;
+
+    CHECK(standin_start_framed(&standin, 0, 0, false, FRAMER_MODE_COBS) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, &config) == 0);
+
+    pump(client, 500, &results);
+
+    CHECK(results.ok == 500);
+    CHECK(client->stats.retransmits == 0);
+    CHECK(client->framer.corrupt == 0);
+    CHECK(standin.framer.corrupt == 0);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+static void test_invalid(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 256}};
+
+    CHECK(standin_start(&standin, 0, 0, false) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, NULL) == 0);
+
+    CHECK(bbbled_client_submit(client, COMMAND_SET_RGB, params, 1, NULL, NULL) == -EINVAL);
+    CHECK(bbbled_client_submit(client, NUM_COMMANDS, NULL, 0, NULL, NULL) == -EINVAL);
+    CHECK(bbbled_client_in_flight(client) == 0);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+static void test_ping(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct bbbled_ping_report report;
+    double deadline;
+
+    CHECK(standin_start(&standin, 0, 0, false) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, NULL) == 0);
+
+    bbbled_client_ping_report(client, &report);
+    CHECK(report.samples == 0);
+
+    for (unsigned sent = 0; sent < 20; ++sent)
+    {
+        CHECK(bbbled_client_ping(client) >= 0);
+    }
+    CHECK(bbbled_client_drain(client, 5000) == 0);
+
+    /*  Pongs follow their ACKs, give the last few time to arrive */
+    deadline = now_s() + 5;
+    while (client->stats.pongs < 20 && now_s() < deadline)
+    {
+        CHECK(bbbled_client_poll(client, 10) == 0);
+    }
+
+    bbbled_client_ping_report(client, &report);
+    CHECK(report.samples == 20);
+    CHECK(report.rtt.max_us > 0);
+    CHECK(report.rtt.p50_us <= report.rtt.p99_us);
+    CHECK(report.usb_one_way.max_us <= report.rtt.max_us);
+    // No peer link behind the stand-in
+    CHECK(report.peer_one_way.max_us == 0);
+    CHECK(client->stats.invalid_params == 0);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+static void test_palette(void)
+{
+    struct standin standin;
+    struct bbbled_client *client = calloc(1, sizeof(*client));
+    struct results results = {0};
+    struct rgb colours[16];
+    uint8_t indices[PALETTE_MAX_PER_FRAME];
+    uint64_t rgb_bytes;
+    uint64_t indexed_bytes;
+
+    CHECK(standin_start(&standin, 0, 0, false) == 0);
+    CHECK(bbbled_client_attach(client, standin.master_fd, NULL) == 0);
+
+    for (size_t index = 0; index < ARRAY_SIZE(colours); ++index)
+    {
+        colours[index] = (struct rgb) {.red = index * 16, .green = 255 - index, .blue = 128};
+    }
+    CHECK(bbbled_client_upload_palette(client, colours, ARRAY_SIZE(colours), 5000) == 0);
+    CHECK(client->stats.completed == ARRAY_SIZE(colours));
+    CHECK(bbbled_client_upload_palette(client, colours, PALETTE_MAX_ENTRIES + 1, 5000) == -EINVAL);
+
+    /*  The same 120 LEDs as set_rgb, then as set_idx */
+    rgb_bytes = client->stats.bytes_tx;
+    for (uint16_t led = 0; led < 120;)
+    {
+        struct key_val_pair params[] = {
+            {.key = KEY_RED, .value = colours[led % 16].red},
+            {.key = KEY_GREEN, .value = colours[led % 16].green},
+            {.key = KEY_BLUE, .value = colours[led % 16].blue},
+            {.key = KEY_TARGET, .value = led},
+        };
+
+        int ret = bbbled_client_submit(client, COMMAND_SET_RGB, params, ARRAY_SIZE(params), on_done, &results);
+        if (ret == -EAGAIN)
+        {
+            CHECK(bbbled_client_poll(client, 100) == 0);
+            continue;
+        }
+        CHECK(ret >= 0);
+        led++;
+    }
+    CHECK(bbbled_client_drain(client, 5000) == 0);
+    rgb_bytes = client->stats.bytes_tx - rgb_bytes;
+
+    indexed_bytes = client->stats.bytes_tx;
+    for (uint16_t led = 0; led < 120;)
+    {
+        for (size_t index = 0; index < PALETTE_MAX_PER_FRAME; ++index)
+        {
+            indices[index] = (led + index) % 16;
+        }
+
+        int ret = bbbled_client_set_indexed(client, led, indices, PALETTE_MAX_PER_FRAME, on_done, &results);
+        if (ret == -EAGAIN)
+        {
+            CHECK(bbbled_client_poll(client, 100) == 0);
+            continue;
+        }
+        CHECK(ret >= 0);
+        led += PALETTE_MAX_PER_FRAME;
+    }
+    CHECK(bbbled_client_drain(client, 5000) == 0);
+    indexed_bytes = client->stats.bytes_tx - indexed_bytes;
+
+    CHECK(results.ok == 120 + 10);
+    CHECK(client->stats.nacks == 0);
+    CHECK(bbbled_client_set_indexed(client, 0, indices, 0, NULL, NULL) == -EINVAL);
+    CHECK(bbbled_client_set_indexed(client, 0, indices, PALETTE_MAX_PER_FRAME + 1, NULL, NULL) == -EINVAL);
+
+    printf("palette: 120 LEDs in %llu B as set_rgb, %llu B as set_idx, %.1fx less\n",
+           (unsigned long long) rgb_bytes, (unsigned long long) indexed_bytes,
+           (double) rgb_bytes / indexed_bytes);
+    CHECK(rgb_bytes > 3 * indexed_bytes);
+
+    bbbled_client_close(client);
+    standin_stop(&standin);
+    free(client);
+}
+
+int main(void)
+{
+    test_pipelined();
+    test_lossy();
+    test_nack();
+    test_dead_peer();
+    test_tx_full();
+    test_cobs();
+    test_invalid();
+    test_ping();
+    test_palette();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("all client tests passed\n");
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Every vector kernel this machine can run against the scalar one, over
+ * every length a frame can have, at every alignment.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os_simd.h"
+#include "protocol.h"
+#include "framer.h"
+
+#define MAX_LEN 600
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static uint8_t buffer[MAX_LEN + 64];
+
+static void fill(unsigned seed)
+{
+    srand(seed);
+    for (size_t index = 0; index < sizeof(buffer); ++index)
+    {
+        buffer[index] = (uint8_t) rand();
+    }
+}
+
+static void test_crc(os_simd_t level)
+{
+    uint16_t expected[MAX_LEN + 1];
+
+    fill(1);
+
+    for (size_t offset = 0; offset < 16; ++offset)
+    {
+        os_simd_select(OS_SIMD_SCALAR);
+        for (size_t len = 0; len <= MAX_LEN; ++len)
+        {
+            expected[len] = os_crc16_ccitt(0xffff - len, buffer + offset, len);
+        }
+
+        os_simd_select(level);
+        for (size_t len = 0; len <= MAX_LEN; ++len)
+        {
+            CHECK(os_crc16_ccitt(0xffff - len, buffer + offset, len) == expected[len]);
+        }
+    }
+
+    /*  The check value for "123456789" with Zephyr's seed of 0 */
+    memcpy(buffer, "123456789123456789123456789123456789", 36);
+    os_simd_select(OS_SIMD_SCALAR);
+    uint16_t scalar = os_crc16_ccitt(0, buffer, 36);
+    os_simd_select(level);
+    CHECK(os_crc16_ccitt(0, buffer, 9) == 0x2189);
+    CHECK(os_crc16_ccitt(0, buffer, 36) == scalar);
+}
+
+static void test_find(os_simd_t level)
+{
+    fill(2);
+
+    /*  No delimiters anywhere, then one at each position in turn */
+    for (size_t index = 0; index < sizeof(buffer); ++index)
+    {
+        if (buffer[index] == ',' || buffer[index] == '#')
+        {
+            buffer[index] = 'x';
+        }
+    }
+
+    os_simd_select(level);
+
+    for (size_t offset = 0; offset < 32; ++offset)
+    {
+        for (size_t len = 0; len <= MAX_LEN; ++len)
+        {
+            CHECK(os_find_delim(buffer + offset, len, ',', '#') == len);
+        }
+    }
+
+    for (size_t at = 0; at < MAX_LEN; ++at)
+    {
+        for (size_t offset = 0; offset < 3; ++offset)
+        {
+            uint8_t saved = buffer[offset + at];
+
+            buffer[offset + at] = (at & 1) ? ',' : '#';
+            CHECK(os_find_delim(buffer + offset, MAX_LEN, ',', '#') == at);
+            CHECK(os_find_delim(buffer + offset, at, ',', '#') == at);
+            // Only ever the first
+            buffer[offset + MAX_LEN - 1] = ',';
+            CHECK(os_find_delim(buffer + offset, MAX_LEN, ',', '#') == at);
+            buffer[offset + MAX_LEN - 1] = 'x';
+            buffer[offset + at] = saved;
+        }
+    }
+
+    /*  Bytes with the top bit set are not matches */
+    memset(buffer, 0xac, 64);
+    CHECK(os_find_delim(buffer, 64, ',', ',') == 64);
+    buffer[40] = 0x2c;
+    CHECK(os_find_delim(buffer, 64, ',', ',') == 40);
+}
+
+struct frames {
+    unsigned count;
+    uint16_t last_msg_num;
+};
+
+static void on_frame(const uint8_t *frame, size_t len, void *user_data)
+{
+    struct frames *frames = (struct frames *) user_data;
+    struct parsed_data parsed = {0};
+    uint16_t msg_num = 0;
+
+    if (parse((char *) frame, len, &parsed, &msg_num) == 0)
+    {
+        frames->count++;
+        frames->last_msg_num = msg_num;
+    }
+}
+
+/*  The framer and parser on top of the kernels, fed in awkward pieces */
+static void test_stream(os_simd_t level)
+{
+    struct protocol_pkt pkt = {
+        .command = COMMAND_SET_RGB,
+        .params = {
+            {.key = KEY_RED, .value = 255},
+            {.key = KEY_GREEN, .value = 128},
+            {.key = KEY_BLUE, .value = 7},
+            {.key = KEY_TARGET, .value = 1234},
+        },
+        .num_params = 4,
+    };
+    static uint8_t stream[64 * PROTOCOL_RECV_BUF_SIZE];
+    static struct framer framer;
+    struct frames frames = {0};
+    size_t len = 0;
+
+    os_simd_select(level);
+
+    for (uint16_t msg_num = 0; msg_num < 64; ++msg_num)
+    {
+        pkt.msg_num = msg_num;
+        // Line noise between some of them
+        if (msg_num % 3 == 0)
+        {
+            memcpy(stream + len, "noise#12", 8);
+            len += 8;
+        }
+        len += serialise_packet(&pkt, stream + len, sizeof(stream) - len);
+    }
+
+    for (size_t chunk = 1; chunk < 70; chunk += 7)
+    {
+        memset(&frames, 0, sizeof(frames));
+        framer_init(&framer, on_frame, &frames);
+
+        for (size_t pos = 0; pos < len; pos += chunk)
+        {
+            framer_feed(&framer, stream + pos, MIN(chunk, len - pos));
+        }
+
+        CHECK(frames.count == 64);
+        CHECK(frames.last_msg_num == 63);
+    }
+}
+
+int main(void)
+{
+    for (os_simd_t level = OS_SIMD_SCALAR; level < OS_SIMD_NUM_LEVELS; ++level)
+    {
+        if (!os_simd_supported(level))
+        {
+            CHECK(os_simd_select(level) == -ENOTSUP);
+            continue;
+        }
+
+        CHECK(os_simd_select(level) == 0);
+        printf("%s: vector crc %s\n", os_simd_name(level), os_simd_has_crc() ? "yes" : "no");
+
+        test_crc(level);
+        test_find(level);
+        test_stream(level);
+    }
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("all simd tests passed\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "capture.h"
+
+LOG_MODULE_REGISTER(bbbled_capture, LOG_LEVEL_DBG);
+
+/*  Copy into the ring at offset, wrapping at the end */
+static void ring_put(capture_t capture, size_t offset, const uint8_t *src, size_t len)
+{
+    size_t first = MIN(len, capture->size - offset);
+
+    memcpy(&capture->buf[offset], src, first);
+    memcpy(capture->buf, &src[first], len - first);
+}
+
+static void ring_get(capture_t capture, size_t offset, uint8_t *dest, size_t len)
+{
+    size_t first = MIN(len, capture->size - offset);
+
+    memcpy(dest, &capture->buf[offset], first);
+    memcpy(&dest[first], capture->buf, len - first);
+}
+
+/*  Size of the record at the tail. Caller holds the lock */
+static size_t tail_record_size(capture_t capture)
+{
+    uint8_t header[CAPTURE_HEADER_SIZE];
+
+    ring_get(capture, capture->tail, header, sizeof(header));
+    return CAPTURE_HEADER_SIZE + header[6];
+}
+
+static void drop_tail(capture_t capture, size_t record_size)
+{
+    capture->tail = (capture->tail + record_size) % capture->size;
+    capture->used -= record_size;
+}
+
+void capture_init(capture_t capture, uint8_t *buf, size_t size, uint8_t snaplen)
+{
+    __ASSERT(capture, "Invalid capture ptr");
+    __ASSERT(size >= CAPTURE_HEADER_SIZE + snaplen, "Capture buffer too small");
+
+    capture->buf = buf;
+    capture->size = size;
+    capture->snaplen = snaplen;
+    os_lock_init(&capture->lock);
+    capture_clear(capture);
+}
+
+void capture_record(capture_t capture, capture_dir_t dir, const uint8_t *frame, size_t len)
+{
+    uint8_t captured = MIN(len, capture->snaplen);
+    size_t record_size = CAPTURE_HEADER_SIZE + captured;
+    uint32_t timestamp = os_cycles();
+    uint16_t len_dir = MIN(len, CAPTURE_LEN_TX - 1) | ((dir == CAPTURE_TX) ? CAPTURE_LEN_TX : 0);
+    uint8_t header[CAPTURE_HEADER_SIZE] = {
+        timestamp & 0xff,
+        (timestamp >> 8) & 0xff,
+        (timestamp >> 16) & 0xff,
+        (timestamp >> 24) & 0xff,
+        len_dir & 0xff,
+        len_dir >> 8,
+        captured,
+    };
+    os_lock_key_t key = os_lock(&capture->lock);
+
+    /*  Newest wins, make room by dropping the oldest */
+    while (capture->size - capture->used < record_size)
+    {
+        drop_tail(capture, tail_record_size(capture));
+        capture->stats.overwritten++;
+    }
+
+    ring_put(capture, capture->head, header, sizeof(header));
+    ring_put(capture, (capture->head + sizeof(header)) % capture->size, frame, captured);
+    capture->head = (capture->head + record_size) % capture->size;
+    capture->used += record_size;
+    capture->stats.records++;
+
+    os_unlock(&capture->lock, key);
+}
+
+size_t capture_read(capture_t capture, uint8_t *dest, size_t dest_size)
+{
+    size_t copied = 0;
+    os_lock_key_t key = os_lock(&capture->lock);
+
+    while (capture->used)
+    {
+        size_t record_size = tail_record_size(capture);
+
+        if (copied + record_size > dest_size)
+        {
+            break;
+        }
+
+        ring_get(capture, capture->tail, &dest[copied], record_size);
+        drop_tail(capture, record_size);
+        copied += record_size;
+    }
+
+    os_unlock(&capture->lock, key);
+
+    return copied;
+}
+
+void capture_clear(capture_t capture)
+{
+    os_lock_key_t key = os_lock(&capture->lock);
+
+    capture->head = 0;
+    capture->tail = 0;
+    capture->used = 0;
+    memset(&capture->stats, 0, sizeof(capture->stats));
+
+    os_unlock(&capture->lock, key);
+}
+
+void capture_stats_get(capture_t capture, struct capture_stats *stats)
+{
+    os_lock_key_t key = os_lock(&capture->lock);
+
+    *stats = capture->stats;
+
+    os_unlock(&capture->lock, key);
+}
+
+int capture_parse(const uint8_t *buf, size_t len, struct capture_record *record)
+{
+    uint16_t len_dir;
+
+    if (len < CAPTURE_HEADER_SIZE || len < (size_t) CAPTURE_HEADER_SIZE + buf[6])
+    {
+        return -1;
+    }
+
+    len_dir = buf[4] | (buf[5] << 8);
+    record->timestamp = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+    record->dir = (len_dir & CAPTURE_LEN_TX) ? CAPTURE_TX : CAPTURE_RX;
+    record->len = len_dir & ~CAPTURE_LEN_TX;
+    record->captured = buf[6];
+    record->data = &buf[CAPTURE_HEADER_SIZE];
+
+    return CAPTURE_HEADER_SIZE + record->captured;
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef _BBBLED_CAPTURE_H
+#define _BBBLED_CAPTURE_H
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Each record is a 7 byte header, little endian, then the frame:
+ *
+ *   u32 timestamp   os_cycles() when the frame was seen
+ *   u16 len         frame length, CAPTURE_LEN_TX set for outgoing frames
+ *   u8  captured    frame bytes that follow, at most the snap length
+ */
+#define CAPTURE_HEADER_SIZE 7
+#define CAPTURE_LEN_TX 0x8000
+// Longest snap length, so captured fits in its byte
+#define CAPTURE_MAX_SNAPLEN 255
+
+typedef enum {
+    CAPTURE_RX = 0,
+    CAPTURE_TX,
+} capture_dir_t;
+
+/**
+ * @brief One record, as capture_parse() finds it
+ * @param   timestamp   :   os_cycles() when the frame was seen
+ * @param   dir         :   which way the frame went
+ * @param   len         :   length of the frame on the link
+ * @param   captured    :   bytes of it kept, less than len if it was cut short
+ * @param   data        :   the bytes kept, in the buffer that was parsed
+ */
+struct capture_record {
+    uint32_t timestamp;
+    capture_dir_t dir;
+    uint16_t len;
+    uint8_t captured;
+    const uint8_t *data;
+};
+
+/**
+ * @brief Capture statistics
+ * @param   records     :   frames recorded
+ * @param   overwritten :   records lost to newer ones before being read
+ */
+struct capture_stats {
+    uint32_t records;
+    uint32_t overwritten;
+};
+
+/**
+ * @brief A ring of binary frame records. When it fills up the oldest
+ *        records make way, so it always holds the most recent traffic.
+ * @param   buf     :   the ring
+ * @param   size    :   bytes in the ring
+ * @param   head    :   where the next record goes
+ * @param   tail    :   oldest record
+ * @param   used    :   bytes of records in the ring
+ * @param   snaplen :   frame bytes kept per record
+ * @param   lock    :   guards the ring, frames are recorded and read
+ *                      from different threads
+ * @param   stats   :   statistics
+ */
+struct capture {
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t tail;
+    size_t used;
+    uint8_t snaplen;
+    os_lock_t lock;
+    struct capture_stats stats;
+};
+
+typedef struct capture* capture_t;
+
+/**
+ * @brief   Initialise a capture ring
+ *
+ * @param   capture :   capture to initialise
+ * @param   buf     :   memory for the ring, must hold at least one record
+ *                      of snaplen bytes
+ * @param   size    :   size of buf
+ * @param   snaplen :   frame bytes to keep per record, up to CAPTURE_MAX_SNAPLEN
+ */
+void capture_init(capture_t capture, uint8_t *buf, size_t size, uint8_t snaplen);
+
+/**
+ * @brief   Record a frame. Costs a timestamp and a copy of up to snaplen
+ *          bytes under a spinlock.
+ *
+ * @param   capture :   capture
+ * @param   dir     :   CAPTURE_RX or CAPTURE_TX
+ * @param   frame   :   the frame
+ * @param   len     :   length of the frame
+ */
+void capture_record(capture_t capture, capture_dir_t dir, const uint8_t *frame, size_t len);
+
+/**
+ * @brief   Take the oldest records out of the ring. Only whole records
+ *          are copied.
+ *
+ * @param   capture     :   capture
+ * @param   dest        :   where to copy the records
+ * @param   dest_size   :   room in dest
+ *
+ * @returns Bytes copied, 0 once the ring is empty
+ */
+size_t capture_read(capture_t capture, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   Throw away every record and reset the statistics
+ */
+void capture_clear(capture_t capture);
+
+/**
+ * @brief   Copy out the statistics
+ */
+void capture_stats_get(capture_t capture, struct capture_stats *stats);
+
+/**
+ * @brief   Decode the record at the start of buf, as written by
+ *          capture_read()
+ *
+ * @param   buf     :   records
+ * @param   len     :   bytes in buf
+ * @param   record  :   filled in, data points into buf
+ *
+ * @retval  bytes the record takes up
+ * @retval  -1 if buf doesn't hold a whole record
+ */
+int capture_parse(const uint8_t *buf, size_t len, struct capture_record *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_CAPTURE_H */
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include <errno.h>
+
+#include "cobs.h"
+
+// A code byte of 0xFF means 254 data bytes and no implied zero
+#define COBS_MAX_RUN 0xFF
+
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dest, size_t dest_size)
+{
+    size_t code_index = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    if (dest_size == 0)
+    {
+        return 0;
+    }
+
+    for (size_t index = 0; index < len; ++index)
+    {
+        if (out >= dest_size)
+        {
+            return 0;
+        }
+
+        if (src[index] == 0)
+        {
+            /*  The zero becomes the code byte of the block it ends */
+            dest[code_index] = code;
+            code_index = out++;
+            code = 1;
+            continue;
+        }
+
+        dest[out++] = src[index];
+
+        /*  Full run, start a new block if there is more to come */
+        if (++code == COBS_MAX_RUN && index + 1 < len)
+        {
+            if (out >= dest_size)
+            {
+                return 0;
+            }
+            dest[code_index] = code;
+            code_index = out++;
+            code = 1;
+        }
+    }
+
+    dest[code_index] = code;
+    return out;
+}
+
+int cobs_decode(const uint8_t *src, size_t len, uint8_t *dest, size_t dest_size)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len)
+    {
+        uint8_t code = src[in++];
+
+        if (code == COBS_DELIMITER || in + code - 1 > len)
+        {
+            return -EINVAL;
+        }
+
+        for (uint8_t run = 1; run < code; ++run)
+        {
+            uint8_t byte = src[in++];
+
+            if (byte == COBS_DELIMITER)
+            {
+                return -EINVAL;
+            }
+            if (out == dest_size)
+            {
+                return -ENOBUFS;
+            }
+            dest[out++] = byte;
+        }
+
+        /*  Every block but the last, and not after a full run, hides a zero */
+        if (code != COBS_MAX_RUN && in < len)
+        {
+            if (out == dest_size)
+            {
+                return -ENOBUFS;
+            }
+            dest[out++] = 0;
+        }
+    }
+
+    return (int) out;
+}
\ No newline at end of file
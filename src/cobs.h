@@ -0,0 +1,51 @@
+#ifndef _BBBLED_COBS_H
+#define _BBBLED_COBS_H
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Consistent Overhead Byte Stuffing. Encoded data never contains 0x00,
+ * so 0x00 can delimit frames: a receiver that loses sync just waits for
+ * the next delimiter, whatever the payload looks like.
+ */
+
+#define COBS_DELIMITER 0x00
+
+// Worst case encoded size of len bytes, not counting the delimiter
+#define COBS_MAX_ENCODED_SIZE(len) ((len) + ((len) / 254) + 1)
+
+/**
+ * @brief   Encode a block
+ *
+ * @param   src         :   bytes to encode
+ * @param   len         :   number of bytes
+ * @param   dest        :   where to write the encoded bytes, must not overlap src
+ * @param   dest_size   :   room in dest
+ *
+ * @returns Encoded length (no delimiter), 0 if dest is too small
+ */
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   Decode a block. Decoding in place (dest == src) is fine.
+ *
+ * @param   src         :   encoded bytes, without the delimiter
+ * @param   len         :   number of bytes
+ * @param   dest        :   where to write the decoded bytes
+ * @param   dest_size   :   room in dest
+ *
+ * @retval  decoded length
+ * @retval  -EINVAL if src is not valid COBS
+ * @retval  -ENOBUFS if dest is too small
+ */
+int cobs_decode(const uint8_t *src, size_t len, uint8_t *dest, size_t dest_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_COBS_H */
\ No newline at end of file
@@ -1,113 +1,82 @@
 #include "commands.h"
-#include <zephyr/sys/util.h>
 #include <string.h>
-#include <zephyr/kernel.h>
 #include <stdlib.h>
 
 /**
- * Global array of str/enum values for all the accepted commands
+ * Everything in here is generated from the schema in commands_schema.h
  */
-static const command_t valid_commands_enum[] = {
-    COMMAND_SET_RGB,
-    COMMAND_ACK,
-    COMMAND_NACK,
-};
+
+#define COMMAND_STR(name, str, delivery) str,
 static const char *valid_commands_str[] = {
-    "set_rgb",
-    "ack",
-    "nack",
+    COMMAND_LIST(COMMAND_STR)
 };
+#undef COMMAND_STR
 
-
-/**
- * Global arrays of str/enum values for all the accepted keys
- */
-static const key_t valid_keys_enum[] = {
-    KEY_RED,
-    KEY_GREEN,
-    KEY_BLUE,
-    KEY_MSGNUM,
+#define COMMAND_DELIVERY(name, str, delivery) COMMAND_DELIVERY_##delivery,
+static const command_delivery_t command_deliveries[] = {
+    COMMAND_LIST(COMMAND_DELIVERY)
 };
-static const char *valid_keys_str[] = {
-    "red",
-    "green",
-    "blue",
-    "msg",
-};
-
+#undef COMMAND_DELIVERY
 
-/**
- * Which specific keys are valid for which command
- */
-static const key_t valid_keys_set_rgb[] = {
-    SETRGB_RED,
-    SETRGB_GREEN,
-    SETRGB_BLUE,
+#define KEY_STR(name, str) str,
+static const char *valid_keys_str[] = {
+    KEY_LIST(KEY_STR)
 };
+#undef KEY_STR
 
-static const key_t valid_keys_ack_nack[] = {
-    KEY_MSGNUM,
-};
+/* set_rgb_keys_t predates the schema, make sure they still agree */
+BUILD_ASSERT((int) SETRGB_RED == (int) KEY_RED, "set_rgb keys out of sync");
+BUILD_ASSERT((int) SETRGB_GREEN == (int) KEY_GREEN, "set_rgb keys out of sync");
+BUILD_ASSERT((int) SETRGB_BLUE == (int) KEY_BLUE, "set_rgb keys out of sync");
+BUILD_ASSERT((int) SETRGB_TARGET == (int) KEY_TARGET, "set_rgb keys out of sync");
 
 
 command_t cmd_to_enum(char *str)
 {
-    command_t command = COMMAND_INVALID;
     for (int i = 0; i < NUM_COMMANDS; ++i)
     {
         if (strcmp(valid_commands_str[i], str) == 0)
         {
-            command = i;
-            return command;
+            return (command_t) i;
         }
     }
-    return command;
+    return COMMAND_INVALID;
+}
+
+command_delivery_t command_delivery(command_t command)
+{
+    if ((unsigned) command >= NUM_COMMANDS)
+    {
+        return COMMAND_DELIVERY_ORDERED;
+    }
+    return command_deliveries[command];
 }
 
-key_t key_to_enum(char *str)
+param_key_t key_to_enum(char *str)
 {
-    key_t key = KEY_INVALID;
     for (int i = 0; i < NUM_KEYS; ++i)
     {
         if (strcmp(valid_keys_str[i], str) == 0)
         {
-            key = i;
-            return key;
+            return (param_key_t) i;
         }
     }
-    return key;
+    return KEY_INVALID;
 }
 
-char* cmd_to_string (command_t command)
+char* cmd_to_string(command_t command)
 {
-    switch (command)
+    if ((unsigned) command >= NUM_COMMANDS)
     {
-        case COMMAND_SET_RGB:
-            return "set_rgb";
-        case COMMAND_ACK:
-            return "ack";
-        case COMMAND_NACK:
-            return "nack";
-        default:
-            return NULL;
+        return NULL;
     }
+    return (char *) valid_commands_str[command];
 }
 
-char* key_to_string(key_t key)
+char* key_to_string(param_key_t key)
 {
-    switch (key)
-    {
-        case KEY_RED:
-            return "red";
-        case KEY_GREEN:
-            return "green";
-        case KEY_BLUE:
-            return "blue";
-        case KEY_MSGNUM:
-            return "msg";
-        default:
-            __ASSERT(0, "unreachable");
-    }
+    __ASSERT((unsigned) key < NUM_KEYS, "unreachable");
+    return (char *) valid_keys_str[key];
 }
 
 value_t str_to_value(char *str)
@@ -121,21 +90,30 @@ void value_to_str(value_t value, char *dest, size_t size)
     snprintf(dest, size, "%d", value);
 }
 
-static int validate_kv_set_rgb(key_t key, value_t value)
-{
-    set_rgb_keys_t param = (set_rgb_keys_t) key;
-
-    switch (param)
-    {
-        case SETRGB_RED:
-        case SETRGB_GREEN:
-        case SETRGB_BLUE:
-            return (value > UINT8_MAX || value < 0);
-        default:
-            return -1;
-
+/*
+ *  One validator per command. Each is a switch over the keys the command
+ *  accepts with the range check folded into a single unsigned compare,
+ *  so the compiler can turn it into a jump table.
+ *
+ *  Returns 0 if valid, 1 if out of range, -1 for a key the command doesn't take.
+ */
+#define RANGE_CASE(key, min, max) \
+    case KEY_##key: return ((uint32_t) value - (uint32_t) (min) > (uint32_t) (max) - (uint32_t) (min));
+
+#define COMMAND_VALIDATOR(name, str, delivery)                      \
+    static int validate_kv_##name(param_key_t key, value_t value)   \
+    {                                                               \
+        ARG_UNUSED(value);                                          \
+        switch (key)                                                \
+        {                                                           \
+            PARAMS_##name(RANGE_CASE)                               \
+            default:                                                \
+                return -1;                                          \
+        }                                                           \
     }
-}
+COMMAND_LIST(COMMAND_VALIDATOR)
+#undef COMMAND_VALIDATOR
+#undef RANGE_CASE
 
 /**
  * @brief   Given a command, make sure that the params we have
@@ -146,24 +124,35 @@ static int validate_kv_set_rgb(key_t key, value_t value)
  * @param   value   :   value to evaluate
  *
  * @retval  0 if params are valid
- * @retval  1 if not
+ * @retval  non zero if not
  */
 int validate_param_for_command(
     command_t command,
-    key_t key,
+    param_key_t key,
     value_t value)
 {
     switch (command)
     {
-        case COMMAND_SET_RGB:
-            return validate_kv_set_rgb(key, value);
-        case COMMAND_ACK:
-        case COMMAND_NACK:
+#define VALIDATE_CASE(name, str, delivery) \
+        case COMMAND_##name: return validate_kv_##name(key, value);
+        COMMAND_LIST(VALIDATE_CASE)
+#undef VALIDATE_CASE
+        default:
             return 1;
-        case NUM_COMMANDS:
-        case COMMAND_INVALID:
+    }
+}
+
+int validate_params_for_command(
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params)
+{
+    for (size_t index = 0; index < num_params; ++index)
+    {
+        if (validate_param_for_command(command, params[index].key, params[index].value))
+        {
             return 1;
-        default:
-            __ASSERT(0, "unreachable");
+        }
     }
+    return 0;
 }
\ No newline at end of file
@@ -1,49 +1,76 @@
 #ifndef _BBBLED_COMMANDS_H
 #define _BBBLED_COMMANDS_H
 #include <stdio.h>
-#include <zephyr/types.h>
+#include "os.h"
+#include "commands_schema.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define COMMAND_ENUM(name, str, delivery) COMMAND_##name,
 typedef enum {
-    COMMAND_SET_RGB = 0,
-    COMMAND_ACK,
-    COMMAND_NACK,
+    COMMAND_LIST(COMMAND_ENUM)
     NUM_COMMANDS,
     COMMAND_INVALID,
 } command_t;
+#undef COMMAND_ENUM
+
+typedef enum {
+    // Must be applied in the order it was sent
+    COMMAND_DELIVERY_ORDERED = 0,
+    // Idempotent and independent, can be applied as it arrives
+    COMMAND_DELIVERY_UNORDERED,
+} command_delivery_t;
 
 typedef enum {
     SETRGB_RED = 0,
     SETRGB_GREEN,
-    SETRGB_BLUE
+    SETRGB_BLUE,
+    SETRGB_TARGET = 4,
 } set_rgb_keys_t;
 
+#define KEY_ENUM(name, str) KEY_##name,
 typedef enum {
-    KEY_RED = 0,
-    KEY_GREEN,
-    KEY_BLUE,
-    KEY_MSGNUM,
+    KEY_LIST(KEY_ENUM)
     NUM_KEYS,
     KEY_INVALID,
-} key_t;
+} param_key_t;
+#undef KEY_ENUM
 
 typedef uint16_t value_t;
 
 /* kv pair definition */
 struct key_val_pair{
-    key_t key;
+    param_key_t key;
     value_t value;
 };
 
-key_t key_to_enum(char *str);
+param_key_t key_to_enum(char *str);
 command_t cmd_to_enum(char *str);
-char* key_to_string(key_t key);
+char* key_to_string(param_key_t key);
 char* cmd_to_string(command_t command);
 value_t str_to_value(char *str);
-int validate_param_for_command(command_t command, key_t key, value_t value);
+int validate_param_for_command(command_t command, param_key_t key, value_t value);
+
+/**
+ * @brief   How a command declares it must be delivered, see the schema
+ *
+ * @retval  COMMAND_DELIVERY_ORDERED for unknown commands
+ */
+command_delivery_t command_delivery(command_t command);
+
+/**
+ * @brief   Check a whole parameter list against a command's schema
+ *
+ * @param   command     :   command the parameters are for
+ * @param   params      :   parameters
+ * @param   num_params  :   number of parameters
+ *
+ * @retval  0 if every parameter is valid
+ * @retval  1 if not
+ */
+int validate_params_for_command(command_t command, const struct key_val_pair *params, size_t num_params);
 
 #ifdef __cplusplus
 }
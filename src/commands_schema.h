@@ -0,0 +1,138 @@
+#ifndef _BBBLED_COMMANDS_SCHEMA_H
+#define _BBBLED_COMMANDS_SCHEMA_H
+
+/*
+ * The command schema. Every command, key and value range is declared
+ * here once, and the enums, string tables, validators and specialised
+ * serialisers are all generated from it (commands.h, commands.c,
+ * protocol.c). Adding a command means adding a line to COMMAND_LIST and
+ * a PARAMS_<name> list, nothing else.
+ *
+ * COMMAND_LIST entries are X(NAME, "wire name", DELIVERY)
+ * KEY_LIST entries are     X(NAME, "wire name")
+ * PARAMS_<command> entries are P(KEY, min, max), inclusive
+ *
+ * DELIVERY is ORDERED if a command has to be applied in the order it
+ * was sent, UNORDERED if it is idempotent and independent of whatever
+ * else is in flight (see command_delivery()).
+ *
+ * The value enums and limits those ranges use live here too, so the
+ * command layer doesn't depend on the modules that handle the commands.
+ *
+ * Order matters, it fixes the enum values.
+ */
+
+#define COMMAND_LIST(X)                     \
+    X(SET_RGB,  "set_rgb",  UNORDERED)      \
+    X(ACK,      "ack",      UNORDERED)      \
+    X(NACK,     "nack",     UNORDERED)      \
+    X(EFFECT,   "effect",   ORDERED)        \
+    X(PING,     "ping",     UNORDERED)      \
+    X(PONG,     "pong",     UNORDERED)      \
+    X(PALETTE,  "palette",  ORDERED)        \
+    X(SET_IDX,  "set_idx",  UNORDERED)
+
+#define KEY_LIST(X)                         \
+    X(RED,      "red")                      \
+    X(GREEN,    "green")                    \
+    X(BLUE,     "blue")                     \
+    X(MSGNUM,   "msg")                      \
+    X(TARGET,   "target")                   \
+    X(EFFECT,   "type")                     \
+    X(DURATION, "duration")                 \
+    X(EASING,   "easing")                   \
+    X(COUNT,    "count")                    \
+    X(T0H,      "t0h")                      \
+    X(T0L,      "t0l")                      \
+    X(T1H,      "t1h")                      \
+    X(T1L,      "t1l")                      \
+    X(T2H,      "t2h")                      \
+    X(T2L,      "t2l")                      \
+    X(T3H,      "t3h")                      \
+    X(T3L,      "t3l")                      \
+    X(INDEX,    "index")                    \
+    X(I0,       "i0")                       \
+    X(I1,       "i1")                       \
+    X(I2,       "i2")                       \
+    X(I3,       "i3")                       \
+    X(I4,       "i4")                       \
+    X(I5,       "i5")
+
+#define PARAMS_SET_RGB(P)                   \
+    P(RED,      0, UINT8_MAX)               \
+    P(GREEN,    0, UINT8_MAX)               \
+    P(BLUE,     0, UINT8_MAX)               \
+    P(TARGET,   0, UINT16_MAX)
+
+// Only ever carry the message number, which is not a param
+#define PARAMS_ACK(P)
+#define PARAMS_NACK(P)
+
+/*  Effect types and easing curves, see effect.h */
+typedef enum {
+    EFFECT_NONE = 0,
+    EFFECT_FADE,
+    EFFECT_PULSE,
+    EFFECT_CHASE,
+    NUM_EFFECTS,
+} effect_type_t;
+
+typedef enum {
+    EASING_LINEAR = 0,
+    EASING_IN,
+    EASING_OUT,
+    EASING_IN_OUT,
+    NUM_EASINGS,
+} easing_t;
+
+#define PARAMS_EFFECT(P)                    \
+    P(TARGET,   0, UINT16_MAX)              \
+    P(EFFECT,   EFFECT_NONE + 1, NUM_EFFECTS - 1) \
+    P(DURATION, 1, UINT16_MAX)              \
+    P(EASING,   0, NUM_EASINGS - 1)         \
+    P(COUNT,    1, UINT16_MAX)              \
+    P(RED,      0, UINT8_MAX)               \
+    P(GREEN,    0, UINT8_MAX)               \
+    P(BLUE,     0, UINT8_MAX)
+
+/*  Timestamps, split in two because values are 16 bit (see ping.h):
+    t0 sent by the host, t1 received, t2 forwarded and t3 echoed back
+    by the dongle. Each is in the clock of whoever stamped it */
+#define PARAMS_PING(P)                      \
+    P(T0H,      0, UINT16_MAX)              \
+    P(T0L,      0, UINT16_MAX)              \
+    P(T1H,      0, UINT16_MAX)              \
+    P(T1L,      0, UINT16_MAX)              \
+    P(T2H,      0, UINT16_MAX)              \
+    P(T2L,      0, UINT16_MAX)              \
+    P(T3H,      0, UINT16_MAX)              \
+    P(T3L,      0, UINT16_MAX)
+#define PARAMS_PONG(P) PARAMS_PING(P)
+
+/*  Indexed colour, see palette.h. Each iN is two palette indices */
+// Entries in a palette, indices are a byte
+#define PALETTE_MAX_ENTRIES 256
+// Indices packed into each iN value
+#define PALETTE_INDICES_PER_VALUE 2
+// iN keys in a set_idx
+#define PALETTE_MAX_VALUES 6
+// Most LEDs one set_idx sets
+#define PALETTE_MAX_PER_FRAME (PALETTE_INDICES_PER_VALUE * PALETTE_MAX_VALUES)
+
+#define PARAMS_PALETTE(P)                   \
+    P(INDEX,    0, PALETTE_MAX_ENTRIES - 1) \
+    P(RED,      0, UINT8_MAX)               \
+    P(GREEN,    0, UINT8_MAX)               \
+    P(BLUE,     0, UINT8_MAX)
+
+#define PARAMS_SET_IDX(P)                   \
+    P(TARGET,   0, UINT16_MAX)              \
+    P(COUNT,    1, PALETTE_MAX_PER_FRAME)   \
+    P(I0,       0, UINT16_MAX)              \
+    P(I1,       0, UINT16_MAX)              \
+    P(I2,       0, UINT16_MAX)              \
+    P(I3,       0, UINT16_MAX)              \
+    P(I4,       0, UINT16_MAX)              \
+    P(I5,       0, UINT16_MAX)
+
+#endif /* _BBBLED_COMMANDS_SCHEMA_H */
\ No newline at end of file
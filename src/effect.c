@@ -0,0 +1,352 @@
+#include <errno.h>
+#include <string.h>
+
+#include "effect.h"
+
+LOG_MODULE_REGISTER(bbbled_effect, LOG_LEVEL_DBG);
+
+static inline bool rgb_equal(struct rgb a, struct rgb b)
+{
+    return a.red == b.red && a.green == b.green && a.blue == b.blue;
+}
+
+/**
+ * @brief   Interpolate a single channel
+ *
+ * @param   from    :   value at progress 0
+ * @param   to      :   value at progress EFFECT_FIXED_ONE
+ * @param   t       :   Q16 progress
+ */
+static inline uint8_t lerp_channel(uint8_t from, uint8_t to, uint32_t t)
+{
+    int32_t diff = (int32_t)to - (int32_t)from;
+
+    return (uint8_t)(from + (diff * (int32_t)t) / (int32_t)EFFECT_FIXED_ONE);
+}
+
+static inline struct rgb lerp_rgb(struct rgb from, struct rgb to, uint32_t t)
+{
+    struct rgb out = {
+        .red = lerp_channel(from.red, to.red, t),
+        .green = lerp_channel(from.green, to.green, t),
+        .blue = lerp_channel(from.blue, to.blue, t),
+    };
+    return out;
+}
+
+/**
+ * @brief   Multiply two Q16 values
+ */
+static inline uint32_t fixed_mul(uint32_t a, uint32_t b)
+{
+    return (uint32_t)(((uint64_t)a * b) >> EFFECT_FIXED_SHIFT);
+}
+
+uint32_t effect_ease(easing_t easing, uint32_t progress)
+{
+    uint32_t p = MIN(progress, EFFECT_FIXED_ONE);
+    uint32_t inv = EFFECT_FIXED_ONE - p;
+
+    switch (easing)
+    {
+        case EASING_IN:
+            return fixed_mul(p, p);
+        case EASING_OUT:
+            return EFFECT_FIXED_ONE - fixed_mul(inv, inv);
+        case EASING_IN_OUT:
+            if (p < EFFECT_FIXED_ONE / 2)
+            {
+                return 2 * fixed_mul(p, p);
+            }
+            return EFFECT_FIXED_ONE - 2 * fixed_mul(inv, inv);
+        case EASING_LINEAR:
+        default:
+            return p;
+    }
+}
+
+/**
+ * @brief   Q16 progress through the current cycle of an effect
+ */
+static inline uint32_t cycle_progress(uint32_t elapsed_ms, uint16_t duration_ms)
+{
+    return (uint32_t)(((uint64_t)(elapsed_ms % duration_ms) << EFFECT_FIXED_SHIFT) / duration_ms);
+}
+
+static void emit_if_changed(effect_engine_t engine, struct effect_slot *slot, uint16_t target, struct rgb colour)
+{
+    if (!rgb_equal(colour, slot->last))
+    {
+        slot->last = colour;
+        engine->emit(target, colour, engine->user_data);
+    }
+}
+
+static void render_fade(effect_engine_t engine, struct effect_slot *slot)
+{
+    struct effect_params *params = &slot->params;
+    uint32_t progress;
+
+    if (slot->elapsed_ms >= params->duration_ms)
+    {
+        progress = EFFECT_FIXED_ONE;
+        slot->active = false;
+    }
+    else
+    {
+        progress = cycle_progress(slot->elapsed_ms, params->duration_ms);
+    }
+
+    uint32_t t = effect_ease(params->easing, progress);
+    emit_if_changed(engine, slot, params->target, lerp_rgb(slot->from, params->colour, t));
+}
+
+static void render_pulse(effect_engine_t engine, struct effect_slot *slot)
+{
+    struct effect_params *params = &slot->params;
+    uint32_t progress = cycle_progress(slot->elapsed_ms, params->duration_ms);
+
+    /*  Triangle wave: up for the first half of the cycle, down for the second */
+    uint32_t wave = (progress < EFFECT_FIXED_ONE / 2) ?
+        (2 * progress) :
+        (2 * (EFFECT_FIXED_ONE - progress));
+
+    uint32_t t = effect_ease(params->easing, wave);
+    emit_if_changed(engine, slot, params->target, lerp_rgb(slot->from, params->colour, t));
+}
+
+static void render_chase(effect_engine_t engine, struct effect_slot *slot)
+{
+    struct effect_params *params = &slot->params;
+    uint32_t progress = cycle_progress(slot->elapsed_ms, params->duration_ms);
+    uint32_t t = effect_ease(params->easing, progress);
+    uint16_t position = (uint16_t)(((uint64_t)t * params->count) >> EFFECT_FIXED_SHIFT);
+
+    position = MIN(position, params->count - 1);
+
+    if (position == slot->position && rgb_equal(slot->last, params->colour))
+    {
+        return;
+    }
+
+    /*  Put the LED we are leaving back to the background colour */
+    if (position != slot->position)
+    {
+        engine->emit(params->target + slot->position, slot->from, engine->user_data);
+    }
+
+    slot->position = position;
+    slot->last = params->colour;
+    engine->emit(params->target + position, params->colour, engine->user_data);
+}
+
+static struct effect_slot *find_slot(effect_engine_t engine, uint16_t target)
+{
+    struct effect_slot *free_slot = NULL;
+
+    for (uint8_t index = 0; index < EFFECT_MAX_SLOTS; ++index)
+    {
+        struct effect_slot *slot = &engine->slots[index];
+
+        if (slot->params.type != EFFECT_NONE && slot->params.target == target)
+        {
+            return slot;
+        }
+        if (!slot->active && free_slot == NULL)
+        {
+            free_slot = slot;
+        }
+    }
+
+    return free_slot;
+}
+
+static bool any_active(effect_engine_t engine)
+{
+    for (uint8_t index = 0; index < EFFECT_MAX_SLOTS; ++index)
+    {
+        if (engine->slots[index].active) return true;
+    }
+    return false;
+}
+
+void effect_engine_tick(effect_engine_t engine, uint32_t elapsed_ms)
+{
+    os_lock_key_t key = os_lock(&engine->lock);
+
+    for (uint8_t index = 0; index < EFFECT_MAX_SLOTS; ++index)
+    {
+        struct effect_slot *slot = &engine->slots[index];
+
+        if (!slot->active)
+        {
+            continue;
+        }
+
+        slot->elapsed_ms += elapsed_ms;
+
+        switch (slot->params.type)
+        {
+            case EFFECT_FADE:
+                render_fade(engine, slot);
+                break;
+            case EFFECT_PULSE:
+                render_pulse(engine, slot);
+                break;
+            case EFFECT_CHASE:
+                render_chase(engine, slot);
+                break;
+            default:
+                slot->active = false;
+                break;
+        }
+    }
+
+    if (!any_active(engine))
+    {
+        timer_stop(engine->tick_timer);
+    }
+
+    os_unlock(&engine->lock, key);
+}
+
+static void effect_tick_expiry(os_timer_t *timer)
+{
+    effect_engine_t engine = (effect_engine_t) timer_user_data_get(timer);
+
+    effect_engine_tick(engine, EFFECT_TICK_MSEC);
+}
+
+void effect_engine_init(effect_engine_t engine, os_timer_t *timer, effect_emit_t emit, void *user_data)
+{
+    __ASSERT(engine, "Invalid engine ptr");
+    __ASSERT(emit, "Invalid emit fn");
+
+    memset(engine->slots, 0, sizeof(engine->slots));
+    engine->tick_timer = timer;
+    engine->emit = emit;
+    engine->user_data = user_data;
+    os_lock_init(&engine->lock);
+
+    timer_init(timer, effect_tick_expiry, NULL, engine);
+}
+
+int effect_start(effect_engine_t engine, const struct effect_params *params)
+{
+    if (params->type == EFFECT_NONE || params->type >= NUM_EFFECTS ||
+        params->easing >= NUM_EASINGS || params->duration_ms == 0)
+    {
+        return -EINVAL;
+    }
+
+    if (params->type == EFFECT_CHASE && params->count == 0)
+    {
+        return -EINVAL;
+    }
+
+    os_lock_key_t key = os_lock(&engine->lock);
+
+    struct effect_slot *slot = find_slot(engine, params->target);
+    if (slot == NULL)
+    {
+        os_unlock(&engine->lock, key);
+        LOG_WRN("no free effect slot for target %d", params->target);
+        return -ENOMEM;
+    }
+
+    bool was_running = any_active(engine);
+
+    /*  Carry on from wherever the previous effect on this target left
+        off. A free slot that last ran another LED starts from black. */
+    bool same_target = slot->params.type != EFFECT_NONE && slot->params.target == params->target;
+    struct rgb from = same_target ? slot->last : (struct rgb){0};
+
+    /*  A chase runs over a black background */
+    if (params->type == EFFECT_CHASE)
+    {
+        from = (struct rgb){0};
+    }
+
+    slot->params = *params;
+    slot->from = from;
+    slot->last = from;
+    slot->elapsed_ms = 0;
+    slot->position = 0;
+    slot->active = true;
+
+    /*  Under the lock, so a tick finishing the last effect can't stop
+        the timer after we have decided it is already running */
+    if (!was_running)
+    {
+        timer_start(engine->tick_timer, TIMER_MSEC(EFFECT_TICK_MSEC), TIMER_MSEC(EFFECT_TICK_MSEC));
+    }
+
+    os_unlock(&engine->lock, key);
+
+    return 0;
+}
+
+void effect_stop(effect_engine_t engine, uint16_t target)
+{
+    os_lock_key_t key = os_lock(&engine->lock);
+
+    for (uint8_t index = 0; index < EFFECT_MAX_SLOTS; ++index)
+    {
+        struct effect_slot *slot = &engine->slots[index];
+
+        if (slot->active && slot->params.target == target)
+        {
+            slot->active = false;
+        }
+    }
+
+    os_unlock(&engine->lock, key);
+}
+
+int effect_params_from_pairs(const struct key_val_pair *pairs, size_t num_pairs, struct effect_params *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->count = 1;
+
+    for (size_t index = 0; index < num_pairs; ++index)
+    {
+        value_t value = pairs[index].value;
+
+        switch (pairs[index].key)
+        {
+            case KEY_TARGET:
+                params->target = value;
+                break;
+            case KEY_EFFECT:
+                params->type = (effect_type_t) value;
+                break;
+            case KEY_DURATION:
+                params->duration_ms = value;
+                break;
+            case KEY_EASING:
+                params->easing = (easing_t) value;
+                break;
+            case KEY_COUNT:
+                params->count = value;
+                break;
+            case KEY_RED:
+                params->colour.red = (uint8_t) value;
+                break;
+            case KEY_GREEN:
+                params->colour.green = (uint8_t) value;
+                break;
+            case KEY_BLUE:
+                params->colour.blue = (uint8_t) value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (params->type == EFFECT_NONE || params->duration_ms == 0)
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
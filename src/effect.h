@@ -0,0 +1,154 @@
+#ifndef _BBBLED_EFFECT_H
+#define _BBBLED_EFFECT_H
+
+#include "os.h"
+#include "commands.h"
+#include "timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Render period, roughly 60 fps
+#define EFFECT_TICK_MSEC 16
+// Number of effects that can run at the same time
+#define EFFECT_MAX_SLOTS 8
+// Fixed point format used for progress and easing (Q16)
+#define EFFECT_FIXED_SHIFT 16
+#define EFFECT_FIXED_ONE (1UL << EFFECT_FIXED_SHIFT)
+
+/*  effect_type_t and easing_t are in commands_schema.h */
+
+struct rgb {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+};
+
+/**
+ * @brief Parameters uploaded by the host for a single effect
+ * @param   type        :   fade, pulse or chase
+ * @param   easing      :   easing curve applied to the progress
+ * @param   duration_ms :   length of a fade, or of one pulse/chase cycle
+ * @param   target      :   LED the effect applies to (first LED for a chase)
+ * @param   count       :   number of LEDs a chase runs across
+ * @param   colour      :   colour to fade/pulse/chase to
+ */
+struct effect_params {
+    effect_type_t type;
+    easing_t easing;
+    uint16_t duration_ms;
+    uint16_t target;
+    uint16_t count;
+    struct rgb colour;
+};
+
+/**
+ * @brief   Called whenever the engine changes the colour of a target.
+ *          Runs in the context of the tick timer, so it should only
+ *          queue the update.
+ *
+ * @param   target      :   LED to update
+ * @param   colour      :   new colour
+ * @param   user_data   :   user data given to effect_engine_init
+ */
+typedef void (*effect_emit_t)(uint16_t target, struct rgb colour, void *user_data);
+
+/**
+ * @brief State for one running effect
+ * @param   active      :   effect is running
+ * @param   params      :   parameters uploaded by the host
+ * @param   from        :   colour the target had when the effect started
+ * @param   last        :   last colour emitted
+ * @param   elapsed_ms  :   time since the effect started
+ * @param   position    :   LED the chase is currently on
+ */
+struct effect_slot {
+    bool active;
+    struct effect_params params;
+    struct rgb from;
+    struct rgb last;
+    uint32_t elapsed_ms;
+    uint16_t position;
+};
+
+struct effect_engine {
+    struct effect_slot slots[EFFECT_MAX_SLOTS];
+    os_timer_t *tick_timer;
+    effect_emit_t emit;
+    void *user_data;
+    os_lock_t lock;
+};
+
+typedef struct effect_engine* effect_engine_t;
+
+/**
+ * @brief   Initialise the effect engine
+ *
+ * @param   engine      :   engine to initialise
+ * @param   timer       :   uninitialised timer used for the render tick
+ * @param   emit        :   called for every colour update
+ * @param   user_data   :   passed through to emit
+ */
+void effect_engine_init(effect_engine_t engine, os_timer_t *timer, effect_emit_t emit, void *user_data);
+
+/**
+ * @brief   Start an effect. Replaces any effect already running on
+ *          the same target, continuing from the colour it left off at.
+ *
+ * @param   engine  :   effect engine
+ * @param   params  :   effect to run
+ *
+ * @retval  0 on success
+ * @retval  -EINVAL if the parameters are invalid
+ * @retval  -ENOMEM if every slot is busy
+ */
+int effect_start(effect_engine_t engine, const struct effect_params *params);
+
+/**
+ * @brief   Stop the effect running on a target. The target keeps its
+ *          last colour.
+ *
+ * @param   engine  :   effect engine
+ * @param   target  :   target to stop
+ */
+void effect_stop(effect_engine_t engine, uint16_t target);
+
+/**
+ * @brief   Advance every running effect and emit the colours that
+ *          changed. Called from the tick timer, but can be driven
+ *          directly (e.g. from tests).
+ *
+ * @param   engine      :   effect engine
+ * @param   elapsed_ms  :   time since the previous tick
+ */
+void effect_engine_tick(effect_engine_t engine, uint32_t elapsed_ms);
+
+/**
+ * @brief   Apply an easing curve to a Q16 progress value
+ *
+ * @param   easing      :   curve to apply
+ * @param   progress    :   progress from 0 to EFFECT_FIXED_ONE
+ *
+ * @returns Eased progress from 0 to EFFECT_FIXED_ONE
+ */
+uint32_t effect_ease(easing_t easing, uint32_t progress);
+
+/**
+ * @brief   Build effect parameters from the key:value pairs of an
+ *          effect command
+ *
+ * @param   pairs       :   parsed pairs
+ * @param   num_pairs   :   number of pairs
+ * @param   params      :   parameters to populate
+ *
+ * @retval  0 on success
+ * @retval  -EINVAL if the effect type or duration is missing
+ */
+int effect_params_from_pairs(const struct key_val_pair *pairs, size_t num_pairs, struct effect_params *params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_EFFECT_H */
@@ -0,0 +1,393 @@
+#include <string.h>
+
+#include "fragment.h"
+
+LOG_MODULE_REGISTER(bbbled_fragment, LOG_LEVEL_DBG);
+
+/**
+ * @brief   Bitmap with the lowest `count` bits set
+ */
+static inline uint32_t all_fragments(uint8_t count)
+{
+    return (count >= FRAGMENT_MAX_FRAGMENTS) ? UINT32_MAX : ((1UL << count) - 1);
+}
+
+static inline void write_header(uint8_t *dest, const struct fragment_header *hdr)
+{
+    dest[0] = (uint8_t)(hdr->msg_id >> 8);
+    dest[1] = (uint8_t)(hdr->msg_id & 0xFF);
+    dest[2] = hdr->index;
+    dest[3] = hdr->count;
+}
+
+static inline void read_header(const uint8_t *src, struct fragment_header *hdr)
+{
+    hdr->msg_id = ((uint16_t)src[0] << 8) | src[1];
+    hdr->index = src[2];
+    hdr->count = src[3];
+}
+
+static inline bool mtu_is_valid(size_t mtu)
+{
+    return mtu >= FRAGMENT_MIN_MTU && mtu <= FRAGMENT_MAX_MTU;
+}
+
+fragment_ret_t fragment_tx_init(
+    fragment_tx_t tx,
+    const uint8_t *msg,
+    size_t len,
+    uint16_t msg_id,
+    size_t mtu)
+{
+    __ASSERT(tx, "Invalid tx ptr");
+
+    if (!mtu_is_valid(mtu))
+    {
+        return FRAGMENT_INVALID_MTU;
+    }
+
+    size_t payload = fragment_payload_size(mtu);
+    size_t count = (len + payload - 1) / payload;
+
+    /*  An empty message still needs one fragment to announce it */
+    if (count == 0)
+    {
+        count = 1;
+    }
+
+    if (count > FRAGMENT_MAX_FRAGMENTS || len > FRAGMENT_MAX_MSG_SIZE)
+    {
+        LOG_WRN("message too large to fragment [%zu bytes]", len);
+        return FRAGMENT_MSG_TOO_LARGE;
+    }
+
+    tx->msg = msg;
+    tx->len = len;
+    tx->msg_id = msg_id;
+    tx->mtu = mtu;
+    tx->count = (uint8_t) count;
+    tx->pending = all_fragments(tx->count);
+
+    return FRAGMENT_OK;
+}
+
+size_t fragment_tx_build(fragment_tx_t tx, uint8_t index, uint8_t *dest, size_t dest_size)
+{
+    if (index >= tx->count)
+    {
+        return 0;
+    }
+
+    size_t payload = fragment_payload_size(tx->mtu);
+    size_t offset = index * payload;
+    size_t frag_len = MIN(payload, tx->len - offset);
+
+    if (dest_size < FRAGMENT_HEADER_SIZE + frag_len)
+    {
+        return 0;
+    }
+
+    struct fragment_header hdr = {
+        .msg_id = tx->msg_id,
+        .index = index,
+        .count = tx->count,
+    };
+
+    write_header(dest, &hdr);
+    memcpy(dest + FRAGMENT_HEADER_SIZE, tx->msg + offset, frag_len);
+
+    return FRAGMENT_HEADER_SIZE + frag_len;
+}
+
+uint8_t fragment_tx_send(fragment_tx_t tx, fragment_emit_t emit, void *user_data)
+{
+    uint8_t frag[FRAGMENT_MAX_MTU];
+    uint8_t sent = 0;
+
+    for (uint8_t index = 0; index < tx->count; ++index)
+    {
+        if (!(tx->pending & BIT(index)))
+        {
+            continue;
+        }
+
+        size_t len = fragment_tx_build(tx, index, frag, sizeof(frag));
+        if (len)
+        {
+            emit(frag, len, user_data);
+            ++sent;
+        }
+    }
+
+    return sent;
+}
+
+fragment_ret_t fragment_tx_handle_ack(fragment_tx_t tx, const uint8_t *frame, size_t len)
+{
+    struct fragment_header hdr;
+
+    if (len < FRAGMENT_ACK_SIZE)
+    {
+        return FRAGMENT_INVALID_HEADER;
+    }
+
+    read_header(frame, &hdr);
+
+    if (hdr.index != FRAGMENT_ACK_INDEX || hdr.msg_id != tx->msg_id)
+    {
+        return FRAGMENT_INVALID_HEADER;
+    }
+
+    const uint8_t *bitmap = frame + FRAGMENT_HEADER_SIZE;
+    uint32_t received =
+        ((uint32_t)bitmap[0] << 24) |
+        ((uint32_t)bitmap[1] << 16) |
+        ((uint32_t)bitmap[2] << 8) |
+        (uint32_t)bitmap[3];
+
+    tx->pending &= ~received;
+
+    return tx->pending ? FRAGMENT_INCOMPLETE : FRAGMENT_OK;
+}
+
+fragment_ret_t fragment_rx_init(fragment_rx_t rx, size_t mtu)
+{
+    __ASSERT(rx, "Invalid rx ptr");
+
+    if (!mtu_is_valid(mtu))
+    {
+        return FRAGMENT_INVALID_MTU;
+    }
+
+    rx->mtu = mtu;
+    rx->clock = 0;
+    rx->done_next = 0;
+    rx->done_count = 0;
+    rx->evicted = 0;
+
+    for (uint8_t index = 0; index < FRAGMENT_RX_POOL_SIZE; ++index)
+    {
+        rx->slots[index].in_use = false;
+    }
+
+    return FRAGMENT_OK;
+}
+
+static inline bool slot_complete(const struct fragment_rx_slot *slot)
+{
+    return slot->received == all_fragments(slot->count);
+}
+
+/**
+ * @brief   Find the slot reassembling the given message. With claim, take
+ *          a free slot if there is none yet, or failing that the partial
+ *          one that has waited longest for a fragment. A complete slot
+ *          belongs to the caller until it is released, so it is never
+ *          taken.
+ */
+static struct fragment_rx_slot *find_slot(fragment_rx_t rx, uint16_t msg_id, bool claim)
+{
+    struct fragment_rx_slot *free_slot = NULL;
+    struct fragment_rx_slot *oldest = NULL;
+
+    for (uint8_t index = 0; index < FRAGMENT_RX_POOL_SIZE; ++index)
+    {
+        struct fragment_rx_slot *slot = &rx->slots[index];
+
+        if (slot->in_use && slot->msg_id == msg_id)
+        {
+            return slot;
+        }
+        if (!slot->in_use && free_slot == NULL)
+        {
+            free_slot = slot;
+        }
+        if (slot->in_use && !slot_complete(slot)
+            && (oldest == NULL || (int32_t) (slot->last_used - oldest->last_used) < 0))
+        {
+            oldest = slot;
+        }
+    }
+
+    if (!claim || free_slot)
+    {
+        return claim ? free_slot : NULL;
+    }
+
+    if (oldest)
+    {
+        LOG_WRN("dropping msg %d to make room for %d", oldest->msg_id, msg_id);
+        oldest->in_use = false;
+        rx->evicted++;
+    }
+    return oldest;
+}
+
+static const struct fragment_rx_done *find_done(fragment_rx_t rx, uint16_t msg_id)
+{
+    for (uint8_t index = 0; index < rx->done_count; ++index)
+    {
+        if (rx->done[index].msg_id == msg_id)
+        {
+            return &rx->done[index];
+        }
+    }
+    return NULL;
+}
+
+static void remember_done(fragment_rx_t rx, const struct fragment_rx_slot *slot)
+{
+    rx->done[rx->done_next] = (struct fragment_rx_done) {
+        .msg_id = slot->msg_id,
+        .count = slot->count,
+    };
+    rx->done_next = (rx->done_next + 1) % FRAGMENT_RX_DONE_SIZE;
+    rx->done_count = MIN(rx->done_count + 1, FRAGMENT_RX_DONE_SIZE);
+}
+
+fragment_ret_t fragment_rx_receive(
+    fragment_rx_t rx,
+    const uint8_t *frag,
+    size_t len,
+    struct fragment_rx_slot **complete)
+{
+    struct fragment_header hdr;
+    size_t payload = fragment_payload_size(rx->mtu);
+
+    if (len < FRAGMENT_HEADER_SIZE || len > rx->mtu)
+    {
+        return FRAGMENT_INVALID_HEADER;
+    }
+
+    read_header(frag, &hdr);
+
+    if (hdr.count == 0 || hdr.count > FRAGMENT_MAX_FRAGMENTS || hdr.index >= hdr.count)
+    {
+        LOG_WRN("invalid fragment header [%d/%d]", hdr.index, hdr.count);
+        return FRAGMENT_INVALID_HEADER;
+    }
+
+    size_t frag_len = len - FRAGMENT_HEADER_SIZE;
+    bool is_last = (hdr.index == hdr.count - 1);
+
+    /*  Only the last fragment may be short, otherwise the offsets
+        of the following fragments would not line up */
+    if (!is_last && frag_len != payload)
+    {
+        return FRAGMENT_INVALID_HEADER;
+    }
+
+    size_t offset = hdr.index * payload;
+    if (offset + frag_len > FRAGMENT_MAX_MSG_SIZE)
+    {
+        return FRAGMENT_MSG_TOO_LARGE;
+    }
+
+    struct fragment_rx_slot *slot = find_slot(rx, hdr.msg_id, false);
+
+    /*  The sender missed our status frame and is resending, it must
+        not be delivered twice */
+    if (slot == NULL && find_done(rx, hdr.msg_id))
+    {
+        return FRAGMENT_DUPLICATE;
+    }
+
+    if (slot == NULL)
+    {
+        slot = find_slot(rx, hdr.msg_id, true);
+    }
+    if (slot == NULL)
+    {
+        LOG_WRN("no reassembly slot for msg %d", hdr.msg_id);
+        return FRAGMENT_NO_SLOT;
+    }
+
+    slot->last_used = rx->clock++;
+
+    if (!slot->in_use)
+    {
+        slot->in_use = true;
+        slot->msg_id = hdr.msg_id;
+        slot->count = hdr.count;
+        slot->received = 0;
+        slot->len = 0;
+    }
+    else if (slot->count != hdr.count)
+    {
+        return FRAGMENT_INVALID_HEADER;
+    }
+
+    if (slot->received & BIT(hdr.index))
+    {
+        return FRAGMENT_DUPLICATE;
+    }
+
+    memcpy(slot->buffer + offset, frag + FRAGMENT_HEADER_SIZE, frag_len);
+    slot->received |= BIT(hdr.index);
+
+    if (is_last)
+    {
+        slot->len = offset + frag_len;
+    }
+
+    if (!slot_complete(slot))
+    {
+        return FRAGMENT_INCOMPLETE;
+    }
+
+    remember_done(rx, slot);
+
+    if (complete)
+    {
+        *complete = slot;
+    }
+
+    return FRAGMENT_OK;
+}
+
+size_t fragment_rx_build_ack(fragment_rx_t rx, uint16_t msg_id, uint8_t *dest, size_t dest_size)
+{
+    struct fragment_rx_slot *slot = find_slot(rx, msg_id, false);
+    const struct fragment_rx_done *done = slot ? NULL : find_done(rx, msg_id);
+    struct fragment_header hdr = {
+        .msg_id = msg_id,
+        .index = FRAGMENT_ACK_INDEX,
+    };
+    uint32_t received;
+
+    if ((slot == NULL && done == NULL) || dest_size < FRAGMENT_ACK_SIZE)
+    {
+        return 0;
+    }
+
+    if (slot)
+    {
+        hdr.count = slot->count;
+        received = slot->received;
+    }
+    else
+    {
+        hdr.count = done->count;
+        received = all_fragments(done->count);
+    }
+
+    write_header(dest, &hdr);
+
+    uint8_t *bitmap = dest + FRAGMENT_HEADER_SIZE;
+    bitmap[0] = (uint8_t)(received >> 24);
+    bitmap[1] = (uint8_t)(received >> 16);
+    bitmap[2] = (uint8_t)(received >> 8);
+    bitmap[3] = (uint8_t)(received);
+
+    return FRAGMENT_ACK_SIZE;
+}
+
+void fragment_rx_release(fragment_rx_t rx, struct fragment_rx_slot *slot)
+{
+    ARG_UNUSED(rx);
+
+    if (slot)
+    {
+        slot->in_use = false;
+    }
+}
@@ -0,0 +1,260 @@
+#ifndef _BBBLED_FRAGMENT_H
+#define _BBBLED_FRAGMENT_H
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Splits a frame into fragments that fit a link MTU smaller than the
+ * frame (a BLE ATT write) and reassembles them on the other side.
+ * Meant for the BLE link. Nothing builds it into the USB firmware yet,
+ * and frames are still limited to PROTOCOL_RECV_BUF_SIZE.
+ */
+
+/*  Every fragment starts with a fixed 4-byte header:
+    [msg id (hi)][msg id (lo)][fragment index][fragment count] */
+#define FRAGMENT_HEADER_SIZE 4
+// Fragment status (ack) frames carry the received bitmap after the header
+#define FRAGMENT_ACK_SIZE (FRAGMENT_HEADER_SIZE + sizeof(uint32_t))
+// Index reserved to mark a status frame rather than a data fragment
+#define FRAGMENT_ACK_INDEX 0xFF
+// One bit per fragment in a uint32_t bitmap
+#define FRAGMENT_MAX_FRAGMENTS 32
+// Smallest MTU that still leaves room for payload and a status frame
+#define FRAGMENT_MIN_MTU FRAGMENT_ACK_SIZE
+// Largest MTU, fragments are built on the stack
+#define FRAGMENT_MAX_MTU 512
+// Largest logical message that can be reassembled
+#define FRAGMENT_MAX_MSG_SIZE 2048
+// Number of messages that can be reassembled at the same time
+#define FRAGMENT_RX_POOL_SIZE 4
+// Completed messages remembered, so late fragments are re-acked, not re-delivered
+#define FRAGMENT_RX_DONE_SIZE 8
+
+typedef enum {
+    FRAGMENT_OK = 0,
+    FRAGMENT_INCOMPLETE,
+    FRAGMENT_INVALID_MTU,
+    FRAGMENT_INVALID_HEADER,
+    FRAGMENT_MSG_TOO_LARGE,
+    FRAGMENT_NO_SLOT,
+    FRAGMENT_DUPLICATE,
+} fragment_ret_t;
+
+struct fragment_header {
+    uint16_t msg_id;
+    uint8_t index;
+    uint8_t count;
+};
+
+/**
+ * @brief   Called for every fragment that should go out on the link
+ *
+ * @param   frag        :   fragment bytes, header included
+ * @param   len         :   number of bytes in the fragment
+ * @param   user_data   :   user data given to the send function
+ */
+typedef void (*fragment_emit_t)(const uint8_t *frag, size_t len, void *user_data);
+
+/**
+ * @brief Sender side state for a single logical message
+ * @param   msg     :   the message being fragmented (not copied)
+ * @param   len     :   length of the message
+ * @param   msg_id  :   id shared by every fragment of the message
+ * @param   mtu     :   size of a fragment, header included
+ * @param   count   :   how many fragments the message is split into
+ * @param   pending :   bitmap of fragments not yet acknowledged
+ */
+struct fragment_tx {
+    const uint8_t *msg;
+    size_t len;
+    uint16_t msg_id;
+    size_t mtu;
+    uint8_t count;
+    uint32_t pending;
+};
+
+typedef struct fragment_tx* fragment_tx_t;
+
+/**
+ * @brief Reassembly slot for one logical message
+ * @param   in_use      :   slot is holding a message
+ * @param   msg_id      :   id of the message being reassembled
+ * @param   count       :   how many fragments are expected
+ * @param   received    :   bitmap of fragments received so far
+ * @param   last_used   :   receiver clock when a fragment last arrived
+ * @param   len         :   length of the reassembled message (valid once complete)
+ * @param   buffer      :   reassembly buffer
+ */
+struct fragment_rx_slot {
+    bool in_use;
+    uint16_t msg_id;
+    uint8_t count;
+    uint32_t received;
+    uint32_t last_used;
+    size_t len;
+    uint8_t buffer[FRAGMENT_MAX_MSG_SIZE];
+};
+
+/**
+ * @brief A message that has been reassembled
+ * @param   msg_id  :   its id
+ * @param   count   :   how many fragments it had, to ack them all again
+ */
+struct fragment_rx_done {
+    uint16_t msg_id;
+    uint8_t count;
+};
+
+/**
+ * @brief Receiver state
+ * @param   mtu         :   link MTU
+ * @param   clock       :   counts fragments, to find the least recently used slot
+ * @param   slots       :   reassembly pool
+ * @param   done        :   ring of the most recently completed messages
+ * @param   done_next   :   where the next completed message goes
+ * @param   done_count  :   entries of done in use
+ * @param   evicted     :   partial messages dropped to make room
+ */
+struct fragment_rx {
+    size_t mtu;
+    uint32_t clock;
+    struct fragment_rx_slot slots[FRAGMENT_RX_POOL_SIZE];
+    struct fragment_rx_done done[FRAGMENT_RX_DONE_SIZE];
+    uint8_t done_next;
+    uint8_t done_count;
+    uint32_t evicted;
+};
+
+typedef struct fragment_rx* fragment_rx_t;
+
+/**
+ * @brief   Prepare a message for fragmentation. Every fragment starts
+ *          out pending.
+ *
+ * @param   tx      :   sender state to initialise
+ * @param   msg     :   message to fragment. Must stay valid until acknowledged
+ * @param   len     :   length of the message
+ * @param   msg_id  :   id for the message
+ * @param   mtu     :   link MTU (header included)
+ *
+ * @retval  FRAGMENT_OK on success
+ * @retval  FRAGMENT_INVALID_MTU if the mtu is below FRAGMENT_MIN_MTU or
+ *          above FRAGMENT_MAX_MTU
+ * @retval  FRAGMENT_MSG_TOO_LARGE if the message needs too many fragments
+ */
+fragment_ret_t fragment_tx_init(fragment_tx_t tx, const uint8_t *msg, size_t len, uint16_t msg_id, size_t mtu);
+
+/**
+ * @brief   Build a single fragment of the message
+ *
+ * @param   tx          :   sender state
+ * @param   index       :   fragment to build
+ * @param   dest        :   buffer to write into
+ * @param   dest_size   :   size of the buffer
+ *
+ * @returns Number of bytes written, 0 if the fragment could not be built
+ */
+size_t fragment_tx_build(fragment_tx_t tx, uint8_t index, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   Emit every fragment that is still pending. After an ack
+ *          this only sends the fragments the receiver is missing.
+ *
+ * @param   tx          :   sender state
+ * @param   emit        :   called once per fragment
+ * @param   user_data   :   passed through to emit
+ *
+ * @returns Number of fragments emitted
+ */
+uint8_t fragment_tx_send(fragment_tx_t tx, fragment_emit_t emit, void *user_data);
+
+/**
+ * @brief   Process a status frame from the receiver
+ *
+ * @param   tx      :   sender state
+ * @param   frame   :   status frame bytes
+ * @param   len     :   length of the status frame
+ *
+ * @retval  FRAGMENT_OK if every fragment has been acknowledged
+ * @retval  FRAGMENT_INCOMPLETE if fragments are still pending
+ * @retval  FRAGMENT_INVALID_HEADER if the frame is not a status frame for this message
+ */
+fragment_ret_t fragment_tx_handle_ack(fragment_tx_t tx, const uint8_t *frame, size_t len);
+
+/**
+ * @brief   Initialise the receiver and its reassembly pool
+ *
+ * @param   rx  :   receiver state
+ * @param   mtu :   link MTU (header included). Must match the sender's
+ *
+ * @retval  FRAGMENT_OK on success
+ * @retval  FRAGMENT_INVALID_MTU if the mtu cannot hold a fragment
+ */
+fragment_ret_t fragment_rx_init(fragment_rx_t rx, size_t mtu);
+
+/**
+ * @brief   Feed a received fragment into the reassembly pool
+ *
+ * @param   rx          :   receiver state
+ * @param   frag        :   fragment bytes, header included
+ * @param   len         :   length of the fragment
+ * @param   complete    :   set to the finished slot once the message is reassembled
+ *
+ *          When every slot is taken, the partial message that has gone
+ *          longest without a fragment is dropped to make room.
+ *
+ * @retval  FRAGMENT_OK when the message is complete
+ * @retval  FRAGMENT_INCOMPLETE when fragments are still missing
+ * @retval  FRAGMENT_DUPLICATE if the fragment was already received, or
+ *          belongs to a recently completed message. Ack it again, the
+ *          sender missed the last status frame
+ * @retval  FRAGMENT_NO_SLOT if every slot holds a complete message that
+ *          has not been released
+ * @retval  FRAGMENT_INVALID_HEADER if the fragment is malformed
+ */
+fragment_ret_t fragment_rx_receive(
+    fragment_rx_t rx,
+    const uint8_t *frag,
+    size_t len,
+    struct fragment_rx_slot **complete);
+
+/**
+ * @brief   Build a status frame telling the sender which fragments
+ *          of a message have arrived
+ *
+ * @param   rx          :   receiver state
+ * @param   msg_id      :   message to report on
+ * @param   dest        :   buffer to write into
+ * @param   dest_size   :   size of the buffer
+ *
+ * @returns Number of bytes written, 0 if the message is unknown. A
+ *          recently completed message is acked in full, even once its
+ *          slot has been released
+ */
+size_t fragment_rx_build_ack(fragment_rx_t rx, uint16_t msg_id, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   Return a reassembly slot to the pool
+ *
+ * @param   rx      :   receiver state
+ * @param   slot    :   slot handed out by fragment_rx_receive
+ */
+void fragment_rx_release(fragment_rx_t rx, struct fragment_rx_slot *slot);
+
+/**
+ * @brief   Number of payload bytes a single fragment can carry
+ */
+static inline size_t fragment_payload_size(size_t mtu)
+{
+    return mtu - FRAGMENT_HEADER_SIZE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_FRAGMENT_H */
@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include "framer.h"
+
+#define FRAMER_PREAMBLE '!'
+#define FRAMER_CRC_MARKER '#'
+
+LOG_MODULE_REGISTER(bbbled_framer, LOG_LEVEL_DBG);
+
+static inline void start_frame(framer_t framer)
+{
+    framer->buffer[0] = FRAMER_PREAMBLE;
+    framer->len = 1;
+    framer->crc_chars = 0;
+    framer->state = FRAMER_BODY;
+}
+
+static inline void drop_frame(framer_t framer)
+{
+    framer->dropped += framer->len;
+    framer->len = 0;
+    framer->state = FRAMER_WAIT_PREAMBLE;
+}
+
+void framer_init(framer_t framer, framer_frame_cb_t frame_cb, void *user_data)
+{
+    __ASSERT(framer, "Invalid framer ptr");
+
+    framer->mode = FRAMER_MODE_TEXT;
+    framer->frame_cb = frame_cb;
+    framer->user_data = user_data;
+    framer->dropped = 0;
+    framer->corrupt = 0;
+    framer_reset(framer);
+}
+
+void framer_set_mode(framer_t framer, framer_mode_t mode)
+{
+    framer->mode = mode;
+    framer_reset(framer);
+}
+
+void framer_reset(framer_t framer)
+{
+    /*  COBS has no start marker, whatever comes next is taken as the
+        start of a frame. If it wasn't, it fails to decode or fails
+        its CRC and we are back in sync at the next delimiter */
+    framer->state = (framer->mode == FRAMER_MODE_COBS) ? FRAMER_BODY : FRAMER_WAIT_PREAMBLE;
+    framer->len = 0;
+    framer->crc_chars = 0;
+}
+
+size_t framer_encode(framer_mode_t mode, const uint8_t *frame, size_t len, uint8_t *dest, size_t dest_size)
+{
+    size_t encoded;
+
+    if (mode == FRAMER_MODE_TEXT)
+    {
+        if (len > dest_size)
+        {
+            return 0;
+        }
+        memcpy(dest, frame, len);
+        return len;
+    }
+
+    if (dest_size == 0)
+    {
+        return 0;
+    }
+
+    encoded = cobs_encode(frame, len, dest, dest_size - 1);
+    if (encoded == 0)
+    {
+        return 0;
+    }
+    dest[encoded] = COBS_DELIMITER;
+
+    return encoded + 1;
+}
+
+/**
+ * @brief   A delimiter: decode what we have in place and hand it on
+ *
+ * @retval  true if a frame was handed on
+ */
+static bool end_cobs_frame(framer_t framer)
+{
+    bool delivered = false;
+
+    if (framer->state == FRAMER_BODY && framer->len)
+    {
+        int decoded = cobs_decode(framer->buffer, framer->len, framer->buffer, FRAMER_BUF_SIZE);
+
+        if (decoded > 0)
+        {
+            framer->buffer[decoded] = '\0';
+            if (framer->frame_cb)
+            {
+                framer->frame_cb(framer->buffer, decoded, framer->user_data);
+            }
+            delivered = true;
+        }
+        else
+        {
+            LOG_DBG("dropping corrupt frame [%d bytes]", (int) framer->len);
+            framer->dropped += framer->len;
+            framer->corrupt++;
+        }
+    }
+
+    /*  Whatever happened, the next byte starts a frame */
+    framer->len = 0;
+    framer->state = FRAMER_BODY;
+
+    return delivered;
+}
+
+static size_t feed_cobs(framer_t framer, const uint8_t *data, size_t len)
+{
+    size_t frames = 0;
+
+    for (size_t index = 0; index < len; ++index)
+    {
+        uint8_t byte = data[index];
+
+        if (byte == COBS_DELIMITER)
+        {
+            frames += end_cobs_frame(framer);
+            continue;
+        }
+
+        if (framer->state == FRAMER_WAIT_PREAMBLE)
+        {
+            /*  Overran the buffer, sit it out until the delimiter */
+            framer->dropped++;
+            continue;
+        }
+
+        if (framer->len == FRAMER_COBS_BUF_SIZE)
+        {
+            LOG_WRN("frame too long, dropping");
+            drop_frame(framer);
+            framer->dropped++;
+            continue;
+        }
+
+        framer->buffer[framer->len++] = byte;
+    }
+
+    return frames;
+}
+
+size_t framer_feed(framer_t framer, const uint8_t *data, size_t len)
+{
+    size_t frames = 0;
+    size_t index = 0;
+
+    if (framer->mode == FRAMER_MODE_COBS)
+    {
+        return feed_cobs(framer, data, len);
+    }
+
+    while (index < len)
+    {
+        uint8_t byte;
+
+        if (framer->state == FRAMER_WAIT_PREAMBLE)
+        {
+            /*  Everything up to the next preamble is noise */
+            size_t skip = os_find_delim(data + index, len - index, FRAMER_PREAMBLE, FRAMER_PREAMBLE);
+
+            framer->dropped += skip;
+            index += skip;
+            if (index == len)
+            {
+                break;
+            }
+        }
+        else if (framer->state == FRAMER_BODY)
+        {
+            /*  Only the markers need looking at, copy the run up to
+                the next one in one go */
+            size_t run = os_find_delim(data + index, len - index, FRAMER_PREAMBLE, FRAMER_CRC_MARKER);
+            size_t room = FRAMER_BUF_SIZE - framer->len;
+
+            if (run > room)
+            {
+                LOG_WRN("frame too long, dropping");
+                framer->len = FRAMER_BUF_SIZE;
+                drop_frame(framer);
+                framer->dropped++;
+                index += room + 1;
+                continue;
+            }
+
+            memcpy(&framer->buffer[framer->len], data + index, run);
+            framer->len += run;
+            index += run;
+            if (index == len)
+            {
+                break;
+            }
+        }
+
+        byte = data[index++];
+
+        if (byte == FRAMER_PREAMBLE)
+        {
+            /*  A preamble always starts a new frame. Whatever we
+                had so far was truncated */
+            if (framer->state != FRAMER_WAIT_PREAMBLE)
+            {
+                LOG_DBG("dropping truncated frame [%d bytes]", (int) framer->len);
+                drop_frame(framer);
+            }
+            start_frame(framer);
+            continue;
+        }
+
+        if (framer->len == FRAMER_BUF_SIZE)
+        {
+            LOG_WRN("frame too long, dropping");
+            drop_frame(framer);
+            framer->dropped++;
+            continue;
+        }
+
+        framer->buffer[framer->len++] = byte;
+
+        if (framer->state == FRAMER_BODY)
+        {
+            /*  Nothing else stops a run in the body */
+            framer->state = FRAMER_CRC;
+        }
+        else if (++framer->crc_chars == FRAMER_CRC_CHARS)
+        {
+            framer->buffer[framer->len] = '\0';
+
+            if (framer->frame_cb)
+            {
+                framer->frame_cb(framer->buffer, framer->len, framer->user_data);
+            }
+            ++frames;
+            framer_reset(framer);
+        }
+    }
+
+    return frames;
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef _BBBLED_FRAMER_H
+#define _BBBLED_FRAMER_H
+
+#include "os.h"
+#include "cobs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same as PROTOCOL_RECV_BUF_SIZE
+#define FRAMER_BUF_SIZE 512
+// Number of hex characters after the CRC marker
+#define FRAMER_CRC_CHARS 4
+// Longest COBS encoded frame, a full frame once stuffed
+#define FRAMER_COBS_BUF_SIZE COBS_MAX_ENCODED_SIZE(FRAMER_BUF_SIZE)
+
+/**
+ * @brief   Called for every complete frame found in the stream
+ *
+ * @param   frame       :   frame bytes, from the preamble up to the last CRC
+ *                          character. Null terminated so it can go straight to parse()
+ * @param   len         :   length of the frame
+ * @param   user_data   :   user data given to framer_init
+ */
+typedef void (*framer_frame_cb_t)(const uint8_t *frame, size_t len, void *user_data);
+
+typedef enum {
+    // '!' starts a frame, 4 hex characters after the '#' end it
+    FRAMER_MODE_TEXT = 0,
+    // COBS encoded frames, each followed by a 0x00 delimiter
+    FRAMER_MODE_COBS,
+} framer_mode_t;
+
+typedef enum {
+    FRAMER_WAIT_PREAMBLE = 0,
+    FRAMER_BODY,
+    FRAMER_CRC,
+} framer_state_t;
+
+/**
+ * @brief Splits a byte stream (e.g. CDC-ACM) into protocol frames
+ * @param   mode        :   how frames are delimited
+ * @param   state       :   where we are in the current frame
+ * @param   buffer      :   frame being assembled
+ * @param   len         :   bytes in the buffer
+ * @param   crc_chars   :   CRC characters seen so far
+ * @param   dropped     :   bytes discarded while resynchronising
+ * @param   corrupt     :   COBS frames that failed to decode
+ * @param   frame_cb    :   called for each complete frame
+ * @param   user_data   :   passed through to frame_cb
+ */
+struct framer {
+    framer_mode_t mode;
+    framer_state_t state;
+    uint8_t buffer[FRAMER_COBS_BUF_SIZE + 1];
+    size_t len;
+    uint8_t crc_chars;
+    size_t dropped;
+    size_t corrupt;
+    framer_frame_cb_t frame_cb;
+    void *user_data;
+};
+
+typedef struct framer* framer_t;
+
+/**
+ * @brief   Initialise a framer
+ *
+ * @param   framer      :   framer to initialise
+ * @param   frame_cb    :   called for each complete frame
+ * @param   user_data   :   passed through to frame_cb
+ */
+void framer_init(framer_t framer, framer_frame_cb_t frame_cb, void *user_data);
+
+/**
+ * @brief   Switch how frames are delimited. Throws away any partial frame.
+ *
+ * @param   framer  :   framer
+ * @param   mode    :   FRAMER_MODE_TEXT (the default) or FRAMER_MODE_COBS
+ */
+void framer_set_mode(framer_t framer, framer_mode_t mode);
+
+/**
+ * @brief   Encode a frame for the wire in the given mode
+ *
+ * @param   mode        :   framing mode
+ * @param   frame       :   frame from the serialiser
+ * @param   len         :   length of the frame
+ * @param   dest        :   where to write the bytes to send
+ * @param   dest_size   :   room in dest
+ *
+ * @returns Bytes to send, 0 if dest is too small
+ */
+size_t framer_encode(framer_mode_t mode, const uint8_t *frame, size_t len, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   Feed stream bytes into the framer. Frames are handed to the
+ *          callback as soon as their last CRC character arrives. A
+ *          preamble in the middle of a frame, or a frame that outgrows
+ *          the buffer, throws the partial frame away.
+ *
+ *          In COBS mode every 0x00 ends a frame, so a corrupted frame
+ *          costs that frame and nothing more. Frames are handed on
+ *          decoded.
+ *
+ * @param   framer  :   framer
+ * @param   data    :   bytes from the stream
+ * @param   len     :   number of bytes
+ *
+ * @returns Number of complete frames found
+ */
+size_t framer_feed(framer_t framer, const uint8_t *data, size_t len);
+
+/**
+ * @brief   Throw away any partially assembled frame
+ */
+void framer_reset(framer_t framer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_FRAMER_H */
@@ -6,10 +6,10 @@
 
 /**
  * @file
- * @brief Sample echo app for CDC ACM class
+ * @brief BBBLed dongle
  *
- * Sample app for USB CDC ACM class driver. The received data is echoed back
- * to the serial port.
+ * Receives protocol frames from the BeagleBone over USB CDC ACM. How bytes
+ * get on and off the UART is up to the transport picked in Kconfig.
  */
 
 #include <stdio.h>
@@ -17,21 +17,37 @@
 #include <zephyr/device.h>
 #include <zephyr/drivers/uart.h>
 #include <zephyr/kernel.h>
-#include <zephyr/sys/ring_buffer.h>
 
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/usbd.h>
 #include <zephyr/logging/log.h>
-LOG_MODULE_REGISTER(cdc_acm_echo, LOG_LEVEL_DBG);
 
-const struct device *const uart_dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
-
-#define RING_BUF_SIZE 1024
-uint8_t ring_buffer[RING_BUF_SIZE];
-
-struct ring_buf ringbuf;
-
-static bool rx_throttled;
+#include "protocol.h"
+#include "protocol_loop.h"
+#include "proto_shell.h"
+#include "transport.h"
+
+LOG_MODULE_REGISTER(bbbled_main, LOG_LEVEL_DBG);
+
+/* The shell has the other CDC-ACM port */
+const struct device *const uart_dev = DEVICE_DT_GET(DT_NODELABEL(cdc_acm_uart0));
+
+static struct transport transport;
+static struct protocol_ctx protocol;
+static struct protocol_loop protocol_loop;
+static os_timer_t resend_timer;
+static uint8_t rx_frame[PROTOCOL_RECV_BUF_SIZE];
+#if defined(CONFIG_BBBLED_CAPTURE)
+static struct capture capture;
+static uint8_t capture_buf[CONFIG_BBBLED_CAPTURE_BUF_SIZE];
+#endif
+#if defined(CONFIG_BBBLED_PALETTE)
+static struct palette palette;
+#endif
+#if defined(CONFIG_BBBLED_EFFECTS)
+static struct effect_engine effects;
+static os_timer_t effect_timer;
+#endif
 
 static inline void print_baudrate(const struct device *dev)
 {
@@ -106,132 +122,145 @@ static int enable_usb_device_next(void)
 }
 #endif /* defined(CONFIG_USB_DEVICE_STACK_NEXT) */
 
-static void interrupt_handler(const struct device *dev, void *user_data)
+#if CONFIG_BBBLED_TRANSPORT_STATS_INTERVAL_MS > 0
+static void log_transport_stats(void)
 {
-	ARG_UNUSED(user_data);
-
-	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
-		if (!rx_throttled && uart_irq_rx_ready(dev)) {
-			int recv_len, rb_len;
-			uint8_t buffer[64];
-			size_t len = MIN(ring_buf_space_get(&ringbuf),
-					 sizeof(buffer));
-
-			if (len == 0) {
-				/* Throttle because ring buffer is full */
-				uart_irq_rx_disable(dev);
-				rx_throttled = true;
-				continue;
-			}
-
-			recv_len = uart_fifo_read(dev, buffer, len);
-			if (recv_len < 0) {
-				LOG_ERR("Failed to read UART FIFO");
-				recv_len = 0;
-			};
-
-			rb_len = ring_buf_put(&ringbuf, buffer, recv_len);
-			if (rb_len < recv_len) {
-				LOG_ERR("Drop %u bytes", recv_len - rb_len);
-			}
-
-			LOG_DBG("tty fifo -> ringbuf %d bytes", rb_len);
-			if (rb_len) {
-				uart_irq_tx_enable(dev);
-			}
-		}
-
-		if (uart_irq_tx_ready(dev)) {
-			uint8_t buffer[64];
-			int rb_len, send_len;
-
-			rb_len = ring_buf_get(&ringbuf, buffer, sizeof(buffer));
-			if (!rb_len) {
-				LOG_DBG("Ring buffer empty, disable TX IRQ");
-				uart_irq_tx_disable(dev);
-				continue;
-			}
-
-			if (rx_throttled) {
-				uart_irq_rx_enable(dev);
-				rx_throttled = false;
-			}
-
-			send_len = uart_fifo_fill(dev, buffer, rb_len);
-			if (send_len < rb_len) {
-				LOG_ERR("Drop %d bytes", rb_len - send_len);
-			}
+	static uint32_t last_ms;
+	uint32_t now = k_uptime_get_32();
+	struct transport_stats stats;
 
-			LOG_DBG("ringbuf -> tty fifo %d bytes", send_len);
-		}
+	if (now - last_ms < CONFIG_BBBLED_TRANSPORT_STATS_INTERVAL_MS) {
+		return;
 	}
+
+	transport_stats_get(&transport, &stats);
+	transport_stats_reset(&transport);
+
+	LOG_INF("rx %u B/s, tx %u B/s, %u us/KB, %u dropped",
+		(uint32_t)((uint64_t)stats.rx_bytes * 1000U / (now - last_ms)),
+		(uint32_t)((uint64_t)stats.tx_bytes * 1000U / (now - last_ms)),
+		transport_us_per_kb(&stats), stats.rx_dropped);
+
+	/* Frames per USB write: how much the latency budget is buying */
+	const struct tx_coalesce_stats *coalesce = &protocol_loop.coalesce.stats;
+
+	LOG_INF("tx %u writes, %u.%02u frames/write, %u full, %u on budget",
+		coalesce->writes,
+		tx_coalesce_frames_per_write_x100(coalesce) / 100U,
+		tx_coalesce_frames_per_write_x100(coalesce) % 100U,
+		coalesce->full_flushes, coalesce->timer_flushes);
+	LOG_INF("frames/write 0:%u 1:%u 2:%u 3:%u 4:%u 5:%u 6:%u 7:%u 8+:%u",
+		coalesce->frames_per_write[0], coalesce->frames_per_write[1],
+		coalesce->frames_per_write[2], coalesce->frames_per_write[3],
+		coalesce->frames_per_write[4], coalesce->frames_per_write[5],
+		coalesce->frames_per_write[6], coalesce->frames_per_write[7],
+		coalesce->frames_per_write[8]);
+
+	/* Buffer pressure per size class, and copies the frames needed */
+	struct pbuf_stats pbufs;
+
+	pbuf_stats_get(&pbufs);
+	pbuf_stats_reset();
+
+	LOG_INF("pbuf small %u/%u peak, medium %u/%u, large %u/%u, %u failed, %u B copied",
+		pbufs.classes[0].peak, PBUF_SMALL_COUNT,
+		pbufs.classes[1].peak, PBUF_MEDIUM_COUNT,
+		pbufs.classes[2].peak, PBUF_LARGE_COUNT,
+		pbufs.classes[0].failures + pbufs.classes[1].failures + pbufs.classes[2].failures,
+		pbufs.bytes_copied);
+	last_ms = now;
 }
+#endif
 
 int main(void)
 {
 	int ret;
 
-// 	if (!device_is_ready(uart_dev)) {
-// 		LOG_ERR("CDC ACM device not ready");
-// 		return 0;
-// 	}
-
-// #if defined(CONFIG_USB_DEVICE_STACK_NEXT)
-// 		ret = enable_usb_device_next();
-// #else
-// 		ret = usb_enable(NULL);
-// #endif
+	if (!device_is_ready(uart_dev)) {
+		LOG_ERR("CDC ACM device not ready");
+		return 0;
+	}
 
-// 	if (ret != 0) {
-// 		LOG_ERR("Failed to enable USB");
-// 		return 0;
-// 	}
+#if defined(CONFIG_USB_DEVICE_STACK_NEXT)
+	ret = enable_usb_device_next();
+#elif !defined(CONFIG_USB_DEVICE_INITIALIZE_AT_BOOT)
+	ret = usb_enable(NULL);
+#else
+	ret = 0;
+#endif
+
+	if (ret != 0) {
+		LOG_ERR("Failed to enable USB");
+		return 0;
+	}
 
 	LOG_INF("USB device enabled");
 
-// 	ring_buf_init(&ringbuf, sizeof(ring_buffer), ring_buffer);
-
-// 	LOG_INF("Wait for DTR");
+	LOG_INF("Wait for DTR");
 
-// #if defined(CONFIG_USB_DEVICE_STACK_NEXT)
-// 	k_sem_take(&dtr_sem, K_FOREVER);
-// #else
-// 	while (true) {
-// 		uint32_t dtr = 0U;
-
-// 		uart_line_ctrl_get(uart_dev, UART_LINE_CTRL_DTR, &dtr);
-// 		if (dtr) {
-// 			break;
-// 		} else {
-// 			/* Give CPU resources to low priority threads. */
-// 			k_sleep(K_MSEC(100));
-// 		}
-// 	}
-// #endif
+#if defined(CONFIG_USB_DEVICE_STACK_NEXT)
+	k_sem_take(&dtr_sem, K_FOREVER);
+#else
+	while (true) {
+		uint32_t dtr = 0U;
 
-// 	LOG_INF("DTR set");
+		uart_line_ctrl_get(uart_dev, UART_LINE_CTRL_DTR, &dtr);
+		if (dtr) {
+			break;
+		} else {
+			/* Give CPU resources to low priority threads. */
+			k_sleep(K_MSEC(100));
+		}
+	}
+#endif
 
-// 	/* They are optional, we use them to test the interrupt endpoint */
-// 	ret = uart_line_ctrl_set(uart_dev, UART_LINE_CTRL_DCD, 1);
-// 	if (ret) {
-// 		LOG_WRN("Failed to set DCD, ret code %d", ret);
-// 	}
+	LOG_INF("DTR set");
 
-// 	ret = uart_line_ctrl_set(uart_dev, UART_LINE_CTRL_DSR, 1);
-// 	if (ret) {
-// 		LOG_WRN("Failed to set DSR, ret code %d", ret);
-// 	}
+	/* Wait 100ms for the host to do all settings */
+	k_msleep(100);
 
-// 	/* Wait 100ms for the host to do all settings */
-// 	k_msleep(100);
+#ifndef CONFIG_USB_DEVICE_STACK_NEXT
+	print_baudrate(uart_dev);
+#endif
 
-// #ifndef CONFIG_USB_DEVICE_STACK_NEXT
-// 	print_baudrate(uart_dev);
-// #endif
-// 	uart_irq_callback_set(uart_dev, interrupt_handler);
+	ret = transport_init(&transport, uart_dev);
+	if (ret) {
+		LOG_ERR("Failed to start transport [%d]", ret);
+		return 0;
+	}
 
-// 	/* Enable rx interrupts */
-// 	uart_irq_rx_enable(uart_dev);
+	protocol_init(&protocol, rx_frame, sizeof(rx_frame), &resend_timer);
+	protocol_loop_init(&protocol_loop, &protocol, &transport);
+
+#if defined(CONFIG_BBBLED_CAPTURE)
+	capture_init(&capture, capture_buf, sizeof(capture_buf), CONFIG_BBBLED_CAPTURE_SNAPLEN);
+	protocol_loop_set_capture(&protocol_loop, &capture);
+#if defined(CONFIG_BBBLED_SHELL)
+	proto_shell_set_capture(&capture);
+#endif
+#endif
+
+#if defined(CONFIG_BBBLED_PALETTE)
+	palette_init(&palette);
+	protocol_loop_set_palette(&protocol_loop, &palette);
+#endif
+
+#if defined(CONFIG_BBBLED_EFFECTS)
+	/* No link past this one yet, so what is rendered comes back to the
+	 * host. Off by default until the downstream link exists.
+	 */
+	effect_engine_init(&effects, &effect_timer, protocol_loop_effect_emit, &protocol);
+	protocol_loop_set_effects(&protocol_loop, &effects);
+#endif
+
+#if CONFIG_BBBLED_TRANSPORT_STATS_INTERVAL_MS > 0
+	while (true) {
+		protocol_loop_step(&protocol_loop, K_MSEC(CONFIG_BBBLED_TRANSPORT_STATS_INTERVAL_MS));
+		log_transport_stats();
+	}
+#else
+	protocol_loop_run(&protocol_loop);
+#endif
 
 	return 0;
-}
+}
\ No newline at end of file
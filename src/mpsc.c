@@ -0,0 +1,75 @@
+#include "mpsc.h"
+
+/*
+ * Vyukov's intrusive MPSC queue. Producers exchange themselves into the
+ * head and then link the previous head to themselves. The consumer walks
+ * from the tail following the links. The stub node stands in whenever
+ * the consumer has taken everything, so there is always a node to link
+ * on to and the consumer never needs to touch the head to pop.
+ */
+
+void mpsc_init(mpsc_t queue)
+{
+    __ASSERT(queue, "Invalid queue ptr");
+
+    os_atomic_ptr_set(&queue->stub.next, NULL);
+    os_atomic_ptr_set(&queue->head, &queue->stub);
+    queue->tail = &queue->stub;
+}
+
+void mpsc_push(mpsc_t queue, struct mpsc_node *node)
+{
+    struct mpsc_node *prev;
+
+    os_atomic_ptr_set(&node->next, NULL);
+    prev = os_atomic_ptr_set(&queue->head, node);
+
+    /*  Until this store lands the consumer can't see node, or anything
+        pushed after it */
+    os_atomic_ptr_set(&prev->next, node);
+}
+
+struct mpsc_node *mpsc_pop(mpsc_t queue)
+{
+    struct mpsc_node *tail = queue->tail;
+    struct mpsc_node *next = os_atomic_ptr_get(&tail->next);
+
+    if (tail == &queue->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+
+        /*  Step over the stub */
+        queue->tail = next;
+        tail = next;
+        next = os_atomic_ptr_get(&tail->next);
+    }
+
+    if (next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    /*  tail looks like the last node. If it isn't the head a producer
+        is halfway through linking on to it */
+    if (tail != os_atomic_ptr_get(&queue->head))
+    {
+        return NULL;
+    }
+
+    /*  It really is the last one. Put the stub behind it so it can be
+        taken without leaving the queue without a node */
+    mpsc_push(queue, &queue->stub);
+
+    next = os_atomic_ptr_get(&tail->next);
+    if (next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
\ No newline at end of file
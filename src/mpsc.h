@@ -0,0 +1,67 @@
+#ifndef _BBBLED_MPSC_H
+#define _BBBLED_MPSC_H
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Link embedded in whatever is being queued
+ * @param   next    :   next node towards the tail, written by producers
+ */
+struct mpsc_node {
+    os_atomic_ptr_t next;
+};
+
+/**
+ * @brief Intrusive lock-free queue, any number of producers and a
+ *        single consumer. A push is one atomic exchange and one store,
+ *        so producers never wait on each other or on the consumer and
+ *        can push from an ISR.
+ * @param   head    :   last node pushed, producers swap themselves in here
+ * @param   tail    :   next node to pop, only the consumer touches it
+ * @param   stub    :   keeps the queue non-empty so head is never NULL
+ */
+struct mpsc {
+    os_atomic_ptr_t head;
+    struct mpsc_node *tail;
+    struct mpsc_node stub;
+};
+
+typedef struct mpsc* mpsc_t;
+
+/**
+ * @brief   Initialise an empty queue
+ */
+void mpsc_init(mpsc_t queue);
+
+/**
+ * @brief   Push a node. Safe from any thread or ISR.
+ *
+ * @param   queue   :   queue
+ * @param   node    :   node to push, must not already be queued
+ */
+void mpsc_push(mpsc_t queue, struct mpsc_node *node);
+
+/**
+ * @brief   Pop the oldest node. Consumer only.
+ *
+ *          A producer that has swapped itself in but not yet linked to
+ *          its predecessor hides everything behind it for a moment, so
+ *          NULL can come back while a push is in progress. The producer
+ *          should signal the consumer once mpsc_push() returns, and the
+ *          consumer tries again then.
+ *
+ * @param   queue   :   queue
+ *
+ * @returns The node, NULL if there is nothing (yet) to pop
+ */
+struct mpsc_node *mpsc_pop(mpsc_t queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_MPSC_H */
\ No newline at end of file
@@ -0,0 +1,371 @@
+#ifndef _BBBLED_OS_H
+#define _BBBLED_OS_H
+
+/*
+ * Thin OS abstraction for the protocol core. On Zephyr everything maps
+ * straight onto the kernel primitives and is inlined away. Anywhere
+ * else (the BeagleBone host, Linux benchmarks) the POSIX port in
+ * os_posix.c is used instead.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined(__ZEPHYR__)
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/random/random.h>
+#include <zephyr/logging/log.h>
+
+#else /* !__ZEPHYR__ */
+
+#include <pthread.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#endif
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef BIT
+#define BIT(n) (1UL << (n))
+#endif
+#ifndef CLAMP
+#define CLAMP(val, low, high) (((val) <= (low)) ? (low) : MIN(val, high))
+#endif
+#ifndef DIV_ROUND_UP
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#endif
+#ifndef ROUND_UP
+#define ROUND_UP(x, align) (DIV_ROUND_UP(x, align) * (align))
+#endif
+#ifndef CONTAINER_OF
+#define CONTAINER_OF(ptr, type, field) ((type *)(((char *)(ptr)) - offsetof(type, field)))
+#endif
+#define ARG_UNUSED(x) (void)(x)
+#ifndef BUILD_ASSERT
+#define BUILD_ASSERT(cond, msg) _Static_assert(cond, msg)
+#endif
+
+#ifdef NDEBUG
+#define __ASSERT(test, fmt, ...) ((void)(test))
+#else
+#define __ASSERT(test, fmt, ...) \
+    do { if (!(test)) { os_assert_fail(__FILE__, __LINE__, fmt); } } while (0)
+#endif
+
+void os_assert_fail(const char *file, int line, const char *msg);
+
+/* Logging */
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERR  1
+#define LOG_LEVEL_WRN  2
+#define LOG_LEVEL_INF  3
+#define LOG_LEVEL_DBG  4
+
+// Compile time ceiling on what gets logged, keeps benchmarks quiet
+#ifndef OS_LOG_LEVEL
+#define OS_LOG_LEVEL LOG_LEVEL_WRN
+#endif
+
+void os_log(int level, const char *module, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define LOG_MODULE_REGISTER(name, ...) \
+    static const char *const _os_log_module __attribute__((unused)) = #name
+#define LOG_MODULE_DECLARE(name, ...) LOG_MODULE_REGISTER(name)
+
+#define _OS_LOG(level, ...) \
+    do { if ((level) <= OS_LOG_LEVEL) { os_log(level, _os_log_module, __VA_ARGS__); } } while (0)
+
+#define LOG_ERR(...) _OS_LOG(LOG_LEVEL_ERR, __VA_ARGS__)
+#define LOG_WRN(...) _OS_LOG(LOG_LEVEL_WRN, __VA_ARGS__)
+#define LOG_INF(...) _OS_LOG(LOG_LEVEL_INF, __VA_ARGS__)
+#define LOG_DBG(...) _OS_LOG(LOG_LEVEL_DBG, __VA_ARGS__)
+
+#endif /* __ZEPHYR__ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed-size block allocator
+ */
+
+#if defined(__ZEPHYR__)
+
+typedef struct k_mem_slab os_pool_t;
+
+#define OS_POOL_DEFINE(name, block_size, block_count, align) \
+    K_MEM_SLAB_DEFINE(name, block_size, block_count, align)
+
+static inline int os_pool_alloc(os_pool_t *pool, void **block)
+{
+    return k_mem_slab_alloc(pool, block, K_NO_WAIT);
+}
+
+static inline void os_pool_free(os_pool_t *pool, void *block)
+{
+    k_mem_slab_free(pool, block);
+}
+
+#else
+
+typedef struct os_pool {
+    uint8_t *buffer;
+    size_t block_size;
+    uint32_t num_blocks;
+    uint32_t num_used;
+    uint32_t next_unused;
+    void *free_list;
+    pthread_mutex_t lock;
+} os_pool_t;
+
+#define OS_POOL_DEFINE(name, size, count, align)                                     \
+    static uint8_t __attribute__((aligned(align)))                                   \
+        _os_pool_buf_##name[(count) * ROUND_UP(size, align)];                        \
+    os_pool_t name = {                                                               \
+        .buffer = _os_pool_buf_##name,                                               \
+        .block_size = ROUND_UP(size, align),                                         \
+        .num_blocks = (count),                                                       \
+        .lock = PTHREAD_MUTEX_INITIALIZER,                                           \
+    }
+
+int os_pool_alloc(os_pool_t *pool, void **block);
+void os_pool_free(os_pool_t *pool, void *block);
+
+#endif
+
+/*
+ * Locking, short critical sections only
+ */
+
+#if defined(__ZEPHYR__)
+
+typedef struct k_spinlock os_lock_t;
+typedef k_spinlock_key_t os_lock_key_t;
+
+#define OS_LOCK_INITIALIZER {}
+
+static inline void os_lock_init(os_lock_t *lock)
+{
+    ARG_UNUSED(lock);
+}
+
+static inline os_lock_key_t os_lock(os_lock_t *lock)
+{
+    return k_spin_lock(lock);
+}
+
+static inline void os_unlock(os_lock_t *lock, os_lock_key_t key)
+{
+    k_spin_unlock(lock, key);
+}
+
+#else
+
+typedef pthread_mutex_t os_lock_t;
+typedef int os_lock_key_t;
+
+#define OS_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+static inline void os_lock_init(os_lock_t *lock)
+{
+    pthread_mutex_init(lock, NULL);
+}
+
+static inline os_lock_key_t os_lock(os_lock_t *lock)
+{
+    pthread_mutex_lock(lock);
+    return 0;
+}
+
+static inline void os_unlock(os_lock_t *lock, os_lock_key_t key)
+{
+    ARG_UNUSED(key);
+    pthread_mutex_unlock(lock);
+}
+
+#endif
+
+/*
+ * Atomic counters and pointers. inc/dec and ptr_set return the value
+ * from before the change.
+ */
+
+#if defined(__ZEPHYR__)
+
+typedef atomic_t os_atomic_t;
+
+static inline void os_atomic_set(os_atomic_t *target, int value)
+{
+    atomic_set(target, value);
+}
+
+static inline int os_atomic_get(os_atomic_t *target)
+{
+    return atomic_get(target);
+}
+
+static inline int os_atomic_inc(os_atomic_t *target)
+{
+    return atomic_inc(target);
+}
+
+static inline int os_atomic_dec(os_atomic_t *target)
+{
+    return atomic_dec(target);
+}
+
+typedef atomic_ptr_t os_atomic_ptr_t;
+
+static inline void *os_atomic_ptr_get(os_atomic_ptr_t *target)
+{
+    return atomic_ptr_get(target);
+}
+
+static inline void *os_atomic_ptr_set(os_atomic_ptr_t *target, void *value)
+{
+    return atomic_ptr_set(target, value);
+}
+
+#else
+
+typedef int os_atomic_t;
+
+static inline void os_atomic_set(os_atomic_t *target, int value)
+{
+    __atomic_store_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int os_atomic_get(os_atomic_t *target)
+{
+    return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+}
+
+static inline int os_atomic_inc(os_atomic_t *target)
+{
+    return __atomic_fetch_add(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int os_atomic_dec(os_atomic_t *target)
+{
+    return __atomic_fetch_sub(target, 1, __ATOMIC_SEQ_CST);
+}
+
+typedef void *os_atomic_ptr_t;
+
+static inline void *os_atomic_ptr_get(os_atomic_ptr_t *target)
+{
+    return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+}
+
+static inline void *os_atomic_ptr_set(os_atomic_ptr_t *target, void *value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+/*
+ * Random numbers, CRC, scanning and time. The host versions of the CRC
+ * and the scan are vectorised, see os_simd.h
+ */
+
+#if defined(__ZEPHYR__)
+
+static inline uint16_t os_rand16(void)
+{
+    return sys_rand16_get();
+}
+
+static inline uint16_t os_crc16_ccitt(uint16_t seed, const uint8_t *src, size_t len)
+{
+    return crc16_ccitt(seed, src, len);
+}
+
+static inline size_t os_find_delim(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    size_t index = 0;
+
+    while (index < len && src[index] != first && src[index] != second)
+    {
+        ++index;
+    }
+    return index;
+}
+
+static inline uint32_t os_uptime_ms(void)
+{
+    return k_uptime_get_32();
+}
+
+/*  Wraps cleanly at 2^32 us. Tick resolution without a 64 bit counter */
+static inline uint32_t os_uptime_us(void)
+{
+#if defined(CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER)
+    return (uint32_t) k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+    return (uint32_t) k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
+
+static inline uint32_t os_cycles(void)
+{
+    return k_cycle_get_32();
+}
+
+static inline uint32_t os_cycles_per_sec(void)
+{
+    return sys_clock_hw_cycles_per_sec();
+}
+
+#else
+
+uint16_t os_rand16(void);
+
+/**
+ * @brief   CRC16-CCITT, bit compatible with Zephyr's crc16_ccitt()
+ *
+ * @param   seed    :   initial value, or the CRC so far
+ * @param   src     :   bytes to add to the CRC
+ * @param   len     :   number of bytes
+ */
+uint16_t os_crc16_ccitt(uint16_t seed, const uint8_t *src, size_t len);
+
+/**
+ * @brief   Find the first of either of two bytes
+ *
+ * @param   src     :   bytes to search
+ * @param   len     :   number of bytes
+ * @param   first   :   a byte to look for
+ * @param   second  :   the other, may be the same as first
+ *
+ * @return  index of the first match, len if there is none
+ */
+size_t os_find_delim(const uint8_t *src, size_t len, uint8_t first, uint8_t second);
+
+uint32_t os_uptime_ms(void);
+uint32_t os_uptime_us(void);
+
+/* Monotonic nanoseconds on the host */
+uint32_t os_cycles(void);
+uint32_t os_cycles_per_sec(void);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_OS_H */
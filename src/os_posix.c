@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "os.h"
+
+static const char *level_str[] = {
+    [LOG_LEVEL_NONE] = "",
+    [LOG_LEVEL_ERR] = "err",
+    [LOG_LEVEL_WRN] = "wrn",
+    [LOG_LEVEL_INF] = "inf",
+    [LOG_LEVEL_DBG] = "dbg",
+};
+
+void os_assert_fail(const char *file, int line, const char *msg)
+{
+    fprintf(stderr, "ASSERTION FAIL @ %s:%d: %s\n", file, line, msg);
+    abort();
+}
+
+void os_log(int level, const char *module, const char *fmt, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "<%s> %s: ", level_str[level], module);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+int os_pool_alloc(os_pool_t *pool, void **block)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->free_list)
+    {
+        /*  Freed blocks hold the pointer to the next free block */
+        *block = pool->free_list;
+        pool->free_list = *(void **)pool->free_list;
+    }
+    else if (pool->next_unused < pool->num_blocks)
+    {
+        *block = pool->buffer + (pool->next_unused * pool->block_size);
+        pool->next_unused++;
+    }
+    else
+    {
+        *block = NULL;
+        rc = -ENOMEM;
+    }
+
+    if (rc == 0)
+    {
+        pool->num_used++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return rc;
+}
+
+void os_pool_free(os_pool_t *pool, void *block)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    pool->num_used--;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+uint16_t os_rand16(void)
+{
+    static __thread uint32_t state;
+
+    if (state == 0)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        state = (uint32_t)(ts.tv_nsec ^ ts.tv_sec) | 1;
+    }
+
+    /*  xorshift32, plenty for message numbers */
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return (uint16_t)(state >> 16);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t os_uptime_ms(void)
+{
+    return (uint32_t)(monotonic_ns() / 1000000ULL);
+}
+
+uint32_t os_uptime_us(void)
+{
+    return (uint32_t)(monotonic_ns() / 1000ULL);
+}
+
+uint32_t os_cycles(void)
+{
+    return (uint32_t) monotonic_ns();
+}
+
+uint32_t os_cycles_per_sec(void)
+{
+    return 1000000000UL;
+}
\ No newline at end of file
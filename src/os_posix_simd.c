@@ -0,0 +1,362 @@
+/*
+ * Vector kernels for the host port: the CRC over every frame and the
+ * delimiter scans in the framer and tokeniser. Each kernel is compiled
+ * for its own target, whatever the rest of the build is tuned for, and
+ * the best one the CPU runs is picked on first use.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+
+#include "os_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OS_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define OS_SIMD_ARM 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+typedef uint16_t (*crc_fn_t)(uint16_t seed, const uint8_t *src, size_t len);
+typedef size_t (*find_fn_t)(const uint8_t *src, size_t len, uint8_t first, uint8_t second);
+
+static uint16_t crc_resolve(uint16_t seed, const uint8_t *src, size_t len);
+static size_t find_resolve(const uint8_t *src, size_t len, uint8_t first, uint8_t second);
+
+static crc_fn_t crc_fn = crc_resolve;
+static find_fn_t find_fn = find_resolve;
+static os_simd_t selected = OS_SIMD_SCALAR;
+static pthread_once_t resolved = PTHREAD_ONCE_INIT;
+
+static void select_best(void);
+
+/*
+ * Scalar, the same as the firmware
+ */
+
+static uint16_t crc_scalar(uint16_t seed, const uint8_t *src, size_t len)
+{
+    for (; len > 0; len--)
+    {
+        uint8_t e, f;
+
+        e = seed ^ *src++;
+        f = e ^ (e << 4);
+        seed = (seed >> 8) ^ ((uint16_t)f << 8) ^ ((uint16_t)f << 3) ^ ((uint16_t)f >> 4);
+    }
+
+    return seed;
+}
+
+static size_t find_scalar(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    size_t index = 0;
+
+    while (index < len && src[index] != first && src[index] != second)
+    {
+        ++index;
+    }
+    return index;
+}
+
+/*
+ * Folding CRC. The CRC is reflected, so a 16 byte block loaded little
+ * endian has its highest degree coefficient in bit 0. A block B is
+ * folded into the next one as B * x^128 mod P, split in 64 bit halves:
+ *
+ *   low half  (degrees 64..127) * (x^191 mod P)
+ *   high half (degrees 0..63)   * (x^127 mod P)
+ *
+ * One less than the shift in each, as a carry-less multiply of two
+ * reflected values comes out one bit short. The constants are reflected
+ * into the top of a 64 bit word. What is left after the last fold is
+ * congruent to the message so far, so the scalar CRC of it finishes the
+ * job. The seed is folded in by XORing it into the first two bytes.
+ */
+
+#define CRC_FOLD_191 0xa95d000000000000ULL
+#define CRC_FOLD_127 0x7eea000000000000ULL
+
+/*  Below this the set up costs more than it saves */
+#define CRC_FOLD_MIN_LEN 32
+
+#if defined(OS_SIMD_X86)
+
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc_clmul(uint16_t seed, const uint8_t *src, size_t len)
+{
+    const __m128i fold = _mm_set_epi64x((long long) CRC_FOLD_127, (long long) CRC_FOLD_191);
+    uint8_t rest[16];
+    __m128i acc;
+
+    if (len < CRC_FOLD_MIN_LEN)
+    {
+        return crc_scalar(seed, src, len);
+    }
+
+    acc = _mm_xor_si128(_mm_loadu_si128((const __m128i *) src), _mm_cvtsi32_si128(seed));
+    src += 16;
+    len -= 16;
+
+    for (; len >= 16; src += 16, len -= 16)
+    {
+        __m128i low = _mm_clmulepi64_si128(acc, fold, 0x00);
+        __m128i high = _mm_clmulepi64_si128(acc, fold, 0x11);
+
+        acc = _mm_xor_si128(_mm_xor_si128(low, high), _mm_loadu_si128((const __m128i *) src));
+    }
+
+    _mm_storeu_si128((__m128i *) rest, acc);
+    return crc_scalar(crc_scalar(0, rest, sizeof(rest)), src, len);
+}
+
+__attribute__((target("sse2")))
+static size_t find_sse2(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    const __m128i a = _mm_set1_epi8((char) first);
+    const __m128i b = _mm_set1_epi8((char) second);
+    size_t index = 0;
+
+    for (; index + 16 <= len; index += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (src + index));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, a), _mm_cmpeq_epi8(bytes, b)));
+
+        if (mask)
+        {
+            return index + __builtin_ctz(mask);
+        }
+    }
+
+    return index + find_scalar(src + index, len - index, first, second);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    const __m256i a = _mm256_set1_epi8((char) first);
+    const __m256i b = _mm256_set1_epi8((char) second);
+    size_t index = 0;
+
+    for (; index + 32 <= len; index += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (src + index));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, a), _mm256_cmpeq_epi8(bytes, b)));
+
+        if (mask)
+        {
+            return index + __builtin_ctz(mask);
+        }
+    }
+
+    /*  Short frames and tails are most of what we see, don't leave
+        them to the byte loop */
+    return index + find_sse2(src + index, len - index, first, second);
+}
+
+#elif defined(OS_SIMD_ARM)
+
+#if defined(__aarch64__)
+
+__attribute__((target("+crypto")))
+static uint16_t crc_pmull(uint16_t seed, const uint8_t *src, size_t len)
+{
+    const poly64_t fold_low = (poly64_t) CRC_FOLD_191;
+    const poly64_t fold_high = (poly64_t) CRC_FOLD_127;
+    uint8_t rest[16];
+    uint64x2_t acc;
+
+    if (len < CRC_FOLD_MIN_LEN)
+    {
+        return crc_scalar(seed, src, len);
+    }
+
+    acc = veorq_u64(vreinterpretq_u64_u8(vld1q_u8(src)), vcombine_u64(vcreate_u64(seed), vcreate_u64(0)));
+    src += 16;
+    len -= 16;
+
+    for (; len >= 16; src += 16, len -= 16)
+    {
+        poly128_t low = vmull_p64((poly64_t) vgetq_lane_u64(acc, 0), fold_low);
+        poly128_t high = vmull_p64((poly64_t) vgetq_lane_u64(acc, 1), fold_high);
+
+        acc = veorq_u64(veorq_u64(vreinterpretq_u64_p128(low), vreinterpretq_u64_p128(high)),
+                        vreinterpretq_u64_u8(vld1q_u8(src)));
+    }
+
+    vst1q_u8(rest, vreinterpretq_u8_u64(acc));
+    return crc_scalar(crc_scalar(0, rest, sizeof(rest)), src, len);
+}
+
+#endif /* __aarch64__ */
+
+static size_t find_neon(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    const uint8x16_t a = vdupq_n_u8(first);
+    const uint8x16_t b = vdupq_n_u8(second);
+    size_t index = 0;
+
+    for (; index + 16 <= len; index += 16)
+    {
+        uint8x16_t bytes = vld1q_u8(src + index);
+        uint8x16_t hits = vorrq_u8(vceqq_u8(bytes, a), vceqq_u8(bytes, b));
+        /*  No movemask on NEON. Narrow each byte to a nibble instead */
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+
+        if (mask)
+        {
+            return index + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+
+    return index + find_scalar(src + index, len - index, first, second);
+}
+
+#endif
+
+/*
+ * Selection
+ */
+
+static crc_fn_t crc_for(os_simd_t level)
+{
+#if defined(OS_SIMD_X86)
+    if ((level == OS_SIMD_SSE || level == OS_SIMD_AVX2) && __builtin_cpu_supports("pclmul"))
+    {
+        return crc_clmul;
+    }
+#elif defined(OS_SIMD_ARM) && defined(__aarch64__)
+    if (level == OS_SIMD_NEON && (getauxval(AT_HWCAP) & HWCAP_PMULL))
+    {
+        return crc_pmull;
+    }
+#endif
+    ARG_UNUSED(level);
+    return crc_scalar;
+}
+
+static find_fn_t find_for(os_simd_t level)
+{
+    switch (level)
+    {
+#if defined(OS_SIMD_X86)
+    case OS_SIMD_SSE:
+        return find_sse2;
+    case OS_SIMD_AVX2:
+        return find_avx2;
+#elif defined(OS_SIMD_ARM)
+    case OS_SIMD_NEON:
+        return find_neon;
+#endif
+    default:
+        return find_scalar;
+    }
+}
+
+bool os_simd_supported(os_simd_t level)
+{
+    switch (level)
+    {
+    case OS_SIMD_SCALAR:
+        return true;
+#if defined(OS_SIMD_X86)
+    case OS_SIMD_SSE:
+        return __builtin_cpu_supports("sse2");
+    case OS_SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+#elif defined(OS_SIMD_ARM) && defined(__aarch64__)
+    case OS_SIMD_NEON:
+        return true;
+#elif defined(OS_SIMD_ARM)
+    case OS_SIMD_NEON:
+        return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+    default:
+        return false;
+    }
+}
+
+os_simd_t os_simd_best(void)
+{
+    for (int level = OS_SIMD_NUM_LEVELS - 1; level > OS_SIMD_SCALAR; --level)
+    {
+        if (os_simd_supported(level))
+        {
+            return level;
+        }
+    }
+    return OS_SIMD_SCALAR;
+}
+
+int os_simd_select(os_simd_t level)
+{
+    if (level >= OS_SIMD_NUM_LEVELS || !os_simd_supported(level))
+    {
+        return -ENOTSUP;
+    }
+
+    crc_fn = crc_for(level);
+    find_fn = find_for(level);
+    selected = level;
+    return 0;
+}
+
+os_simd_t os_simd_selected(void)
+{
+    pthread_once(&resolved, select_best);
+    return selected;
+}
+
+const char *os_simd_name(os_simd_t level)
+{
+    static const char *names[OS_SIMD_NUM_LEVELS] = {
+        [OS_SIMD_SCALAR] = "scalar",
+        [OS_SIMD_SSE] = "sse2",
+        [OS_SIMD_AVX2] = "avx2",
+        [OS_SIMD_NEON] = "neon",
+    };
+
+    return (level < OS_SIMD_NUM_LEVELS) ? names[level] : "?";
+}
+
+bool os_simd_has_crc(void)
+{
+    pthread_once(&resolved, select_best);
+    return crc_fn != crc_scalar;
+}
+
+static void select_best(void)
+{
+    /*  Unless someone pinned a level first */
+    if (find_fn == find_resolve)
+    {
+        os_simd_select(os_simd_best());
+    }
+}
+
+static uint16_t crc_resolve(uint16_t seed, const uint8_t *src, size_t len)
+{
+    pthread_once(&resolved, select_best);
+    return crc_fn(seed, src, len);
+}
+
+static size_t find_resolve(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    pthread_once(&resolved, select_best);
+    return find_fn(src, len, first, second);
+}
+
+uint16_t os_crc16_ccitt(uint16_t seed, const uint8_t *src, size_t len)
+{
+    return crc_fn(seed, src, len);
+}
+
+size_t os_find_delim(const uint8_t *src, size_t len, uint8_t first, uint8_t second)
+{
+    return find_fn(src, len, first, second);
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef _BBBLED_OS_SIMD_H
+#define _BBBLED_OS_SIMD_H
+
+/*
+ * Vector kernels behind os_crc16_ccitt() and os_find_delim() on the
+ * host. The best level the CPU has is picked on first use, this is only
+ * needed to pin one, e.g. to benchmark against the scalar code.
+ */
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    // Plain C, the same as the firmware
+    OS_SIMD_SCALAR = 0,
+    // SSE2 scan, PCLMULQDQ CRC where the CPU has it
+    OS_SIMD_SSE,
+    // AVX2 scan, PCLMULQDQ CRC where the CPU has it
+    OS_SIMD_AVX2,
+    // NEON scan, PMULL CRC where the core has it (AArch64 only)
+    OS_SIMD_NEON,
+    OS_SIMD_NUM_LEVELS,
+} os_simd_t;
+
+/**
+ * @brief   Best level this CPU supports
+ */
+os_simd_t os_simd_best(void);
+
+/**
+ * @brief   Whether this build and CPU can run a level
+ */
+bool os_simd_supported(os_simd_t level);
+
+/**
+ * @brief   Use a level from now on. Not thread safe, pin it before
+ *          anything else runs.
+ *
+ * @retval  0 on success
+ * @retval  -ENOTSUP if the build or CPU can't run it
+ */
+int os_simd_select(os_simd_t level);
+
+/**
+ * @brief   The level in use
+ */
+os_simd_t os_simd_selected(void);
+
+/**
+ * @brief   Name of a level, for printing
+ */
+const char *os_simd_name(os_simd_t level);
+
+/**
+ * @brief   Whether the selected level has a vector CRC, or falls back
+ *          to the scalar one
+ */
+bool os_simd_has_crc(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_OS_SIMD_H */
@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <string.h>
+
+#include "palette.h"
+#include "protocol.h"
+
+LOG_MODULE_REGISTER(bbbled_palette, LOG_LEVEL_DBG);
+
+/*  Each packed value's key follows on from the last */
+BUILD_ASSERT(KEY_I5 == KEY_I0 + PALETTE_MAX_VALUES - 1, "palette keys out of order");
+BUILD_ASSERT(PALETTE_MAX_VALUES + 2 <= PROTOCOL_MAX_PARAMS, "a full set_idx doesn't fit in a packet");
+BUILD_ASSERT(PALETTE_MAX_ENTRIES == UINT8_MAX + 1, "indices are a byte");
+
+void palette_init(palette_t palette)
+{
+    __ASSERT(palette, "Invalid palette ptr");
+
+    memset(palette, 0, sizeof(*palette));
+}
+
+void palette_set(palette_t palette, uint8_t index, struct rgb colour)
+{
+    palette->entries[index] = colour;
+    palette->loaded[index / 32] |= BIT(index % 32);
+}
+
+int palette_get(palette_t palette, uint8_t index, struct rgb *colour)
+{
+    if (!(palette->loaded[index / 32] & BIT(index % 32)))
+    {
+        return -ENOENT;
+    }
+
+    *colour = palette->entries[index];
+    return 0;
+}
+
+int palette_apply(palette_t palette, const struct key_val_pair *params, size_t num_params)
+{
+    struct rgb colour = {0};
+    bool have_index = false;
+    uint8_t index = 0;
+
+    /*  The schema has already checked the ranges */
+    for (size_t param = 0; param < num_params; ++param)
+    {
+        switch (params[param].key)
+        {
+            case KEY_INDEX:
+                index = (uint8_t) params[param].value;
+                have_index = true;
+                break;
+            case KEY_RED:
+                colour.red = (uint8_t) params[param].value;
+                break;
+            case KEY_GREEN:
+                colour.green = (uint8_t) params[param].value;
+                break;
+            case KEY_BLUE:
+                colour.blue = (uint8_t) params[param].value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!have_index)
+    {
+        return -EINVAL;
+    }
+
+    palette_set(palette, index, colour);
+    palette->stats.uploads++;
+    return 0;
+}
+
+int palette_expand(palette_t palette, const struct key_val_pair *params, size_t num_params,
+                   palette_emit_t emit, void *user_data)
+{
+    value_t values[PALETTE_MAX_VALUES] = {0};
+    size_t num_values = 0;
+    bool have_target = false;
+    uint16_t target = 0;
+    uint16_t count = 1;
+    int emitted = 0;
+
+    for (size_t param = 0; param < num_params; ++param)
+    {
+        param_key_t key = params[param].key;
+
+        if (key == KEY_TARGET)
+        {
+            target = params[param].value;
+            have_target = true;
+        }
+        else if (key == KEY_COUNT)
+        {
+            count = params[param].value;
+        }
+        else if (key >= KEY_I0 && key <= KEY_I5)
+        {
+            values[key - KEY_I0] = params[param].value;
+            num_values = MAX(num_values, (size_t) (key - KEY_I0) + 1);
+        }
+    }
+
+    if (!have_target || count == 0 || DIV_ROUND_UP(count, PALETTE_INDICES_PER_VALUE) > num_values)
+    {
+        return -EINVAL;
+    }
+
+    for (uint16_t led = 0; led < count; ++led)
+    {
+        value_t packed = values[led / PALETTE_INDICES_PER_VALUE];
+        uint8_t index = (led % PALETTE_INDICES_PER_VALUE) ? (uint8_t) (packed >> 8) : (uint8_t) packed;
+        struct rgb colour;
+
+        if (palette_get(palette, index, &colour))
+        {
+            LOG_DBG("led %u wants entry %u, never uploaded", target + led, index);
+            palette->stats.misses++;
+            continue;
+        }
+
+        emit((uint16_t) (target + led), colour, user_data);
+        emitted++;
+    }
+
+    palette->stats.expanded += emitted;
+    return emitted;
+}
+
+size_t palette_pack(uint16_t target, const uint8_t *indices, size_t count, struct key_val_pair *params)
+{
+    size_t num_params = 0;
+
+    if (count == 0 || count > PALETTE_MAX_PER_FRAME)
+    {
+        return 0;
+    }
+
+    params[num_params++] = (struct key_val_pair) {.key = KEY_TARGET, .value = target};
+    /*  Leave count out for a single LED, it defaults to 1 */
+    if (count > 1)
+    {
+        params[num_params++] = (struct key_val_pair) {.key = KEY_COUNT, .value = (value_t) count};
+    }
+
+    for (size_t led = 0; led < count; led += PALETTE_INDICES_PER_VALUE)
+    {
+        value_t packed = indices[led];
+
+        if (led + 1 < count)
+        {
+            packed |= (value_t) indices[led + 1] << 8;
+        }
+        params[num_params++] = (struct key_val_pair) {
+            .key = (param_key_t) (KEY_I0 + led / PALETTE_INDICES_PER_VALUE),
+            .value = packed,
+        };
+    }
+
+    return num_params;
+}
\ No newline at end of file
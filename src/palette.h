@@ -0,0 +1,132 @@
+#ifndef _BBBLED_PALETTE_H
+#define _BBBLED_PALETTE_H
+
+#include "os.h"
+#include "commands.h"
+#include "effect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Indexed colour. The host uploads a palette once with one `palette`
+ * command per entry, then sends `set_idx` with palette indices instead
+ * of three colour channels per LED:
+ *
+ *   !palette,index:3,red:255,green:128,blue:0,msg:1#1234
+ *   !set_idx,target:40,count:5,i0:771,i1:1027,i2:3,msg:2#abcd
+ *
+ * Values are 16 bit, so each iN carries two indices, the lower byte for
+ * the first LED. count LEDs from target on get a colour, 1 if count is
+ * left out. The dongle expands each LED to a set_rgb before passing it
+ * on, so nothing past the dongle knows about palettes.
+ */
+
+/*  PALETTE_MAX_ENTRIES and PALETTE_MAX_PER_FRAME are in commands_schema.h */
+
+/**
+ * @brief   Gets each LED a set_idx expands to
+ *
+ * @param   target      :   LED to update
+ * @param   colour      :   its colour from the palette
+ * @param   user_data   :   passed through from palette_expand()
+ */
+typedef void (*palette_emit_t)(uint16_t target, struct rgb colour, void *user_data);
+
+/**
+ * @brief Palette statistics
+ * @param   uploads     :   entries uploaded
+ * @param   expanded    :   LEDs set from the palette
+ * @param   misses      :   LEDs skipped because their entry was never uploaded
+ * @param   dropped     :   set_idx frames ACKed with nothing to take their colours
+ */
+struct palette_stats {
+    uint32_t uploads;
+    uint32_t expanded;
+    uint32_t misses;
+    uint32_t dropped;
+};
+
+/**
+ * @brief The colours uploaded by the host
+ * @param   entries :   colour for each index
+ * @param   loaded  :   bitmap of the entries that have been uploaded
+ * @param   stats   :   statistics
+ */
+struct palette {
+    struct rgb entries[PALETTE_MAX_ENTRIES];
+    uint32_t loaded[PALETTE_MAX_ENTRIES / 32];
+    struct palette_stats stats;
+};
+
+typedef struct palette* palette_t;
+
+/**
+ * @brief   Empty a palette
+ */
+void palette_init(palette_t palette);
+
+/**
+ * @brief   Set one entry
+ *
+ * @param   palette :   palette
+ * @param   index   :   entry
+ * @param   colour  :   its colour
+ */
+void palette_set(palette_t palette, uint8_t index, struct rgb colour);
+
+/**
+ * @brief   Look up one entry
+ *
+ * @retval  0 on success
+ * @retval  -ENOENT if the entry was never uploaded
+ */
+int palette_get(palette_t palette, uint8_t index, struct rgb *colour);
+
+/**
+ * @brief   Apply the params of a palette command
+ *
+ * @param   palette     :   palette
+ * @param   params      :   decoded params
+ * @param   num_params  :   number of params
+ *
+ * @retval  0 on success
+ * @retval  -EINVAL if the index is missing
+ */
+int palette_apply(palette_t palette, const struct key_val_pair *params, size_t num_params);
+
+/**
+ * @brief   Expand the params of a set_idx command into colours
+ *
+ * @param   palette     :   palette
+ * @param   params      :   decoded params
+ * @param   num_params  :   number of params
+ * @param   emit        :   called for each LED, in order
+ * @param   user_data   :   passed through to emit
+ *
+ * @retval  number of LEDs emitted. LEDs whose entry was never uploaded
+ *          are left as they are and counted in the stats.
+ * @retval  -EINVAL if the target is missing, or count wants more
+ *          indices than there are
+ */
+int palette_expand(palette_t palette, const struct key_val_pair *params, size_t num_params,
+                   palette_emit_t emit, void *user_data);
+
+/**
+ * @brief   Build the params of a set_idx for a run of LEDs
+ *
+ * @param   target      :   first LED
+ * @param   indices     :   palette index for each LED
+ * @param   count       :   number of LEDs, at most PALETTE_MAX_PER_FRAME
+ * @param   params      :   where to put the params, room for PROTOCOL_MAX_PARAMS
+ *
+ * @retval  number of params, 0 if count is out of range
+ */
+size_t palette_pack(uint16_t target, const uint8_t *indices, size_t count, struct key_val_pair *params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_PALETTE_H */
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include <string.h>
+
+#include "pbuf.h"
+
+#define PBUF_ALIGNMENT 4
+
+LOG_MODULE_REGISTER(bbbled_pbuf, LOG_LEVEL_DBG);
+
+OS_POOL_DEFINE(pbuf_small_pool, sizeof(struct pbuf) + PBUF_SMALL_SIZE, PBUF_SMALL_COUNT, PBUF_ALIGNMENT);
+OS_POOL_DEFINE(pbuf_medium_pool, sizeof(struct pbuf) + PBUF_MEDIUM_SIZE, PBUF_MEDIUM_COUNT, PBUF_ALIGNMENT);
+OS_POOL_DEFINE(pbuf_large_pool, sizeof(struct pbuf) + PBUF_LARGE_SIZE, PBUF_LARGE_COUNT, PBUF_ALIGNMENT);
+
+/**
+ * Smallest first, pbuf_alloc() walks up from the first that fits
+ */
+static const struct {
+    os_pool_t *pool;
+    uint16_t size;
+} pbuf_classes[PBUF_NUM_CLASSES] = {
+    {&pbuf_small_pool, PBUF_SMALL_SIZE},
+    {&pbuf_medium_pool, PBUF_MEDIUM_SIZE},
+    {&pbuf_large_pool, PBUF_LARGE_SIZE},
+};
+
+static struct pbuf_stats pbuf_stats;
+static os_lock_t pbuf_stats_lock = OS_LOCK_INITIALIZER;
+
+struct pbuf *pbuf_alloc(size_t size)
+{
+    bool missed = false;
+
+    for (uint8_t size_class = 0; size_class < PBUF_NUM_CLASSES; ++size_class)
+    {
+        struct pbuf_class_stats *stats = &pbuf_stats.classes[size_class];
+        struct pbuf *buf;
+        os_lock_key_t key;
+
+        if (pbuf_classes[size_class].size < size)
+        {
+            continue;
+        }
+
+        if (os_pool_alloc(pbuf_classes[size_class].pool, (void **) &buf))
+        {
+            /*  Counted against the class the buffer should have come from */
+            if (!missed)
+            {
+                key = os_lock(&pbuf_stats_lock);
+                stats->failures++;
+                os_unlock(&pbuf_stats_lock, key);
+                missed = true;
+            }
+            continue;
+        }
+
+        os_atomic_set(&buf->ref, 1);
+        buf->size = pbuf_classes[size_class].size;
+        buf->len = 0;
+        buf->size_class = size_class;
+
+        key = os_lock(&pbuf_stats_lock);
+        stats->allocs++;
+        stats->in_use++;
+        stats->peak = MAX(stats->peak, stats->in_use);
+        os_unlock(&pbuf_stats_lock, key);
+
+        return buf;
+    }
+
+    LOG_WRN("no buffer for %d bytes", (int) size);
+    return NULL;
+}
+
+struct pbuf *pbuf_alloc_copy(const uint8_t *data, size_t len)
+{
+    struct pbuf *buf = pbuf_alloc(len);
+    os_lock_key_t key;
+
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(buf->data, data, len);
+    buf->len = len;
+
+    key = os_lock(&pbuf_stats_lock);
+    pbuf_stats.bytes_copied += len;
+    os_unlock(&pbuf_stats_lock, key);
+
+    return buf;
+}
+
+struct pbuf *pbuf_ref(struct pbuf *buf)
+{
+    __ASSERT(buf, "Invalid pbuf ptr");
+    __ASSERT(os_atomic_get(&buf->ref) > 0, "pbuf already freed");
+
+    os_atomic_inc(&buf->ref);
+    return buf;
+}
+
+void pbuf_unref(struct pbuf *buf)
+{
+    os_lock_key_t key;
+
+    __ASSERT(buf, "Invalid pbuf ptr");
+
+    if (os_atomic_dec(&buf->ref) != 1)
+    {
+        return;
+    }
+
+    key = os_lock(&pbuf_stats_lock);
+    pbuf_stats.classes[buf->size_class].in_use--;
+    os_unlock(&pbuf_stats_lock, key);
+
+    os_pool_free(pbuf_classes[buf->size_class].pool, buf);
+}
+
+size_t pbuf_copy_out(const struct pbuf *buf, uint8_t *dest, size_t dest_size)
+{
+    os_lock_key_t key;
+
+    if (buf->len > dest_size)
+    {
+        return 0;
+    }
+
+    memcpy(dest, buf->data, buf->len);
+
+    key = os_lock(&pbuf_stats_lock);
+    pbuf_stats.bytes_copied += buf->len;
+    os_unlock(&pbuf_stats_lock, key);
+
+    return buf->len;
+}
+
+void pbuf_stats_get(struct pbuf_stats *stats)
+{
+    os_lock_key_t key = os_lock(&pbuf_stats_lock);
+    *stats = pbuf_stats;
+    os_unlock(&pbuf_stats_lock, key);
+}
+
+void pbuf_stats_reset(void)
+{
+    os_lock_key_t key = os_lock(&pbuf_stats_lock);
+
+    for (uint8_t size_class = 0; size_class < PBUF_NUM_CLASSES; ++size_class)
+    {
+        struct pbuf_class_stats *stats = &pbuf_stats.classes[size_class];
+
+        stats->peak = stats->in_use;
+        stats->allocs = 0;
+        stats->failures = 0;
+    }
+    pbuf_stats.bytes_copied = 0;
+
+    os_unlock(&pbuf_stats_lock, key);
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#ifndef _BBBLED_PBUF_H
+#define _BBBLED_PBUF_H
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Size classes. A buffer comes from the smallest class it fits in, or
+ * the next one up if that class has run dry.
+ */
+// ACKs, NACKs and short status frames
+#define PBUF_SMALL_SIZE 32
+#define PBUF_SMALL_COUNT 8
+// set_rgb, effect and most other data frames
+#define PBUF_MEDIUM_SIZE 128
+#define PBUF_MEDIUM_COUNT 8
+// Anything up to a full receive buffer
+#define PBUF_LARGE_SIZE 512
+#define PBUF_LARGE_COUNT 2
+
+#define PBUF_NUM_CLASSES 3
+
+/**
+ * @brief A refcounted buffer. Whoever holds a reference may read the
+ *        data, nobody should write to it once it has been shared.
+ * @param   ref         :   references held
+ * @param   size        :   bytes data can hold
+ * @param   len         :   bytes of data in use
+ * @param   size_class  :   class the buffer came from
+ * @param   data        :   the bytes
+ */
+struct pbuf {
+    os_atomic_t ref;
+    uint16_t size;
+    uint16_t len;
+    uint8_t size_class;
+    uint8_t data[];
+};
+
+/**
+ * @brief Per size class statistics
+ * @param   in_use      :   buffers currently allocated
+ * @param   peak        :   most buffers allocated at once
+ * @param   allocs      :   successful allocations
+ * @param   failures    :   allocations that found no free buffer
+ */
+struct pbuf_class_stats {
+    uint32_t in_use;
+    uint32_t peak;
+    uint32_t allocs;
+    uint32_t failures;
+};
+
+/**
+ * @brief Buffer statistics
+ * @param   classes         :   per size class
+ * @param   bytes_copied    :   bytes copied into or out of a buffer
+ */
+struct pbuf_stats {
+    struct pbuf_class_stats classes[PBUF_NUM_CLASSES];
+    uint32_t bytes_copied;
+};
+
+/**
+ * @brief   Allocate a buffer with room for at least size bytes. The
+ *          caller holds the only reference.
+ *
+ * @param   size    :   bytes needed
+ *
+ * @retval  buffer with len 0
+ * @retval  NULL if no class with room has a free buffer
+ */
+struct pbuf *pbuf_alloc(size_t size);
+
+/**
+ * @brief   Allocate a buffer and copy data into it
+ *
+ * @retval  buffer holding a copy of data
+ * @retval  NULL if nothing is free
+ */
+struct pbuf *pbuf_alloc_copy(const uint8_t *data, size_t len);
+
+/**
+ * @brief   Take another reference to a buffer
+ *
+ * @returns buf, for chaining
+ */
+struct pbuf *pbuf_ref(struct pbuf *buf);
+
+/**
+ * @brief   Drop a reference. The last one returns the buffer to its
+ *          pool. Safe from ISR context.
+ */
+void pbuf_unref(struct pbuf *buf);
+
+/**
+ * @brief   Copy a buffer's data out into flat memory
+ *
+ * @param   buf         :   buffer
+ * @param   dest        :   where to copy to
+ * @param   dest_size   :   room in dest
+ *
+ * @returns bytes copied, 0 if it didn't fit
+ */
+size_t pbuf_copy_out(const struct pbuf *buf, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   Snapshot of the buffer statistics
+ */
+void pbuf_stats_get(struct pbuf_stats *stats);
+
+/**
+ * @brief   Zero the counters. In use counts are left alone.
+ */
+void pbuf_stats_reset(void);
+
+static inline size_t pbuf_tailroom(const struct pbuf *buf)
+{
+    return buf->size - buf->len;
+}
+
+static inline int pbuf_refs(struct pbuf *buf)
+{
+    return os_atomic_get(&buf->ref);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_PBUF_H */
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include <errno.h>
+
+#include "ping.h"
+#include "protocol.h"
+
+LOG_MODULE_REGISTER(bbbled_ping, LOG_LEVEL_DBG);
+
+/*  Each stamp's keys follow on from the last, hi then lo */
+BUILD_ASSERT(KEY_T1H == KEY_T0H + 2 && KEY_T2H == KEY_T0H + 4 && KEY_T3H == KEY_T0H + 6,
+             "ping keys out of order");
+BUILD_ASSERT(KEY_T0L == KEY_T0H + 1, "ping keys out of order");
+BUILD_ASSERT(2 * PING_NUM_STAMPS <= PROTOCOL_MAX_PARAMS, "a ping doesn't fit in a packet");
+
+static inline param_key_t stamp_key(ping_stamp_t stamp, bool low)
+{
+    return (param_key_t) (KEY_T0H + 2 * stamp + low);
+}
+
+static void set_param(struct key_val_pair *params, size_t *num_params, param_key_t key, value_t value)
+{
+    for (size_t index = 0; index < *num_params; ++index)
+    {
+        if (params[index].key == key)
+        {
+            params[index].value = value;
+            return;
+        }
+    }
+
+    __ASSERT(*num_params < PROTOCOL_MAX_PARAMS, "No room for ping stamp");
+    params[(*num_params)++] = (struct key_val_pair) {.key = key, .value = value};
+}
+
+static int get_param(const struct key_val_pair *params, size_t num_params, param_key_t key, value_t *value)
+{
+    for (size_t index = 0; index < num_params; ++index)
+    {
+        if (params[index].key == key)
+        {
+            *value = params[index].value;
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+void ping_stamp(struct key_val_pair *params, size_t *num_params, ping_stamp_t stamp, uint32_t us)
+{
+    set_param(params, num_params, stamp_key(stamp, false), (value_t) (us >> 16));
+    set_param(params, num_params, stamp_key(stamp, true), (value_t) (us & 0xffff));
+}
+
+int ping_get(const struct key_val_pair *params, size_t num_params, ping_stamp_t stamp, uint32_t *us)
+{
+    value_t high;
+    value_t low;
+
+    if (get_param(params, num_params, stamp_key(stamp, false), &high)
+        || get_param(params, num_params, stamp_key(stamp, true), &low))
+    {
+        return -ENOENT;
+    }
+
+    *us = ((uint32_t) high << 16) | low;
+    return 0;
+}
+
+int ping_sample(const struct key_val_pair *params, size_t num_params, uint32_t now_us, struct ping_sample *sample)
+{
+    uint32_t stamps[PING_NUM_STAMPS];
+    uint32_t in_dongle;
+
+    for (int stamp = 0; stamp < PING_NUM_STAMPS; ++stamp)
+    {
+        if (ping_get(params, num_params, stamp, &stamps[stamp]))
+        {
+            return -ENOENT;
+        }
+    }
+
+    /*  Unsigned differences, so a clock wrapping in between is fine */
+    in_dongle = stamps[PING_ECHOED] - stamps[PING_RECEIVED];
+    sample->rtt_us = now_us - stamps[PING_SENT];
+    sample->dongle_us = stamps[PING_FORWARDED] - stamps[PING_RECEIVED];
+    sample->peer_rtt_us = stamps[PING_ECHOED] - stamps[PING_FORWARDED];
+    sample->usb_rtt_us = (sample->rtt_us > in_dongle) ? sample->rtt_us - in_dongle : 0;
+
+    return 0;
+}
\ No newline at end of file
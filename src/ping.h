@@ -0,0 +1,93 @@
+#ifndef _BBBLED_PING_H
+#define _BBBLED_PING_H
+
+#include "os.h"
+#include "commands.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A ping collects a timestamp at every hop and comes back as a pong:
+ *
+ *   host  --ping t0-->  dongle t1 ... t2  --ping-->  peer
+ *   host  <--pong----   dongle t3         <--pong--  peer
+ *
+ * t0 is in the host's clock, t1 to t3 in the dongle's. Nothing assumes
+ * the two agree, every interval is taken within one clock:
+ *
+ *   round trip      now - t0
+ *   dongle          t2 - t1, time spent before forwarding
+ *   peer link       t3 - t2, there and back over the peer link (BLE)
+ *   USB link        round trip - (t3 - t1), there and back over USB
+ *
+ * One way figures are half the link's round trip. With no peer link the
+ * dongle answers itself, t2 = t3 and the peer link reads 0.
+ *
+ * Timestamps are microseconds, 32 bit and free to wrap: each goes on
+ * the wire as a hi/lo pair of 16 bit values.
+ */
+
+typedef enum {
+    // Host sent the ping
+    PING_SENT = 0,
+    // Dongle received it
+    PING_RECEIVED,
+    // Dongle forwarded it to the peer (or answered it)
+    PING_FORWARDED,
+    // Dongle sent the pong back
+    PING_ECHOED,
+    PING_NUM_STAMPS,
+} ping_stamp_t;
+
+/**
+ * @brief Latencies from one pong, in microseconds
+ * @param   rtt_us      :   host to host round trip
+ * @param   usb_rtt_us  :   round trip over the USB link, dongle time taken out
+ * @param   peer_rtt_us :   round trip over the peer link, from the dongle
+ * @param   dongle_us   :   time the ping spent in the dongle before forwarding
+ */
+struct ping_sample {
+    uint32_t rtt_us;
+    uint32_t usb_rtt_us;
+    uint32_t peer_rtt_us;
+    uint32_t dongle_us;
+};
+
+/**
+ * @brief   Set a timestamp in a param list, adding it if it isn't there
+ *
+ * @param   params      :   params of a ping or pong, room for PROTOCOL_MAX_PARAMS
+ * @param   num_params  :   params in use, updated
+ * @param   stamp       :   which timestamp
+ * @param   us          :   its value
+ */
+void ping_stamp(struct key_val_pair *params, size_t *num_params, ping_stamp_t stamp, uint32_t us);
+
+/**
+ * @brief   Read a timestamp back out of a param list
+ *
+ * @retval  0 on success
+ * @retval  -ENOENT if either half is missing
+ */
+int ping_get(const struct key_val_pair *params, size_t num_params, ping_stamp_t stamp, uint32_t *us);
+
+/**
+ * @brief   Work out the latencies from a pong
+ *
+ * @param   params      :   params of the pong
+ * @param   num_params  :   number of params
+ * @param   now_us      :   when the pong arrived, in the clock t0 was taken from
+ * @param   sample      :   filled in
+ *
+ * @retval  0 on success
+ * @retval  -ENOENT if a timestamp is missing
+ */
+int ping_sample(const struct key_val_pair *params, size_t num_params, uint32_t now_us, struct ping_sample *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_PING_H */
\ No newline at end of file
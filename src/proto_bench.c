@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <string.h>
+
+#include "proto_bench.h"
+
+LOG_MODULE_REGISTER(bbbled_proto_bench, LOG_LEVEL_DBG);
+
+static const char *const op_names[PROTO_BENCH_NUM_OPS] = {
+    [PROTO_BENCH_PARSE] = "parse",
+    [PROTO_BENCH_SERIALISE] = "serialise",
+    [PROTO_BENCH_CRC] = "crc",
+    [PROTO_BENCH_ROUNDTRIP] = "roundtrip",
+};
+
+int proto_bench_op_from_string(const char *name)
+{
+    for (int op = 0; op < PROTO_BENCH_NUM_OPS; ++op)
+    {
+        if (strcmp(name, op_names[op]) == 0)
+        {
+            return op;
+        }
+    }
+    return -EINVAL;
+}
+
+const char *proto_bench_op_name(proto_bench_op_t op)
+{
+    return (op < PROTO_BENCH_NUM_OPS) ? op_names[op] : NULL;
+}
+
+int proto_bench_prepare(proto_bench_t bench, proto_bench_op_t op)
+{
+    if (op >= PROTO_BENCH_NUM_OPS)
+    {
+        return -EINVAL;
+    }
+
+    /*  The frame the host sends most of, with a msg number that needs
+        every digit */
+    bench->op = op;
+    bench->pkt = (struct protocol_pkt) {
+        .command = COMMAND_SET_RGB,
+        .params = {
+            {.key = KEY_RED, .value = 255},
+            {.key = KEY_GREEN, .value = 128},
+            {.key = KEY_BLUE, .value = 7},
+        },
+        .num_params = 3,
+        .msg_num = 48913,
+    };
+    bench->len = serialise_packet(&bench->pkt, bench->frame, PROTOCOL_RECV_BUF_SIZE);
+    bench->frame[bench->len] = '\0';
+    bench->sink = 0;
+
+    if (op == PROTO_BENCH_ROUNDTRIP)
+    {
+        protocol_init(&bench->sender, NULL, 0, &bench->sender_timer);
+        protocol_init(&bench->receiver, NULL, 0, &bench->receiver_timer);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   Hand the next frame ctx has to send to peer, the way the
+ *          loop does with a frame off the wire
+ *
+ * @retval  true if there was a frame
+ */
+static bool hand_over(proto_bench_t bench, protocol_ctx_t ctx, protocol_ctx_t peer)
+{
+    struct pbuf *frame = protocol_tx_pbuf(ctx);
+    struct parsed_data parsed = {0};
+
+    if (!frame)
+    {
+        return false;
+    }
+
+    memcpy(bench->rx_buf, frame->data, frame->len);
+    bench->rx_buf[frame->len] = '\0';
+    peer->rx_buf = bench->rx_buf;
+    peer->rx_len = frame->len;
+    pbuf_unref(frame);
+
+    handle_incoming(peer, &parsed);
+    if (parsed.command != COMMAND_INVALID && parsed.command != COMMAND_ACK)
+    {
+        bench->sink ^= parsed_data_decode(&parsed);
+    }
+
+    return true;
+}
+
+static int roundtrip(proto_bench_t bench)
+{
+    int msg_num = protocol_submit(
+        &bench->sender, bench->pkt.command, bench->pkt.params, bench->pkt.num_params);
+
+    if (msg_num < 0)
+    {
+        return msg_num;
+    }
+
+    if (!hand_over(bench, &bench->sender, &bench->receiver)
+        || !hand_over(bench, &bench->receiver, &bench->sender)
+        || bench->sender.awaiting_ack)
+    {
+        LOG_WRN("msg %d not acknowledged", msg_num);
+        return -EIO;
+    }
+
+    bench->sink ^= (uint32_t) msg_num;
+    return 0;
+}
+
+int proto_bench_run(proto_bench_t bench, uint32_t iterations)
+{
+    struct parsed_data parsed;
+    uint16_t msg_num;
+    int ret;
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        switch (bench->op)
+        {
+            case PROTO_BENCH_PARSE:
+                memset(&parsed, 0, sizeof(parsed));
+                parse((char*) bench->frame, bench->len, &parsed, &msg_num);
+                bench->sink ^= msg_num;
+                break;
+            case PROTO_BENCH_SERIALISE:
+                bench->sink ^= serialise_packet(&bench->pkt, bench->frame, PROTOCOL_RECV_BUF_SIZE);
+                break;
+            case PROTO_BENCH_CRC:
+                bench->sink ^= os_crc16_ccitt(PROTOCOL_CRC_POLY, bench->frame, bench->len);
+                break;
+            case PROTO_BENCH_ROUNDTRIP:
+                ret = roundtrip(bench);
+                if (ret)
+                {
+                    return ret;
+                }
+                break;
+            default:
+                return -EINVAL;
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
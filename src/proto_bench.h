@@ -0,0 +1,99 @@
+#ifndef _BBBLED_PROTO_BENCH_H
+#define _BBBLED_PROTO_BENCH_H
+
+#include "os.h"
+#include "protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    // parse() of a set_rgb frame
+    PROTO_BENCH_PARSE = 0,
+    // serialise_packet() of the same packet
+    PROTO_BENCH_SERIALISE,
+    // CRC over the frame
+    PROTO_BENCH_CRC,
+    // Submit, send, receive, ACK and complete between two contexts
+    PROTO_BENCH_ROUNDTRIP,
+    PROTO_BENCH_NUM_OPS,
+} proto_bench_op_t;
+
+/**
+ * @brief State for one benchmark. Big, keep it static.
+ * @param   op              :   operation being measured
+ * @param   pkt             :   packet every operation works on
+ * @param   frame           :   pkt serialised
+ * @param   len             :   length of the frame
+ * @param   sender          :   roundtrip: context the packets are submitted on
+ * @param   receiver        :   roundtrip: context that ACKs them
+ * @param   sender_timer    :   sender's ACK timeout
+ * @param   receiver_timer  :   receiver's ACK timeout
+ * @param   rx_buf          :   frame being handed from one context to the other
+ * @param   sink            :   results are folded in here so nothing is optimised away
+ */
+struct proto_bench {
+    proto_bench_op_t op;
+    struct protocol_pkt pkt;
+    uint8_t frame[PROTOCOL_RECV_BUF_SIZE + 1];
+    size_t len;
+    struct protocol_ctx sender;
+    struct protocol_ctx receiver;
+    os_timer_t sender_timer;
+    os_timer_t receiver_timer;
+    uint8_t rx_buf[PROTOCOL_RECV_BUF_SIZE + 1];
+    uint32_t sink;
+};
+
+typedef struct proto_bench* proto_bench_t;
+
+/**
+ * @brief   Look an operation up by name
+ *
+ * @param   name    :   "parse", "serialise", "crc" or "roundtrip"
+ *
+ * @retval  the operation
+ * @retval  -EINVAL if there is no such operation
+ */
+int proto_bench_op_from_string(const char *name);
+
+/**
+ * @brief   Name of an operation, NULL if out of range
+ */
+const char *proto_bench_op_name(proto_bench_op_t op);
+
+/**
+ * @brief   Set up everything the operation needs, so proto_bench_run()
+ *          only does the work being measured
+ *
+ * @param   bench   :   benchmark state
+ * @param   op      :   operation to measure
+ *
+ * @retval  0 on success
+ * @retval  -EINVAL for an unknown operation
+ */
+int proto_bench_prepare(proto_bench_t bench, proto_bench_op_t op);
+
+/**
+ * @brief   Run the operation. Times nothing itself, the caller reads
+ *          whatever clock it trusts either side.
+ *
+ *          A roundtrip uses the real protocol contexts and shares the
+ *          packet and frame pools with any live link, so run it while
+ *          the link is quiet.
+ *
+ * @param   bench       :   prepared benchmark
+ * @param   iterations  :   times to run it
+ *
+ * @retval  0 on success
+ * @retval  -ENOMEM if a roundtrip found the pools empty
+ * @retval  -EIO if a roundtrip packet was not acknowledged
+ */
+int proto_bench_run(proto_bench_t bench, uint32_t iterations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_PROTO_BENCH_H */
\ No newline at end of file
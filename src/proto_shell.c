@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/timing/timing.h>
+
+#include "proto_bench.h"
+#include "proto_shell.h"
+
+#define PROTO_SHELL_DEFAULT_ITERATIONS 1000
+// Capture bytes printed per line of a dump
+#define PROTO_SHELL_DUMP_LINE 32
+
+LOG_MODULE_REGISTER(bbbled_proto_shell, LOG_LEVEL_DBG);
+
+/*  Far too big for the shell thread's stack */
+static struct proto_bench bench;
+static capture_t capture;
+static uint8_t dump_buf[256];
+
+void proto_shell_set_capture(capture_t new_capture)
+{
+    capture = new_capture;
+}
+
+/**
+ * @brief   proto bench <parse|serialise|crc|roundtrip> [N]
+ *
+ *          Times N runs of the real code path with the timing API, which
+ *          counts CPU cycles (DWT on the nRF52840) rather than the 32 kHz
+ *          system clock.
+ */
+static int cmd_bench(const struct shell *sh, size_t argc, char **argv)
+{
+    int op = proto_bench_op_from_string(argv[1]);
+    uint32_t iterations = PROTO_SHELL_DEFAULT_ITERATIONS;
+    timing_t start;
+    timing_t end;
+    uint64_t cycles;
+    uint64_t ns;
+    int ret;
+
+    if (op < 0)
+    {
+        shell_error(sh, "unknown op %s, try parse, serialise, crc or roundtrip", argv[1]);
+        return -EINVAL;
+    }
+
+    if (argc > 2)
+    {
+        char *end_ptr;
+
+        iterations = strtoul(argv[2], &end_ptr, 10);
+        if (*end_ptr != '\0' || iterations == 0)
+        {
+            shell_error(sh, "N must be a number above 0");
+            return -EINVAL;
+        }
+    }
+
+    ret = proto_bench_prepare(&bench, op);
+    if (ret)
+    {
+        return ret;
+    }
+
+    timing_init();
+    timing_start();
+    start = timing_counter_get();
+    ret = proto_bench_run(&bench, iterations);
+    end = timing_counter_get();
+    timing_stop();
+
+    if (ret)
+    {
+        shell_error(sh, "%s failed [%d]", proto_bench_op_name(op), ret);
+        return ret;
+    }
+
+    cycles = timing_cycles_get(&start, &end);
+    ns = MAX(timing_cycles_to_ns(cycles), 1);
+
+    shell_print(sh, "%s: %u ops on a %u byte frame, %u cycles/op, %u ns/op, %u frames/s",
+        proto_bench_op_name(op),
+        iterations,
+        (uint32_t) bench.len,
+        (uint32_t) (cycles / iterations),
+        (uint32_t) (ns / iterations),
+        (uint32_t) ((uint64_t) iterations * NSEC_PER_SEC / ns));
+
+    return 0;
+}
+
+static capture_t get_capture(const struct shell *sh)
+{
+    if (!capture)
+    {
+        shell_error(sh, "capture is not enabled");
+    }
+    return capture;
+}
+
+/**
+ * @brief   proto capture dump
+ *
+ *          Drains the capture as hex, between a header line and an end
+ *          line, for bbbled_capture_decode to turn into a timeline.
+ */
+static int cmd_capture_dump(const struct shell *sh, size_t argc, char **argv)
+{
+    struct capture_stats stats;
+    char line[2 * PROTO_SHELL_DUMP_LINE + 1];
+    size_t len;
+
+    if (!get_capture(sh))
+    {
+        return -ENODEV;
+    }
+
+    capture_stats_get(capture, &stats);
+    shell_print(sh, "capture %u Hz, %u records, %u overwritten",
+        os_cycles_per_sec(), stats.records, stats.overwritten);
+
+    while ((len = capture_read(capture, dump_buf, sizeof(dump_buf))) > 0)
+    {
+        for (size_t offset = 0; offset < len; offset += PROTO_SHELL_DUMP_LINE)
+        {
+            size_t count = MIN(len - offset, PROTO_SHELL_DUMP_LINE);
+
+            bin2hex(&dump_buf[offset], count, line, sizeof(line));
+            shell_print(sh, "%s", line);
+        }
+    }
+
+    shell_print(sh, "capture end");
+    return 0;
+}
+
+static int cmd_capture_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    struct capture_stats stats;
+
+    if (!get_capture(sh))
+    {
+        return -ENODEV;
+    }
+
+    capture_stats_get(capture, &stats);
+    shell_print(sh, "%u records, %u overwritten, %u of %u bytes in use",
+        stats.records, stats.overwritten, (uint32_t) capture->used, (uint32_t) capture->size);
+    return 0;
+}
+
+static int cmd_capture_clear(const struct shell *sh, size_t argc, char **argv)
+{
+    if (!get_capture(sh))
+    {
+        return -ENODEV;
+    }
+
+    capture_clear(capture);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(capture_cmds,
+    SHELL_CMD(dump, NULL, "Drain the capture as hex for bbbled_capture_decode", cmd_capture_dump),
+    SHELL_CMD(stats, NULL, "Records taken and lost", cmd_capture_stats),
+    SHELL_CMD(clear, NULL, "Throw the capture away", cmd_capture_clear),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(proto_cmds,
+    SHELL_CMD_ARG(bench, NULL,
+        "Time the protocol core: bench <parse|serialise|crc|roundtrip> [N]",
+        cmd_bench, 2, 1),
+    SHELL_CMD(capture, &capture_cmds, "Frames recorded by the protocol loop", NULL),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(proto, &proto_cmds, "BBBLed protocol commands", NULL);
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef _BBBLED_PROTO_SHELL_H
+#define _BBBLED_PROTO_SHELL_H
+
+#include "capture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Give "proto capture" the capture the protocol loop records into
+ *
+ * @param   capture :   capture, NULL if there is none
+ */
+void proto_shell_set_capture(capture_t capture);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_PROTO_SHELL_H */
\ No newline at end of file
@@ -1,9 +1,6 @@
 #include <errno.h>
-#include <zephyr/random/random.h>
 #include <string.h>
 #include <stdio.h>
-#include <zephyr/sys/crc.h>
-#include <zephyr/logging/log.h>
 #include <stdlib.h>
 
 #include "protocol.h"
@@ -18,8 +15,33 @@
 #define PROTOCOL_KEY_VALUE_SEP      ":"
 #define PROTOCOL_ITEM_SEP           ","
 #define PROTOCOL_CRC                "#"
+// Hex characters after the CRC marker
+#define PROTOCOL_CRC_CHARS          4
 
-K_MEM_SLAB_DEFINE(protocol_pkt_slab, PKT_SLAB_BLOCK_SIZE, PKT_SLAB_BLOCK_COUNT, SLAB_ALIGNMENT);
+/**
+ * @brief What a priority class gets
+ * @param   max_retries :   retransmissions before giving up
+ * @param   timeout_ms  :   time to wait for an ACK
+ */
+struct prio_class {
+    uint8_t max_retries;
+    uint16_t timeout_ms;
+};
+
+static const struct prio_class prio_classes[PROTOCOL_NUM_PRIOS] = {
+    [PROTOCOL_PRIO_NORMAL] = {.max_retries = PROTOCOL_MAX_MSG_RETRIES, .timeout_ms = PKT_TIMEOUT_MSEC},
+    [PROTOCOL_PRIO_URGENT] = {.max_retries = PROTOCOL_RETRIES_FOREVER, .timeout_ms = PKT_TIMEOUT_MSEC / 2},
+    [PROTOCOL_PRIO_BULK]   = {.max_retries = 1,                        .timeout_ms = PKT_TIMEOUT_MSEC * 2},
+};
+
+// Order the submission queues are drained in
+static const protocol_prio_t prio_order[PROTOCOL_NUM_PRIOS] = {
+    PROTOCOL_PRIO_URGENT,
+    PROTOCOL_PRIO_NORMAL,
+    PROTOCOL_PRIO_BULK,
+};
+
+OS_POOL_DEFINE(protocol_pkt_slab, PKT_SLAB_BLOCK_SIZE, PKT_SLAB_BLOCK_COUNT, SLAB_ALIGNMENT);
 
 LOG_MODULE_REGISTER(bbbled_protocol, LOG_LEVEL_DBG);
 
@@ -51,7 +73,7 @@ static inline const pkt_t create_nack()
  */
 static inline uint16_t create_msg_num(void)
 {
-    return sys_rand16_get();
+    return os_rand16();
 }
 
 // /**
@@ -91,15 +113,17 @@ static inline uint16_t create_msg_num(void)
 //     return size;
 // }
 
-size_t serialise_packet(
+/**
+ * @brief   Serialise a packet, CRC included, through the handler registry
+ *
+ * @retval  0 on success, ctx->bytes_written is the frame length
+ * @retval  -ENOBUFS if it did not fit
+ * @retval  -EINVAL for an unknown command
+ */
+static int serialise_packet_ctx(
     pkt_t pkt,
-    uint8_t *dest,
-    size_t dest_size)
+    serial_ctx_t ctx)
 {
-    struct serial_ctx ctx;
-
-    serialise_ctx_init(&ctx, dest, dest_size, NULL);
-
     struct kv_pair_adapter adapter = {
         .pairs = pkt->params,
         .num_pairs = pkt->num_params,
@@ -107,6 +131,7 @@ size_t serialise_packet(
         .pair_terminator = PROTOCOL_ITEM_SEP
     };
 
+    /*  The CRC is kept up to date as bytes go out */
     struct serial_registry reg[] = {
         {.handler = serialise_padding_char,     .user_data = PROTOCOL_PREAMBLE},
         {.handler = serialise_str,              .user_data = cmd_to_string(pkt->command)},
@@ -116,23 +141,221 @@ size_t serialise_packet(
         {.handler = serialise_padding_char,     .user_data = PROTOCOL_KEY_VALUE_SEP},
         {.handler = serialise_uint16t_dec,      .user_data = &pkt->msg_num},
         {.handler = serialise_padding_char,     .user_data = PROTOCOL_CRC},
+        {.handler = serialise_crc_hex,          .user_data = NULL},
     };
 
-    serialise_handler_register(&ctx, reg, ARRAY_SIZE(reg));
+    if (cmd_to_string(pkt->command) == NULL)
+    {
+        return -EINVAL;
+    }
+
+    serialise_handler_register(ctx, reg, ARRAY_SIZE(reg));
+
+    return serialise(ctx);
+}
 
-    serialise(&ctx);
+size_t serialise_packet_generic(
+    pkt_t pkt,
+    uint8_t *dest,
+    size_t dest_size)
+{
+    struct serial_ctx ctx;
 
-    /* CRC afterwards */
-    crc_t crc = crc16_ccitt(PROTOCOL_CRC_POLY, ctx.buffer, ctx.bytes_written);
-    serialise_uint16t_hex(&ctx, &crc);
+    serialise_ctx_init(&ctx, dest, dest_size, NULL);
 
-    LOG_INF("Serialised packet, data=%s", dest);
+    if (serialise_packet_ctx(pkt, &ctx))
+    {
+        return 0;
+    }
 
     return ctx.bytes_written;
 }
 
+/*
+ *  Specialised serialisers, one per command, generated from the schema in
+ *  commands_schema.h. The command prefix and every "key:" are string
+ *  literals so they go out as fixed size copies, and there are no
+ *  callbacks in the way. The output is byte for byte the same as
+ *  serialise_packet_generic().
+ */
+
+struct emitter {
+    uint8_t *pos;
+    uint8_t *end;
+    bool overflow;
+};
+
+static inline void emit_bytes(struct emitter *e, const char *src, size_t len)
+{
+    if ((size_t) (e->end - e->pos) < len)
+    {
+        e->overflow = true;
+        return;
+    }
+    memcpy(e->pos, src, len);
+    e->pos += len;
+}
+
+#define EMIT_LITERAL(e, lit) emit_bytes(e, lit, sizeof(lit) - 1)
+
+static inline void emit_u16_dec(struct emitter *e, uint16_t value)
+{
+    char digits[PROTOCOL_MAX_MSG_NUM_CHARS];
+    size_t len = 0;
+
+    do
+    {
+        digits[sizeof(digits) - 1 - len++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    emit_bytes(e, digits + sizeof(digits) - len, len);
+}
+
+static inline void emit_u16_hex(struct emitter *e, uint16_t value)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char digits[4] = {
+        hex[(value >> 12) & 0xf],
+        hex[(value >> 8) & 0xf],
+        hex[(value >> 4) & 0xf],
+        hex[value & 0xf],
+    };
+
+    emit_bytes(e, digits, sizeof(digits));
+}
+
+#define KEY_PREFIX(name, str) \
+    static inline void emit_key_##name(struct emitter *e) { EMIT_LITERAL(e, str PROTOCOL_KEY_VALUE_SEP); }
+KEY_LIST(KEY_PREFIX)
+#undef KEY_PREFIX
+
+#define PARAM_CASE(key, min, max) \
+    case KEY_##key: emit_key_##key(&e); break;
+
+#define COMMAND_SERIALISER(name, str, delivery)                                 \
+    static size_t serialise_##name(pkt_t pkt, uint8_t *dest, size_t dest_size)  \
+    {                                                                           \
+        struct emitter e = {.pos = dest, .end = dest + dest_size};             \
+                                                                                \
+        EMIT_LITERAL(&e, PROTOCOL_PREAMBLE str PROTOCOL_ITEM_SEP);              \
+        for (size_t index = 0; index < pkt->num_params; ++index)               \
+        {                                                                       \
+            switch (pkt->params[index].key)                                     \
+            {                                                                   \
+                PARAMS_##name(PARAM_CASE)                                       \
+                default:                                                        \
+                    LOG_WRN("%s does not take key %d", str, pkt->params[index].key); \
+                    return 0;                                                   \
+            }                                                                   \
+            emit_u16_dec(&e, pkt->params[index].value);                         \
+            EMIT_LITERAL(&e, PROTOCOL_ITEM_SEP);                                \
+        }                                                                       \
+        emit_key_MSGNUM(&e);                                                    \
+        emit_u16_dec(&e, pkt->msg_num);                                         \
+        EMIT_LITERAL(&e, PROTOCOL_CRC);                                         \
+        if (e.overflow) return 0;                                               \
+        emit_u16_hex(&e, os_crc16_ccitt(PROTOCOL_CRC_POLY, dest, e.pos - dest));\
+        if (e.overflow) return 0;                                               \
+        if (e.pos < e.end) *e.pos = '\0';                                       \
+        return e.pos - dest;                                                    \
+    }
+COMMAND_LIST(COMMAND_SERIALISER)
+#undef COMMAND_SERIALISER
+#undef PARAM_CASE
+
+size_t serialise_packet(
+    pkt_t pkt,
+    uint8_t *dest,
+    size_t dest_size)
+{
+    size_t len;
+
+    switch (pkt->command)
+    {
+#define SERIALISE_CASE(name, str, delivery) \
+        case COMMAND_##name: len = serialise_##name(pkt, dest, dest_size); break;
+        COMMAND_LIST(SERIALISE_CASE)
+#undef SERIALISE_CASE
+        default:
+            return 0;
+    }
+
+    return len;
+}
+
+/*  Longest a frame for pkt can come out, so it gets the smallest
+    buffer it fits in rather than a full receive buffer */
+static size_t serialised_size_max(pkt_t pkt)
+{
+#define KEY_LEN(name, str) [KEY_##name] = sizeof(str) - 1,
+    static const uint8_t key_len[NUM_KEYS] = { KEY_LIST(KEY_LEN) };
+#undef KEY_LEN
+#define COMMAND_LEN(name, str, delivery) [COMMAND_##name] = sizeof(str) - 1,
+    static const uint8_t command_len[NUM_COMMANDS] = { COMMAND_LIST(COMMAND_LEN) };
+#undef COMMAND_LEN
+    /*  '!' <command> ',' ... "msg:" <num> '#' <crc> '\0' */
+    size_t size = 2 + command_len[pkt->command] + key_len[KEY_MSGNUM] + 1 + PROTOCOL_MAX_MSG_NUM_CHARS + 1 + 4 + 1;
+
+    for (size_t index = 0; index < pkt->num_params; ++index)
+    {
+        /*  <key> ':' <value> ',' */
+        size += key_len[pkt->params[index].key] + 1 + PROTOCOL_MAX_MSG_NUM_CHARS + 1;
+    }
+
+    return size;
+}
+
+struct pbuf *serialise_packet_pbuf(pkt_t pkt)
+{
+    struct pbuf *buf;
+
+    if ((unsigned) pkt->command >= NUM_COMMANDS || pkt->num_params > PROTOCOL_MAX_PARAMS)
+    {
+        return NULL;
+    }
+
+    for (size_t index = 0; index < pkt->num_params; ++index)
+    {
+        if ((unsigned) pkt->params[index].key >= NUM_KEYS)
+        {
+            return NULL;
+        }
+    }
+
+    buf = pbuf_alloc(serialised_size_max(pkt));
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+
+    buf->len = serialise_packet(pkt, buf->data, buf->size);
+    if (buf->len == 0)
+    {
+        pbuf_unref(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+static inline int hex_digit(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
 /**
- * @brief Verify the CRC of a packet
+ * @brief Verify the CRC of a packet. Never looks past len, whatever
+ *        the bytes are.
  *
  * @param   bytes   :   bytes to verify
  * @param   len     :   length of the bytes
@@ -141,202 +364,325 @@ size_t serialise_packet(
  */
 static int verify_crc(const uint8_t* bytes, size_t len)
 {
-    const uint8_t *crc_start;
-    crc_t crc;
-    size_t data_len;
-    uint8_t index = 0;
+    const uint8_t *crc_start = memchr(bytes, *PROTOCOL_CRC, len);
+    crc_t crc = 0;
 
-    crc_start = bytes;
-
-    /* Find where the CRC starts */
-    while (*crc_start++ != '#')
-    {
-        if (index++ == len) break;
-    };
-
-    if (index >= len)
+    if (crc_start == NULL || (size_t) LEN(bytes + len, crc_start + 1) < PROTOCOL_CRC_CHARS)
     {
         LOG_WRN("could not find a crc");
-        return 1;
+        return -1;
     }
 
-    /* convert to int */
-    crc = (crc_t) strtol(crc_start, NULL, 16);
-    data_len = (crc_start - bytes);
+    /*  Exactly 4 hex characters, covering everything up to the '#' */
+    for (size_t index = 1; index <= PROTOCOL_CRC_CHARS; ++index)
+    {
+        int digit = hex_digit(crc_start[index]);
+
+        if (digit < 0)
+        {
+            return -1;
+        }
+        crc = (crc << 4) | digit;
+    }
 
-    LOG_DBG("got crc %04x, expected %04x", crc, crc16_ccitt(PROTOCOL_CRC_POLY, bytes, data_len));
-    if (crc == crc16_ccitt(PROTOCOL_CRC_POLY, bytes, data_len))
+    if (crc == os_crc16_ccitt(PROTOCOL_CRC_POLY, bytes, LEN(crc_start, bytes) + 1))
     {
         return 0;
     }
 
+    LOG_DBG("got crc %04x", crc);
     return -1;
 }
 
 /**
- * @brief   Given a string, populate an array with comma-separated tokens
+ * @brief   Split comma-separated tokens into an array in a single pass.
+ *          Stops at the CRC marker, the end of the input or when the
+ *          array is full, so the cost is linear in len whatever the
+ *          input looks like. Tokens too long for the array are left
+ *          empty.
  *
  * @param   str         string to examine
- * @param   len         size of the string
+ * @param   len         bytes of it to look at
  * @param   token_array array to populate
  *
  * @retval  The number of tokens in the array
  */
-static uint8_t tokeniser(char *str, size_t len, char token_array[][PROTOCOL_MAX_TOKEN_LEN])
+static uint8_t tokeniser(const char *str, size_t len, char token_array[][PROTOCOL_MAX_TOKEN_LEN])
 {
-    uint8_t index;
-    char *search_char = PROTOCOL_ITEM_SEP;
-    char *start_token;
-    char *end_token;
+    const char *start_token = str;
+    const char *end = str + len;
+    uint8_t index = 0;
 
-    for (index = 0; index < PROTOCOL_MAX_NUM_TOKENS; ++index)
+    while (start_token < end && index < PROTOCOL_MAX_NUM_TOKENS)
     {
-        if (strstr(str, search_char) == NULL)
+        const char *pos = start_token + os_find_delim((const uint8_t *) start_token, LEN(end, start_token),
+                                                      *PROTOCOL_ITEM_SEP, *PROTOCOL_CRC);
+        if (pos == end)
         {
-            if (strstr(str, PROTOCOL_CRC) == NULL)
-            {
-                LOG_DBG("reached end of input");
-                break;
-            }
-            else
-            {
-                search_char = PROTOCOL_CRC;
-            }
+            break;
         }
 
-        start_token = str;
-        end_token = strstr((str), search_char);
-        size_t token_len = LEN(end_token, start_token);
+        size_t token_len = LEN(pos, start_token);
 
         if (token_len >= PROTOCOL_MAX_TOKEN_LEN)
         {
-            LOG_WRN("token too large [%ld bytes] - skipping", (token_len));
+            LOG_WRN("token too large [%d bytes] - skipping", (int) token_len);
+            token_array[index][0] = '\0';
         }
         else
         {
             /*  copy the token into the array and null terminate it */
-            memcpy(token_array[index], start_token, (token_len));
+            memcpy(token_array[index], start_token, token_len);
             token_array[index][token_len] = '\0';
         }
+        ++index;
 
-        /* Consume up to (and including) the next search character */
-        str = strstr(str, search_char);
-        str++;
+        if (*pos == *PROTOCOL_CRC)
+        {
+            break;
+        }
+        start_token = pos + 1;
     }
 
     return index;
 }
 
-int parse(
-    char *str,
-    size_t len,
-    parsed_data_t data,
-    uint16_t *msg_num)
+static inline bool is_msg_token(const char *token, const char *end)
 {
-    command_t command = COMMAND_INVALID;
-    char token_array[PROTOCOL_MAX_NUM_TOKENS][PROTOCOL_MAX_TOKEN_LEN] = {0};
-    uint8_t pair_index = 0;
-    uint8_t num_tokens = 0;
-    uint8_t invalid_params = 0;
+    const size_t id_len = sizeof(PROTOCOL_MSG_IDENTIFIER PROTOCOL_KEY_VALUE_SEP) - 1;
+
+    return (size_t) LEN(end, token) > id_len
+        && memcmp(token, PROTOCOL_MSG_IDENTIFIER PROTOCOL_KEY_VALUE_SEP, id_len) == 0;
+}
+
+/**
+ * @brief   Find the msg:<number> token. The serialisers always put it
+ *          last, so look just before the CRC marker first and only walk
+ *          the params if someone put it elsewhere.
+ *
+ * @param   params  :   first param, just after the command
+ * @param   end     :   the CRC marker
+ * @param   msg_num :   where to put the number
+ * @param   digits  :   where to put the start of the number in the frame
+ *
+ * @retval  0 if found
+ * @retval  -1 if there is no msg token, or it isn't a number
+ */
+static int find_msg_num(const char *params, const char *end, uint16_t *msg_num, const char **digits_at)
+{
+    const char *token = end;
+    uint32_t value = 0;
+    size_t digits = 0;
+
+    while (token > params && token[-1] != *PROTOCOL_ITEM_SEP)
+    {
+        --token;
+    }
+
+    if (!is_msg_token(token, end))
+    {
+        for (token = params; token < end && !is_msg_token(token, end); )
+        {
+            token = memchr(token, *PROTOCOL_ITEM_SEP, LEN(end, token));
+            token = token ? token + 1 : end;
+        }
+        if (token == end)
+        {
+            return -1;
+        }
+    }
+
+    token += sizeof(PROTOCOL_MSG_IDENTIFIER PROTOCOL_KEY_VALUE_SEP) - 1;
+    *digits_at = token;
+    for (; token < end && *token != *PROTOCOL_ITEM_SEP; ++token)
+    {
+        if (*token < '0' || *token > '9' || ++digits > PROTOCOL_MAX_MSG_NUM_CHARS)
+        {
+            return -1;
+        }
+        value = (value * 10) + (*token - '0');
+    }
+
+    if (digits == 0 || value > UINT16_MAX)
+    {
+        return -1;
+    }
 
-    if (str == NULL)
+    *msg_num = (uint16_t) value;
+    return 0;
+}
+
+int parse_header(char *str, size_t len, parsed_data_t data)
+{
+    char command_str[PROTOCOL_MAX_CMD_LEN + 1];
+    const char *crc_marker;
+    const char *command_end;
+    const char *digits;
+    size_t command_len;
+    size_t frame_len;
+
+    data->command = COMMAND_INVALID;
+    data->num_params = 0;
+    data->body = NULL;
+    data->status = PARSER_OK;
+    data->frame = NULL;
+
+    if (str == NULL || len == 0)
     {
         return -1;
     }
 
-    char id = *str;
-    if (id != *PROTOCOL_PREAMBLE)
+    if (*str != *PROTOCOL_PREAMBLE)
     {
         LOG_WRN("preamble not found");
         return -1;
     }
 
-    if (verify_crc(str, len))
+    if (verify_crc((const uint8_t *) str, len))
     {
         LOG_WRN("invalid crc");
         return -1;
     }
 
-    /*  Convert the received bytes into string tokens
-        Containing command, params and message number.
-        Increment the pointer by one beforehand, we dont
-        want the '!' included */
-    num_tokens = tokeniser((char*) (str + 1), len - 1, token_array);
+    /*  verify_crc() found the marker within len */
+    crc_marker = memchr(str, *PROTOCOL_CRC, len);
 
+    /*  The command runs up to the first separator */
+    command_end = memchr(str + 1, *PROTOCOL_ITEM_SEP, LEN(crc_marker, str + 1));
+    if (command_end == NULL)
+    {
+        command_end = crc_marker;
+    }
 
-    command = cmd_to_enum(token_array[0]);
+    command_len = LEN(command_end, str + 1);
+    if (command_len > PROTOCOL_MAX_CMD_LEN)
+    {
+        LOG_ERR("command invalid");
+        return -1;
+    }
+    memcpy(command_str, str + 1, command_len);
+    command_str[command_len] = '\0';
 
-    /*  Check the command is valid */
-    if (command == COMMAND_INVALID)
+    data->command = cmd_to_enum(command_str);
+    if (data->command == COMMAND_INVALID)
     {
         LOG_ERR("command invalid");
         return -1;
     }
 
-    /*  We have a valid command, now iterate and
-        validate the key:value sent with this
-        command */
-    for (uint8_t index = 1; index < num_tokens; ++index)
+    /*  Leave the params where they are until someone wants them */
+    data->body = (command_end == crc_marker) ? (char *) crc_marker : (char *) command_end + 1;
+    data->body_len = LEN(crc_marker, data->body) + 1;
+
+    if (find_msg_num(data->body, crc_marker, &data->msg_num, &digits))
     {
-        /*  Find the pointer to the separator */
-        char *key_end = strstr(token_array[index], PROTOCOL_KEY_VALUE_SEP);
+        LOG_WRN("no msg number");
+        return -1;
+    }
 
-        if (key_end)
+    /*  Where the frame is, for anything that wants to pass it on */
+    frame_len = LEN(crc_marker, str) + 1 + PROTOCOL_CRC_CHARS;
+    if (frame_len <= len)
+    {
+        data->frame = str;
+        data->frame_len = frame_len;
+        data->msg_offset = LEN(digits, str);
+        data->msg_len = 0;
+        while (digits[data->msg_len] != *PROTOCOL_ITEM_SEP && &digits[data->msg_len] != crc_marker)
         {
-            char *val_start;
-            char* val_end;
-            struct key_val_pair pair;
-            size_t key_len = LEN(key_end, token_array[index]);
-            char key_str[PROTOCOL_MAX_KEY_LEN];
-            char value_str[PROTOCOL_MAX_KEY_LEN];
+            ++data->msg_len;
+        }
+    }
+
+    return PARSER_OK;
+}
+
+int parsed_data_decode(parsed_data_t data)
+{
+    char token_array[PROTOCOL_MAX_NUM_TOKENS][PROTOCOL_MAX_TOKEN_LEN] = {0};
+    uint8_t pair_index = 0;
+    uint8_t num_tokens = 0;
+    uint8_t invalid_params = 0;
 
-            /*  Copy and null-terminate the value */
-            memcpy(key_str, token_array[index], (key_len));
-            key_str[key_len] = '\0';
-            pair.key = key_to_enum(key_str);
+    if (data->body == NULL)
+    {
+        return data->status;
+    }
 
+    /*  Convert the param bytes into string tokens */
+    num_tokens = tokeniser(data->body, data->body_len, token_array);
+    data->body = NULL;
 
-            /*  Copy the key */
-            val_start = key_end + 1;
+    /*  Iterate and validate the key:value sent with this command */
+    for (uint8_t index = 0; index < num_tokens; ++index)
+    {
+        /*  Find the separator, tokens are null terminated and bounded */
+        char *key_end = strchr(token_array[index], *PROTOCOL_KEY_VALUE_SEP);
+        size_t key_len;
+        char key_str[PROTOCOL_MAX_KEY_LEN];
+        struct key_val_pair pair;
 
-            /*  assume the end of the token has been null-terminated
-                (should be done in the tokeniser)*/
-            while (*key_end++ != '\0');
-            val_end = key_end;
-            memcpy(value_str, val_start, LEN(val_end, val_start));
-            pair.value = str_to_value(value_str);
+        if (key_end == NULL)
+        {
+            break;
+        }
 
-            /*  Validate the params and get the msg number
-                if one has been supplied */
-            if (strcmp(key_str, PROTOCOL_MSG_IDENTIFIER) == 0)
-            {
-                *msg_num = pair.value;
-            }
-            else if (validate_param_for_command(command, pair.key, pair.value) == 0)
-            {
-                data->params[pair_index] = pair;
-                ++pair_index;
-            }
-            else
-            {
-                LOG_WRN("invalid param [%s:%s]", pair.key, pair.value);
-                invalid_params = 1;
-            }
+        key_len = LEN(key_end, token_array[index]);
+        if (key_len >= PROTOCOL_MAX_KEY_LEN || strlen(key_end + 1) > PROTOCOL_MAX_VALUE_LEN)
+        {
+            LOG_WRN("param too long");
+            invalid_params = 1;
+            continue;
+        }
+
+        /*  Copy and null-terminate the key */
+        memcpy(key_str, token_array[index], key_len);
+        key_str[key_len] = '\0';
+
+        /*  The header already has the msg number */
+        if (strcmp(key_str, PROTOCOL_MSG_IDENTIFIER) == 0)
+        {
+            continue;
+        }
+
+        pair.key = key_to_enum(key_str);
+        pair.value = str_to_value(key_end + 1);
+
+        if (pair_index < PROTOCOL_MAX_PARAMS &&
+            validate_param_for_command(data->command, pair.key, pair.value) == 0)
+        {
+            data->params[pair_index] = pair;
+            ++pair_index;
         }
         else
         {
-            break;
+            LOG_WRN("invalid param [%d:%d]", pair.key, (int) pair.value);
+            invalid_params = 1;
         }
     }
-    data->command = command;
     data->num_params = pair_index;
+    data->status = invalid_params ? PARSER_INVALID_PARAMS : PARSER_OK;
+
+    return data->status;
+}
+
+int parse(
+    char *str,
+    size_t len,
+    parsed_data_t data,
+    uint16_t *msg_num)
+{
+    int header = parse_header(str, len, data);
 
-    if (*msg_num == -1)
+    if (data->command == COMMAND_INVALID)
     {
         return -1;
     }
 
-    if (invalid_params)
+    *msg_num = data->msg_num;
+
+    /*  Decode what we can even without a msg number */
+    if (parsed_data_decode(data) != PARSER_OK || header != PARSER_OK)
     {
         return -1;
     }
@@ -344,66 +690,280 @@ int parse(
     return PARSER_OK;
 }
 
-static void remove_packet(protocol_ctx_t ctx, const uint16_t msg_num)
+struct pbuf *protocol_relay_pbuf(const struct parsed_data *data, uint16_t msg_num)
 {
-    if (ctx->to_send && ctx->to_send->msg_num == msg_num)
+    const uint8_t *frame = (const uint8_t *) data->frame;
+    const size_t rest = data->msg_offset + data->msg_len;
+    struct emitter e;
+    struct pbuf *buf;
+
+    if (frame == NULL)
+    {
+        return NULL;
+    }
+
+    /*  Same number on both links, the frame goes as it is */
+    if (msg_num == data->msg_num)
+    {
+        return pbuf_alloc_copy(frame, data->frame_len);
+    }
+
+    buf = pbuf_alloc(data->frame_len - data->msg_len + PROTOCOL_MAX_MSG_NUM_CHARS + 1);
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+
+    /*  Everything but the number and the CRC is copied over untouched */
+    e = (struct emitter) {.pos = buf->data, .end = buf->data + buf->size};
+    emit_bytes(&e, (const char *) frame, data->msg_offset);
+    emit_u16_dec(&e, msg_num);
+    emit_bytes(&e, (const char *) frame + rest, data->frame_len - PROTOCOL_CRC_CHARS - rest);
+    emit_u16_hex(&e, os_crc16_ccitt(PROTOCOL_CRC_POLY, buf->data, e.pos - buf->data));
+    if (e.overflow)
+    {
+        pbuf_unref(buf);
+        return NULL;
+    }
+    if (e.pos < e.end)
     {
-        timer_stop(ctx->resend_timer);
-        k_mem_slab_free(&protocol_pkt_slab, ctx->to_send);
-        ctx->to_send = NULL;
+        *e.pos = '\0';
     }
+    buf->len = e.pos - buf->data;
+
+    return buf;
 }
 
-inline void queue_packet(protocol_ctx_t ctx, const pkt_t pkt)
+/**
+ * @brief   Free a packet along with the relayed frame it carries, if any
+ */
+static void free_packet(pkt_t pkt)
 {
-    if (ctx->to_send == NULL)
+    if (pkt->frame)
     {
-        ctx->to_send = pkt;
+        pbuf_unref(pkt->frame);
     }
+    os_pool_free(&protocol_pkt_slab, pkt);
 }
 
-static inline void mark_packet_for_resend(protocol_ctx_t ctx)
+/*  A relayed packet goes out as the bytes it came in as */
+static inline struct pbuf *packet_pbuf(pkt_t pkt)
 {
-    ctx->to_send->resend = true;
+    return pkt->frame ? pbuf_ref(pkt->frame) : serialise_packet_pbuf(pkt);
 }
 
-inline pkt_t send_pkt(protocol_ctx_t ctx)
+/**
+ * @brief   Give an in flight slot back. Whoever is still sending the
+ *          frame keeps their own reference.
+ */
+static void release_slot(protocol_ctx_t ctx, struct protocol_in_flight *slot)
 {
-    timer_start(ctx->resend_timer, K_MSEC(PKT_TIMEOUT_MSEC), K_MSEC(PKT_TIMEOUT_MSEC));
-    return ctx->to_send;
+    timer_wheel_cancel(ctx->wheel, &slot->timer);
+    free_packet(slot->pkt);
+    slot->pkt = NULL;
+    if (slot->buf)
+    {
+        pbuf_unref(slot->buf);
+        slot->buf = NULL;
+    }
 }
 
-void handle_incoming(
-    protocol_ctx_t ctx,
-    parsed_data_t data)
+static void remove_packet(protocol_ctx_t ctx, const uint16_t msg_num)
 {
-    __ASSERT(ctx, "Invalid ctx ptr");
-    __ASSERT(data, "Invalid data ptr");
-    int16_t msg_num = -1;
-
-    int ret = parse((char*) ctx->rx_buf, ctx->rx_len, data, &msg_num);
-    if (ret)
+    if (ctx->wheel == NULL)
     {
-        LOG_ERR("Parsing failed");
-        queue_packet(ctx, create_nack());
+        if (ctx->to_send && ctx->to_send->msg_num == msg_num)
+        {
+            timer_stop(ctx->resend_timer);
+            free_packet(ctx->to_send);
+            ctx->to_send = NULL;
+            /*  Whoever is still sending it keeps their own reference */
+            if (ctx->to_send_buf)
+            {
+                pbuf_unref(ctx->to_send_buf);
+                ctx->to_send_buf = NULL;
+            }
+            ctx->awaiting_ack = false;
+        }
         return;
     }
 
-    switch (data->command)
+    /*  to_send only holds our own ACKs and NACKs, the data is in the slots */
+    for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
     {
-        case COMMAND_SET_RGB:
-            remove_packet(ctx, msg_num);
-            queue_packet(ctx, create_ack(msg_num));
-            break;
-        case COMMAND_ACK:
-            remove_packet(ctx, msg_num);
+        struct protocol_in_flight *slot = &ctx->in_flight[index];
+
+        if (slot->pkt && slot->pkt->msg_num == msg_num)
+        {
+            release_slot(ctx, slot);
+            return;
+        }
+    }
+}
+
+static inline void queue_packet(protocol_ctx_t ctx, const pkt_t pkt)
+{
+    if (pkt == NULL)
+    {
+        return;
+    }
+
+    if (ctx->to_send == NULL)
+    {
+        ctx->to_send = pkt;
+    }
+    else if (ctx->wheel)
+    {
+        /*  to_send only holds ACKs and NACKs here, line them up */
+        pkt_t last = ctx->to_send;
+
+        while (last->next)
+        {
+            last = last->next;
+        }
+        last->next = pkt;
+    }
+    else
+    {
+        /*  Only one packet at a time, drop it rather than leak it */
+        free_packet(pkt);
+    }
+}
+
+static inline void mark_packet_for_resend(protocol_ctx_t ctx)
+{
+    if (ctx->wheel)
+    {
+        /*  No telling which frame the NACK was for */
+        for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+        {
+            if (ctx->in_flight[index].pkt)
+            {
+                ctx->in_flight[index].pkt->resend = true;
+            }
+        }
+        return;
+    }
+
+    if (ctx->to_send)
+    {
+        ctx->to_send->resend = true;
+    }
+}
+
+/**
+ * @brief   Take the oldest packet of the most urgent class other threads
+ *          have submitted
+ *
+ * @return  The packet, NULL if there is none
+ */
+static inline pkt_t next_submitted(protocol_ctx_t ctx)
+{
+    for (size_t index = 0; index < ARRAY_SIZE(prio_order); ++index)
+    {
+        struct mpsc_node *node = mpsc_pop(&ctx->submitted[prio_order[index]]);
+
+        if (node)
+        {
+            return CONTAINER_OF(node, struct protocol_pkt, node);
+        }
+    }
+
+    return NULL;
+}
+
+static inline bool packet_expired(const pkt_t pkt, uint32_t now_ms)
+{
+    /*  Signed difference so uptime wrapping doesn't matter */
+    return pkt->expires_ms && (int32_t) (now_ms - pkt->expires_ms) >= 0;
+}
+
+/**
+ * @brief   A packet's ACK timer has run out. Decide whether it is worth
+ *          another go.
+ *
+ * @param   ctx             :   context
+ * @param   pkt             :   packet that timed out
+ * @param   retry_attempts  :   its retransmissions so far, bumped on a retry
+ *
+ * @retval  true if it has been flagged for a resend
+ * @retval  false if it has expired or run out of retries and should go
+ */
+static bool retry_timed_out(protocol_ctx_t ctx, pkt_t pkt, uint8_t *retry_attempts)
+{
+    uint8_t max_retries = prio_classes[pkt->prio].max_retries;
+
+    if (packet_expired(pkt, os_uptime_ms()))
+    {
+        /*  Too late to matter, don't spend more airtime on it */
+        LOG_DBG("msg %d expired", pkt->msg_num);
+        ctx->expired++;
+        return false;
+    }
+
+    if (max_retries != PROTOCOL_RETRIES_FOREVER && *retry_attempts >= max_retries)
+    {
+        LOG_WRN("msg %d not acknowledged, giving up", pkt->msg_num);
+        ctx->gave_up++;
+        return false;
+    }
+
+    /*  Saturates rather than wraps for packets retried forever */
+    if (*retry_attempts < UINT8_MAX)
+    {
+        *retry_attempts += 1;
+    }
+    pkt->resend = true;
+
+    return true;
+}
+
+static inline pkt_t send_pkt(protocol_ctx_t ctx)
+{
+    uint16_t timeout_ms = prio_classes[ctx->to_send->prio].timeout_ms;
+
+    timer_start(ctx->resend_timer, TIMER_MSEC(timeout_ms), TIMER_MSEC(timeout_ms));
+    return ctx->to_send;
+}
+
+void handle_incoming(
+    protocol_ctx_t ctx,
+    parsed_data_t data)
+{
+    __ASSERT(ctx, "Invalid ctx ptr");
+    __ASSERT(data, "Invalid data ptr");
+
+    /*  The ACK only needs the header, the params are left for whoever
+        consumes the data */
+    int ret = parse_header((char*) ctx->rx_buf, ctx->rx_len, data);
+    if (ret)
+    {
+        LOG_ERR("Parsing failed");
+        data->command = COMMAND_INVALID;
+        queue_packet(ctx, create_nack());
+        return;
+    }
+    uint16_t msg_num = data->msg_num;
+
+    switch (data->command)
+    {
+        case COMMAND_ACK:
+            remove_packet(ctx, msg_num);
             break;
         case COMMAND_NACK:
             mark_packet_for_resend(ctx);
             break;
         case COMMAND_INVALID:
+        case NUM_COMMANDS:
             queue_packet(ctx, create_nack());
             break;
+        default:
+            /*  Everything else in the schema is data, so adding a
+                command doesn't mean adding it here. Only an ACK
+                releases one of our packets, a data frame's msg number
+                is the sender's own */
+            queue_packet(ctx, create_ack(msg_num));
+            break;
     }
 }
 
@@ -422,7 +982,7 @@ pkt_t protocol_packet_create(
     }
 
     /*  Then allocate memory */
-    int rc = k_mem_slab_alloc(&protocol_pkt_slab, (void **)&pkt, K_FOREVER);
+    int rc = os_pool_alloc(&protocol_pkt_slab, (void **)&pkt);
     if (rc)
     {
         LOG_ERR("slab memory allocation failed");
@@ -454,29 +1014,530 @@ pkt_t protocol_packet_create(
     return pkt;
 }
 
-static void resend_timer_expiry(timer_t *timer)
+int protocol_submit(
+    protocol_ctx_t ctx,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params)
 {
-    protocol_ctx_t ctx = (protocol_ctx_t)timer->user_data;
+    return protocol_submit_qos(ctx, command, params, num_params, PROTOCOL_PRIO_NORMAL, PROTOCOL_TTL_NONE);
+}
+
+/**
+ * @brief   Hand a new packet over to the owner of ctx
+ *
+ * @returns The packet's msg number
+ */
+static int submit_packet(protocol_ctx_t ctx, pkt_t pkt, protocol_prio_t prio, uint32_t ttl_ms)
+{
+    uint16_t msg_num;
+
+    pkt->prio = prio;
+    if (ttl_ms != PROTOCOL_TTL_NONE)
+    {
+        /*  0 means never, nudge a deadline that lands on it */
+        pkt->expires_ms = MAX(os_uptime_ms() + ttl_ms, 1);
+    }
+
+    /*  Once pushed the packet belongs to the owner, it may be sent,
+        acknowledged and freed before we get to look at it again */
+    msg_num = pkt->msg_num;
+    mpsc_push(&ctx->submitted[prio], &pkt->node);
+
+    if (ctx->event_cb)
+    {
+        ctx->event_cb(ctx, PROTOCOL_EVENT_SUBMIT, ctx->event_user_data);
+    }
+
+    return msg_num;
+}
+
+int protocol_submit_qos(
+    protocol_ctx_t ctx,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params,
+    protocol_prio_t prio,
+    uint32_t ttl_ms)
+{
+    pkt_t pkt;
+
+    __ASSERT(ctx, "Invalid ctx ptr");
+
+    /*  ACKs and NACKs belong to the owning thread */
+    if (cmd_to_string(command) == NULL ||
+        command == COMMAND_ACK || command == COMMAND_NACK ||
+        (unsigned) prio >= PROTOCOL_NUM_PRIOS ||
+        num_params > PROTOCOL_MAX_PARAMS ||
+        validate_params_for_command(command, params, num_params))
+    {
+        return -EINVAL;
+    }
+
+    /*  The pool is safe to allocate from on any thread */
+    pkt = protocol_packet_create(command, (struct key_val_pair *) params, num_params, create_msg_num());
+    if (pkt == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    return submit_packet(ctx, pkt, prio, ttl_ms);
+}
+
+int protocol_submit_relay(protocol_ctx_t ctx, const struct parsed_data *data)
+{
+    pkt_t pkt;
+
+    __ASSERT(ctx, "Invalid ctx ptr");
+    __ASSERT(data, "Invalid data ptr");
+
+    if (data->frame == NULL ||
+        data->command == COMMAND_ACK || data->command == COMMAND_NACK ||
+        cmd_to_string(data->command) == NULL)
+    {
+        return -EINVAL;
+    }
+
+    /*  No params, the frame already has them */
+    pkt = protocol_packet_create(data->command, NULL, 0, create_msg_num());
+    if (pkt == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    pkt->frame = protocol_relay_pbuf(data, pkt->msg_num);
+    if (pkt->frame == NULL)
+    {
+        free_packet(pkt);
+        return -ENOMEM;
+    }
+
+    return submit_packet(ctx, pkt, PROTOCOL_PRIO_NORMAL, PROTOCOL_TTL_NONE);
+}
+
+/*  Runs in ISR context. The ARQ state belongs to the owning thread,
+    so just let it know */
+static void resend_timer_expiry(os_timer_t *timer)
+{
+    protocol_ctx_t ctx = (protocol_ctx_t)timer_user_data_get(timer);
+
+    if (ctx->event_cb)
+    {
+        ctx->event_cb(ctx, PROTOCOL_EVENT_TIMEOUT, ctx->event_user_data);
+    }
+}
+
+void protocol_set_event_cb(protocol_ctx_t ctx, protocol_event_cb_t event_cb, void *user_data)
+{
+    ctx->event_cb = event_cb;
+    ctx->event_user_data = user_data;
+}
+
+void protocol_timeout(protocol_ctx_t ctx)
+{
+    __ASSERT(ctx, "Invalid ctx ptr");
+
+    if (ctx->wheel)
+    {
+        for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+        {
+            struct protocol_in_flight *slot = &ctx->in_flight[index];
+
+            /*  The flag may be left over from a packet that has since
+                been acknowledged, it is cleared when the slot is reused */
+            if (slot->pkt == NULL || !os_atomic_get(&slot->timed_out))
+            {
+                continue;
+            }
+            os_atomic_set(&slot->timed_out, 0);
+
+            if (!retry_timed_out(ctx, slot->pkt, &slot->retry_attempts))
+            {
+                release_slot(ctx, slot);
+            }
+        }
+        return;
+    }
 
-    if (ctx->retry_attempts == PROTOCOL_MAX_MSG_RETRIES)
+    /*  The ACK may have arrived between the timer firing and us
+        getting here */
+    if (ctx->to_send == NULL || !ctx->awaiting_ack)
+    {
+        return;
+    }
+
+    if (!retry_timed_out(ctx, ctx->to_send, &ctx->retry_attempts))
     {
         remove_packet(ctx, ctx->to_send->msg_num);
     }
-    else
+}
+
+/*  Wheel expiry, possibly in ISR context. Flag the slot and let the
+    owner deal with it */
+static void in_flight_expiry(struct timer_wheel_entry *entry, void *user_data)
+{
+    protocol_ctx_t ctx = (protocol_ctx_t) user_data;
+    struct protocol_in_flight *slot = CONTAINER_OF(entry, struct protocol_in_flight, timer);
+
+    os_atomic_set(&slot->timed_out, 1);
+
+    if (ctx->event_cb)
     {
-        ctx->retry_attempts += 1;
-        ctx->to_send->resend = true;
+        ctx->event_cb(ctx, PROTOCOL_EVENT_TIMEOUT, ctx->event_user_data);
+    }
+}
+
+void protocol_set_delivery(protocol_ctx_t ctx, timer_wheel_t wheel, command_delivery_t delivery)
+{
+    __ASSERT(ctx, "Invalid ctx ptr");
+    __ASSERT(wheel, "Invalid wheel ptr");
+
+    ctx->wheel = wheel;
+    ctx->delivery = delivery;
+
+    for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+    {
+        timer_wheel_entry_init(&ctx->in_flight[index].timer, in_flight_expiry, ctx);
+    }
+}
+
+static inline command_delivery_t packet_delivery(protocol_ctx_t ctx, const pkt_t pkt)
+{
+    if (ctx->delivery == COMMAND_DELIVERY_ORDERED)
+    {
+        return COMMAND_DELIVERY_ORDERED;
+    }
+    return command_delivery(pkt->command);
+}
+
+static bool ordered_in_flight(protocol_ctx_t ctx)
+{
+    for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+    {
+        pkt_t pkt = ctx->in_flight[index].pkt;
+
+        if (pkt && packet_delivery(ctx, pkt) == COMMAND_DELIVERY_ORDERED)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool packet_target(const pkt_t pkt, value_t *target)
+{
+    for (size_t index = 0; index < pkt->num_params; ++index)
+    {
+        if (pkt->params[index].key == KEY_TARGET)
+        {
+            *target = pkt->params[index].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief   Whether a packet for the same target is in flight. A resend
+ *          of the older one could land after this one and undo it, so
+ *          this one waits for its ACK.
+ */
+static bool target_in_flight(protocol_ctx_t ctx, const pkt_t pkt)
+{
+    value_t target;
+    value_t other;
+
+    if (!packet_target(pkt, &target))
+    {
+        return false;
+    }
+
+    for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+    {
+        pkt_t in_flight = ctx->in_flight[index].pkt;
+
+        if (in_flight && packet_target(in_flight, &other) && other == target)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief   Take the next packet that may go out now: the oldest of the
+ *          most urgent class, skipping ordered packets while another
+ *          ordered one is in flight, and packets whose target already
+ *          has one in flight. Anything that went stale while waiting is
+ *          dropped on the way.
+ *
+ * @return  The packet, NULL if nothing can go yet
+ */
+static pkt_t take_ready(protocol_ctx_t ctx)
+{
+    bool ordered_busy = ordered_in_flight(ctx);
+    uint32_t now_ms = os_uptime_ms();
+    struct mpsc_node *node;
+
+    /*  The submission queues can only be taken from the front, move
+        everything across to lists we can pick from */
+    for (size_t prio = 0; prio < PROTOCOL_NUM_PRIOS; ++prio)
+    {
+        struct protocol_pkt_list *list = &ctx->ready[prio];
+
+        while ((node = mpsc_pop(&ctx->submitted[prio])) != NULL)
+        {
+            pkt_t pkt = CONTAINER_OF(node, struct protocol_pkt, node);
+
+            pkt->next = NULL;
+            if (list->tail)
+            {
+                list->tail->next = pkt;
+            }
+            else
+            {
+                list->head = pkt;
+            }
+            list->tail = pkt;
+        }
+    }
+
+    for (size_t index = 0; index < ARRAY_SIZE(prio_order); ++index)
+    {
+        struct protocol_pkt_list *list = &ctx->ready[prio_order[index]];
+        pkt_t prev = NULL;
+        pkt_t pkt = list->head;
+
+        while (pkt)
+        {
+            pkt_t next = pkt->next;
+            bool expired = packet_expired(pkt, now_ms);
+            bool held = (ordered_busy && packet_delivery(ctx, pkt) == COMMAND_DELIVERY_ORDERED)
+                        || target_in_flight(ctx, pkt);
+
+            if (expired || !held)
+            {
+                /*  Unlink it */
+                if (prev)
+                {
+                    prev->next = next;
+                }
+                else
+                {
+                    list->head = next;
+                }
+                if (list->tail == pkt)
+                {
+                    list->tail = prev;
+                }
+                pkt->next = NULL;
+
+                if (!expired)
+                {
+                    return pkt;
+                }
+
+                LOG_DBG("msg %d expired before sending", pkt->msg_num);
+                ctx->expired++;
+                free_packet(pkt);
+            }
+            else
+            {
+                prev = pkt;
+            }
+            pkt = next;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief   (Re)send the packet in a slot and start its ACK timer
+ *
+ * @returns A reference to the frame for the caller, NULL if there was
+ *          no buffer to serialise into (it goes on the next call)
+ */
+static struct pbuf *send_slot(protocol_ctx_t ctx, struct protocol_in_flight *slot)
+{
+    pkt_t pkt = slot->pkt;
+
+    if (slot->buf == NULL)
+    {
+        slot->buf = packet_pbuf(pkt);
+        if (slot->buf == NULL)
+        {
+            pkt->resend = true;
+            return NULL;
+        }
     }
+
+    pkt->resend = false;
+    timer_wheel_arm(ctx->wheel, &slot->timer, prio_classes[pkt->prio].timeout_ms);
+
+    return pbuf_ref(slot->buf);
 }
 
-void protocol_init(struct protocol_ctx *ctx, uint8_t *buffer, size_t buffer_size, timer_t *timer)
+/**
+ * @brief   protocol_tx_pbuf() for data in unordered mode. Retransmissions
+ *          go first, then new packets while there are free slots.
+ */
+static struct pbuf *tx_in_flight(protocol_ctx_t ctx)
+{
+    struct protocol_in_flight *free_slot = NULL;
+    uint32_t now_ms = os_uptime_ms();
+    pkt_t pkt;
+
+    for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+    {
+        struct protocol_in_flight *slot = &ctx->in_flight[index];
+
+        if (slot->pkt && slot->pkt->resend && packet_expired(slot->pkt, now_ms))
+        {
+            /*  Went stale waiting to be resent */
+            LOG_DBG("msg %d expired before resending", slot->pkt->msg_num);
+            ctx->expired++;
+            release_slot(ctx, slot);
+        }
+
+        if (slot->pkt == NULL)
+        {
+            free_slot = free_slot ? free_slot : slot;
+            continue;
+        }
+
+        if (slot->pkt->resend)
+        {
+            return send_slot(ctx, slot);
+        }
+    }
+
+    if (free_slot == NULL)
+    {
+        return NULL;
+    }
+
+    pkt = take_ready(ctx);
+    if (pkt == NULL)
+    {
+        return NULL;
+    }
+
+    free_slot->pkt = pkt;
+    free_slot->retry_attempts = 0;
+    os_atomic_set(&free_slot->timed_out, 0);
+
+    return send_slot(ctx, free_slot);
+}
+
+struct pbuf *protocol_tx_pbuf(protocol_ctx_t ctx)
+{
+    pkt_t pkt;
+    struct pbuf *buf;
+
+    /*  With a wheel, to_send only ever holds ACKs and NACKs. They go
+        first, data goes from the in flight slots */
+    if (ctx->wheel && ctx->to_send == NULL)
+    {
+        return tx_in_flight(ctx);
+    }
+
+    for (;;)
+    {
+        /*  Only one packet in flight, the next submitted one goes once
+            the slot is free */
+        if (ctx->to_send == NULL)
+        {
+            ctx->to_send = next_submitted(ctx);
+        }
+        pkt = ctx->to_send;
+
+        if (pkt == NULL || (ctx->awaiting_ack && !pkt->resend))
+        {
+            return NULL;
+        }
+
+        if (!packet_expired(pkt, os_uptime_ms()))
+        {
+            break;
+        }
+
+        /*  Went stale waiting its turn, or waiting to be resent */
+        LOG_DBG("msg %d expired before sending", pkt->msg_num);
+        ctx->expired++;
+        remove_packet(ctx, pkt->msg_num);
+    }
+
+    if (ctx->to_send_buf == NULL)
+    {
+        ctx->to_send_buf = packet_pbuf(pkt);
+        if (ctx->to_send_buf == NULL)
+        {
+            /*  Buffers come back as the TX path finishes with them */
+            return NULL;
+        }
+    }
+    buf = ctx->to_send_buf;
+
+    if (pkt->command == COMMAND_ACK || pkt->command == COMMAND_NACK)
+    {
+        /*  Nothing comes back for these, our reference goes to the caller */
+        ctx->to_send = pkt->next;
+        free_packet(pkt);
+        ctx->to_send_buf = NULL;
+        return buf;
+    }
+
+    if (!ctx->awaiting_ack)
+    {
+        ctx->retry_attempts = 0;
+        ctx->awaiting_ack = true;
+    }
+    pkt->resend = false;
+    send_pkt(ctx);
+
+    return pbuf_ref(buf);
+}
+
+size_t protocol_tx(protocol_ctx_t ctx, uint8_t *dest, size_t dest_size)
+{
+    struct pbuf *buf = protocol_tx_pbuf(ctx);
+    size_t len;
+
+    if (buf == NULL)
+    {
+        return 0;
+    }
+
+    len = pbuf_copy_out(buf, dest, dest_size);
+    pbuf_unref(buf);
+
+    return len;
+}
+
+void protocol_init(struct protocol_ctx *ctx, uint8_t *buffer, size_t buffer_size, os_timer_t *timer)
 {
     protocol_ctx_t this = ctx;
 
     timer_init(timer, resend_timer_expiry, NULL, this);
-    // this->resend_timer = timer;
+    this->resend_timer = timer;
     this->rx_buf = buffer;
     this->rx_len = buffer_size;
     this->to_send = NULL;
-    this->retry_attempts = PROTOCOL_MAX_MSG_RETRIES;
+    this->to_send_buf = NULL;
+    this->retry_attempts = 0;
+    this->awaiting_ack = false;
+    this->event_cb = NULL;
+    this->event_user_data = NULL;
+    this->expired = 0;
+    this->gave_up = 0;
+    this->wheel = NULL;
+    this->delivery = COMMAND_DELIVERY_ORDERED;
+    memset(this->in_flight, 0, sizeof(this->in_flight));
+    for (size_t prio = 0; prio < PROTOCOL_NUM_PRIOS; ++prio)
+    {
+        mpsc_init(&this->submitted[prio]);
+        this->ready[prio].head = NULL;
+        this->ready[prio].tail = NULL;
+    }
 }
\ No newline at end of file
@@ -1,12 +1,12 @@
 #ifndef _BBBLED_PROTOCOL_H
 #define _BBBLED_PROTOCOL_H
 
-#include <zephyr/types.h>
-#include <zephyr/kernel.h>
-#include <zephyr/sys/ring_buffer.h>
+#include "os.h"
 
 #include "commands.h"
 #include "serialise.h"
+#include "pbuf.h"
+#include "mpsc.h"
 #include "timer.h"
 
 #ifdef __cplusplus
@@ -17,6 +17,12 @@ extern "C" {
 #define PROTOCOL_MAX_KEY_LEN 16
 #define PROTOCOL_MAX_VALUE_LEN 16
 #define PROTOCOL_MAX_MSG_RETRIES 5
+// Retry limit meaning "until acknowledged or expired"
+#define PROTOCOL_RETRIES_FOREVER UINT8_MAX
+// No time to live, the packet never goes stale
+#define PROTOCOL_TTL_NONE 0
+// Data packets that can be waiting for an ACK at once, unordered mode only
+#define PROTOCOL_MAX_IN_FLIGHT 8
 #define PROTOCOL_CRC_POLY 0x0000 // CCITT poly
 // max number of chars in msg:<number> identifier
 #define PROTOCOL_MAX_MSG_NUM_CHARS 5
@@ -57,16 +63,56 @@ typedef enum {
 
 typedef uint16_t crc_t;
 
+/*
+ * Priority classes. Waiting packets go out most urgent first, and the
+ * class sets how long to wait for an ACK and how often to retry.
+ */
+typedef enum {
+    // 100 ms timeout, PROTOCOL_MAX_MSG_RETRIES retries
+    PROTOCOL_PRIO_NORMAL = 0,
+    // Jumps the queue, 50 ms timeout, retries until acknowledged or expired
+    PROTOCOL_PRIO_URGENT,
+    // Goes when nothing else is waiting, 200 ms timeout, one retry
+    PROTOCOL_PRIO_BULK,
+    PROTOCOL_NUM_PRIOS,
+} protocol_prio_t;
+
 enum pkt_type {
     PKT_TYPE_DATA = 1,
     PKT_TYPE_ACK,
     PKT_TYPE_NACK,
 };
 
+/**
+ * @brief A received frame. The header is filled in straight away, the
+ *        params only once parsed_data_decode() is called.
+ * @param   command     :   command in the frame
+ * @param   params      :   decoded params
+ * @param   num_params  :   number of decoded params
+ * @param   msg_num     :   msg number in the frame
+ * @param   body        :   params still to decode, in the frame itself.
+ *                          NULL once decoded
+ * @param   body_len    :   bytes of body, up to and including the CRC marker
+ * @param   status      :   PARSER_OK, or PARSER_INVALID_PARAMS if decoding
+ *                          found a param the command doesn't take
+ * @param   frame       :   the whole frame, for relaying it. NULL if the
+ *                          header didn't parse
+ * @param   frame_len   :   length of the frame up to the last CRC character
+ * @param   msg_offset  :   where the msg number's digits start in the frame
+ * @param   msg_len     :   number of digits
+ */
 struct parsed_data{
     command_t command;
     struct key_val_pair params[PROTOCOL_MAX_PARAMS];
     size_t num_params;
+    uint16_t msg_num;
+    char *body;
+    size_t body_len;
+    int status;
+    char *frame;
+    size_t frame_len;
+    uint16_t msg_offset;
+    uint8_t msg_len;
 };
 
 typedef struct parsed_data* parsed_data_t;
@@ -79,6 +125,12 @@ typedef struct parsed_data* parsed_data_t;
  * @param   msg_num     :   msg number for the pkt
  * @param   crc         :   the crc for the data
  * @param   resend      :   if the pkt is marked for resend
+ * @param   prio        :   priority class
+ * @param   expires_ms  :   uptime after which the pkt is stale, 0 for never
+ * @param   node        :   link in the submission queue
+ * @param   next        :   link in the owner's own lists
+ * @param   frame       :   frame to send as it is, relayed from another
+ *                          link. NULL to serialise the params
  */
 struct protocol_pkt {
     command_t command;
@@ -87,18 +139,93 @@ struct protocol_pkt {
     uint16_t msg_num;
     crc_t crc; // CRC checksum for the message
     bool resend;
+    protocol_prio_t prio;
+    uint32_t expires_ms;
+    struct mpsc_node node;
+    struct protocol_pkt *next;
+    struct pbuf *frame;
 };
 
 typedef struct protocol_pkt* pkt_t;
 
-typedef void (*timer_cb_t)(timer_t*);
+struct protocol_pkt_list {
+    pkt_t head;
+    pkt_t tail;
+};
+
+/**
+ * @brief A data packet waiting for its ACK in unordered mode
+ * @param   pkt             :   the packet, NULL if the slot is free
+ * @param   buf             :   the packet serialised, kept for retransmission
+ * @param   retry_attempts  :   retransmissions so far
+ * @param   timer           :   ACK timeout on the context's wheel
+ * @param   timed_out       :   set by the wheel, handled by protocol_timeout()
+ */
+struct protocol_in_flight {
+    pkt_t pkt;
+    struct pbuf *buf;
+    uint8_t retry_attempts;
+    struct timer_wheel_entry timer;
+    os_atomic_t timed_out;
+};
 
+typedef void (*timer_cb_t)(os_timer_t*);
+
+typedef enum {
+    PROTOCOL_EVENT_TIMEOUT = 0,
+    // Another thread has submitted a packet
+    PROTOCOL_EVENT_SUBMIT,
+} protocol_event_t;
+
+struct protocol_ctx;
+
+/**
+ * @brief   Called when something needs the owner's attention. May be
+ *          called from ISR context, so only post it on to the thread
+ *          that owns the context.
+ */
+typedef void (*protocol_event_cb_t)(struct protocol_ctx *ctx, protocol_event_t event, void *user_data);
+
+/**
+ * @brief Protocol context. All of the ARQ state is owned by one thread,
+ *        nothing else should touch it. Other threads hand packets over
+ *        through protocol_submit().
+ * @param   rx_buf          :   frame to parse
+ * @param   rx_len          :   length of the frame
+ * @param   to_send         :   packet waiting to be sent or acknowledged
+ * @param   to_send_buf     :   to_send serialised, kept for retransmission
+ * @param   retry_attempts  :   retransmissions of to_send so far
+ * @param   awaiting_ack    :   to_send has been sent and needs an ACK
+ * @param   resend_timer    :   ACK timeout
+ * @param   event_cb        :   tells the owner about timeouts
+ * @param   event_user_data :   passed through to event_cb
+ * @param   submitted       :   packets from protocol_submit(), one queue
+ *                              per priority class, oldest first
+ * @param   expired         :   packets dropped because their TTL ran out
+ * @param   gave_up         :   packets dropped because they ran out of retries
+ * @param   wheel           :   ACK timers in unordered mode, NULL otherwise
+ * @param   delivery        :   COMMAND_DELIVERY_UNORDERED lets commands that
+ *                              allow it overtake each other
+ * @param   in_flight       :   data packets awaiting an ACK in unordered mode
+ * @param   ready           :   submitted packets waiting for a slot, per class
+ */
 struct protocol_ctx {
     uint8_t *rx_buf;
     size_t rx_len;
     struct protocol_pkt *to_send;
+    struct pbuf *to_send_buf;
     uint8_t retry_attempts;
-    timer_t *resend_timer;
+    bool awaiting_ack;
+    os_timer_t *resend_timer;
+    protocol_event_cb_t event_cb;
+    void *event_user_data;
+    struct mpsc submitted[PROTOCOL_NUM_PRIOS];
+    uint32_t expired;
+    uint32_t gave_up;
+    timer_wheel_t wheel;
+    command_delivery_t delivery;
+    struct protocol_in_flight in_flight[PROTOCOL_MAX_IN_FLIGHT];
+    struct protocol_pkt_list ready[PROTOCOL_NUM_PRIOS];
 };
 
 typedef struct protocol_ctx* protocol_ctx_t;
@@ -117,6 +244,79 @@ typedef struct protocol_ctx* protocol_ctx_t;
  */
 pkt_t protocol_packet_create(command_t command, struct key_val_pair *params, size_t num_params, uint16_t msg_num);
 
+/**
+ * @brief   Queue a data packet for sending. Safe to call from any
+ *          thread: producers never take a lock, so they don't hold each
+ *          other or the owning thread up. Packets go out in the order
+ *          they were submitted, once whatever is in flight has been
+ *          acknowledged. Same as protocol_submit_qos() with
+ *          PROTOCOL_PRIO_NORMAL and no TTL.
+ *
+ *          The owner is told with PROTOCOL_EVENT_SUBMIT, from the
+ *          submitting thread.
+ *
+ * @param   ctx         :   context
+ * @param   command     :   command to send
+ * @param   params      :   parameters for the command
+ * @param   num_params  :   number of parameters
+ *
+ * @retval  message number (>= 0) on success
+ * @retval  -EINVAL if the command or its parameters are invalid
+ * @retval  -ENOMEM if no packet is free, one comes back with each ACK
+ */
+int protocol_submit(
+    protocol_ctx_t ctx,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params);
+
+/**
+ * @brief   As protocol_submit(), with a priority class and time to live.
+ *          Packets of a more urgent class go ahead of anything less
+ *          urgent still waiting. A packet still waiting to be sent, or
+ *          not yet acknowledged, when its TTL runs out is dropped rather
+ *          than sent or retried again.
+ *
+ * @param   ctx         :   context
+ * @param   command     :   command to send
+ * @param   params      :   parameters for the command
+ * @param   num_params  :   number of parameters
+ * @param   prio        :   priority class
+ * @param   ttl_ms      :   time to live from now, PROTOCOL_TTL_NONE for none
+ *
+ * @retval  message number (>= 0) on success
+ * @retval  -EINVAL if the command, parameters or class are invalid
+ * @retval  -ENOMEM if no packet is free
+ */
+int protocol_submit_qos(
+    protocol_ctx_t ctx,
+    command_t command,
+    const struct key_val_pair *params,
+    size_t num_params,
+    protocol_prio_t prio,
+    uint32_t ttl_ms);
+
+/**
+ * @brief   Submit a frame received on another link to go out on this
+ *          one, without decoding and re-serialising it. The frame gets
+ *          a msg number from this context, and only that number and the
+ *          CRC are rewritten. Otherwise as protocol_submit(), in the
+ *          normal class with no TTL.
+ *
+ *          The params are not checked, so call this only with frames
+ *          the peer is trusted to validate, or decode them first.
+ *
+ * @param   ctx     :   context of the link to relay onto
+ * @param   data    :   header from parse_header(), the frame must still
+ *                      be where it was parsed. It is copied before this
+ *                      returns
+ *
+ * @retval  message number on this link (>= 0) on success
+ * @retval  -EINVAL if there is no frame, or it is an ACK or NACK
+ * @retval  -ENOMEM if no packet or buffer is free
+ */
+int protocol_submit_relay(protocol_ctx_t ctx, const struct parsed_data *data);
+
 /**
  * @brief Convert a packet to a string
  *
@@ -124,11 +324,29 @@ pkt_t protocol_packet_create(command_t command, struct key_val_pair *params, siz
  * @param   dest        buffer to copy into
  * @param   dest_size   size of buffer
  *
- * @returns Amount of bytes written to the buffer
+ * @returns Amount of bytes written to the buffer, 0 if it did not fit
+ *          or the packet has a key its command does not take
  *
  */
 size_t serialise_packet(struct protocol_pkt *pkt, uint8_t *dest, size_t dest_size);
 
+/**
+ * @brief   Serialise a packet straight into a buffer from the smallest
+ *          size class it fits in
+ *
+ * @retval  buffer holding the frame, caller holds the only reference
+ * @retval  NULL if the packet is invalid or no buffer is free
+ */
+struct pbuf *serialise_packet_pbuf(struct protocol_pkt *pkt);
+
+/**
+ * @brief   Same output as serialise_packet(), but built from the generic
+ *          serial_registry callback chain rather than the code generated
+ *          from the command schema. Kept as a reference for tests and
+ *          benchmarks.
+ */
+size_t serialise_packet_generic(struct protocol_pkt *pkt, uint8_t *dest, size_t dest_size);
+
 /**
  * @brief Create a new protocol context
  *
@@ -142,7 +360,7 @@ void protocol_init(
     protocol_ctx_t ctx,
     uint8_t *buffer,
     size_t buffer_size,
-    timer_t *timer);
+    os_timer_t *timer);
 
 /**
  * @brief   parse a string, returning its command and params if valid
@@ -161,10 +379,128 @@ int parse(
     parsed_data_t data,
     uint16_t *msg_num);
 
+/**
+ * @brief   Check the preamble and CRC and pull out the command and msg
+ *          number, which is all an ACK needs. The params are left in the
+ *          frame for parsed_data_decode().
+ *
+ * @param   str     :   frame to parse, null terminated
+ * @param   len     :   length of the frame
+ * @param   data    :   header to fill in
+ *
+ * @retval  -1 if the frame is damaged, or has no valid command or msg number
+ * @retval  0 if successful
+ */
+int parse_header(char *str, size_t len, parsed_data_t data);
+
+/**
+ * @brief   Decode and validate the params of a frame from parse_header().
+ *          Only the first call does any work. The frame must still be
+ *          where it was when the header was parsed.
+ *
+ *          The frame has usually been acknowledged by now, so a bad
+ *          param can't be NACKed. It is reported here instead, and the
+ *          params that were valid are still decoded.
+ *
+ * @param   data    :   parsed header
+ *
+ * @retval  PARSER_OK if every param is valid for the command
+ * @retval  PARSER_INVALID_PARAMS if not
+ */
+int parsed_data_decode(parsed_data_t data);
+
+/**
+ * @brief   Copy a received frame for another link without decoding it.
+ *          Only the msg number and the CRC are rewritten, and only if
+ *          the number has to change.
+ *
+ * @param   data    :   header from parse_header()
+ * @param   msg_num :   msg number to use on the other link
+ *
+ * @returns The frame, NULL if there is no buffer for it or the header
+ *          didn't parse
+ */
+struct pbuf *protocol_relay_pbuf(const struct parsed_data *data, uint16_t msg_num);
+
+/**
+ * @brief   Handle the frame in ctx->rx_buf. Only the header is parsed
+ *          before the ACK is queued, so data is left to be decoded with
+ *          parsed_data_decode() while ctx->rx_buf is still valid.
+ *          data->command is COMMAND_INVALID if the frame was NACKed.
+ *
+ * @param   ctx     :   protocol context
+ * @param   data    :   filled in with the frame's header
+ */
 void handle_incoming(
     protocol_ctx_t ctx,
     parsed_data_t data);
 
+/**
+ * @brief   Give every data packet its own ACK timer on a wheel, so up to
+ *          PROTOCOL_MAX_IN_FLIGHT can be waiting for their ACKs at once
+ *          and each is retransmitted on its own. ACKs and NACKs queue up
+ *          rather than being dropped while data is in flight.
+ *
+ *          With COMMAND_DELIVERY_UNORDERED, commands the schema declares
+ *          unordered (set_rgb) go out as soon as there is a free slot,
+ *          whatever else is outstanding, and one lost frame no longer
+ *          holds up everything behind it. Ordered commands still go one
+ *          at a time, in order. COMMAND_DELIVERY_ORDERED treats every
+ *          command as ordered, which is stop-and-wait as before.
+ *
+ *          Call before anything is sent. The wheel must tick once a
+ *          millisecond, and its expiry may run in ISR context: it only
+ *          flags the slot and posts PROTOCOL_EVENT_TIMEOUT.
+ *
+ * @param   ctx         :   context
+ * @param   wheel       :   initialised wheel with a 1 ms tick
+ * @param   delivery    :   COMMAND_DELIVERY_ORDERED or COMMAND_DELIVERY_UNORDERED
+ */
+void protocol_set_delivery(protocol_ctx_t ctx, timer_wheel_t wheel, command_delivery_t delivery);
+
+/**
+ * @brief   Set the callback that tells the owner about protocol events
+ *
+ * @param   ctx         :   context
+ * @param   event_cb    :   callback, called from the timer ISR
+ * @param   user_data   :   passed through to the callback
+ */
+void protocol_set_event_cb(protocol_ctx_t ctx, protocol_event_cb_t event_cb, void *user_data);
+
+/**
+ * @brief   Handle an ACK timeout. Call from the owning thread once
+ *          PROTOCOL_EVENT_TIMEOUT has been posted. Each packet whose
+ *          timer ran out is flagged for a resend, or dropped if it has
+ *          expired or run out of the retries its class allows.
+ *
+ * @param   ctx :   context
+ */
+void protocol_timeout(protocol_ctx_t ctx);
+
+/**
+ * @brief   Serialise the next frame that needs to go out, if any. ACKs
+ *          and NACKs are released once serialised, data packets are
+ *          kept until acknowledged and their ACK timer is started.
+ *
+ * @param   ctx         :   context
+ * @param   dest        :   buffer to serialise into
+ * @param   dest_size   :   size of the buffer
+ *
+ * @returns Bytes written, 0 if there is nothing to send
+ */
+size_t protocol_tx(protocol_ctx_t ctx, uint8_t *dest, size_t dest_size);
+
+/**
+ * @brief   As protocol_tx(), but hands out a reference to the frame
+ *          rather than copying it. A data frame is serialised once and
+ *          the same buffer goes out again on every retransmission.
+ *
+ * @param   ctx :   context
+ *
+ * @returns A reference the caller must drop with pbuf_unref(), NULL if
+ *          there is nothing to send (or no buffer to serialise into)
+ */
+struct pbuf *protocol_tx_pbuf(protocol_ctx_t ctx);
 
 
 
@@ -0,0 +1,484 @@
+#include <string.h>
+
+#include "protocol_loop.h"
+#include "ping.h"
+
+// Bytes pulled out of the transport per read
+#define PROTOCOL_LOOP_READ_CHUNK 64
+
+LOG_MODULE_REGISTER(bbbled_protocol_loop, LOG_LEVEL_DBG);
+
+/*  Timer ISR or a submitting thread, hand the event over to the loop */
+static void protocol_event(protocol_ctx_t ctx, protocol_event_t event, void *user_data)
+{
+    protocol_loop_t loop = (protocol_loop_t) user_data;
+
+    ARG_UNUSED(ctx);
+
+    switch (event)
+    {
+        case PROTOCOL_EVENT_TIMEOUT:
+            k_poll_signal_raise(&loop->timer_signal, 0);
+            break;
+        case PROTOCOL_EVENT_SUBMIT:
+            k_poll_signal_raise(&loop->submit_signal, 0);
+            break;
+    }
+}
+
+static void flush_tx(protocol_loop_t loop);
+
+/**
+ * @brief   Stamp a ping or pong and pass it on. A ping from the host goes
+ *          to the peer link, or is answered here if there isn't one. A
+ *          ping that already has a receive stamp came from a dongle, so
+ *          this end is the far side and echoes it untouched. A pong goes
+ *          back to the peer link it is for.
+ */
+static void handle_ping(protocol_loop_t loop, parsed_data_t data, uint32_t rx_us)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    size_t num_params;
+    protocol_ctx_t dest = loop->ctx;
+    command_t command = COMMAND_PONG;
+    uint32_t stamp;
+    int ret;
+
+    if (parsed_data_decode(data) != PARSER_OK)
+    {
+        LOG_WRN("bad timestamps in %s %u", cmd_to_string(data->command), data->msg_num);
+        return;
+    }
+    num_params = data->num_params;
+    memcpy(params, data->params, num_params * sizeof(params[0]));
+
+    if (data->command == COMMAND_PONG)
+    {
+        if (!loop->ping_peer)
+        {
+            LOG_DBG("pong %u with nowhere to go", data->msg_num);
+            return;
+        }
+        ping_stamp(params, &num_params, PING_ECHOED, os_uptime_us());
+        dest = loop->ping_peer;
+    }
+    else if (ping_get(params, num_params, PING_RECEIVED, &stamp) != 0)
+    {
+        ping_stamp(params, &num_params, PING_RECEIVED, rx_us);
+        ping_stamp(params, &num_params, PING_FORWARDED, os_uptime_us());
+        if (loop->ping_peer)
+        {
+            command = COMMAND_PING;
+            dest = loop->ping_peer;
+        }
+        else
+        {
+            ping_stamp(params, &num_params, PING_ECHOED, os_uptime_us());
+        }
+    }
+
+    ret = protocol_submit(dest, command, params, num_params);
+    if (ret < 0)
+    {
+        LOG_WRN("could not pass on %s %u [%d]", cmd_to_string(data->command), data->msg_num, ret);
+    }
+}
+
+struct palette_expansion {
+    protocol_loop_t loop;
+    uint16_t msg_num;
+};
+
+static void emit_rgb(uint16_t target, struct rgb colour, void *user_data)
+{
+    struct palette_expansion *expansion = (struct palette_expansion *) user_data;
+    protocol_loop_t loop = expansion->loop;
+    struct parsed_data data = {
+        .command = COMMAND_SET_RGB,
+        .params = {
+            {.key = KEY_RED, .value = colour.red},
+            {.key = KEY_GREEN, .value = colour.green},
+            {.key = KEY_BLUE, .value = colour.blue},
+            {.key = KEY_TARGET, .value = target},
+        },
+        .num_params = 4,
+        .msg_num = expansion->msg_num,
+        .status = PARSER_OK,
+    };
+
+    loop->rx(&data, loop->rx_user_data);
+}
+
+/**
+ * @brief   Store a palette entry, or expand a set_idx into a set_rgb per
+ *          LED for the rx consumer
+ */
+static void handle_palette(protocol_loop_t loop, parsed_data_t data)
+{
+    struct palette_expansion expansion = {.loop = loop, .msg_num = data->msg_num};
+    int ret;
+
+    if (!loop->palette)
+    {
+        LOG_WRN("%s %u with no palette", cmd_to_string(data->command), data->msg_num);
+        return;
+    }
+
+    if (parsed_data_decode(data) != PARSER_OK)
+    {
+        LOG_WRN("bad params in %s %u", cmd_to_string(data->command), data->msg_num);
+        return;
+    }
+
+    if (data->command == COMMAND_PALETTE)
+    {
+        ret = palette_apply(loop->palette, data->params, data->num_params);
+    }
+    else if (loop->rx)
+    {
+        ret = palette_expand(loop->palette, data->params, data->num_params, emit_rgb, &expansion);
+    }
+    else
+    {
+        /*  Already ACKed, so leave a trace */
+        loop->palette->stats.dropped++;
+        LOG_WRN("set_idx %u dropped, no rx consumer (%u so far)", data->msg_num,
+                loop->palette->stats.dropped);
+        return;
+    }
+
+    if (ret < 0)
+    {
+        LOG_WRN("could not apply %s %u [%d]", cmd_to_string(data->command), data->msg_num, ret);
+    }
+}
+
+/**
+ * @brief   Start the effect a command describes on the engine
+ */
+static void handle_effect(protocol_loop_t loop, parsed_data_t data)
+{
+    struct effect_params params;
+    int ret;
+
+    if (parsed_data_decode(data) != PARSER_OK)
+    {
+        LOG_WRN("bad params in %s %u", cmd_to_string(data->command), data->msg_num);
+        return;
+    }
+
+    ret = effect_params_from_pairs(data->params, data->num_params, &params);
+    if (ret == 0)
+    {
+        ret = effect_start(loop->effects, &params);
+    }
+
+    if (ret < 0)
+    {
+        /*  Already acknowledged, the host won't hear about it */
+        LOG_WRN("could not start effect %u [%d]", data->msg_num, ret);
+    }
+}
+
+static void frame_received(const uint8_t *frame, size_t len, void *user_data)
+{
+    protocol_loop_t loop = (protocol_loop_t) user_data;
+    struct parsed_data data = {0};
+    uint32_t rx_us = os_uptime_us();
+
+    if (loop->capture)
+    {
+        capture_record(loop->capture, CAPTURE_RX, frame, len);
+    }
+
+    /*  Parse in place, the framer holds the frame until we return */
+    loop->ctx->rx_buf = (uint8_t *) frame;
+    loop->ctx->rx_len = len;
+    handle_incoming(loop->ctx, &data);
+
+    switch (data.command)
+    {
+        case COMMAND_SET_RGB:
+        case COMMAND_EFFECT:
+            if (data.command == COMMAND_EFFECT && loop->effects)
+            {
+                flush_tx(loop);
+                handle_effect(loop, &data);
+            }
+            else if (loop->rx)
+            {
+                /*  Get the ACK going before the params are decoded */
+                flush_tx(loop);
+                loop->rx(&data, loop->rx_user_data);
+            }
+            break;
+        case COMMAND_PING:
+        case COMMAND_PONG:
+            flush_tx(loop);
+            handle_ping(loop, &data, rx_us);
+            break;
+        case COMMAND_PALETTE:
+        case COMMAND_SET_IDX:
+            flush_tx(loop);
+            handle_palette(loop, &data);
+            break;
+        default:
+            break;
+    }
+}
+
+static void handle_rx(protocol_loop_t loop)
+{
+    uint8_t buffer[PROTOCOL_LOOP_READ_CHUNK];
+    size_t len;
+
+    k_sem_take(&loop->transport->rx_sem, K_NO_WAIT);
+
+    while ((len = transport_read(loop->transport, buffer, sizeof(buffer))) > 0)
+    {
+        framer_feed(&loop->framer, buffer, len);
+    }
+}
+
+static size_t coalesce_write(const uint8_t *data, size_t len, void *user_data)
+{
+    protocol_loop_t loop = (protocol_loop_t) user_data;
+
+    return transport_write(loop->transport, data, len);
+}
+
+static int queue_frame(protocol_loop_t loop, struct pbuf *frame)
+{
+#if defined(CONFIG_BBBLED_FRAMING_COBS)
+    size_t len = framer_encode(FRAMER_MODE_COBS, frame->data, frame->len,
+                               loop->tx_wire, sizeof(loop->tx_wire));
+
+    return tx_coalesce_add(&loop->coalesce, loop->tx_wire, len);
+#else
+    return tx_coalesce_add(&loop->coalesce, frame->data, frame->len);
+#endif
+}
+
+/**
+ * @brief   Hand whatever the protocol has to send to the coalescer. A
+ *          frame it has no room for is held on to and tried again on the
+ *          next TX done.
+ */
+static void flush_tx(protocol_loop_t loop)
+{
+    for (;;)
+    {
+        struct pbuf *frame = loop->tx_pending;
+
+        if (frame == NULL)
+        {
+            frame = protocol_tx_pbuf(loop->ctx);
+            if (frame == NULL)
+            {
+                return;
+            }
+
+            if (loop->tap)
+            {
+                loop->tap(frame, loop->tap_user_data);
+            }
+            if (loop->capture)
+            {
+                capture_record(loop->capture, CAPTURE_TX, frame->data, frame->len);
+            }
+        }
+
+        /*  The coalescer's copy is the one the USB path needs, the
+            frame itself is shared with the retransmit queue and tap */
+        if (queue_frame(loop, frame) != 0)
+        {
+            loop->tx_pending = frame;
+            return;
+        }
+
+        loop->tx_pending = NULL;
+        pbuf_unref(frame);
+    }
+}
+
+void protocol_loop_init(protocol_loop_t loop, protocol_ctx_t ctx, transport_t transport)
+{
+    __ASSERT(loop, "Invalid loop ptr");
+    __ASSERT(ctx, "Invalid ctx ptr");
+    __ASSERT(transport, "Invalid transport ptr");
+
+    loop->ctx = ctx;
+    loop->transport = transport;
+    loop->tx_pending = NULL;
+    loop->tap = NULL;
+    loop->tap_user_data = NULL;
+    loop->rx = NULL;
+    loop->rx_user_data = NULL;
+    loop->capture = NULL;
+    loop->ping_peer = NULL;
+    loop->palette = NULL;
+    loop->effects = NULL;
+
+    tx_coalesce_init(&loop->coalesce, &loop->coalesce_timer,
+                     CONFIG_BBBLED_TX_COALESCE_PACKET_SIZE,
+                     CONFIG_BBBLED_TX_COALESCE_BUDGET_US,
+                     coalesce_write, loop);
+
+    framer_init(&loop->framer, frame_received, loop);
+    if (IS_ENABLED(CONFIG_BBBLED_FRAMING_COBS))
+    {
+        framer_set_mode(&loop->framer, FRAMER_MODE_COBS);
+    }
+    k_poll_signal_init(&loop->timer_signal);
+    k_poll_signal_init(&loop->submit_signal);
+    protocol_set_event_cb(ctx, protocol_event, loop);
+
+#if defined(CONFIG_BBBLED_PROTOCOL_UNORDERED)
+    timer_wheel_init(&loop->wheel, &loop->wheel_timer, TIMER_MSEC(1));
+    protocol_set_delivery(ctx, &loop->wheel, COMMAND_DELIVERY_UNORDERED);
+#endif
+
+    k_poll_event_init(&loop->events[PROTOCOL_LOOP_EVENT_RX],
+                      K_POLL_TYPE_SEM_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY,
+                      &transport->rx_sem);
+    k_poll_event_init(&loop->events[PROTOCOL_LOOP_EVENT_TIMER],
+                      K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+                      &loop->timer_signal);
+    k_poll_event_init(&loop->events[PROTOCOL_LOOP_EVENT_TX_DONE],
+                      K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+                      &transport->tx_done);
+    k_poll_event_init(&loop->events[PROTOCOL_LOOP_EVENT_SUBMIT],
+                      K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+                      &loop->submit_signal);
+}
+
+void protocol_loop_set_tap(protocol_loop_t loop, protocol_loop_tap_t tap, void *user_data)
+{
+    loop->tap_user_data = user_data;
+    loop->tap = tap;
+}
+
+void protocol_loop_set_rx(protocol_loop_t loop, protocol_loop_rx_t rx, void *user_data)
+{
+    loop->rx_user_data = user_data;
+    loop->rx = rx;
+}
+
+void protocol_loop_set_capture(protocol_loop_t loop, capture_t capture)
+{
+    loop->capture = capture;
+}
+
+void protocol_loop_set_ping_peer(protocol_loop_t loop, protocol_ctx_t peer)
+{
+    loop->ping_peer = peer;
+}
+
+void protocol_loop_set_palette(protocol_loop_t loop, palette_t palette)
+{
+    loop->palette = palette;
+}
+
+void protocol_loop_set_effects(protocol_loop_t loop, effect_engine_t effects)
+{
+    loop->effects = effects;
+}
+
+void protocol_loop_effect_emit(uint16_t target, struct rgb colour, void *user_data)
+{
+    protocol_ctx_t ctx = (protocol_ctx_t) user_data;
+    struct key_val_pair params[] = {
+        {.key = KEY_RED, .value = colour.red},
+        {.key = KEY_GREEN, .value = colour.green},
+        {.key = KEY_BLUE, .value = colour.blue},
+        {.key = KEY_TARGET, .value = target},
+    };
+    int ret = protocol_submit(ctx, COMMAND_SET_RGB, params, ARRAY_SIZE(params));
+
+    if (ret < 0)
+    {
+        /*  The next tick that changes the colour tries again */
+        LOG_WRN("could not queue led %u [%d]", target, ret);
+    }
+}
+
+void protocol_loop_relay(parsed_data_t data, void *user_data)
+{
+    protocol_ctx_t peer = (protocol_ctx_t) user_data;
+    int ret;
+
+    if (data->frame)
+    {
+        ret = protocol_submit_relay(peer, data);
+    }
+    else
+    {
+        /*  Made here, there are no bytes to pass on */
+        ret = protocol_submit(peer, data->command, data->params, data->num_params);
+    }
+
+    if (ret < 0)
+    {
+        /*  Already acknowledged on this side, the sender won't retry */
+        LOG_WRN("could not relay msg %u [%d]", data->msg_num, ret);
+    }
+}
+
+int protocol_loop_step(protocol_loop_t loop, k_timeout_t timeout)
+{
+    struct k_poll_event *events = loop->events;
+
+    int ret = k_poll(events, PROTOCOL_LOOP_NUM_EVENTS, timeout);
+    if (ret && ret != -EAGAIN)
+    {
+        LOG_ERR("k_poll failed [%d]", ret);
+        return ret;
+    }
+
+    if (events[PROTOCOL_LOOP_EVENT_RX].state == K_POLL_STATE_SEM_AVAILABLE)
+    {
+        handle_rx(loop);
+    }
+
+    if (events[PROTOCOL_LOOP_EVENT_TIMER].state == K_POLL_STATE_SIGNALED)
+    {
+        k_poll_signal_reset(&loop->timer_signal);
+        protocol_timeout(loop->ctx);
+    }
+
+    if (events[PROTOCOL_LOOP_EVENT_TX_DONE].state == K_POLL_STATE_SIGNALED)
+    {
+        k_poll_signal_reset(&loop->transport->tx_done);
+
+        /*  Room again for whatever the transport turned away */
+        if (tx_coalesce_stalled(&loop->coalesce))
+        {
+            tx_coalesce_flush(&loop->coalesce);
+        }
+    }
+
+    if (events[PROTOCOL_LOOP_EVENT_SUBMIT].state == K_POLL_STATE_SIGNALED)
+    {
+        /*  Reset before flush_tx() looks at the queue, so a submission
+            racing with us raises it again rather than being missed */
+        k_poll_signal_reset(&loop->submit_signal);
+    }
+
+    for (size_t index = 0; index < PROTOCOL_LOOP_NUM_EVENTS; ++index)
+    {
+        events[index].state = K_POLL_STATE_NOT_READY;
+    }
+
+    /*  Any of the above can leave something to send */
+    flush_tx(loop);
+
+    return 0;
+}
+
+void protocol_loop_run(protocol_loop_t loop)
+{
+    while (true)
+    {
+        protocol_loop_step(loop, K_FOREVER);
+    }
+}
\ No newline at end of file
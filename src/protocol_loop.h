@@ -0,0 +1,210 @@
+#ifndef _BBBLED_PROTOCOL_LOOP_H
+#define _BBBLED_PROTOCOL_LOOP_H
+
+#include "os.h"
+
+#include "capture.h"
+#include "effect.h"
+#include "framer.h"
+#include "palette.h"
+#include "protocol.h"
+#include "transport.h"
+#include "tx_coalesce.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    PROTOCOL_LOOP_EVENT_RX = 0,
+    PROTOCOL_LOOP_EVENT_TIMER,
+    PROTOCOL_LOOP_EVENT_TX_DONE,
+    PROTOCOL_LOOP_EVENT_SUBMIT,
+    PROTOCOL_LOOP_NUM_EVENTS,
+};
+
+/**
+ * @brief   Sees every frame on its way to the transport (stats, capture,
+ *          a relay...). Take a reference with pbuf_ref() to keep the
+ *          frame past the call, never write to it.
+ */
+typedef void (*protocol_loop_tap_t)(struct pbuf *frame, void *user_data);
+
+/**
+ * @brief   Gets every data frame once its ACK is on its way. Only the
+ *          header has been parsed, call parsed_data_decode() for the
+ *          params. The frame is gone once the call returns.
+ */
+typedef void (*protocol_loop_rx_t)(parsed_data_t data, void *user_data);
+
+/**
+ * @brief The protocol event loop. One thread runs it and owns all of
+ *        the ARQ state, ISRs, timers and other threads only post events
+ *        to it.
+ * @param   ctx             :   protocol context
+ * @param   transport       :   where frames come from and go to
+ * @param   framer          :   splits the RX stream into frames
+ * @param   timer_signal    :   raised by the ACK timer
+ * @param   submit_signal   :   raised by protocol_submit()
+ * @param   events          :   what the loop waits on
+ * @param   tx_pending      :   frame the coalescer had no room for, if any
+ * @param   tap             :   optional observer of outgoing frames
+ * @param   tap_user_data   :   passed through to tap
+ * @param   rx              :   optional consumer of incoming data frames
+ * @param   rx_user_data    :   passed through to rx
+ * @param   capture         :   optional record of every frame in and out
+ * @param   ping_peer       :   link pings are forwarded on, NULL to answer them here
+ * @param   palette         :   colours set_idx indices refer to, NULL to ignore them
+ * @param   effects         :   renders effect commands, NULL to pass them to rx
+ * @param   tx_wire         :   COBS encoded copy of the frame going out
+ * @param   coalesce        :   packs frames into USB packets
+ * @param   coalesce_timer  :   latency budget for the coalescer
+ * @param   wheel           :   per-message retransmission timers (unordered delivery)
+ * @param   wheel_timer     :   drives the wheel while anything is in flight
+ */
+struct protocol_loop {
+    protocol_ctx_t ctx;
+    transport_t transport;
+    struct framer framer;
+    struct k_poll_signal timer_signal;
+    struct k_poll_signal submit_signal;
+    struct k_poll_event events[PROTOCOL_LOOP_NUM_EVENTS];
+    struct pbuf *tx_pending;
+    protocol_loop_tap_t tap;
+    void *tap_user_data;
+    protocol_loop_rx_t rx;
+    void *rx_user_data;
+    capture_t capture;
+    protocol_ctx_t ping_peer;
+    palette_t palette;
+    effect_engine_t effects;
+#if defined(CONFIG_BBBLED_FRAMING_COBS)
+    uint8_t tx_wire[FRAMER_COBS_BUF_SIZE + 1];
+#endif
+    struct tx_coalesce coalesce;
+    os_timer_t coalesce_timer;
+#if defined(CONFIG_BBBLED_PROTOCOL_UNORDERED)
+    struct timer_wheel wheel;
+    os_timer_t wheel_timer;
+#endif
+};
+
+typedef struct protocol_loop* protocol_loop_t;
+
+/**
+ * @brief   Initialise the loop. The context and transport must already
+ *          be initialised.
+ *
+ * @param   loop        :   loop to initialise
+ * @param   ctx         :   protocol context, owned by the loop from now on
+ * @param   transport   :   transport to run the protocol over
+ */
+void protocol_loop_init(protocol_loop_t loop, protocol_ctx_t ctx, transport_t transport);
+
+/**
+ * @brief   Set a tap that sees every outgoing frame
+ *
+ * @param   loop        :   loop
+ * @param   tap         :   tap, NULL to remove it
+ * @param   user_data   :   passed through to the tap
+ */
+void protocol_loop_set_tap(protocol_loop_t loop, protocol_loop_tap_t tap, void *user_data);
+
+/**
+ * @brief   Set the consumer of incoming data frames
+ *
+ * @param   loop        :   loop
+ * @param   rx          :   consumer, NULL to remove it
+ * @param   user_data   :   passed through to rx
+ */
+void protocol_loop_set_rx(protocol_loop_t loop, protocol_loop_rx_t rx, void *user_data);
+
+/**
+ * @brief   Record every frame received and sent, retransmissions
+ *          included. Frames are recorded as the protocol sees them,
+ *          before COBS encoding on the way out and after decoding on
+ *          the way in.
+ *
+ * @param   loop        :   loop
+ * @param   capture     :   initialised capture, NULL to stop recording
+ */
+void protocol_loop_set_capture(protocol_loop_t loop, capture_t capture);
+
+/**
+ * @brief   Forward pings received on this loop's link to another one,
+ *          and pongs back the other way (see ping.h). Set it on both
+ *          loops, each with the other's context:
+ *
+ *              protocol_loop_set_ping_peer(&usb_loop, &ble_ctx);
+ *              protocol_loop_set_ping_peer(&ble_loop, &usb_ctx);
+ *
+ *          Without a peer the loop answers pings itself.
+ *
+ * @param   loop    :   loop
+ * @param   peer    :   context of the other link, NULL for none
+ */
+void protocol_loop_set_ping_peer(protocol_loop_t loop, protocol_ctx_t peer);
+
+/**
+ * @brief   Take palette uploads from the host and expand each set_idx
+ *          into one set_rgb per LED for the rx consumer (see palette.h).
+ *          The expanded frames have the set_idx's msg number and no
+ *          frame of their own. Without a palette both commands are
+ *          acknowledged and dropped.
+ *
+ * @param   loop    :   loop
+ * @param   palette :   initialised palette, NULL for none
+ */
+void protocol_loop_set_palette(protocol_loop_t loop, palette_t palette);
+
+/**
+ * @brief   Run effect commands here rather than passing them to the rx
+ *          consumer. Initialise the engine with protocol_loop_effect_emit()
+ *          and the context its set_rgb frames should go out on:
+ *
+ *              effect_engine_init(&effects, &effect_timer, protocol_loop_effect_emit, &ble_ctx);
+ *              protocol_loop_set_effects(&usb_loop, &effects);
+ *
+ * @param   loop    :   loop
+ * @param   effects :   initialised engine, NULL to pass effects to rx
+ */
+void protocol_loop_set_effects(protocol_loop_t loop, effect_engine_t effects);
+
+/**
+ * @brief   An effect_emit_t that submits each colour change as a set_rgb
+ *          on the protocol context given as user_data. Safe from the
+ *          engine's tick timer, it only queues the packet.
+ */
+void protocol_loop_effect_emit(uint16_t target, struct rgb colour, void *user_data);
+
+/**
+ * @brief   An rx consumer that relays every data frame onto another link
+ *          as it came in, see protocol_submit_relay(). Frames made on
+ *          the dongle (an expanded set_idx) are serialised. Set it with the
+ *          other link's context as user_data:
+ *
+ *              protocol_loop_set_rx(&usb_loop, protocol_loop_relay, &ble_ctx);
+ */
+void protocol_loop_relay(parsed_data_t data, void *user_data);
+
+/**
+ * @brief   Wait for one round of events and handle them
+ *
+ * @param   loop    :   loop
+ * @param   timeout :   longest to wait for an event
+ *
+ * @retval  0 once events have been handled or the timeout expired
+ * @retval  -errno from k_poll on failure
+ */
+int protocol_loop_step(protocol_loop_t loop, k_timeout_t timeout);
+
+/**
+ * @brief   Run the loop forever
+ */
+void protocol_loop_run(protocol_loop_t loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_PROTOCOL_LOOP_H */
\ No newline at end of file
@@ -1,33 +1,42 @@
 #include "serialise.h"
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
-#include <zephyr/logging/log.h>
 
 #define STR_SIZE_16BIT_UINT 6
 #define STR_SIZE_16BIT_HEX 5
 
 LOG_MODULE_REGISTER(serialise, LOG_LEVEL_DBG);
 
-typedef struct {
-    serialise_handler_t handler;
-    void *user_data;
-} serialise_cb_t;
+/**
+ * @brief   Append as many bytes as fit. Once something doesn't fit
+ *          nothing more is written.
+ */
+static void write_to_buffer(serial_ctx_t ctx, const uint8_t *src, size_t amount)
+{
+    size_t chunk;
 
-static serialise_cb_t _cb_array[SERIALISE_CALLBACKS_MAX];
-static volatile uint8_t cb_index = 0;
+    if (ctx->error)
+    {
+        return;
+    }
 
+    ctx->crc = os_crc16_ccitt(ctx->crc, src, amount);
 
-void write_to_buffer(uint8_t *dest, uint8_t *src, size_t *written, size_t amount)
-{
-    memcpy(dest, src, amount);
-    *written += amount;
+    chunk = MIN(amount, ctx->buffer_size - ctx->bytes_written);
+    memcpy(ctx->buffer + ctx->bytes_written, src, chunk);
+    ctx->bytes_written += chunk;
+
+    if (chunk < amount)
+    {
+        LOG_WRN("out of room after %d bytes", (int) ctx->bytes_written);
+        ctx->error = -ENOBUFS;
+    }
 }
 
 void serialise_padding_char(serial_ctx_t ctx, void *data)
 {
-    char *c = (char*)data;
-
-    write_to_buffer(ctx->buffer + ctx->bytes_written, c, &ctx->bytes_written, 1);
+    write_to_buffer(ctx, (const uint8_t *) data, 1);
 }
 
 void serialise_uint16t_dec(serial_ctx_t ctx, void *data)
@@ -37,7 +46,7 @@ void serialise_uint16t_dec(serial_ctx_t ctx, void *data)
     char dec_str[STR_SIZE_16BIT_UINT] = {0};
 
     int written = snprintf(dec_str, STR_SIZE_16BIT_UINT, "%d", dec);
-    write_to_buffer(ctx->buffer + ctx->bytes_written, dec_str, &ctx->bytes_written, written);
+    write_to_buffer(ctx, (const uint8_t *) dec_str, written);
 }
 
 void serialise_uint16t_hex(serial_ctx_t ctx, void *data)
@@ -46,36 +55,45 @@ void serialise_uint16t_hex(serial_ctx_t ctx, void *data)
     char hex_str[STR_SIZE_16BIT_HEX] = {0};
 
     int written = snprintf(hex_str, STR_SIZE_16BIT_HEX, "%04x", hex);
-    write_to_buffer(ctx->buffer + ctx->bytes_written, hex_str, &ctx->bytes_written, written);
+    write_to_buffer(ctx, (const uint8_t *) hex_str, written);
+}
+
+void serialise_crc_hex(serial_ctx_t ctx, void *data)
+{
+    /*  Copy it, writing the digits moves the CRC on */
+    uint16_t crc = ctx->crc;
+
+    ARG_UNUSED(data);
+    serialise_uint16t_hex(ctx, &crc);
 }
 
 void serialise_str(serial_ctx_t ctx, void *data)
 {
     char *str = (char*)data;
 
-    write_to_buffer(ctx->buffer + ctx->bytes_written, str, &ctx->bytes_written, strlen(str));
+    write_to_buffer(ctx, (const uint8_t *) str, strlen(str));
 }
 
 void serialise_handler_register(serial_ctx_t ctx, struct serial_registry *reg, size_t reg_size)
 {
-    ctx->max_cb_index = reg_size;
-
-    for (uint8_t index = 0; index < ctx->max_cb_index; ++index)
-    {
-        serialise_cb_t *cb = &(_cb_array[index]);
-        cb->handler = reg[index].handler;
-        cb->user_data = reg[index].user_data;
-    }
+    /*  The registry stays with the context rather than in a shared
+        table, so serialising from several threads is safe. It must
+        outlive the call to serialise() */
+    ctx->registry = reg;
+    ctx->max_cb_index = MIN(reg_size, SERIALISE_CALLBACKS_MAX);
 }
 
-void serialise(serial_ctx_t ctx)
+int serialise(serial_ctx_t ctx)
 {
-    for (uint8_t index = 0; index < ctx->max_cb_index; ++index)
+    for (uint8_t index = 0; index < ctx->max_cb_index && !ctx->error; ++index)
     {
-        serialise_cb_t *cb = &(_cb_array[index]);
+        const struct serial_registry *cb = &(ctx->registry[index]);
         cb->handler(ctx, cb->user_data);
     }
-    memset(_cb_array, 0, SERIALISE_CALLBACKS_MAX);
+    ctx->registry = NULL;
+    ctx->max_cb_index = 0;
+
+    return ctx->error;
 }
 
 void serialise_key_value_pairs(serial_ctx_t ctx, void *data)
@@ -96,10 +114,13 @@ serial_ctx_t serialise_ctx_init(struct serial_ctx *ctx, uint8_t *buffer, size_t
     serial_ctx_t this = ctx;
 
     this->buffer = buffer;
-    this->buffer_size = buffer_size;
+    this->buffer_size = buffer ? buffer_size : 0;
     this->bytes_written = 0;
+    this->crc = 0;
+    this->error = 0;
     this->user_data = user_data;
+    this->registry = NULL;
     this->max_cb_index = 0;
 
     return this;
-}
+}
\ No newline at end of file
@@ -1,7 +1,7 @@
 #ifndef _BBBLED_SERIALISE_H
 #define _BBBLED_SERIALISE_H
 
-#include <zephyr/types.h>
+#include "os.h"
 #include "commands.h"
 
 #ifdef __cplusplus
@@ -10,16 +10,31 @@ extern "C" {
 
 #define SERIALISE_CALLBACKS_MAX UINT8_MAX
 
-/* Serialiser context object definitions */
+struct serial_ctx;
+
+typedef struct serial_ctx* serial_ctx_t;
+
+/**
+ * @brief Serialiser context
+ * @param   buffer          :   buffer being written
+ * @param   bytes_written   :   bytes written so far
+ * @param   buffer_size     :   size of the buffer
+ * @param   crc             :   CRC16-CCITT (seed 0) of everything written so far
+ * @param   error           :   0, or -ENOBUFS once a write did not fit
+ * @param   user_data       :   user data
+ * @param   registry        :   handlers run by serialise()
+ * @param   max_cb_index    :   number of handlers
+ */
 struct serial_ctx {
     uint8_t *buffer;
     size_t bytes_written;
     size_t buffer_size;
+    uint16_t crc;
+    int error;
     void *user_data;
+    const struct serial_registry *registry;
     uint8_t max_cb_index;
 };
-
-typedef struct serial_ctx* serial_ctx_t;
 /* Signature for a serialiser handler */
 typedef void (*serialise_handler_t)(serial_ctx_t, void*);
 
@@ -45,9 +60,24 @@ void serialise_uint16t_hex(serial_ctx_t ctx, void *data);
 void serialise_str(serial_ctx_t ctx, void *data);
 void serialise_handler_register(serial_ctx_t ctx, struct serial_registry *reg, size_t reg_size);
 void serialise_key_value_pairs(serial_ctx_t ctx, void *data);
-void serialise(serial_ctx_t ctx);
+
+/**
+ * @brief   Write the CRC of everything serialised so far as 4 hex digits.
+ *          data is unused.
+ */
+void serialise_crc_hex(serial_ctx_t ctx, void *data);
+
+/**
+ * @brief   Run the registered handlers
+ *
+ * @retval  0 on success
+ * @retval  -ENOBUFS if the output did not fit. Whatever was written
+ *          before then is left in place, the caller should discard it.
+ */
+int serialise(serial_ctx_t ctx);
 serial_ctx_t serialise_ctx_init(struct serial_ctx *ctx, uint8_t *buffer, size_t buffer_size, void *user_data);
 
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,18 +1,271 @@
 #include "timer.h"
 
+#if defined(__ZEPHYR__)
 
-void timer_init(timer_t *timer, timer_expiry_cb_t expiry_fn, timer_stop_cb_t stop_fn, void *data)
+void timer_init(os_timer_t *timer, timer_expiry_cb_t expiry_fn, timer_stop_cb_t stop_fn, void *data)
 {
     k_timer_init(timer, expiry_fn, stop_fn);
     k_timer_user_data_set(timer, data);
 }
 
-void timer_start(timer_t *timer, timeout_t duration, timeout_t period)
+void timer_start(os_timer_t *timer, timeout_t duration, timeout_t period)
 {
     k_timer_start(timer, duration, period);
 }
 
-void timer_stop(timer_t *timer)
+void timer_stop(os_timer_t *timer)
 {
     k_timer_stop(timer);
+}
+
+void *timer_user_data_get(os_timer_t *timer)
+{
+    return k_timer_user_data_get(timer);
+}
+
+#endif /* __ZEPHYR__ */
+
+/*
+ * Timer wheel
+ */
+
+// Slot of a tick in the given level
+#define WHEEL_INDEX(tick, level) \
+    (((tick) >> ((level) * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_SLOT_MASK)
+
+static inline void list_init(struct timer_wheel_node *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static inline bool list_empty(const struct timer_wheel_node *head)
+{
+    return head->next == head;
+}
+
+static inline void list_append(struct timer_wheel_node *head, struct timer_wheel_node *node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static inline void list_unlink(struct timer_wheel_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node;
+    node->prev = node;
+}
+
+/*  Move a whole list onto another (empty) head in O(1) */
+static inline void list_move(struct timer_wheel_node *from, struct timer_wheel_node *to)
+{
+    if (list_empty(from))
+    {
+        list_init(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+/**
+ * @brief   Put an entry in the slot that matches how far away it is.
+ *          Anything due within 64 ticks goes in level 0, within 64^2
+ *          in level 1, and so on. Caller holds the lock.
+ */
+static void wheel_insert(timer_wheel_t wheel, struct timer_wheel_entry *entry)
+{
+    uint32_t delta = entry->expires - wheel->now;
+    uint8_t level;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level)
+    {
+        if (delta < (1UL << ((level + 1) * TIMER_WHEEL_SLOT_BITS)))
+        {
+            break;
+        }
+    }
+
+    list_append(&wheel->slots[level][WHEEL_INDEX(entry->expires, level)], &entry->node);
+}
+
+/**
+ * @brief   Re-file everything in a slot of a higher level now that it is
+ *          close enough for a lower one
+ *
+ * @returns The slot index, 0 means the level above wrapped as well
+ */
+static uint32_t wheel_cascade(timer_wheel_t wheel, uint8_t level)
+{
+    uint32_t index = WHEEL_INDEX(wheel->now, level);
+    struct timer_wheel_node list;
+
+    list_move(&wheel->slots[level][index], &list);
+
+    while (!list_empty(&list))
+    {
+        struct timer_wheel_node *node = list.next;
+        list_unlink(node);
+        wheel_insert(wheel, CONTAINER_OF(node, struct timer_wheel_entry, node));
+    }
+
+    return index;
+}
+
+static void wheel_driver_expiry(os_timer_t *timer)
+{
+    timer_wheel_t wheel = (timer_wheel_t) timer_user_data_get(timer);
+
+    timer_wheel_advance(wheel, 1);
+}
+
+void timer_wheel_init(timer_wheel_t wheel, os_timer_t *driver, timeout_t tick)
+{
+    __ASSERT(wheel, "Invalid wheel ptr");
+
+    for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot)
+        {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+
+    wheel->now = 0;
+    wheel->num_active = 0;
+    wheel->fired = 0;
+    wheel->driver = driver;
+    wheel->tick = tick;
+    os_lock_init(&wheel->lock);
+
+    if (driver)
+    {
+        timer_init(driver, wheel_driver_expiry, NULL, wheel);
+    }
+}
+
+void timer_wheel_entry_init(struct timer_wheel_entry *entry, timer_wheel_cb_t expiry_fn, void *user_data)
+{
+    list_init(&entry->node);
+    entry->expires = 0;
+    entry->active = false;
+    entry->expiry_fn = expiry_fn;
+    entry->user_data = user_data;
+}
+
+void timer_wheel_arm(timer_wheel_t wheel, struct timer_wheel_entry *entry, uint32_t ticks)
+{
+    os_lock_key_t key = os_lock(&wheel->lock);
+
+    if (entry->active)
+    {
+        list_unlink(&entry->node);
+    }
+    else
+    {
+        entry->active = true;
+
+        /*  Only keep the driver running while there is something to
+            time. Started under the lock, so advance can't stop it
+            after seeing the wheel empty */
+        if (wheel->num_active++ == 0 && wheel->driver)
+        {
+            timer_start(wheel->driver, wheel->tick, wheel->tick);
+        }
+    }
+
+    /*  The slot for now has already been processed, so the soonest
+        anything can fire is the next tick */
+    entry->expires = wheel->now + CLAMP(ticks, 1, TIMER_WHEEL_MAX_TICKS);
+    wheel_insert(wheel, entry);
+
+    os_unlock(&wheel->lock, key);
+}
+
+void timer_wheel_cancel(timer_wheel_t wheel, struct timer_wheel_entry *entry)
+{
+    os_lock_key_t key = os_lock(&wheel->lock);
+
+    if (entry->active)
+    {
+        list_unlink(&entry->node);
+        entry->active = false;
+        wheel->num_active--;
+    }
+
+    os_unlock(&wheel->lock, key);
+}
+
+size_t timer_wheel_advance(timer_wheel_t wheel, uint32_t ticks)
+{
+    size_t fired = 0;
+
+    for (uint32_t tick = 0; tick < ticks; ++tick)
+    {
+        struct timer_wheel_node expired;
+        os_lock_key_t key = os_lock(&wheel->lock);
+
+        if (wheel->num_active == 0)
+        {
+            /*  Nothing to fire or cascade, skip straight to the end */
+            wheel->now += ticks - tick;
+            os_unlock(&wheel->lock, key);
+            break;
+        }
+
+        wheel->now++;
+
+        /*  Pull the next lot down from the levels above each time the
+            one below wraps */
+        for (uint8_t level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+        {
+            if (WHEEL_INDEX(wheel->now, level - 1) != 0 || wheel_cascade(wheel, level) != 0)
+            {
+                break;
+            }
+        }
+
+        list_move(&wheel->slots[0][WHEEL_INDEX(wheel->now, 0)], &expired);
+
+        /*  Fire the batch. Each entry is taken off under the lock so a
+            callback can re-arm or cancel any entry, this one included */
+        while (!list_empty(&expired))
+        {
+            struct timer_wheel_entry *entry =
+                CONTAINER_OF(expired.next, struct timer_wheel_entry, node);
+
+            list_unlink(&entry->node);
+            entry->active = false;
+            wheel->num_active--;
+            wheel->fired++;
+            fired++;
+
+            os_unlock(&wheel->lock, key);
+            if (entry->expiry_fn)
+            {
+                entry->expiry_fn(entry, entry->user_data);
+            }
+            key = os_lock(&wheel->lock);
+        }
+
+        os_unlock(&wheel->lock, key);
+    }
+
+    /*  Decided under the lock, an arm in between has started it again */
+    os_lock_key_t key = os_lock(&wheel->lock);
+    if (wheel->driver && wheel->num_active == 0)
+    {
+        timer_stop(wheel->driver);
+    }
+    os_unlock(&wheel->lock, key);
+
+    return fired;
 }
\ No newline at end of file
@@ -1,27 +1,189 @@
 #ifndef _BBBLED_TIMER_H
 #define _BBBLED_TIMER_H
 
-#include <zephyr/kernel.h>
+#include "os.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef struct k_timer timer_t;
+#if defined(__ZEPHYR__)
+
+typedef struct k_timer os_timer_t;
 typedef k_timeout_t timeout_t;
 
 typedef k_timer_expiry_t timer_expiry_cb_t;
 typedef k_timer_stop_t  timer_stop_cb_t;
 
-void timer_init(timer_t *timer, timer_expiry_cb_t expiry_fn, timer_stop_cb_t stop_fn, void *data);
+#define TIMER_MSEC(ms) K_MSEC(ms)
+#define TIMER_USEC(us) K_USEC(us)
+#define TIMER_NO_WAIT K_NO_WAIT
+
+#else
+
+/*  Off target, timers are software timers that fire from timer_poll(),
+    which the owner's event loop calls when timer_next_expiry() says so */
+
+typedef struct os_timer os_timer_t;
+// Microseconds
+typedef uint64_t timeout_t;
+
+typedef void (*timer_expiry_cb_t)(os_timer_t *timer);
+typedef void (*timer_stop_cb_t)(os_timer_t *timer);
+
+struct os_timer {
+    timer_expiry_cb_t expiry_fn;
+    timer_stop_cb_t stop_fn;
+    void *user_data;
+    uint64_t deadline;
+    uint64_t period;
+    bool active;
+    struct os_timer *next;
+};
+
+#define TIMER_MSEC(ms) ((timeout_t)(ms) * 1000)
+#define TIMER_USEC(us) ((timeout_t)(us))
+#define TIMER_NO_WAIT ((timeout_t)0)
+
+/**
+ * @brief   Fire every timer whose deadline has passed
+ *
+ * @returns Number of timers that fired
+ */
+size_t timer_poll(void);
+
+/**
+ * @brief   Time until the next timer is due
+ *
+ * @returns Microseconds until the next deadline, UINT64_MAX if no timer is running
+ */
+uint64_t timer_next_expiry(void);
+
+#endif
+
+void timer_init(os_timer_t *timer, timer_expiry_cb_t expiry_fn, timer_stop_cb_t stop_fn, void *data);
+
+void timer_start(os_timer_t *timer, timeout_t duration, timeout_t period);
+
+void timer_stop(os_timer_t *timer);
 
-void timer_start(timer_t *timer, timeout_t duration, timeout_t period);
+void *timer_user_data_get(os_timer_t *timer);
 
-void timer_stop(timer_t *timer);
+/*
+ * Timer wheel
+ *
+ * Many independent deadlines (one per packet in flight, per peer) on top
+ * of a single os timer. Four levels of 64 slots each, a deadline sits in
+ * the level that matches how far away it is and cascades down as time
+ * passes. Arm, cancel and re-arm are O(1), and everything due on a tick
+ * fires in one batch.
+ */
+
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+// Longest delay that can be armed, in ticks. Longer ones are clamped
+#define TIMER_WHEEL_MAX_TICKS ((1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+struct timer_wheel;
+struct timer_wheel_entry;
+
+/**
+ * @brief   Called when a wheel entry expires, from whatever advanced the
+ *          wheel (the driving timer's expiry, or timer_wheel_advance()).
+ *          The entry may be re-armed from here.
+ */
+typedef void (*timer_wheel_cb_t)(struct timer_wheel_entry *entry, void *user_data);
+
+struct timer_wheel_node {
+    struct timer_wheel_node *next;
+    struct timer_wheel_node *prev;
+};
+
+/**
+ * @brief A deadline on the wheel
+ * @param   node        :   links the entry into its slot
+ * @param   expires     :   tick the entry is due on
+ * @param   active      :   entry is armed
+ * @param   expiry_fn   :   called when the entry expires
+ * @param   user_data   :   passed through to expiry_fn
+ */
+struct timer_wheel_entry {
+    struct timer_wheel_node node;
+    uint32_t expires;
+    bool active;
+    timer_wheel_cb_t expiry_fn;
+    void *user_data;
+};
+
+/**
+ * @brief The wheel
+ * @param   slots       :   entry lists, per level and slot
+ * @param   now         :   last tick processed
+ * @param   num_active  :   entries armed
+ * @param   driver      :   timer that ticks the wheel, NULL to tick by hand
+ * @param   tick        :   driver period
+ * @param   lock        :   guards the slots
+ * @param   fired       :   entries expired so far
+ */
+struct timer_wheel {
+    struct timer_wheel_node slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint32_t now;
+    size_t num_active;
+    os_timer_t *driver;
+    timeout_t tick;
+    os_lock_t lock;
+    uint32_t fired;
+};
+
+typedef struct timer_wheel* timer_wheel_t;
+
+/**
+ * @brief   Initialise a wheel
+ *
+ * @param   wheel   :   wheel to initialise
+ * @param   driver  :   uninitialised timer to drive the wheel with, or
+ *                      NULL to only move it with timer_wheel_advance()
+ * @param   tick    :   length of a tick, e.g. TIMER_MSEC(1)
+ */
+void timer_wheel_init(timer_wheel_t wheel, os_timer_t *driver, timeout_t tick);
+
+void timer_wheel_entry_init(struct timer_wheel_entry *entry, timer_wheel_cb_t expiry_fn, void *user_data);
+
+/**
+ * @brief   Arm (or re-arm) an entry
+ *
+ * @param   wheel   :   wheel
+ * @param   entry   :   entry to arm, moved if it is already armed
+ * @param   ticks   :   ticks from now, at least 1
+ */
+void timer_wheel_arm(timer_wheel_t wheel, struct timer_wheel_entry *entry, uint32_t ticks);
+
+/**
+ * @brief   Disarm an entry. Does nothing if it is not armed.
+ */
+void timer_wheel_cancel(timer_wheel_t wheel, struct timer_wheel_entry *entry);
+
+/**
+ * @brief   Move the wheel on, firing everything that comes due. The
+ *          driver calls this once per tick, simulations call it directly.
+ *
+ * @param   wheel   :   wheel
+ * @param   ticks   :   ticks to move on by
+ *
+ * @returns Number of entries that fired
+ */
+size_t timer_wheel_advance(timer_wheel_t wheel, uint32_t ticks);
+
+static inline bool timer_wheel_entry_active(const struct timer_wheel_entry *entry)
+{
+    return entry->active;
+}
 
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* _BBBLED_TIMER_H */
\ No newline at end of file
+#endif /* _BBBLED_TIMER_H */
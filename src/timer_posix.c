@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "timer.h"
+
+/*  Every running timer, unordered. Hosts only ever run a handful */
+static os_timer_t *active_timers;
+static pthread_mutex_t timers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static void unlink_timer(os_timer_t *timer)
+{
+    for (os_timer_t **it = &active_timers; *it; it = &(*it)->next)
+    {
+        if (*it == timer)
+        {
+            *it = timer->next;
+            timer->next = NULL;
+            return;
+        }
+    }
+}
+
+void timer_init(os_timer_t *timer, timer_expiry_cb_t expiry_fn, timer_stop_cb_t stop_fn, void *data)
+{
+    timer->expiry_fn = expiry_fn;
+    timer->stop_fn = stop_fn;
+    timer->user_data = data;
+    timer->active = false;
+    timer->next = NULL;
+}
+
+void timer_start(os_timer_t *timer, timeout_t duration, timeout_t period)
+{
+    pthread_mutex_lock(&timers_lock);
+
+    if (!timer->active)
+    {
+        timer->next = active_timers;
+        active_timers = timer;
+    }
+
+    timer->deadline = now_us() + duration;
+    timer->period = period;
+    timer->active = true;
+
+    pthread_mutex_unlock(&timers_lock);
+}
+
+void timer_stop(os_timer_t *timer)
+{
+    bool was_active;
+
+    pthread_mutex_lock(&timers_lock);
+
+    was_active = timer->active;
+    if (was_active)
+    {
+        unlink_timer(timer);
+        timer->active = false;
+    }
+
+    pthread_mutex_unlock(&timers_lock);
+
+    if (was_active && timer->stop_fn)
+    {
+        timer->stop_fn(timer);
+    }
+}
+
+void *timer_user_data_get(os_timer_t *timer)
+{
+    return timer->user_data;
+}
+
+/**
+ * @brief   Take the first expired timer off the list, rescheduling
+ *          it if it is periodic
+ */
+static os_timer_t *pop_expired(uint64_t now)
+{
+    os_timer_t *expired = NULL;
+
+    pthread_mutex_lock(&timers_lock);
+
+    for (os_timer_t *timer = active_timers; timer; timer = timer->next)
+    {
+        if (timer->deadline <= now)
+        {
+            expired = timer;
+            break;
+        }
+    }
+
+    if (expired)
+    {
+        if (expired->period)
+        {
+            expired->deadline += expired->period;
+            /*  Don't try to catch up on ticks we slept through */
+            if (expired->deadline <= now)
+            {
+                expired->deadline = now + expired->period;
+            }
+        }
+        else
+        {
+            unlink_timer(expired);
+            expired->active = false;
+        }
+    }
+
+    pthread_mutex_unlock(&timers_lock);
+
+    return expired;
+}
+
+size_t timer_poll(void)
+{
+    uint64_t now = now_us();
+    size_t fired = 0;
+    os_timer_t *timer;
+
+    /*  Callbacks run without the lock held so they can restart or stop timers */
+    while ((timer = pop_expired(now)) != NULL)
+    {
+        if (timer->expiry_fn)
+        {
+            timer->expiry_fn(timer);
+        }
+        ++fired;
+    }
+
+    return fired;
+}
+
+uint64_t timer_next_expiry(void)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t now = now_us();
+
+    pthread_mutex_lock(&timers_lock);
+
+    for (os_timer_t *timer = active_timers; timer; timer = timer->next)
+    {
+        uint64_t remaining = (timer->deadline > now) ? (timer->deadline - now) : 0;
+        next = MIN(next, remaining);
+    }
+
+    pthread_mutex_unlock(&timers_lock);
+
+    return next;
+}
\ No newline at end of file
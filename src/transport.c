@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include "transport.h"
+
+LOG_MODULE_REGISTER(bbbled_transport, LOG_LEVEL_DBG);
+
+int transport_init(transport_t transport, const struct device *dev)
+{
+    __ASSERT(transport, "Invalid transport ptr");
+    __ASSERT(dev, "Invalid device ptr");
+
+    memset(transport, 0, sizeof(*transport));
+    transport->dev = dev;
+
+    ring_buf_init(&transport->rx_ring, sizeof(transport->rx_ring_buf), transport->rx_ring_buf);
+    ring_buf_init(&transport->tx_ring, sizeof(transport->tx_ring_buf), transport->tx_ring_buf);
+    k_sem_init(&transport->rx_sem, 0, 1);
+    k_poll_signal_init(&transport->tx_done);
+
+    return transport_backend_init(transport);
+}
+
+int transport_wait(transport_t transport, k_timeout_t timeout)
+{
+    if (!ring_buf_is_empty(&transport->rx_ring))
+    {
+        return 0;
+    }
+
+    return k_sem_take(&transport->rx_sem, timeout);
+}
+
+size_t transport_read(transport_t transport, uint8_t *dest, size_t len)
+{
+    size_t read = ring_buf_get(&transport->rx_ring, dest, len);
+
+    if (read)
+    {
+        transport_backend_rx_resume(transport);
+    }
+
+    return read;
+}
+
+size_t transport_write(transport_t transport, const uint8_t *src, size_t len)
+{
+    k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+    size_t queued = ring_buf_put(&transport->tx_ring, src, len);
+    k_spin_unlock(&transport->tx_lock, key);
+
+    if (queued < len)
+    {
+        LOG_WRN("tx ring full, dropped %d bytes", (int)(len - queued));
+    }
+
+    if (queued)
+    {
+        transport_backend_tx_kick(transport);
+    }
+
+    return queued;
+}
+
+void transport_stats_get(transport_t transport, struct transport_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+    *stats = transport->stats;
+    k_spin_unlock(&transport->tx_lock, key);
+}
+
+void transport_stats_reset(transport_t transport)
+{
+    k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+    memset(&transport->stats, 0, sizeof(transport->stats));
+    k_spin_unlock(&transport->tx_lock, key);
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+#ifndef _BBBLED_TRANSPORT_H
+#define _BBBLED_TRANSPORT_H
+
+#include <zephyr/device.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Byte transport between the CDC-ACM UART and the protocol decoder.
+ * RX bytes land in a ring buffer that the protocol thread drains with
+ * transport_read(), TX bytes are queued with transport_write() and
+ * pushed out by the backend. rx_sem is given when data arrives and
+ * tx_done is raised once the TX ring has drained, so the owner can
+ * k_poll on both. The backend is picked in Kconfig:
+ *
+ *  - transport_irq.c:   interrupt driven API, FIFO read/fill in the ISR
+ *  - transport_async.c: async API, double buffered RX and TX straight
+ *                       out of the ring buffer
+ */
+
+#define TRANSPORT_RX_RING_SIZE CONFIG_BBBLED_TRANSPORT_RX_RING_SIZE
+#define TRANSPORT_TX_RING_SIZE CONFIG_BBBLED_TRANSPORT_TX_RING_SIZE
+
+/**
+ * @brief Transport statistics
+ * @param   rx_bytes    :   bytes received from the UART
+ * @param   tx_bytes    :   bytes handed to the UART
+ * @param   rx_dropped  :   bytes lost because the RX ring was full
+ * @param   rx_events   :   RX interrupts/events handled
+ * @param   tx_events   :   TX interrupts/events handled
+ * @param   isr_cycles  :   cycles spent in the UART callback
+ */
+struct transport_stats {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t rx_dropped;
+    uint32_t rx_events;
+    uint32_t tx_events;
+    uint64_t isr_cycles;
+};
+
+struct transport {
+    const struct device *dev;
+    struct ring_buf rx_ring;
+    struct ring_buf tx_ring;
+    uint8_t rx_ring_buf[TRANSPORT_RX_RING_SIZE];
+    uint8_t tx_ring_buf[TRANSPORT_TX_RING_SIZE];
+    struct k_sem rx_sem;
+    struct k_poll_signal tx_done;
+    struct k_spinlock tx_lock;
+    bool rx_throttled;
+    bool tx_busy;
+    struct transport_stats stats;
+};
+
+typedef struct transport* transport_t;
+
+/**
+ * @brief   Initialise the transport and start receiving
+ *
+ * @param   transport   :   transport to initialise
+ * @param   dev         :   UART device (the CDC-ACM instance)
+ *
+ * @retval  0 on success
+ * @retval  -errno from the UART driver on failure
+ */
+int transport_init(transport_t transport, const struct device *dev);
+
+/**
+ * @brief   Wait for received bytes
+ *
+ * @param   transport   :   transport
+ * @param   timeout     :   how long to wait
+ *
+ * @retval  0 if there is data to read
+ * @retval  -EAGAIN on timeout
+ */
+int transport_wait(transport_t transport, k_timeout_t timeout);
+
+/**
+ * @brief   Copy received bytes out of the RX ring
+ *
+ * @param   transport   :   transport
+ * @param   dest        :   buffer to copy into
+ * @param   len         :   size of the buffer
+ *
+ * @returns Number of bytes copied
+ */
+size_t transport_read(transport_t transport, uint8_t *dest, size_t len);
+
+/**
+ * @brief   Queue bytes for transmission. Never blocks, whatever does
+ *          not fit in the TX ring is not queued.
+ *
+ * @param   transport   :   transport
+ * @param   src         :   bytes to send
+ * @param   len         :   number of bytes
+ *
+ * @returns Number of bytes queued
+ */
+size_t transport_write(transport_t transport, const uint8_t *src, size_t len);
+
+void transport_stats_get(transport_t transport, struct transport_stats *stats);
+
+void transport_stats_reset(transport_t transport);
+
+/**
+ * @brief   CPU time spent in the UART callback per KB moved, the
+ *          figure to compare the two backends on
+ *
+ * @returns Microseconds per KB, 0 if nothing has been moved yet
+ */
+static inline uint32_t transport_us_per_kb(const struct transport_stats *stats)
+{
+    uint64_t bytes = (uint64_t)stats->rx_bytes + stats->tx_bytes;
+
+    if (bytes == 0)
+    {
+        return 0;
+    }
+
+    return (uint32_t)((stats->isr_cycles * 1000000ULL * 1024ULL) /
+                      ((uint64_t)os_cycles_per_sec() * bytes));
+}
+
+/*
+ * Backend interface, implemented by transport_irq.c or transport_async.c
+ */
+
+int transport_backend_init(transport_t transport);
+
+// More TX data has been queued
+void transport_backend_tx_kick(transport_t transport);
+
+// Space has been freed in the RX ring
+void transport_backend_rx_resume(transport_t transport);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_TRANSPORT_H */
\ No newline at end of file
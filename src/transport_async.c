@@ -0,0 +1,158 @@
+#include <zephyr/drivers/uart.h>
+
+#include "transport.h"
+
+#if defined(CONFIG_UART_ASYNC_ADAPTER)
+#include <uart_async_adapter.h>
+#endif
+
+#define TRANSPORT_ASYNC_RX_BUF_SIZE CONFIG_BBBLED_TRANSPORT_ASYNC_RX_BUF_SIZE
+#define TRANSPORT_ASYNC_RX_TIMEOUT_US CONFIG_BBBLED_TRANSPORT_ASYNC_RX_TIMEOUT_US
+
+LOG_MODULE_REGISTER(bbbled_transport_async, LOG_LEVEL_DBG);
+
+#if defined(CONFIG_UART_ASYNC_ADAPTER)
+/*  The CDC-ACM class driver only implements the interrupt driven API,
+    the adapter provides the async API on top of it */
+UART_ASYNC_ADAPTER_INST_DEFINE(async_adapter);
+#endif
+
+static uint8_t rx_bufs[2][TRANSPORT_ASYNC_RX_BUF_SIZE];
+static uint8_t next_rx_buf;
+
+/**
+ * @brief   Start a TX straight out of the ring buffer, if one is not
+ *          already running. Only the contiguous part goes in one go,
+ *          the rest follows from the TX_DONE event.
+ */
+static void start_tx(transport_t transport)
+{
+    uint8_t *data;
+    k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+
+    if (transport->tx_busy)
+    {
+        k_spin_unlock(&transport->tx_lock, key);
+        return;
+    }
+
+    uint32_t len = ring_buf_get_claim(&transport->tx_ring, &data, TRANSPORT_TX_RING_SIZE);
+    if (len)
+    {
+        transport->tx_busy = true;
+        int ret = uart_tx(transport->dev, data, len, SYS_FOREVER_US);
+        if (ret)
+        {
+            LOG_ERR("uart_tx failed [%d]", ret);
+            ring_buf_get_finish(&transport->tx_ring, 0);
+            transport->tx_busy = false;
+        }
+    }
+
+    k_spin_unlock(&transport->tx_lock, key);
+}
+
+static void finish_tx(transport_t transport, size_t len)
+{
+    k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+
+    ring_buf_get_finish(&transport->tx_ring, len);
+    transport->stats.tx_bytes += len;
+    transport->tx_busy = false;
+
+    k_spin_unlock(&transport->tx_lock, key);
+}
+
+static void enable_rx(transport_t transport)
+{
+    next_rx_buf = 1;
+
+    int ret = uart_rx_enable(transport->dev, rx_bufs[0], sizeof(rx_bufs[0]), TRANSPORT_ASYNC_RX_TIMEOUT_US);
+    if (ret)
+    {
+        LOG_ERR("uart_rx_enable failed [%d]", ret);
+    }
+}
+
+static void uart_callback(const struct device *dev, struct uart_event *evt, void *user_data)
+{
+    transport_t transport = (transport_t) user_data;
+    uint32_t start = k_cycle_get_32();
+    uint32_t put;
+
+    switch (evt->type)
+    {
+        case UART_RX_RDY:
+            transport->stats.rx_events++;
+            put = ring_buf_put(&transport->rx_ring,
+                               evt->data.rx.buf + evt->data.rx.offset,
+                               evt->data.rx.len);
+            transport->stats.rx_bytes += put;
+            transport->stats.rx_dropped += evt->data.rx.len - put;
+            if (put)
+            {
+                k_sem_give(&transport->rx_sem);
+            }
+            break;
+        case UART_RX_BUF_REQUEST:
+            /*  Hand over the other half while this one fills */
+            uart_rx_buf_rsp(dev, rx_bufs[next_rx_buf], sizeof(rx_bufs[next_rx_buf]));
+            next_rx_buf ^= 1;
+            break;
+        case UART_RX_BUF_RELEASED:
+            break;
+        case UART_RX_STOPPED:
+            LOG_WRN("rx stopped [%d]", evt->data.rx_stop.reason);
+            break;
+        case UART_RX_DISABLED:
+            /*  Host closed the port or an error stopped reception,
+                start again so we are ready for the next open */
+            enable_rx(transport);
+            break;
+        case UART_TX_DONE:
+        case UART_TX_ABORTED:
+            transport->stats.tx_events++;
+            finish_tx(transport, evt->data.tx.len);
+            start_tx(transport);
+            if (ring_buf_is_empty(&transport->tx_ring))
+            {
+                k_poll_signal_raise(&transport->tx_done, 0);
+            }
+            break;
+        default:
+            break;
+    }
+
+    transport->stats.isr_cycles += k_cycle_get_32() - start;
+}
+
+int transport_backend_init(transport_t transport)
+{
+#if defined(CONFIG_UART_ASYNC_ADAPTER)
+    uart_async_adapter_init(async_adapter, transport->dev);
+    transport->dev = async_adapter;
+#endif
+
+    int ret = uart_callback_set(transport->dev, uart_callback, transport);
+    if (ret)
+    {
+        LOG_ERR("Failed to set UART callback [%d]", ret);
+        return ret;
+    }
+
+    enable_rx(transport);
+
+    return 0;
+}
+
+void transport_backend_tx_kick(transport_t transport)
+{
+    start_tx(transport);
+}
+
+void transport_backend_rx_resume(transport_t transport)
+{
+    /*  RX never stops for a full ring here, the drop is counted in
+        rx_dropped instead. Size the ring for the host's window. */
+    ARG_UNUSED(transport);
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include <zephyr/drivers/uart.h>
+
+#include "transport.h"
+
+// FIFO read/fill granularity, one full speed bulk packet
+#define TRANSPORT_IRQ_CHUNK 64
+
+LOG_MODULE_REGISTER(bbbled_transport_irq, LOG_LEVEL_DBG);
+
+static void interrupt_handler(const struct device *dev, void *user_data)
+{
+    transport_t transport = (transport_t) user_data;
+    uint32_t start = k_cycle_get_32();
+
+    while (uart_irq_update(dev) && uart_irq_is_pending(dev))
+    {
+        if (!transport->rx_throttled && uart_irq_rx_ready(dev))
+        {
+            uint8_t *data;
+            uint32_t space = ring_buf_put_claim(&transport->rx_ring, &data, TRANSPORT_IRQ_CHUNK);
+
+            transport->stats.rx_events++;
+
+            if (space == 0)
+            {
+                /*  Throttle until the protocol thread catches up,
+                    the host backs off rather than losing bytes */
+                uart_irq_rx_disable(dev);
+                transport->rx_throttled = true;
+                continue;
+            }
+
+            /*  Straight from the FIFO into the ring, no bounce buffer */
+            int recv_len = uart_fifo_read(dev, data, space);
+            if (recv_len < 0)
+            {
+                LOG_ERR("Failed to read UART FIFO");
+                recv_len = 0;
+            }
+
+            ring_buf_put_finish(&transport->rx_ring, recv_len);
+            transport->stats.rx_bytes += recv_len;
+
+            if (recv_len)
+            {
+                k_sem_give(&transport->rx_sem);
+            }
+        }
+
+        if (uart_irq_tx_ready(dev))
+        {
+            uint8_t *data;
+            k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+            uint32_t len = ring_buf_get_claim(&transport->tx_ring, &data, TRANSPORT_IRQ_CHUNK);
+
+            transport->stats.tx_events++;
+
+            if (len == 0)
+            {
+                uart_irq_tx_disable(dev);
+                transport->tx_busy = false;
+                k_spin_unlock(&transport->tx_lock, key);
+                k_poll_signal_raise(&transport->tx_done, 0);
+                continue;
+            }
+
+            int sent = uart_fifo_fill(dev, data, len);
+            ring_buf_get_finish(&transport->tx_ring, MAX(sent, 0));
+            transport->stats.tx_bytes += MAX(sent, 0);
+            k_spin_unlock(&transport->tx_lock, key);
+        }
+    }
+
+    transport->stats.isr_cycles += k_cycle_get_32() - start;
+}
+
+int transport_backend_init(transport_t transport)
+{
+    int ret = uart_irq_callback_user_data_set(transport->dev, interrupt_handler, transport);
+    if (ret)
+    {
+        LOG_ERR("Failed to set UART callback [%d]", ret);
+        return ret;
+    }
+
+    uart_irq_rx_enable(transport->dev);
+
+    return 0;
+}
+
+void transport_backend_tx_kick(transport_t transport)
+{
+    k_spinlock_key_t key = k_spin_lock(&transport->tx_lock);
+
+    if (!transport->tx_busy)
+    {
+        transport->tx_busy = true;
+        uart_irq_tx_enable(transport->dev);
+    }
+
+    k_spin_unlock(&transport->tx_lock, key);
+}
+
+void transport_backend_rx_resume(transport_t transport)
+{
+    if (transport->rx_throttled)
+    {
+        transport->rx_throttled = false;
+        uart_irq_rx_enable(transport->dev);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <string.h>
+
+#include "tx_coalesce.h"
+
+LOG_MODULE_REGISTER(bbbled_tx_coalesce, LOG_LEVEL_DBG);
+
+/*  Frame positions are kept in 16 bits, differences must stay unambiguous */
+BUILD_ASSERT(TX_COALESCE_BUF_SIZE <= UINT16_MAX, "frame_ends too narrow for the buffer");
+
+/**
+ * @brief   Offer the first len bytes to the transport, in two pieces if
+ *          they wrap round the end of the buffer
+ *
+ * @returns Bytes the transport took
+ */
+static size_t write_span(tx_coalesce_t coalesce, size_t len)
+{
+    size_t first = MIN(len, TX_COALESCE_BUF_SIZE - coalesce->head);
+    size_t written = coalesce->write(coalesce->buf + coalesce->head, first, coalesce->user_data);
+
+    if (written == first && first < len)
+    {
+        written += coalesce->write(coalesce->buf, len - first, coalesce->user_data);
+    }
+
+    return written;
+}
+
+/**
+ * @brief   Hand the first len bytes to the transport and move the head
+ *          past whatever it took. Nothing is copied, so it is cheap
+ *          enough for the budget timer. Caller holds the lock.
+ */
+static void write_out(tx_coalesce_t coalesce, size_t len)
+{
+    size_t written = write_span(coalesce, len);
+    uint32_t frames = 0;
+
+    coalesce->stalled = (written < len);
+
+    if (written == 0)
+    {
+        return;
+    }
+
+    /*  A frame counts towards the write it finishes in */
+    while (frames < coalesce->frames &&
+           (uint16_t) (coalesce->frame_ends[(coalesce->first_frame + frames) % TX_COALESCE_MAX_FRAMES] -
+                       coalesce->offset) <= written)
+    {
+        frames++;
+    }
+
+    coalesce->stats.writes++;
+    coalesce->stats.bytes += written;
+    coalesce->stats.frames += frames;
+    coalesce->stats.frames_per_write[MIN(frames, TX_COALESCE_HIST_BINS - 1)]++;
+
+    coalesce->first_frame = (coalesce->first_frame + frames) % TX_COALESCE_MAX_FRAMES;
+    coalesce->frames -= frames;
+    coalesce->offset += written;
+    coalesce->len -= written;
+
+    /*  Back to the start once empty, so the next write is in one piece */
+    coalesce->head = coalesce->len ? (coalesce->head + written) % TX_COALESCE_BUF_SIZE : 0;
+}
+
+/*  Runs in ISR context, only hands bytes over and moves the head */
+static void budget_expiry(os_timer_t *timer)
+{
+    tx_coalesce_t coalesce = (tx_coalesce_t) timer_user_data_get(timer);
+    os_lock_key_t key = os_lock(&coalesce->lock);
+
+    if (coalesce->len)
+    {
+        coalesce->stats.timer_flushes++;
+        write_out(coalesce, coalesce->len);
+    }
+
+    os_unlock(&coalesce->lock, key);
+}
+
+void tx_coalesce_init(
+    tx_coalesce_t coalesce,
+    os_timer_t *timer,
+    size_t packet_size,
+    uint32_t budget_us,
+    tx_coalesce_write_t write,
+    void *user_data)
+{
+    __ASSERT(coalesce, "Invalid coalesce ptr");
+    __ASSERT(write, "Invalid write fn");
+    __ASSERT(packet_size > 0 && packet_size <= TX_COALESCE_BUF_SIZE, "Invalid packet size");
+
+    coalesce->head = 0;
+    coalesce->len = 0;
+    coalesce->offset = 0;
+    coalesce->first_frame = 0;
+    coalesce->frames = 0;
+    coalesce->packet_size = packet_size;
+    coalesce->budget_us = budget_us;
+    coalesce->timer = timer;
+    coalesce->stalled = false;
+    coalesce->write = write;
+    coalesce->user_data = user_data;
+    os_lock_init(&coalesce->lock);
+    memset(&coalesce->stats, 0, sizeof(coalesce->stats));
+
+    timer_init(timer, budget_expiry, NULL, coalesce);
+}
+
+int tx_coalesce_add(tx_coalesce_t coalesce, const uint8_t *frame, size_t len)
+{
+    os_lock_key_t key = os_lock(&coalesce->lock);
+    bool was_empty = (coalesce->len == 0);
+
+    if (coalesce->len + len > TX_COALESCE_BUF_SIZE || coalesce->frames == TX_COALESCE_MAX_FRAMES)
+    {
+        os_unlock(&coalesce->lock, key);
+        return -ENOBUFS;
+    }
+
+    size_t tail = (coalesce->head + coalesce->len) % TX_COALESCE_BUF_SIZE;
+    size_t first = MIN(len, TX_COALESCE_BUF_SIZE - tail);
+
+    memcpy(coalesce->buf + tail, frame, first);
+    memcpy(coalesce->buf, frame + first, len - first);
+    coalesce->len += len;
+    coalesce->frame_ends[(coalesce->first_frame + coalesce->frames++) % TX_COALESCE_MAX_FRAMES] =
+        (uint16_t) (coalesce->offset + coalesce->len);
+
+    if (coalesce->budget_us == 0)
+    {
+        write_out(coalesce, coalesce->len);
+    }
+
+    /*  Every full packet goes now, there is nothing to gain by waiting */
+    while (coalesce->len >= coalesce->packet_size)
+    {
+        size_t before = coalesce->len;
+
+        coalesce->stats.full_flushes++;
+        write_out(coalesce, coalesce->packet_size);
+
+        if (coalesce->len == before)
+        {
+            /*  Transport is full, wait for it to drain */
+            break;
+        }
+    }
+
+    if (coalesce->len == 0)
+    {
+        timer_stop(coalesce->timer);
+    }
+    else if (was_empty)
+    {
+        /*  First byte waiting, start the clock on it */
+        timer_start(coalesce->timer, TIMER_USEC(coalesce->budget_us), TIMER_NO_WAIT);
+    }
+
+    os_unlock(&coalesce->lock, key);
+
+    return 0;
+}
+
+void tx_coalesce_flush(tx_coalesce_t coalesce)
+{
+    os_lock_key_t key = os_lock(&coalesce->lock);
+
+    if (coalesce->len)
+    {
+        write_out(coalesce, coalesce->len);
+    }
+
+    if (coalesce->len == 0)
+    {
+        timer_stop(coalesce->timer);
+    }
+
+    os_unlock(&coalesce->lock, key);
+}
\ No newline at end of file
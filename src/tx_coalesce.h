@@ -0,0 +1,148 @@
+#ifndef _BBBLED_TX_COALESCE_H
+#define _BBBLED_TX_COALESCE_H
+
+#include "os.h"
+#include "timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Room for a few packets worth of frames waiting to go
+#define TX_COALESCE_BUF_SIZE 1024
+// Full speed CDC-ACM bulk endpoint
+#define TX_COALESCE_DEFAULT_PACKET_SIZE 64
+// Most frames that can be waiting at once
+#define TX_COALESCE_MAX_FRAMES 64
+// Histogram bins: 0, 1, ... frames per write, last bin is that many or more
+#define TX_COALESCE_HIST_BINS 9
+
+/**
+ * @brief   Hands coalesced bytes on to the transport
+ *
+ * @returns Bytes accepted, anything short of len is offered again on
+ *          the next flush
+ */
+typedef size_t (*tx_coalesce_write_t)(const uint8_t *data, size_t len, void *user_data);
+
+/**
+ * @brief Coalescing statistics
+ * @param   writes          :   writes handed to the transport
+ * @param   frames          :   frames written
+ * @param   bytes           :   bytes written
+ * @param   full_flushes    :   writes because a packet filled up
+ * @param   timer_flushes   :   writes because the latency budget ran out
+ * @param   frames_per_write:   how many frames finished in each write
+ */
+struct tx_coalesce_stats {
+    uint32_t writes;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t full_flushes;
+    uint32_t timer_flushes;
+    uint32_t frames_per_write[TX_COALESCE_HIST_BINS];
+};
+
+/**
+ * @brief Packs serialised frames into as few transport writes as possible
+ * @param   buf         :   ring of bytes waiting to go
+ * @param   head        :   first waiting byte in buf
+ * @param   len         :   bytes waiting
+ * @param   offset      :   bytes ever written, truncated, the position of head
+ * @param   frame_ends  :   ring of positions just past each waiting frame
+ * @param   first_frame :   oldest entry in frame_ends
+ * @param   frames      :   frames waiting
+ * @param   packet_size :   flush as soon as this many bytes are waiting
+ * @param   budget_us   :   longest a byte may wait before being flushed
+ * @param   timer       :   latency budget timer
+ * @param   stalled     :   the transport took less than it was offered
+ * @param   write       :   where flushed bytes go
+ * @param   user_data   :   passed through to write
+ * @param   lock        :   guards the buffer against the budget timer
+ * @param   stats       :   statistics
+ */
+struct tx_coalesce {
+    uint8_t buf[TX_COALESCE_BUF_SIZE];
+    size_t head;
+    size_t len;
+    uint16_t offset;
+    uint16_t frame_ends[TX_COALESCE_MAX_FRAMES];
+    uint32_t first_frame;
+    uint32_t frames;
+    size_t packet_size;
+    uint32_t budget_us;
+    os_timer_t *timer;
+    bool stalled;
+    tx_coalesce_write_t write;
+    void *user_data;
+    os_lock_t lock;
+    struct tx_coalesce_stats stats;
+};
+
+typedef struct tx_coalesce* tx_coalesce_t;
+
+/**
+ * @brief   Initialise a coalescer
+ *
+ * @param   coalesce    :   coalescer to initialise
+ * @param   timer       :   uninitialised timer for the latency budget
+ * @param   packet_size :   endpoint packet size, flush when this fills
+ * @param   budget_us   :   latency budget in microseconds, e.g. 250.
+ *                          0 writes every frame straight away.
+ * @param   write       :   where flushed bytes go
+ * @param   user_data   :   passed through to write
+ */
+void tx_coalesce_init(
+    tx_coalesce_t coalesce,
+    os_timer_t *timer,
+    size_t packet_size,
+    uint32_t budget_us,
+    tx_coalesce_write_t write,
+    void *user_data);
+
+/**
+ * @brief   Add a frame. Whole packets go out straight away, the rest
+ *          waits for more frames or the latency budget.
+ *
+ * @param   coalesce    :   coalescer
+ * @param   frame       :   serialised frame
+ * @param   len         :   length of the frame
+ *
+ * @retval  0 on success
+ * @retval  -ENOBUFS if the frame does not fit, try again once the
+ *          transport has drained
+ */
+int tx_coalesce_add(tx_coalesce_t coalesce, const uint8_t *frame, size_t len);
+
+/**
+ * @brief   Write everything that is waiting now
+ */
+void tx_coalesce_flush(tx_coalesce_t coalesce);
+
+static inline bool tx_coalesce_pending(tx_coalesce_t coalesce)
+{
+    return coalesce->len > 0;
+}
+
+/**
+ * @brief   Bytes are stuck behind a full transport. Flush again once it
+ *          has drained rather than waiting for the budget.
+ */
+static inline bool tx_coalesce_stalled(tx_coalesce_t coalesce)
+{
+    return coalesce->stalled;
+}
+
+/**
+ * @brief   Average frames per write, in hundredths
+ */
+static inline uint32_t tx_coalesce_frames_per_write_x100(const struct tx_coalesce_stats *stats)
+{
+    return stats->writes ? (stats->frames * 100U) / stats->writes : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_TX_COALESCE_H */
\ No newline at end of file
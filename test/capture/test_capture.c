@@ -0,0 +1,118 @@
+#include <zephyr/ztest.h>
+#include <capture.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(capture_test, LOG_LEVEL_DBG);
+
+#define SET_RGB "!set_rgb,red:255,green:128,blue:7,msg:48913#1234"
+#define SET_RGB_LEN (sizeof(SET_RGB) - 1)
+#define ACK "!ack,msg:48913#abcd"
+#define ACK_LEN (sizeof(ACK) - 1)
+#define SNAPLEN 32
+
+static struct capture capture;
+static uint8_t ring[256];
+static uint8_t out[1024];
+
+static void reset(void *fixture)
+{
+    capture_init(&capture, ring, sizeof(ring), SNAPLEN);
+}
+
+ZTEST(capture_test, record_and_read)
+{
+    struct capture_record record;
+    size_t len;
+    int used;
+
+    capture_record(&capture, CAPTURE_RX, (const uint8_t *) ACK, ACK_LEN);
+    capture_record(&capture, CAPTURE_TX, (const uint8_t *) SET_RGB, SET_RGB_LEN);
+
+    len = capture_read(&capture, out, sizeof(out));
+    zassert_equal(2 * CAPTURE_HEADER_SIZE + ACK_LEN + SNAPLEN, len);
+
+    used = capture_parse(out, len, &record);
+    zassert_equal(CAPTURE_HEADER_SIZE + ACK_LEN, used);
+    zassert_equal(CAPTURE_RX, record.dir);
+    zassert_equal(ACK_LEN, record.len);
+    zassert_equal(ACK_LEN, record.captured);
+    zassert_mem_equal(ACK, record.data, ACK_LEN);
+
+    /*  Cut short at the snap length, but the length on the wire is kept */
+    zassert_equal(len - used, capture_parse(&out[used], len - used, &record));
+    zassert_equal(CAPTURE_TX, record.dir);
+    zassert_equal(SET_RGB_LEN, record.len);
+    zassert_equal(SNAPLEN, record.captured);
+    zassert_mem_equal(SET_RGB, record.data, SNAPLEN);
+
+    zassert_equal(0, capture_read(&capture, out, sizeof(out)));
+}
+
+ZTEST(capture_test, newest_wins)
+{
+    struct capture_stats stats;
+    struct capture_record record;
+    size_t per_record = CAPTURE_HEADER_SIZE + ACK_LEN;
+    size_t fits = sizeof(ring) / per_record;
+    size_t offset = 0;
+    size_t len;
+    char frame[ACK_LEN];
+
+    /*  Go round the ring a few times, numbering the frames */
+    for (size_t index = 0; index < 3 * fits; ++index)
+    {
+        memcpy(frame, ACK, ACK_LEN);
+        frame[1] = 'a' + (index % 26);
+        capture_record(&capture, CAPTURE_RX, (const uint8_t *) frame, ACK_LEN);
+    }
+
+    capture_stats_get(&capture, &stats);
+    zassert_equal(3 * fits, stats.records);
+    zassert_equal(2 * fits, stats.overwritten);
+
+    len = capture_read(&capture, out, sizeof(out));
+    zassert_equal(fits * per_record, len);
+
+    for (size_t index = 2 * fits; index < 3 * fits; ++index)
+    {
+        offset += capture_parse(&out[offset], len - offset, &record);
+        zassert_equal('a' + (index % 26), record.data[1]);
+    }
+    zassert_equal(len, offset);
+}
+
+ZTEST(capture_test, read_whole_records_only)
+{
+    uint8_t small[CAPTURE_HEADER_SIZE + ACK_LEN + 4];
+    struct capture_record record;
+
+    capture_record(&capture, CAPTURE_RX, (const uint8_t *) ACK, ACK_LEN);
+    capture_record(&capture, CAPTURE_TX, (const uint8_t *) ACK, ACK_LEN);
+
+    zassert_equal(CAPTURE_HEADER_SIZE + ACK_LEN, capture_read(&capture, small, sizeof(small)));
+    zassert_equal(CAPTURE_HEADER_SIZE + ACK_LEN, capture_read(&capture, small, sizeof(small)));
+    zassert_equal(CAPTURE_HEADER_SIZE + ACK_LEN, capture_parse(small, sizeof(small), &record));
+    zassert_equal(CAPTURE_TX, record.dir);
+    zassert_equal(0, capture_read(&capture, small, sizeof(small)));
+
+    /*  Not enough bytes for the record the header promises */
+    zassert_equal(-1, capture_parse(small, CAPTURE_HEADER_SIZE + ACK_LEN - 1, &record));
+    zassert_equal(-1, capture_parse(small, 3, &record));
+}
+
+ZTEST(capture_test, clear)
+{
+    struct capture_stats stats;
+
+    capture_record(&capture, CAPTURE_RX, (const uint8_t *) ACK, ACK_LEN);
+    capture_clear(&capture);
+
+    capture_stats_get(&capture, &stats);
+    zassert_equal(0, stats.records);
+    zassert_equal(0, capture_read(&capture, out, sizeof(out)));
+}
+
+
+ZTEST_SUITE(capture_test, NULL, NULL, reset, NULL, NULL);
\ No newline at end of file
@@ -0,0 +1,301 @@
+#include <zephyr/ztest.h>
+#include <effect.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <stdlib.h>
+
+
+LOG_MODULE_REGISTER(effect_test, LOG_LEVEL_DBG);
+
+#define MAX_UPDATES 256
+
+struct update {
+    uint16_t target;
+    struct rgb colour;
+};
+
+static struct update updates[MAX_UPDATES];
+static size_t num_updates;
+
+static struct effect_engine engine;
+static os_timer_t tick_timer;
+
+static void record_update(uint16_t target, struct rgb colour, void *user_data)
+{
+    if (num_updates < MAX_UPDATES)
+    {
+        updates[num_updates].target = target;
+        updates[num_updates].colour = colour;
+    }
+    ++num_updates;
+}
+
+static void setup(void)
+{
+    num_updates = 0;
+    effect_engine_init(&engine, &tick_timer, record_update, NULL);
+}
+
+static struct update *last_update(void)
+{
+    return &updates[num_updates - 1];
+}
+
+ZTEST(effect_test, easing_endpoints)
+{
+    for (easing_t easing = EASING_LINEAR; easing < NUM_EASINGS; ++easing)
+    {
+        zassert_equal(0, effect_ease(easing, 0));
+        zassert_equal(EFFECT_FIXED_ONE, effect_ease(easing, EFFECT_FIXED_ONE));
+    }
+
+    zassert_equal(EFFECT_FIXED_ONE / 2, effect_ease(EASING_LINEAR, EFFECT_FIXED_ONE / 2));
+    zassert_equal(EFFECT_FIXED_ONE / 4, effect_ease(EASING_IN, EFFECT_FIXED_ONE / 2));
+    zassert_equal(3 * EFFECT_FIXED_ONE / 4, effect_ease(EASING_OUT, EFFECT_FIXED_ONE / 2));
+    zassert_equal(EFFECT_FIXED_ONE / 2, effect_ease(EASING_IN_OUT, EFFECT_FIXED_ONE / 2));
+}
+
+ZTEST(effect_test, easing_monotonic)
+{
+    for (easing_t easing = EASING_LINEAR; easing < NUM_EASINGS; ++easing)
+    {
+        uint32_t prev = 0;
+
+        for (uint32_t p = 0; p <= EFFECT_FIXED_ONE; p += 256)
+        {
+            uint32_t eased = effect_ease(easing, p);
+            zassert_true(eased >= prev, "easing %d not monotonic at %d", easing, p);
+            prev = eased;
+        }
+    }
+}
+
+ZTEST(effect_test, fade)
+{
+    struct effect_params params = {
+        .type = EFFECT_FADE,
+        .easing = EASING_LINEAR,
+        .duration_ms = 10 * EFFECT_TICK_MSEC,
+        .target = 3,
+        .colour = {.red = 200, .green = 100, .blue = 0},
+    };
+
+    setup();
+    zassert_ok(effect_start(&engine, &params));
+
+    for (uint8_t tick = 0; tick < 5; ++tick)
+    {
+        effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    }
+
+    /*  Half way through a linear fade */
+    zassert_equal(3, last_update()->target);
+    zassert_equal(100, last_update()->colour.red);
+    zassert_equal(50, last_update()->colour.green);
+    zassert_equal(0, last_update()->colour.blue);
+
+    for (uint8_t tick = 0; tick < 10; ++tick)
+    {
+        effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    }
+
+    /*  Lands exactly on the final colour and stops */
+    zassert_equal(200, last_update()->colour.red);
+    zassert_equal(100, last_update()->colour.green);
+    zassert_equal(10, num_updates);
+    zassert_false(engine.slots[0].active);
+}
+
+ZTEST(effect_test, fade_continues_from_last_colour)
+{
+    struct effect_params params = {
+        .type = EFFECT_FADE,
+        .duration_ms = EFFECT_TICK_MSEC,
+        .colour = {.red = 255},
+    };
+
+    setup();
+    zassert_ok(effect_start(&engine, &params));
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(255, last_update()->colour.red);
+
+    /*  Fade back down to black from red */
+    params.duration_ms = 2 * EFFECT_TICK_MSEC;
+    params.colour.red = 0;
+    zassert_ok(effect_start(&engine, &params));
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(128, last_update()->colour.red);
+}
+
+ZTEST(effect_test, reused_slot_starts_from_black)
+{
+    struct effect_params params = {
+        .type = EFFECT_FADE,
+        .duration_ms = EFFECT_TICK_MSEC,
+        .target = 1,
+        .colour = {.red = 255},
+    };
+
+    setup();
+    zassert_ok(effect_start(&engine, &params));
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_false(engine.slots[0].active);
+
+    /*  Gets target 1's finished slot, not its colour */
+    params.target = 2;
+    params.duration_ms = 2 * EFFECT_TICK_MSEC;
+    params.colour = (struct rgb) {.blue = 200};
+    zassert_ok(effect_start(&engine, &params));
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(2, last_update()->target);
+    zassert_equal(0, last_update()->colour.red);
+    zassert_equal(100, last_update()->colour.blue);
+}
+
+ZTEST(effect_test, pulse)
+{
+    struct effect_params params = {
+        .type = EFFECT_PULSE,
+        .duration_ms = 4 * EFFECT_TICK_MSEC,
+        .colour = {.blue = 200},
+    };
+
+    setup();
+    zassert_ok(effect_start(&engine, &params));
+
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(100, last_update()->colour.blue);
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(200, last_update()->colour.blue);
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(100, last_update()->colour.blue);
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(0, last_update()->colour.blue);
+
+    /*  A pulse keeps going until stopped */
+    zassert_true(engine.slots[0].active);
+    effect_stop(&engine, 0);
+    zassert_false(engine.slots[0].active);
+}
+
+ZTEST(effect_test, chase)
+{
+    struct effect_params params = {
+        .type = EFFECT_CHASE,
+        .duration_ms = 4 * EFFECT_TICK_MSEC,
+        .target = 10,
+        .count = 4,
+        .colour = {.green = 255},
+    };
+
+    setup();
+    zassert_ok(effect_start(&engine, &params));
+
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(11, last_update()->target);
+    zassert_equal(255, last_update()->colour.green);
+
+    /*  Previous LED goes back to black before the next one lights up */
+    effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    zassert_equal(11, updates[num_updates - 2].target);
+    zassert_equal(0, updates[num_updates - 2].colour.green);
+    zassert_equal(12, last_update()->target);
+}
+
+ZTEST(effect_test, only_changes_emitted)
+{
+    struct effect_params params = {
+        .type = EFFECT_FADE,
+        .duration_ms = 60000,
+        .colour = {.red = 1},
+    };
+
+    setup();
+    zassert_ok(effect_start(&engine, &params));
+
+    /*  A slow fade over a small range should not update every frame */
+    for (uint16_t tick = 0; tick < 100; ++tick)
+    {
+        effect_engine_tick(&engine, EFFECT_TICK_MSEC);
+    }
+
+    zassert_equal(0, num_updates);
+}
+
+ZTEST(effect_test, invalid_params)
+{
+    struct effect_params params = {
+        .type = EFFECT_FADE,
+        .duration_ms = 0,
+    };
+
+    setup();
+    zassert_equal(-EINVAL, effect_start(&engine, &params));
+
+    params.duration_ms = 100;
+    params.type = NUM_EFFECTS;
+    zassert_equal(-EINVAL, effect_start(&engine, &params));
+
+    params.type = EFFECT_CHASE;
+    params.count = 0;
+    zassert_equal(-EINVAL, effect_start(&engine, &params));
+}
+
+ZTEST(effect_test, slots_exhausted)
+{
+    struct effect_params params = {
+        .type = EFFECT_PULSE,
+        .duration_ms = 100,
+    };
+
+    setup();
+
+    for (uint16_t target = 0; target < EFFECT_MAX_SLOTS; ++target)
+    {
+        params.target = target;
+        zassert_ok(effect_start(&engine, &params));
+    }
+
+    params.target = EFFECT_MAX_SLOTS;
+    zassert_equal(-ENOMEM, effect_start(&engine, &params));
+}
+
+ZTEST(effect_test, params_from_pairs)
+{
+    struct key_val_pair pairs[] = {
+        {.key = KEY_EFFECT, .value = EFFECT_CHASE},
+        {.key = KEY_DURATION, .value = 1000},
+        {.key = KEY_EASING, .value = EASING_IN_OUT},
+        {.key = KEY_TARGET, .value = 5},
+        {.key = KEY_COUNT, .value = 8},
+        {.key = KEY_RED, .value = 1},
+        {.key = KEY_GREEN, .value = 2},
+        {.key = KEY_BLUE, .value = 3},
+    };
+    struct effect_params params;
+
+    zassert_ok(effect_params_from_pairs(pairs, ARRAY_SIZE(pairs), &params));
+    zassert_equal(EFFECT_CHASE, params.type);
+    zassert_equal(1000, params.duration_ms);
+    zassert_equal(EASING_IN_OUT, params.easing);
+    zassert_equal(5, params.target);
+    zassert_equal(8, params.count);
+    zassert_equal(1, params.colour.red);
+    zassert_equal(2, params.colour.green);
+    zassert_equal(3, params.colour.blue);
+
+    /*  Missing duration */
+    zassert_equal(-EINVAL, effect_params_from_pairs(pairs, 1, &params));
+}
+
+ZTEST(effect_test, validate_effect_params)
+{
+    zassert_ok(validate_param_for_command(COMMAND_EFFECT, KEY_EFFECT, EFFECT_FADE));
+    zassert_true(validate_param_for_command(COMMAND_EFFECT, KEY_EFFECT, EFFECT_NONE));
+    zassert_true(validate_param_for_command(COMMAND_EFFECT, KEY_EASING, NUM_EASINGS));
+    zassert_true(validate_param_for_command(COMMAND_EFFECT, KEY_DURATION, 0));
+    zassert_true(validate_param_for_command(COMMAND_EFFECT, KEY_RED, 256));
+    zassert_true(validate_param_for_command(COMMAND_EFFECT, KEY_MSGNUM, 1));
+}
+
+ZTEST_SUITE(effect_test, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,333 @@
+#include <zephyr/ztest.h>
+#include <fragment.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <stdlib.h>
+
+
+LOG_MODULE_REGISTER(fragment_test, LOG_LEVEL_DBG);
+
+/*  MTUs to exercise, from the smallest usable up to a
+    BLE data length extension sized ATT payload */
+static const size_t test_mtus[] = {FRAGMENT_MIN_MTU, 20, 23, 64, 185, 244};
+
+/*  Loss patterns, one bit per fragment index. A set bit drops
+    the first transmission of that fragment */
+static const uint32_t test_loss[] = {
+    0x00000000, // perfect link
+    0x00000001, // first fragment lost
+    0x80000000, // last possible fragment lost
+    0x55555555, // every other fragment lost
+    0x0000F00F, // bursts
+    0xFFFFFFFF, // everything lost once
+};
+
+struct test_link {
+    fragment_rx_t rx;
+    uint32_t loss;
+    uint16_t transmissions;
+    struct fragment_rx_slot *complete;
+};
+
+static struct fragment_rx rx;
+static uint8_t msg[FRAGMENT_MAX_MSG_SIZE];
+
+static void link_emit(const uint8_t *frag, size_t len, void *user_data)
+{
+    struct test_link *link = (struct test_link*) user_data;
+    uint8_t index = frag[2];
+
+    link->transmissions++;
+
+    if (link->loss & BIT(index))
+    {
+        /*  Drop it this time around */
+        link->loss &= ~BIT(index);
+        return;
+    }
+
+    fragment_rx_receive(link->rx, frag, len, &link->complete);
+}
+
+static void fill_msg(size_t len)
+{
+    for (size_t index = 0; index < len; ++index)
+    {
+        msg[index] = (uint8_t) rand();
+    }
+}
+
+/**
+ * @brief   Send a message over the test link until it is
+ *          reassembled, returning the number of fragment
+ *          transmissions it took
+ */
+static uint16_t transfer(size_t len, size_t mtu, uint32_t loss)
+{
+    struct fragment_tx tx;
+    struct test_link link = {
+        .rx = &rx,
+        .loss = loss,
+    };
+    uint8_t ack[FRAGMENT_ACK_SIZE];
+    fragment_ret_t ret = FRAGMENT_INCOMPLETE;
+    uint8_t rounds = 0;
+
+    zassert_ok(fragment_rx_init(&rx, mtu));
+    zassert_ok(fragment_tx_init(&tx, msg, len, 0x1234, mtu));
+
+    while (ret == FRAGMENT_INCOMPLETE)
+    {
+        zassert_true(rounds++ < 3, "did not converge");
+
+        fragment_tx_send(&tx, link_emit, &link);
+
+        size_t ack_len = fragment_rx_build_ack(&rx, tx.msg_id, ack, sizeof(ack));
+        if (ack_len == 0)
+        {
+            /*  Nothing arrived so there is nothing to ack, the
+                sender times out and tries everything again */
+            continue;
+        }
+
+        ret = fragment_tx_handle_ack(&tx, ack, ack_len);
+    }
+
+    zassert_ok(ret);
+    zassert_not_null(link.complete);
+    zassert_equal(len, link.complete->len);
+    zassert_mem_equal(msg, link.complete->buffer, len);
+
+    fragment_rx_release(&rx, link.complete);
+
+    return link.transmissions;
+}
+
+ZTEST(fragment_test, header)
+{
+    struct fragment_tx tx;
+    uint8_t data[] = "hello world";
+    uint8_t frag[8];
+
+    zassert_ok(fragment_tx_init(&tx, data, 11, 0xABCD, sizeof(frag)));
+    zassert_equal(3, tx.count);
+
+    zassert_equal(8, fragment_tx_build(&tx, 0, frag, sizeof(frag)));
+    zassert_equal(0xAB, frag[0]);
+    zassert_equal(0xCD, frag[1]);
+    zassert_equal(0, frag[2]);
+    zassert_equal(3, frag[3]);
+    zassert_mem_equal("hell", &frag[4], 4);
+
+    /*  The last fragment only carries what is left */
+    zassert_equal(FRAGMENT_HEADER_SIZE + 3, fragment_tx_build(&tx, 2, frag, sizeof(frag)));
+    zassert_mem_equal("rld", &frag[4], 3);
+
+    zassert_equal(0, fragment_tx_build(&tx, 3, frag, sizeof(frag)));
+}
+
+ZTEST(fragment_test, invalid_mtu)
+{
+    struct fragment_tx tx;
+
+    zassert_equal(FRAGMENT_INVALID_MTU, fragment_tx_init(&tx, msg, 10, 0, FRAGMENT_MIN_MTU - 1));
+    zassert_equal(FRAGMENT_INVALID_MTU, fragment_rx_init(&rx, FRAGMENT_HEADER_SIZE));
+    zassert_equal(FRAGMENT_INVALID_MTU, fragment_tx_init(&tx, msg, 10, 0, FRAGMENT_MAX_MTU + 1));
+    zassert_equal(FRAGMENT_INVALID_MTU, fragment_rx_init(&rx, FRAGMENT_MAX_MTU + 1));
+}
+
+ZTEST(fragment_test, max_mtu)
+{
+    fill_msg(FRAGMENT_MAX_MSG_SIZE);
+
+    uint16_t transmissions = transfer(FRAGMENT_MAX_MSG_SIZE, FRAGMENT_MAX_MTU, 0x5);
+    zassert_equal(DIV_ROUND_UP(FRAGMENT_MAX_MSG_SIZE, fragment_payload_size(FRAGMENT_MAX_MTU)) + 2,
+                  transmissions);
+}
+
+ZTEST(fragment_test, too_large)
+{
+    struct fragment_tx tx;
+    size_t mtu = 20;
+    size_t max_len = FRAGMENT_MAX_FRAGMENTS * fragment_payload_size(mtu);
+
+    zassert_ok(fragment_tx_init(&tx, msg, max_len, 0, mtu));
+    zassert_equal(FRAGMENT_MSG_TOO_LARGE, fragment_tx_init(&tx, msg, max_len + 1, 0, mtu));
+}
+
+ZTEST(fragment_test, larger_than_protocol_buffer)
+{
+    /*  Bigger than anything a single protocol frame can hold */
+    size_t len = FRAGMENT_MAX_MSG_SIZE;
+    size_t mtu = 244;
+
+    fill_msg(len);
+
+    uint16_t transmissions = transfer(len, mtu, 0);
+    zassert_equal(DIV_ROUND_UP(len, fragment_payload_size(mtu)), transmissions);
+}
+
+ZTEST(fragment_test, mtu_and_loss_sweep)
+{
+    for (size_t m = 0; m < ARRAY_SIZE(test_mtus); ++m)
+    {
+        size_t mtu = test_mtus[m];
+        size_t payload = fragment_payload_size(mtu);
+        size_t len = MIN(FRAGMENT_MAX_MSG_SIZE, FRAGMENT_MAX_FRAGMENTS * payload);
+
+        fill_msg(len);
+
+        for (size_t l = 0; l < ARRAY_SIZE(test_loss); ++l)
+        {
+            uint8_t count = DIV_ROUND_UP(len, payload);
+            uint32_t all = (count >= 32) ? UINT32_MAX : (BIT(count) - 1);
+            uint32_t lost = test_loss[l] & all;
+
+            uint16_t transmissions = transfer(len, mtu, test_loss[l]);
+
+            /*  Only the fragments that were lost should go out twice */
+            zassert_equal(count + __builtin_popcount(lost), transmissions,
+                          "mtu %d loss %08x", mtu, test_loss[l]);
+
+            TC_PRINT("mtu %3d: %2d fragments, loss %08x -> %2d transmissions\n",
+                     (int) mtu, count, test_loss[l], transmissions);
+        }
+    }
+}
+
+ZTEST(fragment_test, duplicate)
+{
+    struct fragment_tx tx;
+    uint8_t frag[20];
+    size_t len;
+
+    fill_msg(40);
+    zassert_ok(fragment_rx_init(&rx, sizeof(frag)));
+    zassert_ok(fragment_tx_init(&tx, msg, 40, 7, sizeof(frag)));
+
+    len = fragment_tx_build(&tx, 0, frag, sizeof(frag));
+    zassert_equal(FRAGMENT_INCOMPLETE, fragment_rx_receive(&rx, frag, len, NULL));
+    zassert_equal(FRAGMENT_DUPLICATE, fragment_rx_receive(&rx, frag, len, NULL));
+}
+
+ZTEST(fragment_test, pool_full_evicts_oldest)
+{
+    struct fragment_tx tx;
+    uint8_t frag[20];
+    size_t len;
+
+    fill_msg(40);
+    zassert_ok(fragment_rx_init(&rx, sizeof(frag)));
+
+    /*  Start one message per slot but never finish them */
+    for (uint16_t msg_id = 0; msg_id < FRAGMENT_RX_POOL_SIZE; ++msg_id)
+    {
+        zassert_ok(fragment_tx_init(&tx, msg, 40, msg_id, sizeof(frag)));
+        len = fragment_tx_build(&tx, 0, frag, sizeof(frag));
+        zassert_equal(FRAGMENT_INCOMPLETE, fragment_rx_receive(&rx, frag, len, NULL));
+    }
+
+    /*  Message 0 hears from its sender again, so 1 is the oldest */
+    zassert_ok(fragment_tx_init(&tx, msg, 40, 0, sizeof(frag)));
+    len = fragment_tx_build(&tx, 1, frag, sizeof(frag));
+    zassert_equal(FRAGMENT_INCOMPLETE, fragment_rx_receive(&rx, frag, len, NULL));
+
+    zassert_ok(fragment_tx_init(&tx, msg, 40, FRAGMENT_RX_POOL_SIZE, sizeof(frag)));
+    len = fragment_tx_build(&tx, 0, frag, sizeof(frag));
+    zassert_equal(FRAGMENT_INCOMPLETE, fragment_rx_receive(&rx, frag, len, NULL));
+    zassert_equal(1, rx.evicted);
+
+    uint8_t ack[FRAGMENT_ACK_SIZE];
+    zassert_equal(0, fragment_rx_build_ack(&rx, 1, ack, sizeof(ack)));
+    zassert_equal(FRAGMENT_ACK_SIZE, fragment_rx_build_ack(&rx, 0, ack, sizeof(ack)));
+    zassert_equal(FRAGMENT_ACK_SIZE, fragment_rx_build_ack(&rx, 2, ack, sizeof(ack)));
+}
+
+ZTEST(fragment_test, complete_slots_are_kept)
+{
+    struct fragment_tx tx;
+    struct fragment_rx_slot *complete = NULL;
+    uint8_t frag[20];
+    size_t len;
+
+    fill_msg(10);
+    zassert_ok(fragment_rx_init(&rx, sizeof(frag)));
+
+    /*  Complete messages the caller hasn't released yet */
+    for (uint16_t msg_id = 0; msg_id < FRAGMENT_RX_POOL_SIZE; ++msg_id)
+    {
+        zassert_ok(fragment_tx_init(&tx, msg, 10, msg_id, sizeof(frag)));
+        len = fragment_tx_build(&tx, 0, frag, sizeof(frag));
+        zassert_ok(fragment_rx_receive(&rx, frag, len, &complete));
+    }
+
+    zassert_ok(fragment_tx_init(&tx, msg, 10, FRAGMENT_RX_POOL_SIZE, sizeof(frag)));
+    len = fragment_tx_build(&tx, 0, frag, sizeof(frag));
+    zassert_equal(FRAGMENT_NO_SLOT, fragment_rx_receive(&rx, frag, len, NULL));
+    zassert_equal(0, rx.evicted);
+
+    fragment_rx_release(&rx, complete);
+    zassert_ok(fragment_rx_receive(&rx, frag, len, NULL));
+}
+
+ZTEST(fragment_test, lost_ack_is_not_delivered_twice)
+{
+    struct fragment_tx tx;
+    struct fragment_rx_slot *complete = NULL;
+    uint8_t frag[20];
+    uint8_t ack[FRAGMENT_ACK_SIZE];
+    size_t len;
+
+    fill_msg(40);
+    zassert_ok(fragment_rx_init(&rx, sizeof(frag)));
+    zassert_ok(fragment_tx_init(&tx, msg, 40, 9, sizeof(frag)));
+
+    for (uint8_t index = 0; index < tx.count; ++index)
+    {
+        len = fragment_tx_build(&tx, index, frag, sizeof(frag));
+        fragment_rx_receive(&rx, frag, len, &complete);
+    }
+    zassert_not_null(complete);
+    fragment_rx_release(&rx, complete);
+
+    /*  The status frame was lost, the sender tries the lot again */
+    for (uint8_t index = 0; index < tx.count; ++index)
+    {
+        complete = NULL;
+        len = fragment_tx_build(&tx, index, frag, sizeof(frag));
+        zassert_equal(FRAGMENT_DUPLICATE, fragment_rx_receive(&rx, frag, len, &complete));
+        zassert_is_null(complete);
+    }
+
+    /*  And is told it has nothing left to send */
+    len = fragment_rx_build_ack(&rx, 9, ack, sizeof(ack));
+    zassert_equal(FRAGMENT_ACK_SIZE, len);
+    zassert_ok(fragment_tx_handle_ack(&tx, ack, len));
+
+    /*  Only the last few completed messages are remembered */
+    for (uint16_t msg_id = 100; msg_id < 100 + FRAGMENT_RX_DONE_SIZE; ++msg_id)
+    {
+        zassert_ok(fragment_tx_init(&tx, msg, 10, msg_id, sizeof(frag)));
+        len = fragment_tx_build(&tx, 0, frag, sizeof(frag));
+        zassert_ok(fragment_rx_receive(&rx, frag, len, &complete));
+        fragment_rx_release(&rx, complete);
+    }
+    zassert_equal(0, fragment_rx_build_ack(&rx, 9, ack, sizeof(ack)));
+    zassert_equal(FRAGMENT_ACK_SIZE, fragment_rx_build_ack(&rx, 100, ack, sizeof(ack)));
+}
+
+ZTEST(fragment_test, short_middle_fragment)
+{
+    struct fragment_tx tx;
+    uint8_t frag[20];
+    size_t len;
+
+    fill_msg(40);
+    zassert_ok(fragment_rx_init(&rx, sizeof(frag)));
+    zassert_ok(fragment_tx_init(&tx, msg, 40, 1, sizeof(frag)));
+
+    len = fragment_tx_build(&tx, 1, frag, sizeof(frag));
+    zassert_equal(FRAGMENT_INVALID_HEADER, fragment_rx_receive(&rx, frag, len - 1, NULL));
+}
+
+ZTEST_SUITE(fragment_test, NULL, NULL, NULL, NULL, NULL);
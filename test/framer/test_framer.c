@@ -0,0 +1,279 @@
+#include <zephyr/ztest.h>
+#include <framer.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(framer_test, LOG_LEVEL_DBG);
+
+#define MAX_FRAMES 8
+
+static char frames[MAX_FRAMES][FRAMER_BUF_SIZE + 1];
+static size_t num_frames;
+static struct framer framer;
+
+static void record_frame(const uint8_t *frame, size_t len, void *user_data)
+{
+    zassert_equal(strlen((const char*) frame), len);
+
+    if (num_frames < MAX_FRAMES)
+    {
+        memcpy(frames[num_frames], frame, len + 1);
+    }
+    ++num_frames;
+}
+
+static void setup(void)
+{
+    num_frames = 0;
+    framer_init(&framer, record_frame, NULL);
+}
+
+static size_t feed_str(const char *str)
+{
+    return framer_feed(&framer, (const uint8_t*) str, strlen(str));
+}
+
+ZTEST(framer_test, single_frame)
+{
+    setup();
+
+    zassert_equal(1, feed_str("!ack,msg:16#0745"));
+    zassert_equal(1, num_frames);
+    zassert_str_equal("!ack,msg:16#0745", frames[0]);
+}
+
+ZTEST(framer_test, split_across_reads)
+{
+    setup();
+
+    zassert_equal(0, feed_str("!set_rgb,red:1,gr"));
+    zassert_equal(0, feed_str("een:2,blue:3#46"));
+    zassert_equal(1, feed_str("3d"));
+    zassert_str_equal("!set_rgb,red:1,green:2,blue:3#463d", frames[0]);
+}
+
+ZTEST(framer_test, back_to_back)
+{
+    setup();
+
+    zassert_equal(2, feed_str("!ack,msg:16#0745!nack,msg:5489#5f6f"));
+    zassert_str_equal("!ack,msg:16#0745", frames[0]);
+    zassert_str_equal("!nack,msg:5489#5f6f", frames[1]);
+}
+
+ZTEST(framer_test, garbage_between_frames)
+{
+    setup();
+
+    zassert_equal(1, feed_str("\r\nxyz!ack,msg:16#0745\r\n"));
+    zassert_str_equal("!ack,msg:16#0745", frames[0]);
+    zassert_equal(7, framer.dropped);
+}
+
+ZTEST(framer_test, truncated_frame)
+{
+    setup();
+
+    /*  The first frame never finishes, the next preamble resyncs */
+    zassert_equal(1, feed_str("!set_rgb,red:1!ack,msg:16#0745"));
+    zassert_equal(1, num_frames);
+    zassert_str_equal("!ack,msg:16#0745", frames[0]);
+    zassert_equal(strlen("!set_rgb,red:1"), framer.dropped);
+}
+
+ZTEST(framer_test, overlong_frame)
+{
+    uint8_t junk[FRAMER_BUF_SIZE + 10];
+
+    setup();
+
+    memset(junk, 'a', sizeof(junk));
+    junk[0] = '!';
+
+    zassert_equal(0, framer_feed(&framer, junk, sizeof(junk)));
+    zassert_equal(FRAMER_WAIT_PREAMBLE, framer.state);
+
+    zassert_equal(1, feed_str("!ack,msg:16#0745"));
+}
+
+static uint8_t wire[4096];
+static size_t wire_len;
+
+/*  Append a frame to the wire as the sender would */
+static void send_frame(framer_mode_t mode, const char *frame)
+{
+    wire_len += framer_encode(mode, (const uint8_t *) frame, strlen(frame),
+                              wire + wire_len, sizeof(wire) - wire_len);
+}
+
+static void setup_cobs(void)
+{
+    setup();
+    framer_set_mode(&framer, FRAMER_MODE_COBS);
+    wire_len = 0;
+}
+
+ZTEST(framer_test, cobs_frames)
+{
+    setup_cobs();
+
+    send_frame(FRAMER_MODE_COBS, "!ack,msg:16#0745");
+    send_frame(FRAMER_MODE_COBS, "!nack,msg:5489#5f6f");
+
+    /*  Nothing but the delimiters is zero */
+    zassert_is_null(memchr(wire, 0, strlen("!ack,msg:16#0745") + 1));
+
+    zassert_equal(2, framer_feed(&framer, wire, wire_len));
+    zassert_str_equal("!ack,msg:16#0745", frames[0]);
+    zassert_str_equal("!nack,msg:5489#5f6f", frames[1]);
+    zassert_equal(0, framer.dropped);
+}
+
+ZTEST(framer_test, cobs_split_across_reads)
+{
+    setup_cobs();
+
+    send_frame(FRAMER_MODE_COBS, "!set_rgb,red:1,green:2,blue:3#463d");
+
+    for (size_t i = 0; i < wire_len - 1; ++i)
+    {
+        zassert_equal(0, framer_feed(&framer, wire + i, 1));
+    }
+    zassert_equal(1, framer_feed(&framer, wire + wire_len - 1, 1));
+    zassert_str_equal("!set_rgb,red:1,green:2,blue:3#463d", frames[0]);
+}
+
+ZTEST(framer_test, cobs_payload_with_markers)
+{
+    /*  '!' and '#' in the payload would break text framing */
+    const char *frame = "!x!y#z#1234";
+
+    setup_cobs();
+    send_frame(FRAMER_MODE_COBS, frame);
+
+    zassert_equal(1, framer_feed(&framer, wire, wire_len));
+    zassert_str_equal(frame, frames[0]);
+}
+
+ZTEST(framer_test, cobs_corrupt_frame)
+{
+    setup_cobs();
+
+    send_frame(FRAMER_MODE_COBS, "!ack,msg:16#0745");
+    size_t first_len = wire_len;
+    send_frame(FRAMER_MODE_COBS, "!ack,msg:17#1764");
+
+    /*  A code byte pointing past the end can't be decoded */
+    wire[0] = 0xfe;
+
+    zassert_equal(1, framer_feed(&framer, wire, wire_len));
+    zassert_str_equal("!ack,msg:17#1764", frames[0]);
+    zassert_equal(1, framer.corrupt);
+    zassert_equal(first_len - 1, framer.dropped);
+}
+
+ZTEST(framer_test, cobs_overlong_frame)
+{
+    uint8_t junk[FRAMER_COBS_BUF_SIZE + 10];
+
+    setup_cobs();
+
+    memset(junk, 'a', sizeof(junk));
+    zassert_equal(0, framer_feed(&framer, junk, sizeof(junk)));
+    zassert_equal(FRAMER_WAIT_PREAMBLE, framer.state);
+
+    /*  The delimiter after the junk puts us straight back in sync */
+    zassert_equal(0, framer_feed(&framer, (const uint8_t *) "\0", 1));
+    send_frame(FRAMER_MODE_COBS, "!ack,msg:16#0745");
+    zassert_equal(1, framer_feed(&framer, wire, wire_len));
+}
+
+/*
+ *  Recovery cost: send a run of frames, corrupt one byte of one of them,
+ *  and count what it cost to get back in sync: frames lost on top of the
+ *  damaged one, and bytes thrown away. Every byte position of the middle
+ *  frame is hit in turn, with a byte from the payload's own alphabet
+ *  ('!') so text framing sees a fake preamble.
+ */
+#define RECOVERY_FRAMES 3
+
+struct recovery {
+    size_t extra_frames_lost;
+    size_t bytes_dropped;
+    uint32_t cycles;
+    size_t trials;
+};
+
+static void measure_recovery(framer_mode_t mode, uint8_t poison, struct recovery *result)
+{
+    const char *sent[RECOVERY_FRAMES] = {
+        "!set_rgb,red:1,green:2,blue:3#463d",
+        "!effect,target:0,type:1,duration:500,easing:3,red:255,green:0,blue:0,msg:42#9a1c",
+        "!ack,msg:16#0745",
+    };
+    size_t start, end;
+
+    memset(result, 0, sizeof(*result));
+
+    wire_len = 0;
+    send_frame(mode, sent[0]);
+    start = wire_len;
+    send_frame(mode, sent[1]);
+    end = wire_len;
+    send_frame(mode, sent[2]);
+
+    for (size_t pos = start; pos < end; ++pos)
+    {
+        uint8_t saved = wire[pos];
+
+        setup();
+        framer_set_mode(&framer, mode);
+
+        wire[pos] = poison;
+        uint32_t cycles = k_cycle_get_32();
+        framer_feed(&framer, wire, wire_len);
+        result->cycles += k_cycle_get_32() - cycles;
+        wire[pos] = saved;
+
+        /*  Frames either side of the damaged one should survive */
+        size_t intact = 0;
+        for (size_t i = 0; i < MIN(num_frames, MAX_FRAMES); ++i)
+        {
+            intact += (strcmp(frames[i], sent[0]) == 0 || strcmp(frames[i], sent[2]) == 0);
+        }
+        result->extra_frames_lost += 2 - MIN(intact, 2);
+        result->bytes_dropped += framer.dropped;
+        result->trials++;
+    }
+}
+
+ZTEST(framer_test, recovery_cost)
+{
+    struct recovery text, cobs;
+
+    measure_recovery(FRAMER_MODE_TEXT, '!', &text);
+    measure_recovery(FRAMER_MODE_COBS, '!', &cobs);
+
+    TC_PRINT("text: %u extra frames lost, %u bytes dropped, %u cycles over %u corruptions\n",
+             (unsigned) text.extra_frames_lost, (unsigned) text.bytes_dropped,
+             text.cycles, (unsigned) text.trials);
+    TC_PRINT("cobs: %u extra frames lost, %u bytes dropped, %u cycles over %u corruptions\n",
+             (unsigned) cobs.extra_frames_lost, (unsigned) cobs.bytes_dropped,
+             cobs.cycles, (unsigned) cobs.trials);
+
+    /*  A damaged COBS frame only takes a neighbour with it when the
+        hit lands on its delimiter, merging it with the next frame */
+    zassert_true(cobs.extra_frames_lost <= 1);
+
+    /*  A delimiter landing in the middle of a frame splits it, both
+        halves are dropped and nothing else */
+    measure_recovery(FRAMER_MODE_COBS, COBS_DELIMITER, &cobs);
+    TC_PRINT("cobs, 0x00 hit: %u extra frames lost, %u bytes dropped\n",
+             (unsigned) cobs.extra_frames_lost, (unsigned) cobs.bytes_dropped);
+    zassert_equal(0, cobs.extra_frames_lost);
+}
+
+ZTEST_SUITE(framer_test, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,451 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linksim.h"
+
+LOG_MODULE_REGISTER(bbbled_linksim, LOG_LEVEL_DBG);
+
+// Bytes at the end of a frame that are the CRC and its marker
+#define LINKSIM_CRC_TAIL 5
+
+struct linksim_record {
+    uint16_t msg_num;
+    uint32_t submit_ms;
+    bool delivered;
+    bool acked;
+};
+
+/*  Everything a run needs, too big for a test thread's stack */
+static struct {
+    struct protocol_ctx sender;
+    struct protocol_ctx receiver;
+    os_timer_t sender_timer;
+    os_timer_t receiver_timer;
+    struct timer_wheel wheel;
+    os_atomic_t timed_out;
+    struct linksim_channel forward;
+    struct linksim_channel reverse;
+    struct linksim_record records[LINKSIM_MAX_MESSAGES];
+    uint32_t latencies[LINKSIM_MAX_MESSAGES];
+    size_t submitted;
+    uint32_t now_ms;
+    uint8_t rx_buf[LINKSIM_FRAME_SIZE + 1];
+    /*  Per target, the last message the receiver applied and the last
+        one submitted, as indices into records */
+    int32_t applied[LINKSIM_MAX_TARGETS];
+    int32_t latest[LINKSIM_MAX_TARGETS];
+} sim;
+
+static uint32_t channel_rand(linksim_channel_t channel)
+{
+    uint32_t x = channel->rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    channel->rng = x;
+
+    return x;
+}
+
+static inline bool channel_chance(linksim_channel_t channel, uint32_t ppm)
+{
+    /*  Always draw, so changing one rate doesn't shift every other
+        decision the seed makes */
+    return (channel_rand(channel) % 1000000) < ppm;
+}
+
+void linksim_channel_init(linksim_channel_t channel, const struct linksim_channel_config *config)
+{
+    memset(channel, 0, sizeof(*channel));
+    channel->config = *config;
+    channel->rng = config->seed ? config->seed : 1;
+    channel->last_seq = -1;
+}
+
+void linksim_channel_send(linksim_channel_t channel, uint32_t now_ms, const uint8_t *data, size_t len)
+{
+    const struct linksim_channel_config *config = &channel->config;
+    bool lose = channel_chance(channel, config->loss_ppm);
+    bool corrupt = channel_chance(channel, config->corrupt_ppm);
+    bool hold_back = channel_chance(channel, config->reorder_ppm);
+    uint32_t jitter = channel_rand(channel) % (config->jitter_ms + 1);
+    uint32_t damage = channel_rand(channel);
+    uint32_t seq = channel->next_seq++;
+
+    if (lose)
+    {
+        channel->lost++;
+        return;
+    }
+    if (channel->count == LINKSIM_CHANNEL_DEPTH || len > LINKSIM_FRAME_SIZE)
+    {
+        channel->overflow++;
+        return;
+    }
+
+    struct linksim_frame *frame = &channel->frames[channel->count++];
+    frame->due_ms = now_ms + config->delay_ms + jitter + (hold_back ? config->reorder_ms : 0);
+    frame->seq = seq;
+    frame->len = len;
+    memcpy(frame->data, data, len);
+
+    /*  Damage the body rather than the CRC, a flipped case bit in the
+        hex digits would go unnoticed and make runs depend on the
+        message numbers */
+    if (corrupt && len > LINKSIM_CRC_TAIL + 1)
+    {
+        size_t index = 1 + (damage >> 8) % (len - LINKSIM_CRC_TAIL - 1);
+
+        frame->data[index] ^= (uint8_t)(1 + (damage & 0x7f));
+        channel->corrupted++;
+    }
+}
+
+bool linksim_channel_recv(linksim_channel_t channel, uint32_t now_ms, struct linksim_frame *frame)
+{
+    size_t next = channel->count;
+
+    for (size_t index = 0; index < channel->count; ++index)
+    {
+        struct linksim_frame *candidate = &channel->frames[index];
+
+        if ((int32_t)(candidate->due_ms - now_ms) > 0)
+        {
+            continue;
+        }
+        if (next == channel->count
+            || (int32_t)(candidate->due_ms - channel->frames[next].due_ms) < 0
+            || (candidate->due_ms == channel->frames[next].due_ms
+                && candidate->seq < channel->frames[next].seq))
+        {
+            next = index;
+        }
+    }
+
+    if (next == channel->count)
+    {
+        return false;
+    }
+
+    *frame = channel->frames[next];
+    channel->frames[next] = channel->frames[--channel->count];
+
+    if ((int64_t) frame->seq < channel->last_seq)
+    {
+        channel->reordered++;
+    }
+    else
+    {
+        channel->last_seq = frame->seq;
+    }
+
+    return true;
+}
+
+static void sender_event(protocol_ctx_t ctx, protocol_event_t event, void *user_data)
+{
+    if (event == PROTOCOL_EVENT_TIMEOUT)
+    {
+        os_atomic_set(&sim.timed_out, 1);
+    }
+}
+
+/*  Message numbers are random and can come round again, even while an
+    older message with the same number is waiting. A data frame carries
+    its index in red, so match on both, newest first */
+static struct linksim_record *find_record(uint16_t msg_num, value_t red)
+{
+    for (size_t index = sim.submitted; index > 0; --index)
+    {
+        if (sim.records[index - 1].msg_num == msg_num && ((index - 1) & 0xff) == red)
+        {
+            return &sim.records[index - 1];
+        }
+    }
+    return NULL;
+}
+
+/*  An ACK is for the oldest message with its number still waiting, a
+    newer one can't go until that one is done */
+static struct linksim_record *find_unacked(uint16_t msg_num)
+{
+    for (size_t index = 0; index < sim.submitted; ++index)
+    {
+        if (sim.records[index].msg_num == msg_num && !sim.records[index].acked)
+        {
+            return &sim.records[index];
+        }
+    }
+    return NULL;
+}
+
+static bool find_param(const struct parsed_data *parsed, param_key_t key, value_t *value)
+{
+    for (size_t index = 0; index < parsed->num_params; ++index)
+    {
+        if (parsed->params[index].key == key)
+        {
+            *value = parsed->params[index].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*  Peek at a frame without disturbing the copy the context will parse */
+static bool peek_frame(const struct linksim_frame *frame, struct parsed_data *parsed, uint16_t *msg_num)
+{
+    char text[LINKSIM_FRAME_SIZE + 1];
+
+    memcpy(text, frame->data, frame->len);
+    text[frame->len] = '\0';
+    memset(parsed, 0, sizeof(*parsed));
+
+    return parse(text, frame->len, parsed, msg_num) == 0;
+}
+
+static void feed(protocol_ctx_t ctx, const struct linksim_frame *frame)
+{
+    struct parsed_data parsed = {0};
+
+    memcpy(sim.rx_buf, frame->data, frame->len);
+    sim.rx_buf[frame->len] = '\0';
+    ctx->rx_buf = sim.rx_buf;
+    ctx->rx_len = frame->len;
+    handle_incoming(ctx, &parsed);
+}
+
+static bool is_data_frame(const struct pbuf *frame)
+{
+    const char *wire = cmd_to_string(COMMAND_SET_RGB);
+    size_t len = strlen(wire);
+
+    return frame->len > len && memcmp(&frame->data[1], wire, len) == 0;
+}
+
+static size_t drain(protocol_ctx_t ctx, linksim_channel_t channel)
+{
+    struct pbuf *frame;
+    size_t data_frames = 0;
+
+    while ((frame = protocol_tx_pbuf(ctx)) != NULL)
+    {
+        data_frames += is_data_frame(frame);
+        linksim_channel_send(channel, sim.now_ms, frame->data, frame->len);
+        pbuf_unref(frame);
+    }
+
+    return data_frames;
+}
+
+static void receiver_step(struct linksim_stats *stats)
+{
+    struct linksim_frame frame;
+
+    while (linksim_channel_recv(&sim.forward, sim.now_ms, &frame))
+    {
+        struct parsed_data parsed;
+        uint16_t msg_num = 0;
+
+        if (peek_frame(&frame, &parsed, &msg_num) && parsed.command == COMMAND_SET_RGB)
+        {
+            struct linksim_record *record = NULL;
+            value_t red;
+            value_t target;
+
+            if (find_param(&parsed, KEY_RED, &red))
+            {
+                record = find_record(msg_num, red);
+            }
+
+            /*  Applied as it arrives, a resend included */
+            if (record && find_param(&parsed, KEY_TARGET, &target) && target < LINKSIM_MAX_TARGETS)
+            {
+                sim.applied[target] = record - sim.records;
+            }
+
+            if (record && !record->delivered)
+            {
+                record->delivered = true;
+                sim.latencies[stats->delivered++] = sim.now_ms - record->submit_ms;
+            }
+            else
+            {
+                stats->duplicates++;
+            }
+        }
+
+        feed(&sim.receiver, &frame);
+        drain(&sim.receiver, &sim.reverse);
+    }
+}
+
+static void sender_step(struct linksim_stats *stats)
+{
+    struct linksim_frame frame;
+
+    while (linksim_channel_recv(&sim.reverse, sim.now_ms, &frame))
+    {
+        struct parsed_data parsed;
+        uint16_t msg_num = 0;
+
+        if (peek_frame(&frame, &parsed, &msg_num) && parsed.command == COMMAND_ACK)
+        {
+            struct linksim_record *record = find_unacked(msg_num);
+
+            if (record)
+            {
+                record->acked = true;
+                stats->acked++;
+            }
+        }
+
+        feed(&sim.sender, &frame);
+    }
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(size_t count, uint32_t percent)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    return sim.latencies[((count - 1) * percent) / 100];
+}
+
+static void summarise(const struct linksim_config *config, struct linksim_stats *stats)
+{
+    stats->gave_up = sim.sender.gave_up;
+    stats->elapsed_ms = sim.now_ms;
+    stats->goodput = sim.now_ms ? (stats->delivered * 1000.0) / sim.now_ms : 0;
+    stats->retx_ratio = sim.submitted
+        ? ((double) stats->data_frames - sim.submitted) / sim.submitted : 0;
+
+    qsort(sim.latencies, stats->delivered, sizeof(uint32_t), compare_u32);
+    stats->latency_p50 = percentile(stats->delivered, 50);
+    stats->latency_p90 = percentile(stats->delivered, 90);
+    stats->latency_p99 = percentile(stats->delivered, 99);
+    stats->latency_max = percentile(stats->delivered, 100);
+
+    for (size_t target = 0; target < config->num_targets; ++target)
+    {
+        int32_t latest = sim.latest[target];
+
+        if (latest >= 0 && sim.records[latest].acked && sim.applied[target] != latest)
+        {
+            stats->stale++;
+        }
+    }
+
+    stats->forward = sim.forward;
+    stats->reverse = sim.reverse;
+}
+
+int linksim_run(const struct linksim_config *config, struct linksim_stats *stats)
+{
+    if (config->messages > LINKSIM_MAX_MESSAGES || config->window == 0
+        || config->num_targets > LINKSIM_MAX_TARGETS)
+    {
+        return -EINVAL;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    sim.submitted = 0;
+    sim.now_ms = 0;
+    memset(sim.applied, 0xff, sizeof(sim.applied));
+    memset(sim.latest, 0xff, sizeof(sim.latest));
+    os_atomic_set(&sim.timed_out, 0);
+    linksim_channel_init(&sim.forward, &config->forward);
+    linksim_channel_init(&sim.reverse, &config->reverse);
+
+    protocol_init(&sim.sender, NULL, 0, &sim.sender_timer);
+    protocol_init(&sim.receiver, NULL, 0, &sim.receiver_timer);
+    protocol_set_event_cb(&sim.sender, sender_event, NULL);
+    if (config->unordered)
+    {
+        timer_wheel_init(&sim.wheel, NULL, TIMER_MSEC(1));
+        protocol_set_delivery(&sim.sender, &sim.wheel, COMMAND_DELIVERY_UNORDERED);
+    }
+
+    while (sim.now_ms < config->max_ms)
+    {
+        size_t outstanding;
+
+        receiver_step(stats);
+        sender_step(stats);
+
+        outstanding = sim.submitted - stats->acked - MIN(sim.sender.gave_up, sim.submitted - stats->acked);
+        if (sim.submitted == config->messages && outstanding == 0)
+        {
+            summarise(config, stats);
+            return 0;
+        }
+
+        while (sim.submitted < config->messages && outstanding < config->window)
+        {
+            size_t target = config->num_targets ? sim.submitted % config->num_targets : 0;
+            struct key_val_pair params[] = {
+                {.key = KEY_RED, .value = sim.submitted & 0xff},
+                {.key = KEY_GREEN, .value = 128},
+                {.key = KEY_BLUE, .value = 7},
+                {.key = KEY_TARGET, .value = (value_t) target},
+            };
+            size_t num_params = config->num_targets ? ARRAY_SIZE(params) : ARRAY_SIZE(params) - 1;
+            int msg_num = protocol_submit(&sim.sender, COMMAND_SET_RGB, params, num_params);
+
+            if (msg_num < 0)
+            {
+                break;
+            }
+            if (config->num_targets)
+            {
+                sim.latest[target] = sim.submitted;
+            }
+            sim.records[sim.submitted++] = (struct linksim_record) {
+                .msg_num = (uint16_t) msg_num,
+                .submit_ms = sim.now_ms,
+            };
+            outstanding++;
+        }
+
+        if (os_atomic_get(&sim.timed_out))
+        {
+            os_atomic_set(&sim.timed_out, 0);
+            protocol_timeout(&sim.sender);
+        }
+        stats->data_frames += drain(&sim.sender, &sim.forward);
+
+        sim.now_ms++;
+        if (config->unordered)
+        {
+            timer_wheel_advance(&sim.wheel, 1);
+        }
+        else
+        {
+            k_msleep(1);
+        }
+    }
+
+    summarise(config, stats);
+
+    /*  Leave nothing running for the next run */
+    timer_stop(&sim.sender_timer);
+    if (config->unordered)
+    {
+        for (size_t index = 0; index < PROTOCOL_MAX_IN_FLIGHT; ++index)
+        {
+            timer_wheel_cancel(&sim.wheel, &sim.sender.in_flight[index].timer);
+        }
+    }
+    return -ETIMEDOUT;
+}
\ No newline at end of file
@@ -0,0 +1,183 @@
+#ifndef _BBBLED_LINKSIM_H
+#define _BBBLED_LINKSIM_H
+
+#include "os.h"
+#include "protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames on the wire at once, per direction
+#define LINKSIM_CHANNEL_DEPTH 64
+#define LINKSIM_FRAME_SIZE 128
+#define LINKSIM_MAX_MESSAGES 1024
+#define LINKSIM_MAX_TARGETS 16
+
+/**
+ * @brief Channel model for one direction of the link
+ * @param   seed        :   seed for the channel's random numbers, never 0
+ * @param   loss_ppm    :   frames lost, per million
+ * @param   corrupt_ppm :   frames with a byte damaged, per million
+ * @param   delay_ms    :   fixed one way delay
+ * @param   jitter_ms   :   extra delay, uniform in [0, jitter_ms]
+ * @param   reorder_ppm :   frames held back by reorder_ms, per million
+ * @param   reorder_ms  :   how long a held back frame waits
+ */
+struct linksim_channel_config {
+    uint32_t seed;
+    uint32_t loss_ppm;
+    uint32_t corrupt_ppm;
+    uint32_t delay_ms;
+    uint32_t jitter_ms;
+    uint32_t reorder_ppm;
+    uint32_t reorder_ms;
+};
+
+struct linksim_frame {
+    uint32_t due_ms;
+    uint32_t seq;
+    size_t len;
+    uint8_t data[LINKSIM_FRAME_SIZE];
+};
+
+/**
+ * @brief One direction of the link
+ * @param   config      :   channel model
+ * @param   rng         :   xorshift state
+ * @param   frames      :   frames on the wire, unordered
+ * @param   count       :   frames in use
+ * @param   next_seq    :   sequence number for the next frame sent
+ * @param   last_seq    :   sequence number of the last frame delivered
+ * @param   lost        :   frames dropped by the model
+ * @param   corrupted   :   frames damaged by the model
+ * @param   reordered   :   frames delivered after a later one
+ * @param   overflow    :   frames dropped because the wire was full
+ */
+struct linksim_channel {
+    struct linksim_channel_config config;
+    uint32_t rng;
+    struct linksim_frame frames[LINKSIM_CHANNEL_DEPTH];
+    size_t count;
+    uint32_t next_seq;
+    int64_t last_seq;
+    uint32_t lost;
+    uint32_t corrupted;
+    uint32_t reordered;
+    uint32_t overflow;
+};
+
+typedef struct linksim_channel* linksim_channel_t;
+
+/**
+ * @brief How a run is driven
+ * @param   forward     :   sender to receiver
+ * @param   reverse     :   receiver to sender
+ * @param   messages    :   set_rgb packets to deliver (<= LINKSIM_MAX_MESSAGES)
+ * @param   window      :   submitted packets allowed without an ACK
+ * @param   unordered   :   true for per-message timers on a wheel,
+ *                          false for stop-and-wait on the resend timer
+ * @param   max_ms      :   give up on the run after this long
+ * @param   num_targets :   message N goes to target N % num_targets,
+ *                          0 for no target param
+ */
+struct linksim_config {
+    struct linksim_channel_config forward;
+    struct linksim_channel_config reverse;
+    size_t messages;
+    size_t window;
+    bool unordered;
+    uint32_t max_ms;
+    size_t num_targets;
+};
+
+/**
+ * @brief What a run measured
+ * @param   delivered       :   messages that reached the receiver
+ * @param   duplicates      :   copies of a message that had already arrived
+ * @param   acked           :   messages the sender saw an ACK for
+ * @param   gave_up         :   messages the sender ran out of retries on
+ * @param   data_frames     :   data frames the sender put on the wire
+ * @param   elapsed_ms      :   simulated time the run took
+ * @param   goodput         :   messages delivered per second
+ * @param   retx_ratio      :   extra data frames per message submitted
+ * @param   latency_p50     :   submission to first arrival, median (ms)
+ * @param   latency_p90     :   90th percentile (ms)
+ * @param   latency_p99     :   99th percentile (ms)
+ * @param   latency_max     :   worst case (ms)
+ * @param   stale           :   targets left with an older message than the
+ *                              last one acknowledged for them
+ * @param   forward         :   sender to receiver channel counters
+ * @param   reverse         :   receiver to sender channel counters
+ */
+struct linksim_stats {
+    uint32_t delivered;
+    uint32_t duplicates;
+    uint32_t acked;
+    uint32_t gave_up;
+    uint32_t data_frames;
+    uint32_t elapsed_ms;
+    double goodput;
+    double retx_ratio;
+    uint32_t latency_p50;
+    uint32_t latency_p90;
+    uint32_t latency_p99;
+    uint32_t latency_max;
+    uint32_t stale;
+    struct linksim_channel forward;
+    struct linksim_channel reverse;
+};
+
+/**
+ * @brief   Set up a channel
+ *
+ * @param   channel :   channel to initialise
+ * @param   config  :   channel model
+ */
+void linksim_channel_init(linksim_channel_t channel, const struct linksim_channel_config *config);
+
+/**
+ * @brief   Put a frame on the wire. It may be lost, damaged, delayed
+ *          or held back, as the model decides.
+ *
+ * @param   channel :   channel
+ * @param   now_ms  :   current simulated time
+ * @param   data    :   frame
+ * @param   len     :   length of the frame
+ */
+void linksim_channel_send(linksim_channel_t channel, uint32_t now_ms, const uint8_t *data, size_t len);
+
+/**
+ * @brief   Take the next frame that is due, oldest first
+ *
+ * @param   channel :   channel
+ * @param   now_ms  :   current simulated time
+ * @param   frame   :   where to copy the frame
+ *
+ * @retval  true if a frame was due
+ */
+bool linksim_channel_recv(linksim_channel_t channel, uint32_t now_ms, struct linksim_frame *frame);
+
+/**
+ * @brief   Run two protocol contexts against each other over a pair
+ *          of channels, one simulated millisecond at a time. The sender
+ *          submits set_rgb packets as fast as the window allows.
+ *
+ *          Stop-and-wait runs on the context's own resend timer, so
+ *          time is advanced with k_msleep(). Runs are repeatable on
+ *          native_sim, where kernel time is simulated as well.
+ *
+ * @param   config  :   how to drive the run
+ * @param   stats   :   what it measured
+ *
+ * @retval  0 once every message was acknowledged or given up on
+ * @retval  -ETIMEDOUT if max_ms ran out first
+ * @retval  -EINVAL if the config is out of range
+ */
+int linksim_run(const struct linksim_config *config, struct linksim_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BBBLED_LINKSIM_H */
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include <zephyr/ztest.h>
+#include <linksim.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(linksim_test, LOG_LEVEL_DBG);
+
+#define MESSAGES 200
+#define DELAY_MS 5
+#define MAX_RUN_MS 120000
+
+static struct linksim_config base_config(bool unordered, size_t window, uint32_t loss_ppm)
+{
+    struct linksim_config config = {
+        .forward = {.seed = 0x1234, .loss_ppm = loss_ppm, .delay_ms = DELAY_MS},
+        .reverse = {.seed = 0x4321, .loss_ppm = loss_ppm, .delay_ms = DELAY_MS},
+        .messages = MESSAGES,
+        .window = window,
+        .unordered = unordered,
+        .max_ms = MAX_RUN_MS,
+    };
+
+    return config;
+}
+
+static void print_stats(const char *name, const struct linksim_config *config, const struct linksim_stats *stats)
+{
+    TC_PRINT("%-14s win %u loss %4.1f%% corrupt %4.1f%% jitter %2u | "
+             "%6.1f msg/s retx %5.2f p50 %4u p90 %4u p99 %4u max %4u\n",
+             name, (unsigned) config->window,
+             config->forward.loss_ppm / 1e4, config->forward.corrupt_ppm / 1e4,
+             config->forward.jitter_ms,
+             stats->goodput, stats->retx_ratio,
+             stats->latency_p50, stats->latency_p90, stats->latency_p99, stats->latency_max);
+}
+
+ZTEST(linksim_test, channel_repeats_with_seed)
+{
+    struct linksim_channel_config model = {
+        .seed = 99, .loss_ppm = 200000, .corrupt_ppm = 100000,
+        .delay_ms = 3, .jitter_ms = 4, .reorder_ppm = 100000, .reorder_ms = 10,
+    };
+    struct linksim_channel first;
+    struct linksim_channel second;
+    struct linksim_frame a;
+    struct linksim_frame b;
+    uint8_t data[16];
+
+    linksim_channel_init(&first, &model);
+    linksim_channel_init(&second, &model);
+
+    for (uint32_t now = 0; now < 200; ++now)
+    {
+        memset(data, now, sizeof(data));
+        linksim_channel_send(&first, now, data, sizeof(data));
+        linksim_channel_send(&second, now, data, sizeof(data));
+
+        while (linksim_channel_recv(&first, now, &a))
+        {
+            zassert_true(linksim_channel_recv(&second, now, &b));
+            zassert_equal(a.seq, b.seq);
+            zassert_mem_equal(a.data, b.data, a.len);
+        }
+        zassert_false(linksim_channel_recv(&second, now, &b));
+    }
+
+    zassert_true(first.lost > 0);
+    zassert_true(first.corrupted > 0);
+    zassert_true(first.reordered > 0);
+    zassert_equal(first.lost, second.lost);
+    zassert_equal(first.reordered, second.reordered);
+}
+
+ZTEST(linksim_test, channel_delays_and_damages)
+{
+    struct linksim_channel_config model = {.seed = 7, .corrupt_ppm = 1000000, .delay_ms = 5};
+    struct linksim_channel channel;
+    struct linksim_frame frame;
+    const uint8_t data[] = "!ack,msg:1#abcd";
+
+    linksim_channel_init(&channel, &model);
+    linksim_channel_send(&channel, 10, data, sizeof(data) - 1);
+
+    zassert_false(linksim_channel_recv(&channel, 14, &frame));
+    zassert_true(linksim_channel_recv(&channel, 15, &frame));
+    zassert_equal(sizeof(data) - 1, frame.len);
+
+    /*  The CRC is left alone, the damage is somewhere before it */
+    zassert_false(memcmp(data, frame.data, frame.len) == 0);
+    zassert_mem_equal(&data[frame.len - 5], &frame.data[frame.len - 5], 5);
+}
+
+ZTEST(linksim_test, clean_link_sends_once)
+{
+    struct linksim_stats stats;
+
+    for (int unordered = 0; unordered < 2; ++unordered)
+    {
+        struct linksim_config config = base_config(unordered, unordered ? 4 : 1, 0);
+
+        zassert_equal(0, linksim_run(&config, &stats));
+        zassert_equal(MESSAGES, stats.delivered);
+        zassert_equal(MESSAGES, stats.acked);
+        zassert_equal(MESSAGES, stats.data_frames);
+        zassert_equal(0, stats.duplicates);
+        zassert_equal(DELAY_MS, stats.latency_max);
+    }
+}
+
+ZTEST(linksim_test, stop_and_wait_recovers_loss)
+{
+    struct linksim_config config = base_config(false, 1, 100000);
+    struct linksim_stats stats;
+
+    zassert_equal(0, linksim_run(&config, &stats));
+    print_stats("stop-and-wait", &config, &stats);
+
+    /*  Every loss goes through resend_timer_expiry() */
+    zassert_true(stats.data_frames > MESSAGES);
+    zassert_true(stats.forward.lost + stats.reverse.lost > 0);
+    zassert_equal(MESSAGES, stats.acked + stats.gave_up);
+    zassert_true(stats.delivered >= MESSAGES - stats.gave_up);
+}
+
+ZTEST(linksim_test, unordered_recovers_loss_and_corruption)
+{
+    struct linksim_config config = base_config(true, PROTOCOL_MAX_IN_FLIGHT, 100000);
+    struct linksim_stats stats;
+
+    config.forward.corrupt_ppm = 50000;
+    config.forward.jitter_ms = 4;
+    config.forward.reorder_ppm = 50000;
+    config.forward.reorder_ms = 20;
+
+    zassert_equal(0, linksim_run(&config, &stats));
+    print_stats("unordered", &config, &stats);
+
+    zassert_true(stats.forward.corrupted > 0);
+    zassert_true(stats.forward.reordered > 0);
+    zassert_true(stats.data_frames > MESSAGES);
+    zassert_equal(MESSAGES, stats.acked + stats.gave_up);
+    zassert_true(stats.delivered >= MESSAGES - stats.gave_up);
+}
+
+/*  A few targets updated over and over, with several updates to the
+    same one in flight. Whatever is lost, each target ends up with the
+    last update it was sent */
+ZTEST(linksim_test, latest_update_wins)
+{
+    struct linksim_config config = base_config(true, PROTOCOL_MAX_IN_FLIGHT, 200000);
+    struct linksim_stats stats;
+
+    config.num_targets = 3;
+
+    for (uint32_t seed = 1; seed <= 8; ++seed)
+    {
+        config.forward.seed = seed;
+        config.reverse.seed = ~seed;
+
+        zassert_equal(0, linksim_run(&config, &stats));
+        zassert_true(stats.forward.lost > 0);
+        zassert_equal(MESSAGES, stats.acked + stats.gave_up);
+        zassert_equal(0, stats.stale, "seed %u left %u targets stale", seed, stats.stale);
+    }
+    print_stats("same targets", &config, &stats);
+}
+
+ZTEST(linksim_test, runs_repeat)
+{
+    struct linksim_config config = base_config(true, 4, 50000);
+    struct linksim_stats first;
+    struct linksim_stats second;
+
+    config.forward.jitter_ms = 3;
+
+    zassert_equal(0, linksim_run(&config, &first));
+    zassert_equal(0, linksim_run(&config, &second));
+
+    zassert_equal(first.elapsed_ms, second.elapsed_ms);
+    zassert_equal(first.data_frames, second.data_frames);
+    zassert_equal(first.delivered, second.delivered);
+    zassert_equal(first.latency_p99, second.latency_p99);
+}
+
+/*  Not a pass/fail test, the numbers are for tuning timeouts and
+    window sizes */
+ZTEST(linksim_test, sweep)
+{
+    static const uint32_t losses[] = {0, 10000, 50000, 100000, 200000};
+    static const size_t windows[] = {1, 2, 4, 8};
+    struct linksim_stats stats;
+
+    for (size_t loss = 0; loss < ARRAY_SIZE(losses); ++loss)
+    {
+        struct linksim_config config = base_config(false, 1, losses[loss]);
+
+        config.forward.corrupt_ppm = losses[loss] / 10;
+        config.forward.jitter_ms = 2;
+        zassert_equal(0, linksim_run(&config, &stats));
+        print_stats("stop-and-wait", &config, &stats);
+
+        for (size_t window = 0; window < ARRAY_SIZE(windows); ++window)
+        {
+            config.unordered = true;
+            config.window = windows[window];
+            zassert_equal(0, linksim_run(&config, &stats));
+            print_stats("unordered", &config, &stats);
+        }
+    }
+}
+
+ZTEST_SUITE(linksim_test, NULL, NULL, NULL, NULL, NULL);
\ No newline at end of file
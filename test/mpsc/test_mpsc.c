@@ -0,0 +1,144 @@
+#include <zephyr/ztest.h>
+#include <mpsc.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+
+
+LOG_MODULE_REGISTER(mpsc_test, LOG_LEVEL_DBG);
+
+#define NUM_PRODUCERS 4
+#define ITEMS_PER_PRODUCER 2000
+#define PRODUCER_STACK_SIZE 1024
+// Longest the stress test may take before we call it a hang
+#define STRESS_TIMEOUT_MS 10000
+
+struct item {
+    struct mpsc_node node;
+    uint32_t producer;
+    uint32_t seq;
+};
+
+struct producer {
+    struct k_thread thread;
+    uint32_t cycles;
+};
+
+static struct mpsc queue;
+static struct item items[NUM_PRODUCERS][ITEMS_PER_PRODUCER];
+static struct producer producers[NUM_PRODUCERS];
+K_THREAD_STACK_ARRAY_DEFINE(producer_stacks, NUM_PRODUCERS, PRODUCER_STACK_SIZE);
+
+static void reset(void *fixture)
+{
+    mpsc_init(&queue);
+}
+
+static struct item *pop_item(void)
+{
+    struct mpsc_node *node = mpsc_pop(&queue);
+
+    return node ? CONTAINER_OF(node, struct item, node) : NULL;
+}
+
+ZTEST(mpsc_test, empty)
+{
+    zassert_is_null(mpsc_pop(&queue));
+    zassert_is_null(mpsc_pop(&queue));
+}
+
+ZTEST(mpsc_test, fifo)
+{
+    for (uint32_t seq = 0; seq < 3; ++seq)
+    {
+        items[0][seq].seq = seq;
+        mpsc_push(&queue, &items[0][seq].node);
+    }
+
+    for (uint32_t seq = 0; seq < 3; ++seq)
+    {
+        struct item *item = pop_item();
+
+        zassert_not_null(item);
+        zassert_equal(seq, item->seq);
+    }
+    zassert_is_null(mpsc_pop(&queue));
+
+    /*  Taking the last node puts the stub back, the queue carries on
+        working and popped nodes can go round again */
+    mpsc_push(&queue, &items[0][1].node);
+    mpsc_push(&queue, &items[0][0].node);
+    zassert_equal(1, pop_item()->seq);
+    zassert_equal(0, pop_item()->seq);
+    zassert_is_null(mpsc_pop(&queue));
+}
+
+static void produce(void *p1, void *p2, void *p3)
+{
+    uint32_t id = (uint32_t) (uintptr_t) p1;
+    uint32_t start = k_cycle_get_32();
+
+    for (uint32_t seq = 0; seq < ITEMS_PER_PRODUCER; ++seq)
+    {
+        struct item *item = &items[id][seq];
+
+        item->producer = id;
+        item->seq = seq;
+        mpsc_push(&queue, &item->node);
+    }
+
+    producers[id].cycles = k_cycle_get_32() - start;
+}
+
+ZTEST(mpsc_test, producers_stress)
+{
+    uint32_t next_seq[NUM_PRODUCERS] = {0};
+    uint32_t received = 0;
+    uint32_t empty_pops = 0;
+    int64_t deadline = k_uptime_get() + STRESS_TIMEOUT_MS;
+
+    for (uint32_t id = 0; id < NUM_PRODUCERS; ++id)
+    {
+        k_thread_create(&producers[id].thread, producer_stacks[id],
+                        K_THREAD_STACK_SIZEOF(producer_stacks[id]),
+                        produce, (void *) (uintptr_t) id, NULL, NULL,
+                        K_PRIO_PREEMPT(1), 0, K_NO_WAIT);
+    }
+
+    /*  We are the one consumer. Every item must turn up exactly once,
+        and each producer's items in the order they were pushed */
+    while (received < NUM_PRODUCERS * ITEMS_PER_PRODUCER)
+    {
+        struct item *item = pop_item();
+
+        if (item == NULL)
+        {
+            zassert_true(k_uptime_get() < deadline, "items lost, %u received", received);
+            empty_pops++;
+            k_msleep(1);
+            continue;
+        }
+
+        zassert_true(item->producer < NUM_PRODUCERS);
+        zassert_equal(next_seq[item->producer], item->seq,
+                      "producer %u out of order", item->producer);
+        next_seq[item->producer]++;
+        received++;
+    }
+
+    for (uint32_t id = 0; id < NUM_PRODUCERS; ++id)
+    {
+        k_thread_join(&producers[id].thread, K_FOREVER);
+    }
+    zassert_is_null(mpsc_pop(&queue));
+
+    for (uint32_t id = 0; id < NUM_PRODUCERS; ++id)
+    {
+        uint64_t ns = MAX(k_cyc_to_ns_floor64(producers[id].cycles), 1);
+
+        TC_PRINT("producer %u: %u pushes in %u us, %u k/s\n", id, ITEMS_PER_PRODUCER,
+                 (uint32_t) (ns / 1000), (uint32_t) (ITEMS_PER_PRODUCER * 1000000ull / ns));
+    }
+    TC_PRINT("consumer: %u items, %u empty pops\n", received, empty_pops);
+}
+
+ZTEST_SUITE(mpsc_test, NULL, NULL, reset, NULL, NULL);
\ No newline at end of file
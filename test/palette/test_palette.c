@@ -0,0 +1,172 @@
+#include <zephyr/ztest.h>
+#include <palette.h>
+#include <protocol.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(palette_test, LOG_LEVEL_DBG);
+
+struct emitted {
+    size_t count;
+    uint16_t targets[PALETTE_MAX_PER_FRAME];
+    struct rgb colours[PALETTE_MAX_PER_FRAME];
+};
+
+static void record(uint16_t target, struct rgb colour, void *user_data)
+{
+    struct emitted *emitted = (struct emitted *) user_data;
+
+    emitted->targets[emitted->count] = target;
+    emitted->colours[emitted->count] = colour;
+    emitted->count++;
+}
+
+static struct palette palette;
+
+static void palette_before(void *fixture)
+{
+    ARG_UNUSED(fixture);
+
+    palette_init(&palette);
+    for (int index = 0; index < 16; ++index)
+    {
+        palette_set(&palette, index, (struct rgb) {.red = index, .green = 2 * index, .blue = 255 - index});
+    }
+}
+
+ZTEST(palette_test, set_and_get)
+{
+    struct rgb colour;
+
+    zassert_ok(palette_get(&palette, 15, &colour));
+    zassert_equal(15, colour.red);
+    zassert_equal(30, colour.green);
+    zassert_equal(240, colour.blue);
+    zassert_equal(-ENOENT, palette_get(&palette, 16, &colour));
+    zassert_equal(-ENOENT, palette_get(&palette, 255, &colour));
+
+    palette_set(&palette, 255, (struct rgb) {.red = 1, .green = 2, .blue = 3});
+    zassert_ok(palette_get(&palette, 255, &colour));
+    zassert_equal(3, colour.blue);
+}
+
+ZTEST(palette_test, apply_upload)
+{
+    struct key_val_pair params[] = {
+        {.key = KEY_RED, .value = 10},
+        {.key = KEY_GREEN, .value = 20},
+        {.key = KEY_BLUE, .value = 30},
+        {.key = KEY_INDEX, .value = 200},
+    };
+    struct rgb colour;
+
+    zassert_ok(palette_apply(&palette, params, ARRAY_SIZE(params)));
+    zassert_ok(palette_get(&palette, 200, &colour));
+    zassert_equal(10, colour.red);
+    zassert_equal(20, colour.green);
+    zassert_equal(30, colour.blue);
+    zassert_equal(1, palette.stats.uploads);
+
+    /*  No index, no entry */
+    zassert_equal(-EINVAL, palette_apply(&palette, params, 3));
+}
+
+ZTEST(palette_test, pack_and_expand)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    uint8_t indices[PALETTE_MAX_PER_FRAME];
+    struct emitted emitted = {0};
+    size_t num_params;
+
+    for (size_t led = 0; led < PALETTE_MAX_PER_FRAME; ++led)
+    {
+        indices[led] = (uint8_t) (led + 3);
+    }
+
+    /*  A single LED is target and one value */
+    num_params = palette_pack(100, indices, 1, params);
+    zassert_equal(2, num_params);
+    zassert_equal(1, palette_expand(&palette, params, num_params, record, &emitted));
+    zassert_equal(100, emitted.targets[0]);
+    zassert_equal(3, emitted.colours[0].red);
+
+    /*  An odd count leaves the top half of the last value empty */
+    memset(&emitted, 0, sizeof(emitted));
+    num_params = palette_pack(7, indices, 5, params);
+    zassert_equal(2 + 3, num_params);
+    zassert_equal(5, palette_expand(&palette, params, num_params, record, &emitted));
+    for (size_t led = 0; led < 5; ++led)
+    {
+        zassert_equal(7 + led, emitted.targets[led]);
+        zassert_equal(led + 3, emitted.colours[led].red);
+    }
+
+    /*  A full frame */
+    memset(&emitted, 0, sizeof(emitted));
+    num_params = palette_pack(0, indices, PALETTE_MAX_PER_FRAME, params);
+    zassert_equal(PROTOCOL_MAX_PARAMS, num_params);
+    zassert_equal(PALETTE_MAX_PER_FRAME, palette_expand(&palette, params, num_params, record, &emitted));
+    zassert_equal(PALETTE_MAX_PER_FRAME + 2, emitted.colours[PALETTE_MAX_PER_FRAME - 1].red);
+
+    zassert_equal(0, palette_pack(0, indices, 0, params));
+    zassert_equal(0, palette_pack(0, indices, PALETTE_MAX_PER_FRAME + 1, params));
+}
+
+ZTEST(palette_test, expand_bad_input)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    uint8_t indices[] = {1, 2, 200, 4};
+    struct emitted emitted = {0};
+    size_t num_params = palette_pack(50, indices, ARRAY_SIZE(indices), params);
+
+    /*  Entry 200 was never uploaded, the LED is skipped */
+    zassert_equal(3, palette_expand(&palette, params, num_params, record, &emitted));
+    zassert_equal(53, emitted.targets[2]);
+    zassert_equal(1, palette.stats.misses);
+
+    /*  Count wants more values than were sent */
+    params[1].value = 6;
+    zassert_equal(-EINVAL, palette_expand(&palette, params, num_params, record, &emitted));
+
+    /*  No target */
+    zassert_equal(-EINVAL, palette_expand(&palette, params + 1, num_params - 1, record, &emitted));
+}
+
+ZTEST(palette_test, set_idx_survives_the_wire)
+{
+    struct protocol_pkt pkt = {.command = COMMAND_SET_IDX, .msg_num = 65535};
+    struct protocol_pkt rgb = {
+        .command = COMMAND_SET_RGB,
+        .params = {
+            {.key = KEY_RED, .value = 255},
+            {.key = KEY_GREEN, .value = 255},
+            {.key = KEY_BLUE, .value = 255},
+            {.key = KEY_TARGET, .value = 65535},
+        },
+        .num_params = 4,
+        .msg_num = 65535,
+    };
+    uint8_t indices[PALETTE_MAX_PER_FRAME];
+    struct parsed_data parsed = {0};
+    char frame[PROTOCOL_RECV_BUF_SIZE];
+    uint16_t msg_num = 0;
+    size_t len;
+
+    memset(indices, 255, sizeof(indices));
+    pkt.num_params = palette_pack(65535 - PALETTE_MAX_PER_FRAME, indices, PALETTE_MAX_PER_FRAME, pkt.params);
+
+    len = serialise_packet(&pkt, (uint8_t *) frame, sizeof(frame));
+    zassert_true(len > 0);
+    zassert_ok(parse(frame, len, &parsed, &msg_num));
+    zassert_equal(COMMAND_SET_IDX, parsed.command);
+    zassert_equal(pkt.num_params, parsed.num_params);
+    zassert_mem_equal(pkt.params, parsed.params, pkt.num_params * sizeof(pkt.params[0]));
+
+    /*  Twelve LEDs in less than three times the bytes of one */
+    zassert_true(len < 3 * serialise_packet(&rgb, (uint8_t *) frame, sizeof(frame)));
+}
+
+
+ZTEST_SUITE(palette_test, NULL, NULL, palette_before, NULL, NULL);
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <zephyr/ztest.h>
+#include <pbuf.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(pbuf_test, LOG_LEVEL_DBG);
+
+#define FRAME "!set_rgb,red:255,green:11,msg:15#53b5"
+#define FRAME_LEN (sizeof(FRAME) - 1)
+
+static void reset(void *fixture)
+{
+    pbuf_stats_reset();
+}
+
+ZTEST(pbuf_test, smallest_class)
+{
+    struct pbuf *small = pbuf_alloc(PBUF_SMALL_SIZE);
+    struct pbuf *medium = pbuf_alloc(PBUF_SMALL_SIZE + 1);
+    struct pbuf *large = pbuf_alloc(PBUF_MEDIUM_SIZE + 1);
+
+    zassert_not_null(small);
+    zassert_not_null(medium);
+    zassert_not_null(large);
+
+    zassert_equal(PBUF_SMALL_SIZE, small->size);
+    zassert_equal(PBUF_MEDIUM_SIZE, medium->size);
+    zassert_equal(PBUF_LARGE_SIZE, large->size);
+    zassert_equal(0, small->len);
+
+    /*  Nothing is that big */
+    zassert_is_null(pbuf_alloc(PBUF_LARGE_SIZE + 1));
+
+    pbuf_unref(small);
+    pbuf_unref(medium);
+    pbuf_unref(large);
+}
+
+ZTEST(pbuf_test, shared_without_copies)
+{
+    struct pbuf_stats stats;
+    struct pbuf *frame = pbuf_alloc(FRAME_LEN);
+
+    zassert_not_null(frame);
+    memcpy(frame->data, FRAME, FRAME_LEN);
+    frame->len = FRAME_LEN;
+
+    /*  Retransmit queue, TX path and a tap all hold the one buffer */
+    struct pbuf *tx = pbuf_ref(frame);
+    struct pbuf *tap = pbuf_ref(frame);
+
+    zassert_equal(frame, tx);
+    zassert_equal(frame, tap);
+    zassert_equal(3, pbuf_refs(frame));
+
+    /*  Released in any order, the buffer goes back with the last one */
+    pbuf_unref(tx);
+    pbuf_unref(frame);
+    pbuf_stats_get(&stats);
+    zassert_equal(1, stats.classes[1].in_use);
+    zassert_mem_equal(FRAME, tap->data, FRAME_LEN);
+
+    pbuf_unref(tap);
+    pbuf_stats_get(&stats);
+    zassert_equal(0, stats.classes[1].in_use);
+    zassert_equal(0, stats.bytes_copied);
+}
+
+ZTEST(pbuf_test, falls_back_to_larger_class)
+{
+    struct pbuf *small[PBUF_SMALL_COUNT];
+    struct pbuf_stats stats;
+
+    for (size_t i = 0; i < PBUF_SMALL_COUNT; ++i)
+    {
+        small[i] = pbuf_alloc(1);
+        zassert_not_null(small[i]);
+    }
+
+    /*  Small class is dry, a medium buffer does the job */
+    struct pbuf *spill = pbuf_alloc(1);
+
+    zassert_not_null(spill);
+    zassert_equal(PBUF_MEDIUM_SIZE, spill->size);
+
+    pbuf_stats_get(&stats);
+    zassert_equal(1, stats.classes[0].failures);
+    zassert_equal(PBUF_SMALL_COUNT, stats.classes[0].peak);
+
+    pbuf_unref(spill);
+    for (size_t i = 0; i < PBUF_SMALL_COUNT; ++i)
+    {
+        pbuf_unref(small[i]);
+    }
+
+    /*  And they all came back */
+    for (size_t i = 0; i < PBUF_SMALL_COUNT; ++i)
+    {
+        small[i] = pbuf_alloc(1);
+        zassert_equal(PBUF_SMALL_SIZE, small[i]->size);
+    }
+    for (size_t i = 0; i < PBUF_SMALL_COUNT; ++i)
+    {
+        pbuf_unref(small[i]);
+    }
+}
+
+ZTEST(pbuf_test, exhausted)
+{
+    struct pbuf *large[PBUF_LARGE_COUNT];
+
+    for (size_t i = 0; i < PBUF_LARGE_COUNT; ++i)
+    {
+        large[i] = pbuf_alloc(PBUF_LARGE_SIZE);
+        zassert_not_null(large[i]);
+    }
+
+    zassert_is_null(pbuf_alloc(PBUF_LARGE_SIZE));
+
+    for (size_t i = 0; i < PBUF_LARGE_COUNT; ++i)
+    {
+        pbuf_unref(large[i]);
+    }
+}
+
+ZTEST(pbuf_test, copies_counted)
+{
+    uint8_t out[64];
+    struct pbuf_stats stats;
+    struct pbuf *frame = pbuf_alloc_copy((const uint8_t *) FRAME, FRAME_LEN);
+
+    zassert_not_null(frame);
+    zassert_equal(FRAME_LEN, frame->len);
+
+    zassert_equal(FRAME_LEN, pbuf_copy_out(frame, out, sizeof(out)));
+    zassert_mem_equal(FRAME, out, FRAME_LEN);
+
+    /*  Doesn't fit, nothing copied */
+    zassert_equal(0, pbuf_copy_out(frame, out, FRAME_LEN - 1));
+
+    pbuf_stats_get(&stats);
+    zassert_equal(2 * FRAME_LEN, stats.bytes_copied);
+
+    pbuf_unref(frame);
+}
+
+ZTEST_SUITE(pbuf_test, NULL, NULL, reset, NULL, NULL);
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include <zephyr/ztest.h>
+#include <ping.h>
+#include <protocol.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(ping_test, LOG_LEVEL_DBG);
+
+ZTEST(ping_test, stamp_and_get)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    size_t num_params = 0;
+    uint32_t us;
+
+    ping_stamp(params, &num_params, PING_SENT, 0x12345678);
+    zassert_equal(2, num_params);
+    zassert_ok(ping_get(params, num_params, PING_SENT, &us));
+    zassert_equal(0x12345678, us);
+    zassert_equal(-ENOENT, ping_get(params, num_params, PING_RECEIVED, &us));
+
+    /*  Stamping again overwrites rather than adding */
+    ping_stamp(params, &num_params, PING_SENT, 7);
+    zassert_equal(2, num_params);
+    zassert_ok(ping_get(params, num_params, PING_SENT, &us));
+    zassert_equal(7, us);
+
+    for (int stamp = PING_RECEIVED; stamp < PING_NUM_STAMPS; ++stamp)
+    {
+        ping_stamp(params, &num_params, stamp, UINT32_MAX - stamp);
+    }
+    zassert_equal(2 * PING_NUM_STAMPS, num_params);
+    zassert_ok(ping_get(params, num_params, PING_ECHOED, &us));
+    zassert_equal(UINT32_MAX - PING_ECHOED, us);
+}
+
+ZTEST(ping_test, sample)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    size_t num_params = 0;
+    struct ping_sample sample;
+
+    /*  Host and dongle clocks nowhere near each other */
+    ping_stamp(params, &num_params, PING_SENT, 1000000);
+    zassert_equal(-ENOENT, ping_sample(params, num_params, 1000000, &sample));
+
+    ping_stamp(params, &num_params, PING_RECEIVED, 50000);
+    ping_stamp(params, &num_params, PING_FORWARDED, 50100);
+    ping_stamp(params, &num_params, PING_ECHOED, 65100);
+
+    zassert_ok(ping_sample(params, num_params, 1000000 + 16100, &sample));
+    zassert_equal(16100, sample.rtt_us);
+    zassert_equal(100, sample.dongle_us);
+    zassert_equal(15000, sample.peer_rtt_us);
+    zassert_equal(1000, sample.usb_rtt_us);
+}
+
+ZTEST(ping_test, sample_across_wrap)
+{
+    struct key_val_pair params[PROTOCOL_MAX_PARAMS];
+    size_t num_params = 0;
+    struct ping_sample sample;
+
+    ping_stamp(params, &num_params, PING_SENT, UINT32_MAX - 499);
+    ping_stamp(params, &num_params, PING_RECEIVED, UINT32_MAX - 99);
+    ping_stamp(params, &num_params, PING_FORWARDED, 100);
+    ping_stamp(params, &num_params, PING_ECHOED, 100);
+
+    zassert_ok(ping_sample(params, num_params, 700, &sample));
+    zassert_equal(1200, sample.rtt_us);
+    zassert_equal(200, sample.dongle_us);
+    zassert_equal(0, sample.peer_rtt_us);
+    zassert_equal(1000, sample.usb_rtt_us);
+}
+
+ZTEST(ping_test, pong_survives_the_wire)
+{
+    struct protocol_pkt pkt = {.command = COMMAND_PONG, .msg_num = 65534};
+    struct parsed_data parsed = {0};
+    char frame[PROTOCOL_RECV_BUF_SIZE];
+    uint16_t msg_num = 0;
+    uint32_t us;
+    size_t len;
+
+    /*  Every stamp at its longest */
+    for (int stamp = 0; stamp < PING_NUM_STAMPS; ++stamp)
+    {
+        ping_stamp(pkt.params, &pkt.num_params, stamp, 0xfffefffd - stamp);
+    }
+
+    len = serialise_packet(&pkt, (uint8_t *) frame, sizeof(frame));
+    zassert_true(len > 0);
+    zassert_ok(parse(frame, len, &parsed, &msg_num));
+    zassert_equal(COMMAND_PONG, parsed.command);
+    zassert_equal(2 * PING_NUM_STAMPS, parsed.num_params);
+
+    for (int stamp = 0; stamp < PING_NUM_STAMPS; ++stamp)
+    {
+        zassert_ok(ping_get(parsed.params, parsed.num_params, stamp, &us));
+        zassert_equal(0xfffefffd - stamp, us);
+    }
+}
+
+ZTEST(ping_test, ping_is_acked)
+{
+    static struct protocol_ctx ctx;
+    static os_timer_t timer;
+    struct protocol_pkt pkt = {.command = COMMAND_PING, .msg_num = 42};
+    struct parsed_data parsed = {0};
+    uint8_t frame[PROTOCOL_RECV_BUF_SIZE];
+    uint8_t reply[64];
+    size_t len;
+
+    ping_stamp(pkt.params, &pkt.num_params, PING_SENT, 12345);
+    len = serialise_packet(&pkt, frame, sizeof(frame));
+
+    protocol_init(&ctx, frame, len, &timer);
+    ctx.rx_len = len;
+    handle_incoming(&ctx, &parsed);
+    zassert_equal(COMMAND_PING, parsed.command);
+
+    len = protocol_tx(&ctx, reply, sizeof(reply));
+    zassert_true(len > 0);
+    zassert_mem_equal("!ack,msg:42#", reply, 12);
+}
+
+
+ZTEST_SUITE(ping_test, NULL, NULL, NULL, NULL, NULL);
\ No newline at end of file
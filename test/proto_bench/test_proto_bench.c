@@ -0,0 +1,67 @@
+#include <zephyr/ztest.h>
+#include <proto_bench.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(proto_bench_test, LOG_LEVEL_DBG);
+
+static struct proto_bench bench;
+
+ZTEST(proto_bench_test, op_names)
+{
+    for (int op = 0; op < PROTO_BENCH_NUM_OPS; ++op)
+    {
+        zassert_equal(op, proto_bench_op_from_string(proto_bench_op_name(op)));
+    }
+    zassert_equal(-EINVAL, proto_bench_op_from_string("fft"));
+    zassert_is_null(proto_bench_op_name(PROTO_BENCH_NUM_OPS));
+    zassert_equal(-EINVAL, proto_bench_prepare(&bench, PROTO_BENCH_NUM_OPS));
+}
+
+ZTEST(proto_bench_test, frame_is_real)
+{
+    struct parsed_data parsed = {0};
+    uint16_t msg_num = 0;
+    char frame[PROTOCOL_RECV_BUF_SIZE + 1];
+
+    zassert_ok(proto_bench_prepare(&bench, PROTO_BENCH_PARSE));
+    zassert_true(bench.len > 0);
+
+    /*  What parse is timed on has to be a frame it accepts */
+    memcpy(frame, bench.frame, bench.len + 1);
+    zassert_ok(parse(frame, bench.len, &parsed, &msg_num));
+    zassert_equal(COMMAND_SET_RGB, parsed.command);
+    zassert_equal(48913, msg_num);
+}
+
+ZTEST(proto_bench_test, every_op_runs)
+{
+    for (int op = 0; op < PROTO_BENCH_NUM_OPS; ++op)
+    {
+        zassert_ok(proto_bench_prepare(&bench, op));
+        zassert_ok(proto_bench_run(&bench, 100), "%s failed", proto_bench_op_name(op));
+    }
+}
+
+ZTEST(proto_bench_test, roundtrip_returns_everything)
+{
+    struct pbuf_stats pbufs;
+
+    zassert_ok(proto_bench_prepare(&bench, PROTO_BENCH_ROUNDTRIP));
+
+    /*  Many more roundtrips than there are packets or frames, so a
+        leak in either would run the pool dry */
+    zassert_ok(proto_bench_run(&bench, 10 * PROTOCOL_MAX_IN_FLIGHT * PBUF_SMALL_COUNT));
+    zassert_false(bench.sender.awaiting_ack);
+
+    pbuf_stats_get(&pbufs);
+    for (size_t index = 0; index < ARRAY_SIZE(pbufs.classes); ++index)
+    {
+        zassert_equal(0, pbufs.classes[index].in_use);
+    }
+}
+
+
+ZTEST_SUITE(proto_bench_test, NULL, NULL, NULL, NULL, NULL);
\ No newline at end of file
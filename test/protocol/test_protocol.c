@@ -3,16 +3,18 @@
 #include <zephyr/logging/log.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <zephyr/kernel.h>
 
 
 LOG_MODULE_REGISTER(protocol_test, LOG_LEVEL_DBG);
 
 
-static timer_t test_timer;
+static os_timer_t test_timer;
 static bool timer_expired = false;
 
-static void timer_expiry(timer_t timer)
+static void timer_expiry(os_timer_t timer)
 {
     timer_expired = true;
 }
@@ -40,6 +42,56 @@ ZTEST(protocol_test, serialise_pkt)
     zassert_equal(strlen(expected), written);
 }
 
+ZTEST(protocol_test, serialise_matches_generic)
+{
+    struct protocol_pkt pkts[] = {
+        {
+            .command = COMMAND_SET_RGB,
+            .params = {{KEY_RED, 0}, {KEY_GREEN, 9}, {KEY_BLUE, 10}, {KEY_TARGET, 65535}},
+            .num_params = 4,
+            .msg_num = 0,
+        },
+        {
+            .command = COMMAND_EFFECT,
+            .params = {{KEY_EFFECT, 1}, {KEY_DURATION, 1000}, {KEY_EASING, 0}, {KEY_COUNT, 3}, {KEY_RED, 99}},
+            .num_params = 5,
+            .msg_num = 12345,
+        },
+        {.command = COMMAND_ACK, .msg_num = 7},
+        {.command = COMMAND_NACK, .msg_num = 65535},
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(pkts); ++i)
+    {
+        uint8_t generic[256] = {0};
+        uint8_t schema[256] = {0};
+        size_t generic_len = serialise_packet_generic(&pkts[i], generic, sizeof(generic));
+        size_t schema_len = serialise_packet(&pkts[i], schema, sizeof(schema));
+
+        zassert_equal(generic_len, schema_len, "pkt %d", (int) i);
+        zassert_mem_equal(generic, schema, generic_len, "pkt %d", (int) i);
+    }
+}
+
+ZTEST(protocol_test, serialise_rejects)
+{
+    uint8_t buf[256];
+    struct protocol_pkt pkt = {
+        .command = COMMAND_SET_RGB,
+        .params = {{KEY_RED, 255}, {KEY_GREEN, 11}},
+        .num_params = 2,
+        .msg_num = 15,
+    };
+
+    /* Exactly "!set_rgb,red:255,green:11,msg:15#53b5" fits, one less doesn't */
+    zassert_equal(37, serialise_packet(&pkt, buf, 37));
+    zassert_equal(0, serialise_packet(&pkt, buf, 36));
+
+    /* Key the command doesn't take */
+    pkt.params[1].key = KEY_DURATION;
+    zassert_equal(0, serialise_packet(&pkt, buf, sizeof(buf)));
+}
+
 ZTEST(protocol_test, parse_pkt)
 {
     uint8_t stream[] = "!set_rgb,red:1,green:2,blue:3#463d";
@@ -89,15 +141,66 @@ ZTEST(protocol_test, handle_incoming_data)
     struct parsed_data parsed = {0};
 
     struct protocol_ctx ctx;
-    timer_t timer;
+    os_timer_t timer;
     protocol_init(&ctx, buffer, ARRAY_SIZE(buffer), &timer);
 
     handle_incoming(&ctx, &parsed);
 
     zassert_equal(COMMAND_SET_RGB, parsed.command);
-    zassert_equal(3, parsed.num_params);
     zassert_equal(COMMAND_ACK, ctx.to_send->command);
     zassert_equal(48913, ctx.to_send->msg_num);
+
+    /*  The params wait until someone asks for them */
+    zassert_equal(0, parsed.num_params);
+    zassert_equal(PARSER_OK, parsed_data_decode(&parsed));
+    zassert_equal(3, parsed.num_params);
+    zassert_equal(KEY_GREEN, parsed.params[0].key);
+    zassert_equal(244, parsed.params[0].value);
+}
+
+ZTEST(protocol_test, parse_header_only)
+{
+    char last[] = "!set_rgb,green:244,red:0,blue:0,msg:48913#a820";
+    char first[] = "!set_rgb,msg:77,red:1#6b47";
+    char missing[] = "!set_rgb,red:1#d2c2";
+    struct parsed_data parsed = {0};
+
+    zassert_equal(PARSER_OK, parse_header(last, strlen(last), &parsed));
+    zassert_equal(COMMAND_SET_RGB, parsed.command);
+    zassert_equal(48913, parsed.msg_num);
+    zassert_equal(0, parsed.num_params);
+    zassert_equal(&last[9], parsed.body);
+
+    /*  Not where the serialisers put it, but still found */
+    zassert_equal(PARSER_OK, parse_header(first, strlen(first), &parsed));
+    zassert_equal(77, parsed.msg_num);
+    zassert_equal(PARSER_OK, parsed_data_decode(&parsed));
+    zassert_equal(1, parsed.num_params);
+    zassert_equal(KEY_RED, parsed.params[0].key);
+
+    zassert_equal(-1, parse_header(missing, strlen(missing), &parsed));
+}
+
+ZTEST(protocol_test, invalid_params_acked_then_reported)
+{
+    uint8_t buffer[] = "!set_rgb,red:999,msg:12#a7a1";
+    struct parsed_data parsed = {0};
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+
+    protocol_init(&ctx, buffer, ARRAY_SIZE(buffer), &timer);
+    handle_incoming(&ctx, &parsed);
+
+    /*  The header is fine, so the frame arrived and is acknowledged */
+    zassert_equal(COMMAND_ACK, ctx.to_send->command);
+    zassert_equal(12, ctx.to_send->msg_num);
+
+    zassert_equal(PARSER_INVALID_PARAMS, parsed_data_decode(&parsed));
+    zassert_equal(0, parsed.num_params);
+
+    /*  Decoding again gives the same answer without redoing it */
+    zassert_is_null(parsed.body);
+    zassert_equal(PARSER_INVALID_PARAMS, parsed_data_decode(&parsed));
 }
 
 
@@ -107,7 +210,7 @@ ZTEST(protocol_test, handle_incoming_nack)
     struct parsed_data parsed = {0};
 
     struct protocol_ctx ctx;
-    timer_t timer;
+    os_timer_t timer;
     protocol_init(&ctx, buffer, ARRAY_SIZE(buffer), &timer);
 
     struct protocol_pkt pkt = {
@@ -128,7 +231,7 @@ ZTEST(protocol_test, testing)
     timer_expired = false;
 
     struct protocol_ctx ctx;
-    timer_t timer;
+    os_timer_t timer;
     protocol_init(&ctx, buffer, ARRAY_SIZE(buffer), &timer);
 
     handle_incoming(&ctx, &parsed);
@@ -137,4 +240,736 @@ ZTEST(protocol_test, testing)
     zassert_equal(COMMAND_NACK, ctx.to_send->command);
 }
 
+static int timeout_events;
+
+static void count_events(protocol_ctx_t ctx, protocol_event_t event, void *user_data)
+{
+    if (event == PROTOCOL_EVENT_TIMEOUT)
+    {
+        timeout_events++;
+    }
+}
+
+ZTEST(protocol_test, tx_ack_released)
+{
+    uint8_t buffer[] = "!set_rgb,green:244,red:0,blue:0,msg:48913#a820";
+    uint8_t out[PROTOCOL_RECV_BUF_SIZE] = {0};
+    struct parsed_data parsed = {0};
+
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    protocol_init(&ctx, buffer, ARRAY_SIZE(buffer), &timer);
+
+    handle_incoming(&ctx, &parsed);
+
+    size_t len = protocol_tx(&ctx, out, sizeof(out));
+    zassert_equal(strlen("!ack,msg:48913#xxxx"), len);
+    zassert_mem_equal("!ack,msg:48913#", out, strlen("!ack,msg:48913#"));
+
+    /*  Nothing comes back for an ACK, so it is not kept */
+    zassert_is_null(ctx.to_send);
+    zassert_false(ctx.awaiting_ack);
+    zassert_equal(0, protocol_tx(&ctx, out, sizeof(out)));
+}
+
+ZTEST(protocol_test, timer_only_posts_event)
+{
+    uint8_t out[PROTOCOL_RECV_BUF_SIZE];
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 10}};
+
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    protocol_init(&ctx, NULL, 0, &timer);
+    protocol_set_event_cb(&ctx, count_events, NULL);
+    timeout_events = 0;
+
+    ctx.to_send = protocol_packet_create(COMMAND_SET_RGB, params, 1, 1234);
+    zassert_not_null(ctx.to_send);
+    zassert_true(protocol_tx(&ctx, out, sizeof(out)) > 0);
+    zassert_true(ctx.awaiting_ack);
+
+    /*  Nothing to send until the ACK or a timeout */
+    zassert_equal(0, protocol_tx(&ctx, out, sizeof(out)));
+
+    k_msleep(150);
+
+    /*  The timer ISR must not touch the ARQ state itself */
+    zassert_true(timeout_events > 0);
+    zassert_false(ctx.to_send->resend);
+    zassert_equal(0, ctx.retry_attempts);
+
+    protocol_timeout(&ctx);
+    zassert_true(ctx.to_send->resend);
+    zassert_equal(1, ctx.retry_attempts);
+    zassert_true(protocol_tx(&ctx, out, sizeof(out)) > 0);
+
+    timer_stop(&timer);
+    for (uint8_t retry = 1; retry < PROTOCOL_MAX_MSG_RETRIES; ++retry)
+    {
+        protocol_timeout(&ctx);
+    }
+    zassert_not_null(ctx.to_send);
+    zassert_equal(PROTOCOL_MAX_MSG_RETRIES, ctx.retry_attempts);
+
+    /*  Out of retries */
+    protocol_timeout(&ctx);
+    zassert_is_null(ctx.to_send);
+    zassert_false(ctx.awaiting_ack);
+}
+
+ZTEST(protocol_test, late_timeout_ignored)
+{
+    uint8_t out[PROTOCOL_RECV_BUF_SIZE];
+    uint8_t ack[] = "!ack,msg:4321#0000";
+    struct parsed_data parsed = {0};
+
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    protocol_init(&ctx, ack, ARRAY_SIZE(ack), &timer);
+
+    ctx.to_send = protocol_packet_create(COMMAND_SET_RGB, NULL, 0, 4321);
+    protocol_tx(&ctx, out, sizeof(out));
+
+    /*  Fix up the CRC so the ACK parses */
+    crc_t crc = crc16_ccitt(PROTOCOL_CRC_POLY, ack, strlen("!ack,msg:4321#"));
+    snprintf((char *) ack + strlen("!ack,msg:4321#"), 5, "%04x", crc);
+
+    handle_incoming(&ctx, &parsed);
+    zassert_is_null(ctx.to_send);
+
+    /*  A timeout posted before the ACK arrived is harmless */
+    protocol_timeout(&ctx);
+    zassert_is_null(ctx.to_send);
+}
+
+ZTEST(protocol_test, retransmit_shares_buffer)
+{
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 10}};
+    uint8_t ack[] = "!ack,msg:1234#xxxx";
+    struct pbuf_stats stats;
+
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    protocol_init(&ctx, NULL, 0, &timer);
+    pbuf_stats_reset();
+
+    ctx.to_send = protocol_packet_create(COMMAND_SET_RGB, params, 1, 1234);
+    struct pbuf *first = protocol_tx_pbuf(&ctx);
+    zassert_not_null(first);
+
+    /*  The context keeps its own reference for retransmission */
+    zassert_equal(2, pbuf_refs(first));
+
+    /*  A retransmission sends the very same bytes, nothing is
+        serialised or copied again */
+    protocol_timeout(&ctx);
+    struct pbuf *second = protocol_tx_pbuf(&ctx);
+    zassert_equal(first, second);
+    zassert_equal(3, pbuf_refs(first));
+
+    /*  The ACK drops the context's reference, the TX path still has its own */
+    struct parsed_data parsed = {0};
+    uint16_t crc = os_crc16_ccitt(PROTOCOL_CRC_POLY, ack, strlen("!ack,msg:1234#"));
+    snprintf((char *) ack + strlen("!ack,msg:1234#"), 5, "%04x", crc);
+    ctx.rx_buf = ack;
+    ctx.rx_len = sizeof(ack);
+    handle_incoming(&ctx, &parsed);
+    zassert_is_null(ctx.to_send_buf);
+    zassert_equal(2, pbuf_refs(first));
+
+    pbuf_unref(first);
+    pbuf_unref(second);
+
+    pbuf_stats_get(&stats);
+    zassert_equal(0, stats.bytes_copied);
+    zassert_equal(0, stats.classes[1].in_use);
+}
+
+#define SUBMIT_PRODUCERS 3
+#define SUBMITS_PER_PRODUCER 40
+#define SUBMIT_STACK_SIZE 1024
+
+static struct protocol_ctx submit_ctx;
+static struct k_thread submit_threads[SUBMIT_PRODUCERS];
+static uint32_t submit_cycles[SUBMIT_PRODUCERS];
+static uint32_t submit_retries[SUBMIT_PRODUCERS];
+static os_atomic_t submit_events;
+K_THREAD_STACK_ARRAY_DEFINE(submit_stacks, SUBMIT_PRODUCERS, SUBMIT_STACK_SIZE);
+
+static void count_submits(protocol_ctx_t ctx, protocol_event_t event, void *user_data)
+{
+    if (event == PROTOCOL_EVENT_SUBMIT)
+    {
+        os_atomic_inc(&submit_events);
+    }
+}
+
+static void submitter(void *p1, void *p2, void *p3)
+{
+    uint32_t id = (uint32_t) (uintptr_t) p1;
+    uint32_t start = k_cycle_get_32();
+
+    for (uint16_t seq = 0; seq < SUBMITS_PER_PRODUCER; ++seq)
+    {
+        struct key_val_pair params[] = {
+            {.key = KEY_RED, .value = seq},
+            {.key = KEY_BLUE, .value = id},
+        };
+
+        /*  Packets come back as the owner gets its ACKs */
+        while (protocol_submit(&submit_ctx, COMMAND_SET_RGB, params, ARRAY_SIZE(params)) == -ENOMEM)
+        {
+            submit_retries[id]++;
+            k_msleep(1);
+        }
+    }
+
+    submit_cycles[id] = k_cycle_get_32() - start;
+}
+
+static void ack_packet(protocol_ctx_t ctx, uint16_t msg_num)
+{
+    uint8_t ack[32];
+    struct parsed_data parsed = {0};
+    int len = snprintf((char *) ack, sizeof(ack), "!ack,msg:%u#", msg_num);
+    uint16_t crc = os_crc16_ccitt(PROTOCOL_CRC_POLY, ack, len);
+
+    snprintf((char *) ack + len, sizeof(ack) - len, "%04x", crc);
+    ctx->rx_buf = ack;
+    ctx->rx_len = len + 4;
+    handle_incoming(ctx, &parsed);
+}
+
+ZTEST(protocol_test, submit_rejects)
+{
+    struct key_val_pair bad[] = {{.key = KEY_RED, .value = 256}};
+    os_timer_t timer;
+
+    protocol_init(&submit_ctx, NULL, 0, &timer);
+
+    zassert_equal(-EINVAL, protocol_submit(&submit_ctx, COMMAND_SET_RGB, bad, 1));
+    zassert_equal(-EINVAL, protocol_submit(&submit_ctx, COMMAND_ACK, NULL, 0));
+    zassert_equal(-EINVAL, protocol_submit(&submit_ctx, COMMAND_INVALID, NULL, 0));
+    zassert_is_null(protocol_tx_pbuf(&submit_ctx));
+}
+
+ZTEST(protocol_test, submit_from_threads)
+{
+    uint16_t next_seq[SUBMIT_PRODUCERS] = {0};
+    uint32_t sent = 0;
+    os_timer_t timer;
+
+    protocol_init(&submit_ctx, NULL, 0, &timer);
+    protocol_set_event_cb(&submit_ctx, count_submits, NULL);
+    os_atomic_set(&submit_events, 0);
+
+    for (uint32_t id = 0; id < SUBMIT_PRODUCERS; ++id)
+    {
+        submit_retries[id] = 0;
+        k_thread_create(&submit_threads[id], submit_stacks[id],
+                        K_THREAD_STACK_SIZEOF(submit_stacks[id]),
+                        submitter, (void *) (uintptr_t) id, NULL, NULL,
+                        K_PRIO_PREEMPT(1), 0, K_NO_WAIT);
+    }
+
+    /*  Play the owning thread: send whatever is next and ACK it straight
+        away. Each producer's packets must come out in order, and all of
+        them must come out */
+    while (sent < SUBMIT_PRODUCERS * SUBMITS_PER_PRODUCER)
+    {
+        struct pbuf *frame = protocol_tx_pbuf(&submit_ctx);
+
+        if (frame == NULL)
+        {
+            k_msleep(1);
+            continue;
+        }
+
+        pkt_t pkt = submit_ctx.to_send;
+        zassert_not_null(pkt);
+        zassert_equal(COMMAND_SET_RGB, pkt->command);
+
+        uint16_t id = pkt->params[1].value;
+        zassert_true(id < SUBMIT_PRODUCERS);
+        zassert_equal(next_seq[id], pkt->params[0].value);
+        next_seq[id]++;
+        sent++;
+
+        ack_packet(&submit_ctx, pkt->msg_num);
+        zassert_is_null(submit_ctx.to_send);
+        pbuf_unref(frame);
+    }
+
+    for (uint32_t id = 0; id < SUBMIT_PRODUCERS; ++id)
+    {
+        k_thread_join(&submit_threads[id], K_FOREVER);
+        TC_PRINT("submitter %u: %u packets in %u us, %u retries on a full pool\n",
+                 id, SUBMITS_PER_PRODUCER,
+                 (uint32_t) (k_cyc_to_ns_floor64(submit_cycles[id]) / 1000),
+                 submit_retries[id]);
+    }
+
+    zassert_equal(SUBMIT_PRODUCERS * SUBMITS_PER_PRODUCER, os_atomic_get(&submit_events));
+    zassert_is_null(protocol_tx_pbuf(&submit_ctx));
+}
+
+static uint16_t next_red(protocol_ctx_t ctx)
+{
+    struct pbuf *frame = protocol_tx_pbuf(ctx);
+    uint16_t red;
+
+    zassert_not_null(frame);
+    red = ctx->to_send->params[0].value;
+    ack_packet(ctx, ctx->to_send->msg_num);
+    pbuf_unref(frame);
+
+    return red;
+}
+
+ZTEST(protocol_test, urgent_jumps_queue)
+{
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 0}};
+    os_timer_t timer;
+
+    protocol_init(&submit_ctx, NULL, 0, &timer);
+
+    params[0].value = 1;
+    zassert_true(protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_PRIO_BULK, PROTOCOL_TTL_NONE) >= 0);
+    params[0].value = 2;
+    zassert_true(protocol_submit(&submit_ctx, COMMAND_SET_RGB, params, 1) >= 0);
+    params[0].value = 3;
+    zassert_true(protocol_submit(&submit_ctx, COMMAND_SET_RGB, params, 1) >= 0);
+    params[0].value = 4;
+    zassert_true(protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_PRIO_URGENT, PROTOCOL_TTL_NONE) >= 0);
+
+    /*  Urgent first, bulk last, submission order within a class */
+    zassert_equal(4, next_red(&submit_ctx));
+    zassert_equal(2, next_red(&submit_ctx));
+    zassert_equal(3, next_red(&submit_ctx));
+    zassert_equal(1, next_red(&submit_ctx));
+    zassert_is_null(protocol_tx_pbuf(&submit_ctx));
+
+    zassert_equal(-EINVAL, protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_NUM_PRIOS, PROTOCOL_TTL_NONE));
+}
+
+ZTEST(protocol_test, urgent_retries_until_acked)
+{
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 0}};
+    os_timer_t timer;
+
+    protocol_init(&submit_ctx, NULL, 0, &timer);
+
+    int msg_num = protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_PRIO_URGENT, PROTOCOL_TTL_NONE);
+    zassert_true(msg_num >= 0);
+
+    for (int retry = 0; retry < 4 * PROTOCOL_MAX_MSG_RETRIES; ++retry)
+    {
+        struct pbuf *frame = protocol_tx_pbuf(&submit_ctx);
+
+        zassert_not_null(frame);
+        pbuf_unref(frame);
+        protocol_timeout(&submit_ctx);
+    }
+    timer_stop(&timer);
+
+    zassert_not_null(submit_ctx.to_send);
+    zassert_equal(0, submit_ctx.gave_up);
+
+    ack_packet(&submit_ctx, msg_num);
+    zassert_is_null(submit_ctx.to_send);
+}
+
+ZTEST(protocol_test, bulk_gives_up_early)
+{
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 0}};
+    struct pbuf *frame;
+    os_timer_t timer;
+
+    protocol_init(&submit_ctx, NULL, 0, &timer);
+
+    zassert_true(protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_PRIO_BULK, PROTOCOL_TTL_NONE) >= 0);
+
+    frame = protocol_tx_pbuf(&submit_ctx);
+    pbuf_unref(frame);
+    protocol_timeout(&submit_ctx);
+    frame = protocol_tx_pbuf(&submit_ctx);
+    zassert_not_null(frame);
+    pbuf_unref(frame);
+
+    /*  One retry and it's gone */
+    protocol_timeout(&submit_ctx);
+    timer_stop(&timer);
+    zassert_is_null(submit_ctx.to_send);
+    zassert_equal(1, submit_ctx.gave_up);
+}
+
+ZTEST(protocol_test, ttl_drops_stale)
+{
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = 0}};
+    struct pbuf *frame;
+    os_timer_t timer;
+
+    protocol_init(&submit_ctx, NULL, 0, &timer);
+
+    /*  Stale before it ever got its turn */
+    params[0].value = 1;
+    zassert_true(protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_PRIO_NORMAL, 20) >= 0);
+    params[0].value = 2;
+    zassert_true(protocol_submit(&submit_ctx, COMMAND_SET_RGB, params, 1) >= 0);
+    k_msleep(30);
+
+    zassert_equal(2, next_red(&submit_ctx));
+    zassert_equal(1, submit_ctx.expired);
+
+    /*  Stale while waiting for its ACK, it isn't retried */
+    zassert_true(protocol_submit_qos(&submit_ctx, COMMAND_SET_RGB, params, 1, PROTOCOL_PRIO_NORMAL, 20) >= 0);
+    frame = protocol_tx_pbuf(&submit_ctx);
+    zassert_not_null(frame);
+    pbuf_unref(frame);
+    timer_stop(&timer);
+    k_msleep(30);
+
+    protocol_timeout(&submit_ctx);
+    zassert_is_null(submit_ctx.to_send);
+    zassert_equal(2, submit_ctx.expired);
+    zassert_equal(0, submit_ctx.gave_up);
+    zassert_is_null(protocol_tx_pbuf(&submit_ctx));
+}
+
+static struct timer_wheel ack_wheel;
+static int wheel_timeouts;
+
+static void count_wheel_timeouts(protocol_ctx_t ctx, protocol_event_t event, void *user_data)
+{
+    if (event == PROTOCOL_EVENT_TIMEOUT)
+    {
+        wheel_timeouts++;
+    }
+}
+
+static void unordered_init(protocol_ctx_t ctx, os_timer_t *timer, command_delivery_t delivery)
+{
+    protocol_init(ctx, NULL, 0, timer);
+    timer_wheel_init(&ack_wheel, NULL, TIMER_MSEC(1));
+    protocol_set_delivery(ctx, &ack_wheel, delivery);
+    protocol_set_event_cb(ctx, count_wheel_timeouts, NULL);
+    wheel_timeouts = 0;
+}
+
+static int submit_red(protocol_ctx_t ctx, uint16_t red)
+{
+    struct key_val_pair params[] = {{.key = KEY_RED, .value = red}};
+
+    return protocol_submit(ctx, COMMAND_SET_RGB, params, 1);
+}
+
+/*  Send whatever is ready, return the message numbers in order */
+static size_t drain_tx(protocol_ctx_t ctx, uint16_t *msg_nums, size_t max)
+{
+    struct pbuf *frame;
+    size_t count = 0;
+
+    while ((frame = protocol_tx_pbuf(ctx)) != NULL)
+    {
+        char text[PBUF_MEDIUM_SIZE + 1] = {0};
+        char *msg = NULL;
+
+        memcpy(text, frame->data, MIN(frame->len, PBUF_MEDIUM_SIZE));
+        msg = strstr(text, "msg:");
+        zassert_not_null(msg);
+        zassert_true(count < max);
+        msg_nums[count++] = (uint16_t) strtoul(msg + 4, NULL, 10);
+        pbuf_unref(frame);
+    }
+
+    return count;
+}
+
+ZTEST(protocol_test, unordered_overlaps)
+{
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    uint16_t sent[PROTOCOL_MAX_IN_FLIGHT];
+    int msg[3];
+
+    unordered_init(&ctx, &timer, COMMAND_DELIVERY_UNORDERED);
+
+    for (int index = 0; index < 3; ++index)
+    {
+        msg[index] = submit_red(&ctx, index);
+        zassert_true(msg[index] >= 0);
+    }
+
+    /*  All three go without waiting on each other */
+    zassert_equal(3, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(msg[0], sent[0]);
+    zassert_equal(msg[2], sent[2]);
+
+    /*  The middle one is acknowledged, the others time out and are
+        retransmitted on their own */
+    ack_packet(&ctx, msg[1]);
+    timer_wheel_advance(&ack_wheel, 100);
+    zassert_equal(2, wheel_timeouts);
+    protocol_timeout(&ctx);
+
+    zassert_equal(2, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(msg[0], sent[0]);
+    zassert_equal(msg[2], sent[1]);
+
+    ack_packet(&ctx, msg[0]);
+    ack_packet(&ctx, msg[2]);
+    zassert_equal(0, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(0, ack_wheel.num_active);
+}
+
+ZTEST(protocol_test, unordered_keeps_ordered_commands_in_order)
+{
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    uint16_t sent[PROTOCOL_MAX_IN_FLIGHT];
+
+    unordered_init(&ctx, &timer, COMMAND_DELIVERY_UNORDERED);
+
+    int first = protocol_submit(&ctx, COMMAND_EFFECT, NULL, 0);
+    int second = protocol_submit(&ctx, COMMAND_EFFECT, NULL, 0);
+    int colour = submit_red(&ctx, 1);
+
+    /*  The colour overtakes the second effect, which waits for the first */
+    zassert_equal(2, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(first, sent[0]);
+    zassert_equal(colour, sent[1]);
+
+    ack_packet(&ctx, colour);
+    zassert_equal(0, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+
+    ack_packet(&ctx, first);
+    zassert_equal(1, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(second, sent[0]);
+    ack_packet(&ctx, second);
+}
+
+ZTEST(protocol_test, wheel_ordered_is_stop_and_wait)
+{
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    uint16_t sent[PROTOCOL_MAX_IN_FLIGHT];
+
+    unordered_init(&ctx, &timer, COMMAND_DELIVERY_ORDERED);
+
+    int first = submit_red(&ctx, 1);
+    int second = submit_red(&ctx, 2);
+
+    zassert_equal(1, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(first, sent[0]);
+
+    ack_packet(&ctx, first);
+    zassert_equal(1, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(second, sent[0]);
+    ack_packet(&ctx, second);
+}
+
+ZTEST(protocol_test, unordered_acks_not_dropped)
+{
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    uint16_t sent[PROTOCOL_MAX_IN_FLIGHT];
+    struct protocol_pkt incoming = {
+        .command = COMMAND_SET_RGB,
+        .params = {{.key = KEY_RED, .value = 5}},
+        .num_params = 1,
+    };
+    uint8_t frame[PROTOCOL_RECV_BUF_SIZE];
+    struct parsed_data parsed = {0};
+
+    unordered_init(&ctx, &timer, COMMAND_DELIVERY_UNORDERED);
+
+    int msg = submit_red(&ctx, 1);
+    zassert_equal(1, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+
+    /*  Two frames from the peer while ours is waiting for its ACK. Both
+        get their ACK rather than the second being dropped */
+    for (uint16_t num = 100; num < 102; ++num)
+    {
+        incoming.msg_num = num;
+        ctx.rx_len = serialise_packet(&incoming, frame, sizeof(frame) - 1);
+        frame[ctx.rx_len] = '\0';
+        ctx.rx_buf = frame;
+        handle_incoming(&ctx, &parsed);
+    }
+
+    zassert_equal(2, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(100, sent[0]);
+    zassert_equal(101, sent[1]);
+
+    ack_packet(&ctx, msg);
+    zassert_equal(0, ack_wheel.num_active);
+}
+
+ZTEST(protocol_test, data_with_our_msg_num_keeps_packet)
+{
+    struct protocol_ctx ctx;
+    os_timer_t timer;
+    uint16_t sent[PROTOCOL_MAX_IN_FLIGHT];
+    struct protocol_pkt incoming = {
+        .command = COMMAND_PALETTE,
+        .params = {{.key = KEY_INDEX, .value = 3}},
+        .num_params = 1,
+    };
+    uint8_t frame[PROTOCOL_RECV_BUF_SIZE];
+    struct parsed_data parsed = {0};
+
+    unordered_init(&ctx, &timer, COMMAND_DELIVERY_UNORDERED);
+
+    int msg = submit_red(&ctx, 1);
+    zassert_equal(1, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+
+    /*  The peer happens to pick the same msg number for a frame of its
+        own. That is not an ACK, ours stays in flight */
+    incoming.msg_num = (uint16_t) msg;
+    ctx.rx_len = serialise_packet(&incoming, frame, sizeof(frame) - 1);
+    frame[ctx.rx_len] = '\0';
+    ctx.rx_buf = frame;
+    handle_incoming(&ctx, &parsed);
+
+    zassert_equal(1, drain_tx(&ctx, sent, ARRAY_SIZE(sent)));
+    zassert_equal(msg, sent[0]);
+    zassert_equal(1, ack_wheel.num_active);
+
+    ack_packet(&ctx, msg);
+    zassert_equal(0, ack_wheel.num_active);
+}
+
+ZTEST(protocol_test, relay_same_msg_num)
+{
+    char frame[] = "!set_rgb,green:244,red:0,blue:0,msg:48913#a820";
+    struct parsed_data parsed = {0};
+    struct pbuf *relayed;
+
+    zassert_equal(PARSER_OK, parse_header(frame, strlen(frame), &parsed));
+    relayed = protocol_relay_pbuf(&parsed, 48913);
+
+    zassert_not_null(relayed);
+    zassert_equal(strlen(frame), relayed->len);
+    zassert_mem_equal(frame, relayed->data, relayed->len);
+    pbuf_unref(relayed);
+}
+
+ZTEST(protocol_test, relay_rewrites_msg_num)
+{
+    char frame[] = "!set_rgb,msg:77,red:1#6b47";
+    char copy[PROTOCOL_RECV_BUF_SIZE];
+    struct parsed_data parsed = {0};
+    struct parsed_data relayed_data = {0};
+    struct pbuf *relayed;
+
+    zassert_equal(PARSER_OK, parse_header(frame, strlen(frame), &parsed));
+    relayed = protocol_relay_pbuf(&parsed, 65535);
+    zassert_not_null(relayed);
+
+    /*  Only the number and the CRC changed, and the CRC is good */
+    zassert_equal(strlen(frame) + 3, relayed->len);
+    memcpy(copy, relayed->data, relayed->len);
+    copy[relayed->len] = '\0';
+    zassert_mem_equal("!set_rgb,msg:65535,red:1#", copy, 25);
+    zassert_equal(PARSER_OK, parse_header(copy, relayed->len, &relayed_data));
+    zassert_equal(65535, relayed_data.msg_num);
+    zassert_equal(PARSER_OK, parsed_data_decode(&relayed_data));
+    zassert_equal(1, relayed_data.num_params);
+    zassert_equal(1, relayed_data.params[0].value);
+    pbuf_unref(relayed);
+}
+
+ZTEST(protocol_test, submit_relay_goes_out_as_received)
+{
+    char frame[] = "!set_rgb,green:244,red:0,blue:0,msg:48913#a820";
+    struct parsed_data parsed = {0};
+    struct protocol_ctx peer;
+    os_timer_t timer;
+    struct pbuf *sent;
+    struct pbuf_stats before;
+    struct pbuf_stats after;
+    int msg_num;
+
+    protocol_init(&peer, NULL, 0, &timer);
+    zassert_equal(PARSER_OK, parse_header(frame, strlen(frame), &parsed));
+
+    pbuf_stats_get(&before);
+    msg_num = protocol_submit_relay(&peer, &parsed);
+    zassert_true(msg_num >= 0);
+
+    /*  The frame is copied at once, the original can go */
+    memset(frame, 0, sizeof(frame));
+
+    sent = protocol_tx_pbuf(&peer);
+    zassert_not_null(sent);
+    zassert_equal(msg_num, peer.to_send->msg_num);
+    zassert_equal(0, peer.to_send->num_params);
+    zassert_mem_equal("!set_rgb,green:244,red:0,blue:0,msg:", sent->data, 36);
+
+    /*  Retransmissions send the same buffer again */
+    protocol_timeout(&peer);
+    zassert_equal(sent, protocol_tx_pbuf(&peer));
+    pbuf_unref(sent);
+    pbuf_unref(sent);
+
+    ack_packet(&peer, msg_num);
+    zassert_is_null(peer.to_send);
+    pbuf_stats_get(&after);
+    zassert_equal(before.classes[1].in_use, after.classes[1].in_use);
+
+    parsed.frame = NULL;
+    zassert_equal(-EINVAL, protocol_submit_relay(&peer, &parsed));
+}
+
+/*  Append the CRC to a frame that ends in '#' */
+static size_t finish_frame(char *frame, size_t size)
+{
+    size_t len = strlen(frame);
+    uint16_t crc = os_crc16_ccitt(PROTOCOL_CRC_POLY, (uint8_t *) frame, len);
+
+    snprintf(frame + len, size - len, "%04x", crc);
+    return len + 4;
+}
+
+ZTEST(protocol_test, parse_bounded_by_len)
+{
+    char garbage[64];
+    char truncated[] = "!set_rgb,red:1,msg:5#12";
+    struct parsed_data parsed = {0};
+
+    /*  No '#', no terminator, nothing past the end gets read */
+    memset(garbage, ',', sizeof(garbage));
+    garbage[0] = '!';
+    zassert_equal(-1, parse_header(garbage, sizeof(garbage), &parsed));
+
+    /*  '#' too close to the end for a whole CRC */
+    zassert_equal(-1, parse_header(truncated, strlen(truncated), &parsed));
+}
+
+ZTEST(protocol_test, parse_rejects_oversized_params)
+{
+    char frame[PROTOCOL_RECV_BUF_SIZE];
+    struct parsed_data parsed = {0};
+    size_t len;
+
+    /*  A key longer than any real one */
+    strcpy(frame, "!set_rgb,redredredredredredred:1,msg:9#");
+    len = finish_frame(frame, sizeof(frame));
+    zassert_equal(PARSER_OK, parse_header(frame, len, &parsed));
+    zassert_equal(PARSER_INVALID_PARAMS, parsed_data_decode(&parsed));
+
+    /*  A value longer than any real one */
+    strcpy(frame, "!set_rgb,red:00000000000000000001,msg:9#");
+    len = finish_frame(frame, sizeof(frame));
+    zassert_equal(PARSER_OK, parse_header(frame, len, &parsed));
+    zassert_equal(PARSER_INVALID_PARAMS, parsed_data_decode(&parsed));
+
+    /*  More valid params than a packet holds */
+    strcpy(frame, "!set_rgb,red:1,red:1,red:1,red:1,red:1,red:1,red:1,red:1,red:1,msg:9#");
+    len = finish_frame(frame, sizeof(frame));
+    zassert_equal(PARSER_OK, parse_header(frame, len, &parsed));
+    zassert_equal(PARSER_INVALID_PARAMS, parsed_data_decode(&parsed));
+    zassert_equal(PROTOCOL_MAX_PARAMS, parsed.num_params);
+}
+
 ZTEST_SUITE(protocol_test, NULL, NULL, NULL, NULL, NULL);
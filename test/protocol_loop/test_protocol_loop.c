@@ -0,0 +1,232 @@
+#include <zephyr/ztest.h>
+#include <protocol_loop.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(protocol_loop_test, LOG_LEVEL_DBG);
+
+#define MAX_FRAMES 64
+#define EFFECT_TARGET 7
+#define EFFECT_MSG_NUM 1
+
+/*
+ * No UART, the loop's transport is its two rings. The test plays the
+ * host: it writes frames into the RX ring and reads what the loop sends
+ * out of the TX ring, ACKing every data frame.
+ */
+
+int transport_backend_init(transport_t transport)
+{
+    ARG_UNUSED(transport);
+    return 0;
+}
+
+void transport_backend_tx_kick(transport_t transport)
+{
+    ARG_UNUSED(transport);
+}
+
+void transport_backend_rx_resume(transport_t transport)
+{
+    ARG_UNUSED(transport);
+}
+
+struct host {
+    struct framer framer;
+    size_t num_rgb;
+    uint16_t targets[MAX_FRAMES];
+    struct rgb colours[MAX_FRAMES];
+    size_t num_acks;
+    uint16_t acked[MAX_FRAMES];
+};
+
+static const struct device usb_dev = {.name = "usb"};
+static struct transport transport;
+static struct protocol_ctx ctx;
+static os_timer_t resend_timer;
+static uint8_t rx_frame[PROTOCOL_RECV_BUF_SIZE];
+static struct protocol_loop loop;
+static struct effect_engine effects;
+static os_timer_t effect_timer;
+static struct host host;
+static size_t num_rx;
+
+static void host_send(struct protocol_pkt *pkt)
+{
+    uint8_t frame[PROTOCOL_RECV_BUF_SIZE];
+    size_t len = serialise_packet(pkt, frame, sizeof(frame));
+
+    zassert_true(len > 0);
+    zassert_equal(len, ring_buf_put(&transport.rx_ring, frame, len));
+    k_sem_give(&transport.rx_sem);
+}
+
+static void host_frame(const uint8_t *frame, size_t len, void *user_data)
+{
+    struct host *host = (struct host *) user_data;
+    struct parsed_data parsed = {0};
+    struct protocol_pkt ack = {.command = COMMAND_ACK};
+    uint16_t msg_num = 0;
+    struct rgb colour = {0};
+
+    zassert_ok(parse((char *) frame, len, &parsed, &msg_num));
+
+    if (parsed.command == COMMAND_ACK)
+    {
+        zassert_true(host->num_acks < MAX_FRAMES);
+        host->acked[host->num_acks++] = msg_num;
+        return;
+    }
+
+    zassert_equal(COMMAND_SET_RGB, parsed.command);
+    zassert_true(host->num_rgb < MAX_FRAMES);
+
+    for (size_t param = 0; param < parsed.num_params; ++param)
+    {
+        value_t value = parsed.params[param].value;
+
+        switch (parsed.params[param].key)
+        {
+            case KEY_RED:
+                colour.red = (uint8_t) value;
+                break;
+            case KEY_GREEN:
+                colour.green = (uint8_t) value;
+                break;
+            case KEY_BLUE:
+                colour.blue = (uint8_t) value;
+                break;
+            case KEY_TARGET:
+                host->targets[host->num_rgb] = value;
+                break;
+            default:
+                break;
+        }
+    }
+    host->colours[host->num_rgb++] = colour;
+
+    ack.msg_num = msg_num;
+    host_send(&ack);
+}
+
+/*  Read everything the loop has sent so far */
+static void host_drain(void)
+{
+    uint8_t buffer[64];
+    size_t len;
+
+    while ((len = ring_buf_get(&transport.tx_ring, buffer, sizeof(buffer))) > 0)
+    {
+        framer_feed(&host.framer, buffer, len);
+    }
+}
+
+static void run_loop(int64_t ms)
+{
+    int64_t end = k_uptime_get() + ms;
+
+    while (k_uptime_get() < end)
+    {
+        zassert_ok(protocol_loop_step(&loop, K_MSEC(5)));
+        host_drain();
+    }
+}
+
+static void count_rx(parsed_data_t data, void *user_data)
+{
+    ARG_UNUSED(user_data);
+
+    zassert_equal(COMMAND_EFFECT, data->command);
+    num_rx++;
+}
+
+static void send_fade(void)
+{
+    struct protocol_pkt pkt = {
+        .command = COMMAND_EFFECT,
+        .params = {
+            {.key = KEY_EFFECT, .value = EFFECT_FADE},
+            {.key = KEY_DURATION, .value = 10 * EFFECT_TICK_MSEC},
+            {.key = KEY_EASING, .value = EASING_LINEAR},
+            {.key = KEY_TARGET, .value = EFFECT_TARGET},
+            {.key = KEY_RED, .value = 255},
+        },
+        .num_params = 5,
+        .msg_num = EFFECT_MSG_NUM,
+    };
+
+    host_send(&pkt);
+}
+
+static void protocol_loop_before(void *fixture)
+{
+    ARG_UNUSED(fixture);
+
+    memset(&host, 0, sizeof(host));
+    num_rx = 0;
+    framer_init(&host.framer, host_frame, &host);
+
+    zassert_ok(transport_init(&transport, &usb_dev));
+    protocol_init(&ctx, rx_frame, sizeof(rx_frame), &resend_timer);
+    protocol_loop_init(&loop, &ctx, &transport);
+    protocol_loop_set_rx(&loop, count_rx, NULL);
+}
+
+static void protocol_loop_after(void *fixture)
+{
+    ARG_UNUSED(fixture);
+
+    /*  Let anything still running finish before the next test */
+    if (loop.effects)
+    {
+        effect_stop(loop.effects, EFFECT_TARGET);
+    }
+    run_loop(50);
+}
+
+ZTEST(protocol_loop_test, effect_is_rendered)
+{
+    effect_engine_init(&effects, &effect_timer, protocol_loop_effect_emit, &ctx);
+    protocol_loop_set_effects(&loop, &effects);
+
+    send_fade();
+    run_loop(400);
+
+    zassert_true(host.num_acks > 0);
+    zassert_equal(EFFECT_MSG_NUM, host.acked[0]);
+    zassert_equal(0, num_rx, "effect was passed on as well as rendered");
+
+    /*  A tick that changes nothing sends nothing, so at most one a tick */
+    zassert_true(host.num_rgb >= 5, "only %u set_rgb", (unsigned) host.num_rgb);
+    zassert_true(host.num_rgb <= 11, "%u set_rgb", (unsigned) host.num_rgb);
+
+    /*  Every set_rgb was ACKed, so a repeat would be a retransmission */
+    for (size_t frame = 0; frame < host.num_rgb; ++frame)
+    {
+        zassert_equal(EFFECT_TARGET, host.targets[frame]);
+        zassert_equal(0, host.colours[frame].green);
+        zassert_equal(0, host.colours[frame].blue);
+        if (frame > 0)
+        {
+            zassert_true(host.colours[frame].red > host.colours[frame - 1].red,
+                         "red went %u then %u", host.colours[frame - 1].red,
+                         host.colours[frame].red);
+        }
+    }
+    zassert_equal(255, host.colours[host.num_rgb - 1].red);
+}
+
+ZTEST(protocol_loop_test, effect_without_engine_goes_to_rx)
+{
+    send_fade();
+    run_loop(100);
+
+    zassert_equal(1, host.num_acks);
+    zassert_equal(EFFECT_MSG_NUM, host.acked[0]);
+    zassert_equal(1, num_rx);
+    zassert_equal(0, host.num_rgb);
+}
+
+
+ZTEST_SUITE(protocol_loop_test, NULL, NULL, protocol_loop_before, protocol_loop_after, NULL);
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <zephyr/logging/log.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/sys/crc.h>
 
 
 LOG_MODULE_REGISTER(serialise_test, LOG_LEVEL_DBG);
@@ -177,4 +180,51 @@ ZTEST(serialise_test, callbacks)
     zassert_equal(strlen(expected), ctx.bytes_written);
 }
 
+ZTEST(serialise_test, running_crc)
+{
+    struct serial_ctx ctx;
+    uint8_t buffer[32] = {0};
+    char *expected = "!command,msg:12345#";
+    uint16_t dec = 12345;
+
+    struct serial_registry reg[] = {
+        {.handler = serialise_padding_char,     .user_data = "!"},
+        {.handler = serialise_str,              .user_data = "command"},
+        {.handler = serialise_padding_char,     .user_data = ","},
+        {.handler = serialise_str,              .user_data = "msg"},
+        {.handler = serialise_padding_char,     .user_data = ":"},
+        {.handler = serialise_uint16t_dec,      .user_data = &dec},
+        {.handler = serialise_padding_char,     .user_data = "#"},
+        {.handler = serialise_crc_hex,          .user_data = NULL},
+    };
+
+    serialise_ctx_init(&ctx, buffer, sizeof(buffer), NULL);
+    serialise_handler_register(&ctx, reg, ARRAY_SIZE(reg));
+
+    zassert_ok(serialise(&ctx));
+    zassert_equal(strlen(expected) + 4, ctx.bytes_written);
+    zassert_mem_equal(expected, buffer, strlen(expected));
+
+    /*  The CRC of everything before it */
+    char crc[5];
+    snprintf(crc, sizeof(crc), "%04x", crc16_ccitt(0, (const uint8_t *) expected, strlen(expected)));
+    zassert_mem_equal(crc, buffer + strlen(expected), 4);
+}
+
+ZTEST(serialise_test, overflow)
+{
+    uint8_t buffer[8] = {0};
+    struct serial_ctx ctx;
+
+    /*  Single buffer, used to run straight off the end */
+    serialise_ctx_init(&ctx, buffer, sizeof(buffer), NULL);
+    serialise_str(&ctx, "set_rgb,red:255");
+    zassert_equal(-ENOBUFS, ctx.error);
+    zassert_equal(sizeof(buffer), ctx.bytes_written);
+
+    /*  Nothing more goes in after an error */
+    serialise_padding_char(&ctx, ",");
+    zassert_equal(sizeof(buffer), ctx.bytes_written);
+}
+
 ZTEST_SUITE(serialise_test, NULL, NULL, NULL, NULL, NULL);
@@ -7,22 +7,218 @@
 
 LOG_MODULE_REGISTER(timer_test, LOG_LEVEL_DBG);
 
+#define MAX_ENTRIES 1000
 
-void timer_stop_cb(timer_t timer)
+static struct timer_wheel wheel;
+static struct timer_wheel_entry entries[MAX_ENTRIES];
+static uint32_t fired_at[MAX_ENTRIES];
+static uint32_t fire_count[MAX_ENTRIES];
+
+static void record_expiry(struct timer_wheel_entry *entry, void *user_data)
 {
-    zassert_ok(0);
+    size_t index = entry - entries;
+
+    fired_at[index] = wheel.now;
+    fire_count[index]++;
 }
 
-void timer_expired_cb(timer_t timer)
+static void rearm_expiry(struct timer_wheel_entry *entry, void *user_data)
 {
-    zassert_ok(0);
+    record_expiry(entry, user_data);
+
+    if (fire_count[entry - entries] < 5)
+    {
+        timer_wheel_arm(&wheel, entry, (uint32_t)(uintptr_t) user_data);
+    }
 }
 
+static void reset(void *fixture)
+{
+    timer_wheel_init(&wheel, NULL, TIMER_MSEC(1));
+
+    for (size_t index = 0; index < MAX_ENTRIES; ++index)
+    {
+        timer_wheel_entry_init(&entries[index], record_expiry, NULL);
+        fired_at[index] = 0;
+        fire_count[index] = 0;
+    }
+}
 
 ZTEST(timer_test, init)
 {
+    zassert_equal(0, wheel.now);
+    zassert_equal(0, wheel.num_active);
+    zassert_false(timer_wheel_entry_active(&entries[0]));
+    zassert_equal(0, timer_wheel_advance(&wheel, 100));
+    zassert_equal(100, wheel.now);
+}
+
+/*  Deadlines either side of every level boundary must fire on exactly
+    the right tick, whatever phase the wheel is in when they are armed */
+ZTEST(timer_test, fires_on_exact_tick)
+{
+    const uint32_t delays[] = {
+        1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 10000,
+        262143, 262144, 262145, 300000,
+    };
+    const uint32_t phases[] = {0, 1, 63, 4000, 262100};
+
+    for (size_t phase = 0; phase < ARRAY_SIZE(phases); ++phase)
+    {
+        reset(NULL);
+        timer_wheel_advance(&wheel, phases[phase]);
+
+        for (size_t index = 0; index < ARRAY_SIZE(delays); ++index)
+        {
+            timer_wheel_arm(&wheel, &entries[index], delays[index]);
+        }
+        zassert_equal(ARRAY_SIZE(delays), wheel.num_active);
+
+        /*  One tick at a time so a late or early expiry shows up */
+        while (wheel.num_active)
+        {
+            timer_wheel_advance(&wheel, 1);
+        }
+
+        for (size_t index = 0; index < ARRAY_SIZE(delays); ++index)
+        {
+            zassert_equal(1, fire_count[index]);
+            zassert_equal(phases[phase] + delays[index], fired_at[index],
+                          "delay %u phase %u", delays[index], phases[phase]);
+        }
+    }
+}
+
+ZTEST(timer_test, cancel)
+{
+    timer_wheel_arm(&wheel, &entries[0], 10);
+    timer_wheel_arm(&wheel, &entries[1], 5000);
+    zassert_true(timer_wheel_entry_active(&entries[0]));
+
+    timer_wheel_cancel(&wheel, &entries[0]);
+    timer_wheel_cancel(&wheel, &entries[1]);
+    /*  Cancelling twice is harmless */
+    timer_wheel_cancel(&wheel, &entries[1]);
+
+    zassert_false(timer_wheel_entry_active(&entries[0]));
+    zassert_equal(0, wheel.num_active);
+    zassert_equal(0, timer_wheel_advance(&wheel, 10000));
+    zassert_equal(0, fire_count[0]);
+    zassert_equal(0, fire_count[1]);
+}
+
+ZTEST(timer_test, rearm)
+{
+    timer_wheel_arm(&wheel, &entries[0], 10);
+    timer_wheel_advance(&wheel, 5);
+
+    /*  Pushing the deadline back moves the entry, it only fires once */
+    timer_wheel_arm(&wheel, &entries[0], 100);
+    zassert_equal(1, wheel.num_active);
+
+    zassert_equal(0, timer_wheel_advance(&wheel, 99));
+    zassert_equal(1, timer_wheel_advance(&wheel, 1));
+    zassert_equal(105, fired_at[0]);
+    zassert_equal(1, fire_count[0]);
+}
+
+ZTEST(timer_test, batch)
+{
+    for (size_t index = 0; index < 100; ++index)
+    {
+        timer_wheel_arm(&wheel, &entries[index], 70);
+    }
+
+    zassert_equal(0, timer_wheel_advance(&wheel, 69));
+    zassert_equal(100, timer_wheel_advance(&wheel, 1));
+    zassert_equal(0, wheel.num_active);
+}
+
+ZTEST(timer_test, rearm_from_callback)
+{
+    timer_wheel_entry_init(&entries[0], rearm_expiry, (void *)(uintptr_t) 20);
+    timer_wheel_arm(&wheel, &entries[0], 20);
+
+    zassert_equal(5, timer_wheel_advance(&wheel, 1000));
+    zassert_equal(5, fire_count[0]);
+    zassert_equal(100, fired_at[0]);
+    zassert_false(timer_wheel_entry_active(&entries[0]));
+}
+
+ZTEST(timer_test, driven_by_timer)
+{
+    static os_timer_t driver;
+    int64_t start = k_uptime_get();
+
+    timer_wheel_init(&wheel, &driver, TIMER_MSEC(1));
+    timer_wheel_arm(&wheel, &entries[0], 50);
+
+    k_msleep(100);
+
+    zassert_equal(1, fire_count[0]);
+    zassert_true(k_uptime_get() - start >= 50);
+    zassert_equal(0, wheel.num_active);
+}
+
+/*  Arm/cancel cost must not grow with the number of active timers */
+static void measure(size_t num_timers)
+{
+    uint32_t start;
+    uint32_t arm_cycles;
+    uint32_t advance_cycles;
+
+    reset(NULL);
 
+    start = k_cycle_get_32();
+    for (size_t index = 0; index < num_timers; ++index)
+    {
+        /*  Spread over every level */
+        timer_wheel_arm(&wheel, &entries[index], 1 + (index * 7919) % 300000);
+    }
+    arm_cycles = k_cycle_get_32() - start;
+
+    /*  Re-arm everything once more, the cancel + insert path */
+    start = k_cycle_get_32();
+    for (size_t index = 0; index < num_timers; ++index)
+    {
+        timer_wheel_arm(&wheel, &entries[index], 1 + (index * 104729) % 300000);
+    }
+    arm_cycles += k_cycle_get_32() - start;
+
+    start = k_cycle_get_32();
+    size_t fired = 0;
+    while (wheel.num_active)
+    {
+        fired += timer_wheel_advance(&wheel, 1);
+    }
+    advance_cycles = k_cycle_get_32() - start;
+
+    zassert_equal(num_timers, fired);
+    for (size_t index = 0; index < num_timers; ++index)
+    {
+        zassert_equal(1 + (index * 104729) % 300000, fired_at[index]);
+    }
+
+    TC_PRINT("%4u timers: %u cycles per arm, %u cycles per tick\n",
+             (unsigned) num_timers,
+             (unsigned)(arm_cycles / (2 * num_timers)),
+             (unsigned)(advance_cycles / wheel.now));
+}
+
+ZTEST(timer_test, cost_10)
+{
+    measure(10);
+}
+
+ZTEST(timer_test, cost_100)
+{
+    measure(100);
+}
+
+ZTEST(timer_test, cost_1000)
+{
+    measure(1000);
 }
 
 
-ZTEST_SUITE(timer_test, NULL, NULL, NULL, NULL, NULL);
+ZTEST_SUITE(timer_test, NULL, NULL, reset, NULL, NULL);
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include <zephyr/ztest.h>
+#include <tx_coalesce.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+
+LOG_MODULE_REGISTER(tx_coalesce_test, LOG_LEVEL_DBG);
+
+#define ACK "!ack,msg:12345#abcd"
+#define ACK_LEN (sizeof(ACK) - 1)
+
+static struct tx_coalesce coalesce;
+static os_timer_t budget_timer;
+
+static uint8_t wire[4096];
+static size_t wire_len;
+static size_t write_sizes[64];
+static size_t num_writes;
+// Most a single write will take, to fake a full transport
+static size_t write_limit;
+
+static size_t fake_write(const uint8_t *data, size_t len, void *user_data)
+{
+    len = MIN(len, write_limit);
+
+    if (len)
+    {
+        memcpy(wire + wire_len, data, len);
+        wire_len += len;
+        write_sizes[num_writes++] = len;
+    }
+
+    return len;
+}
+
+static void reset(void *fixture)
+{
+    wire_len = 0;
+    num_writes = 0;
+    write_limit = SIZE_MAX;
+    tx_coalesce_init(&coalesce, &budget_timer, 64, 250, fake_write, NULL);
+}
+
+ZTEST(tx_coalesce_test, waits_for_budget)
+{
+    zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+
+    /*  One small frame on its own waits for company */
+    zassert_equal(0, num_writes);
+    zassert_true(tx_coalesce_pending(&coalesce));
+
+    k_msleep(5);
+
+    zassert_equal(1, num_writes);
+    zassert_equal(ACK_LEN, wire_len);
+    zassert_equal(1, coalesce.stats.timer_flushes);
+    zassert_equal(1, coalesce.stats.frames_per_write[1]);
+    zassert_false(tx_coalesce_pending(&coalesce));
+}
+
+ZTEST(tx_coalesce_test, full_packet_goes_now)
+{
+    /*  19 byte ACKs, the fourth one fills the 64 byte packet */
+    for (int index = 0; index < 3; ++index)
+    {
+        zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+    }
+    zassert_equal(0, num_writes);
+
+    zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+
+    zassert_equal(1, num_writes);
+    zassert_equal(64, write_sizes[0]);
+    zassert_equal(1, coalesce.stats.full_flushes);
+    /*  The fourth frame straddles the packet, it counts where it ends */
+    zassert_equal(3, coalesce.stats.frames);
+    zassert_equal(1, coalesce.stats.frames_per_write[3]);
+
+    tx_coalesce_flush(&coalesce);
+    zassert_equal(2, num_writes);
+    zassert_equal(4 * ACK_LEN, wire_len);
+    zassert_equal(4, coalesce.stats.frames);
+
+    /*  Nothing lost or reordered */
+    for (int index = 0; index < 4; ++index)
+    {
+        zassert_mem_equal(ACK, wire + index * ACK_LEN, ACK_LEN);
+    }
+}
+
+ZTEST(tx_coalesce_test, no_budget)
+{
+    tx_coalesce_init(&coalesce, &budget_timer, 64, 0, fake_write, NULL);
+
+    zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+    zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+
+    zassert_equal(2, num_writes);
+    zassert_equal(2, coalesce.stats.frames_per_write[1]);
+}
+
+ZTEST(tx_coalesce_test, large_frame)
+{
+    uint8_t frame[200];
+
+    memset(frame, 'x', sizeof(frame));
+    zassert_ok(tx_coalesce_add(&coalesce, frame, sizeof(frame)));
+
+    /*  Three whole packets now, the tail waits */
+    zassert_equal(3, num_writes);
+    zassert_equal(3, coalesce.stats.frames_per_write[0]);
+    zassert_equal(0, coalesce.stats.frames);
+
+    k_msleep(5);
+    zassert_equal(4, num_writes);
+    zassert_equal(200 - 3 * 64, write_sizes[3]);
+    zassert_equal(1, coalesce.stats.frames);
+}
+
+ZTEST(tx_coalesce_test, transport_full)
+{
+    write_limit = 0;
+
+    for (int index = 0; index < 4; ++index)
+    {
+        zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+    }
+    zassert_equal(0, num_writes);
+    zassert_true(tx_coalesce_pending(&coalesce));
+    zassert_true(tx_coalesce_stalled(&coalesce));
+
+    /*  Some room, half of it goes */
+    write_limit = 30;
+    tx_coalesce_flush(&coalesce);
+    zassert_equal(30, wire_len);
+    zassert_equal(1, coalesce.stats.frames);
+
+    write_limit = SIZE_MAX;
+    tx_coalesce_flush(&coalesce);
+    zassert_equal(4 * ACK_LEN, wire_len);
+    zassert_equal(4, coalesce.stats.frames);
+    zassert_false(tx_coalesce_pending(&coalesce));
+    zassert_false(tx_coalesce_stalled(&coalesce));
+}
+
+static void add_numbered(int first, int count)
+{
+    char frame[ACK_LEN + 1];
+
+    for (int index = first; index < first + count; ++index)
+    {
+        snprintf(frame, sizeof(frame), "!ack,msg:%05d#abcd", index);
+        zassert_ok(tx_coalesce_add(&coalesce, (const uint8_t *) frame, ACK_LEN));
+    }
+}
+
+ZTEST(tx_coalesce_test, wraps_round)
+{
+    char frame[ACK_LEN + 1];
+
+    /*  Most of the buffer waiting, then most of that drained */
+    write_limit = 0;
+    add_numbered(0, 50);
+    write_limit = 40 * ACK_LEN;
+    tx_coalesce_flush(&coalesce);
+    zassert_equal(40, coalesce.stats.frames);
+
+    /*  These run off the end of the buffer and carry on at the start */
+    write_limit = 0;
+    add_numbered(50, 30);
+
+    num_writes = 0;
+    write_limit = SIZE_MAX;
+    tx_coalesce_flush(&coalesce);
+    zassert_equal(2, num_writes);
+    zassert_equal(80, coalesce.stats.frames);
+    zassert_equal(80 * ACK_LEN, wire_len);
+    zassert_false(tx_coalesce_pending(&coalesce));
+
+    for (int index = 0; index < 80; ++index)
+    {
+        snprintf(frame, sizeof(frame), "!ack,msg:%05d#abcd", index);
+        zassert_mem_equal(frame, wire + index * ACK_LEN, ACK_LEN);
+    }
+}
+
+ZTEST(tx_coalesce_test, buffer_full)
+{
+    uint8_t frame[TX_COALESCE_BUF_SIZE];
+
+    write_limit = 0;
+    memset(frame, 'x', sizeof(frame));
+
+    zassert_ok(tx_coalesce_add(&coalesce, frame, sizeof(frame)));
+    zassert_equal(-ENOBUFS, tx_coalesce_add(&coalesce, (const uint8_t *) ACK, ACK_LEN));
+}
+
+
+ZTEST_SUITE(tx_coalesce_test, NULL, NULL, reset, NULL, NULL);
\ No newline at end of file